@@ -16,11 +16,129 @@
 #define _LIB_BARRELFISH_AOS_MESSAGES_H
 
 #include <aos/aos.h>
+#include <aos/shm.h>
 
+/// Words of a message after the header
+#define AOS_RPC_MSG_WORDS       (LMP_MSG_LENGTH - 1)
 
-/* An RPC binding, which may be transported over LMP or UMP. */
+/// Messages the endpoint of a channel buffers, so that calls can pile up
+#define AOS_RPC_BUF_MSGS        32
+
+/// Largest string or array a call or reply carries
+#define AOS_RPC_BULK_MAX        (1024 * 1024)
+
+/// Bulk data from this size on goes through the shared buffers of a channel
+#define AOS_RPC_SHM_THRESHOLD   256
+
+/// Size of a shared buffer, larger bulk data takes several
+#define AOS_RPC_SHM_BUF_SIZE    (16 * 1024)
+
+/// Shared buffers in each direction of a channel
+#define AOS_RPC_SHM_BUF_COUNT   16
+
+/// Kinds of calls
+enum aos_rpc_msg_type {
+    AOS_RPC_BIND = 1,               ///< Sends the client's endpoint to a listening server
+    AOS_RPC_NUMBER,
+    AOS_RPC_STRING,
+    AOS_RPC_RAM_CAP,
+    AOS_RPC_MM_STATS,
+    AOS_RPC_SERIAL_GETCHAR,
+    AOS_RPC_SERIAL_PUTCHAR,
+    AOS_RPC_PROCESS_SPAWN,
+    AOS_RPC_PROCESS_GET_NAME,
+    AOS_RPC_PROCESS_GET_ALL_PIDS,
+    AOS_RPC_BULK_SETUP,             ///< Exchanges the frames of the shared buffers
+};
+
+/// Channel an RPC binding runs over
+enum aos_rpc_transport {
+    AOS_RPC_LMP,                    ///< Same core, messages pass through the kernel
+    AOS_RPC_UMP,                    ///< Any core, messages pass through a shared frame
+};
+
+/**
+ * \brief A call in flight on the client side
+ *
+ * The caller owns the struct, the channel links it into its list of calls
+ * in flight until the reply is complete.
+ */
+struct aos_rpc_call {
+    struct aos_rpc_call *next;      ///< Next call in flight on the channel
+    uint16_t id;                    ///< Tag that the reply carries
+    uint8_t type;
+    bool done;                      ///< Whether the reply is complete
+    errval_t err;                   ///< Error of the transfer, or the one the server returned
+    uintptr_t words[AOS_RPC_MSG_WORDS - 1];    ///< Results in the reply
+    struct capref cap;              ///< Capability in the reply, or NULL_CAP
+    void *bulk;                     ///< String or array in the reply, the caller frees it
+    size_t bulk_size;
+    size_t bulk_received;
+};
+
+/**
+ * \brief A call received by a server, until the server replies to it
+ */
+struct aos_rpc_request {
+    struct aos_rpc_request *next;   ///< Next request that still receives its bulk data
+    uint16_t id;
+    uint8_t type;
+    errval_t err;                   ///< Error while receiving the request
+    uintptr_t words[AOS_RPC_MSG_WORDS];        ///< Arguments
+    struct capref cap;              ///< Capability of the request, the handler owns it
+    void *bulk;                     ///< String or array of the request
+    size_t bulk_size;
+    size_t bulk_received;
+};
+
+struct aos_rpc;
+
+/**
+ * \brief Handles a request on the server side
+ *
+ * The handler may reply right away, or keep `req` and reply later with
+ * aos_rpc_reply(), from any thread. The reply frees `req`.
+ */
+typedef void (*aos_rpc_handler_t)(struct aos_rpc *rpc, struct aos_rpc_request *req);
+
+/**
+ * \brief An RPC binding over LMP or UMP
+ *
+ * Every message starts with a header word holding its type, flags, the ID of
+ * the call and the size of its bulk data. Strings and arrays follow the
+ * first message in fragments of the same ID. Small ones are copied into the
+ * fragments, large ones into buffers in a frame that the two sides share,
+ * and the fragments only announce the buffers. The client sets the frames
+ * up with the first large call, until then large data is copied into
+ * fragments too. A client
+ * may have any number of calls in flight, from one or several threads, and
+ * the server may answer them in any order. Whichever waiting thread receives
+ * a reply hands it to the call with the matching ID.
+ *
+ * Over UMP, every message takes one slot of the ring and the calls work the
+ * same, except that no capabilities can be sent.
+ */
 struct aos_rpc {
-    // TODO(M3): Add state
+    enum aos_rpc_transport transport;
+    struct lmp_chan chan;           ///< Channel of an LMP binding
+    struct ump_chan ump;            ///< Channel of a UMP binding
+    struct waitset *ws;             ///< Waitset the channel receives on
+    struct waitset own_ws;          ///< Waitset of a client channel
+    aos_rpc_handler_t handler;      ///< Server side handler, or NULL for a client
+
+    struct thread_mutex mutex;      ///< Protects the state below
+    struct thread_cond cond;        ///< Signalled when calls complete or the receiver leaves
+    bool receiving;                 ///< Whether a thread dispatches the client waitset
+    bool recv_slot_needed;          ///< Whether a received cap took the receive slot
+    uint16_t next_id;
+    struct aos_rpc_call *calls;     ///< Calls in flight
+    struct aos_rpc_request *requests;  ///< Requests that still receive their bulk data
+
+    struct thread_mutex bulk_mutex; ///< Serializes the use of bulk_tx
+    bool bulk_ready;                ///< Whether the shared buffers are set up
+    size_t bulk_threshold;          ///< Bulk data from this size on is shared
+    struct shm_region bulk_tx;      ///< Buffers this side fills
+    struct shm_region bulk_rx;      ///< Buffers the peer fills
 };
 
 /**
@@ -28,6 +146,26 @@ struct aos_rpc {
  */
 errval_t aos_rpc_init(struct aos_rpc *rpc);
 
+errval_t aos_rpc_bind(struct aos_rpc *rpc, struct capref server_ep);
+errval_t aos_rpc_listen(struct aos_rpc *rpc, struct capref slot,
+                        aos_rpc_handler_t handler, struct waitset *ws);
+errval_t aos_rpc_accept(struct aos_rpc *rpc, struct capref client_ep,
+                        aos_rpc_handler_t handler, struct waitset *ws);
+errval_t aos_rpc_ump_init(struct aos_rpc *rpc, void *buf, size_t bytes, bool first,
+                          aos_rpc_handler_t handler, struct waitset *ws);
+
+errval_t aos_rpc_bulk_setup(struct aos_rpc *rpc);
+
+errval_t aos_rpc_call_start(struct aos_rpc *rpc, struct aos_rpc_call *call,
+                            enum aos_rpc_msg_type type, uintptr_t arg1, uintptr_t arg2,
+                            uintptr_t arg3, struct capref cap, const void *bulk,
+                            size_t bulk_size);
+errval_t aos_rpc_call_wait(struct aos_rpc *rpc, struct aos_rpc_call *call);
+errval_t aos_rpc_reply(struct aos_rpc *rpc, struct aos_rpc_request *req, errval_t err,
+                       uintptr_t res1, uintptr_t res2, struct capref cap, bool give_cap,
+                       const void *bulk, size_t bulk_size);
+errval_t aos_rpc_reply_error(struct capref ep, struct aos_rpc_request *req, errval_t err);
+
 
 /**
  * \brief Send a number.
@@ -48,6 +186,24 @@ errval_t aos_rpc_get_ram_cap(struct aos_rpc *chan, size_t bytes,
                              size_t alignment, struct capref *retcap,
                              size_t *ret_bytes);
 
+/**
+ * \brief Request `count` RAM capabilities of `bytes` each, with all requests
+ * in flight at once.
+ *
+ * Either all of the capabilities are returned, or, if one of the requests
+ * fails, none: the ones that arrived are destroyed again.
+ */
+errval_t aos_rpc_get_ram_caps(struct aos_rpc *chan, size_t bytes, size_t alignment,
+                              size_t count, struct capref *retcaps);
+
+struct mm_stats;
+
+/**
+ * \brief Request the fragmentation and latency statistics of the memory
+ * manager in init.
+ */
+errval_t aos_rpc_get_mm_stats(struct aos_rpc *chan, struct mm_stats *ret);
+
 
 /**
  * \brief Get one character from the serial port
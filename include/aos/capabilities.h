@@ -135,7 +135,19 @@ static inline errval_t vnode_unmap(struct capref pgtl, struct capref mapping)
     capaddr_t mapping_addr = get_cap_addr(mapping);
      enum cnode_type level = get_cap_level(mapping);
 
-    return invoke_vnode_unmap(pgtl, mapping_addr, level);
+    return invoke_vnode_unmap(pgtl, mapping_addr, level, true);
+}
+
+/**
+ * \brief Like vnode_unmap, but leaves the TLB alone. The caller flushes the
+ *        unmapped addresses with invoke_vnode_flush_range once it is done.
+ */
+static inline errval_t vnode_unmap_noflush(struct capref pgtl, struct capref mapping)
+{
+    capaddr_t mapping_addr = get_cap_addr(mapping);
+    enum cnode_type level = get_cap_level(mapping);
+
+    return invoke_vnode_unmap(pgtl, mapping_addr, level, false);
 }
 
 static inline errval_t vnode_modify_flags(struct capref pgtl,
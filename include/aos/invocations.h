@@ -192,9 +192,18 @@ static inline errval_t invoke_cnode_resize(struct capref root, capaddr_t new_cpt
 
 static inline errval_t invoke_vnode_unmap(struct capref cap,
                                           capaddr_t mapping_addr,
-                                          enum cnode_type level)
+                                          enum cnode_type level, bool flush)
 {
-    return cap_invoke3(cap, VNodeCmd_Unmap, mapping_addr, level).error;
+    return cap_invoke4(cap, VNodeCmd_Unmap, mapping_addr, level, flush).error;
+}
+
+/**
+ * \brief Flushes the TLB for [vaddr, vaddr + bytes), invoked on an L0 table
+ */
+static inline errval_t invoke_vnode_flush_range(struct capref cap, genvaddr_t vaddr,
+                                                size_t bytes)
+{
+    return cap_invoke3(cap, VNodeCmd_FlushRange, vaddr, bytes).error;
 }
 
 static inline errval_t invoke_vnode_modify_flags(struct capref cap,
@@ -33,6 +33,20 @@ invoke_monitor_spawn_core(hwid_t core_id, enum cpu_type cpu_type,
                        entry, context, psci_use_hvc).error;
 }
 
+/**
+ * \brief Raise a notification interrupt on a core.
+ *
+ * \param core_id  Core to interrupt
+ * \param vector   Software-generated interrupt to raise, 0 to 15
+ */
+static inline errval_t
+invoke_ipi_notify(coreid_t core_id, uint8_t vector)
+{
+    DEBUG_INVOCATION("%s: called from %p\n", __FUNCTION__,
+            __builtin_return_address(0));
+    return cap_invoke3(cap_ipi, IPICmd_Send_Notify, core_id, vector).error;
+}
+
 static inline errval_t
 invoke_monitor_create_cap(uint64_t *raw, capaddr_t caddr, int level,
         capaddr_t slot, coreid_t owner)
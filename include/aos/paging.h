@@ -43,6 +43,9 @@ errval_t paging_region_init_fixed(struct paging_state *st, struct paging_region
 errval_t paging_region_init_aligned(struct paging_state *st,
                                     struct paging_region *pr,
                                     size_t size, size_t alignment, paging_flags_t flags);
+/// Reserve a lazily backed stack with a guard page below it
+errval_t paging_region_init_stack(struct paging_state *st, struct paging_region *pr,
+                                  size_t size, void **ret_stack);
 /**
  * \brief return a pointer to a bit of the paging region `pr`.
  * This function gets used in some of the code that is responsible
@@ -54,7 +57,7 @@ errval_t paging_region_map(struct paging_region *pr, size_t req_size,
  * \brief free a bit of the paging region `pr`.
  * This function gets used in some of the code that is responsible
  * for allocating Frame (and other) capabilities.
- * We ignore unmap requests right now.
+ * Only the end of what paging_region_map handed out can be freed.
  */
 errval_t paging_region_unmap(struct paging_region *pr, lvaddr_t base, size_t bytes);
 
@@ -64,6 +67,10 @@ errval_t paging_region_unmap(struct paging_region *pr, lvaddr_t base, size_t byt
  */
 errval_t paging_alloc(struct paging_state *st, void **buf, size_t bytes,
                       size_t alignment);
+/// Reserve a given range of virtual address space
+errval_t paging_reserve(struct paging_state *st, lvaddr_t vaddr, size_t bytes);
+/// Return virtual address space from paging_alloc or paging_reserve
+errval_t paging_free(struct paging_state *st, void *buf, size_t bytes);
 
 /**
  * Functions to map a user provided frame.
@@ -76,6 +83,11 @@ errval_t paging_map_frame_attr(struct paging_state *st, void **buf,
 errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
                                struct capref frame, size_t bytes, int flags);
 
+/// Set how many pages the page fault handler maps per fault
+void paging_set_fault_around(struct paging_state *st, size_t pages);
+/// Return the page fault counters of a paging state
+void paging_get_fault_stats(struct paging_state *st, struct paging_fault_stats *ret);
+
 /**
  * refill slab allocator without causing a page fault
  */
@@ -83,11 +95,23 @@ errval_t slab_refill_no_pagefault(struct slab_allocator *slabs,
                                   struct capref frame, size_t minbytes);
 
 /**
- * \brief unmap region starting at address `region`.
- * NOTE: this function is currently here to make libbarrelfish compile. As
- * noted on paging_region_unmap we ignore unmap requests right now.
+ * \brief unmap region starting at address `region`, and free its addresses.
  */
 errval_t paging_unmap(struct paging_state *st, const void *region);
+/// Unmap [vaddr, vaddr + bytes), keeping the addresses allocated
+errval_t paging_unmap_range(struct paging_state *st, lvaddr_t vaddr, size_t bytes);
+/// Flush the TLB for [vaddr, vaddr + bytes)
+errval_t paging_tlb_flush_range(struct paging_state *st, lvaddr_t vaddr, size_t bytes);
+
+/// Make [vaddr, vaddr + bytes) copy-on-write and describe it for another domain
+errval_t paging_share_cow(struct paging_state *st, lvaddr_t vaddr, size_t bytes,
+                          struct paging_cow_range *ranges, size_t max, size_t *ret_count);
+/// Drop the references paging_share_cow took on frames of the paging state
+void paging_unshare_cow(struct paging_state *st, struct paging_cow_range *ranges,
+                        size_t count);
+/// Map ranges another domain shared with paging_share_cow, copy-on-write
+errval_t paging_map_cow_ranges(struct paging_state *st,
+                               const struct paging_cow_range *ranges, size_t count);
 
 
 /// Map user provided frame while allocating VA space for it
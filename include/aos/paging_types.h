@@ -16,6 +16,8 @@
 #define PAGING_TYPES_H_ 1
 
 #include <aos/solution.h>
+#include <aos/thread_sync.h>
+#include <aos/vaddr_tree.h>
 
 #define VADDR_OFFSET ((lvaddr_t)512UL*1024*1024*1024) // 1GB
 #define VREGION_FLAGS_READ     0x01 // Reading allowed
@@ -24,7 +26,10 @@
 #define VREGION_FLAGS_NOCACHE  0x08 // Caching disabled
 #define VREGION_FLAGS_MPB      0x10 // Message passing buffer
 #define VREGION_FLAGS_GUARD    0x20 // Guard page
-#define VREGION_FLAGS_MASK     0x2f // Mask of all individual VREGION_FLAGS
+#define VREGION_FLAGS_LARGE    0x40 // Only 2 MiB and 1 GiB blocks
+#define VREGION_FLAGS_LAZY     0x80 // Backed on first touch, by the fault handler
+#define VREGION_FLAGS_COW      0x100 // Shared until written, then copied by the fault handler
+#define VREGION_FLAGS_MASK     0x1ef // Mask of all individual VREGION_FLAGS
 
 #define VREGION_FLAGS_READ_WRITE \
     (VREGION_FLAGS_READ | VREGION_FLAGS_WRITE)
@@ -38,25 +43,120 @@
 typedef int paging_flags_t;
 
 
+/// Pages the fault handler maps around a faulting address, see paging_set_fault_around
+#define PAGING_FAULT_AROUND_DEFAULT 16
+
+/// Bytes at the top of a thread stack that are backed when the stack is created
+#define PAGING_STACK_EAGER_BYTES (16 * 1024)
+
+/// Bytes below a faulting stack page that the fault handler backs, too
+#define PAGING_STACK_SLACK_BYTES 4096
+
+/**
+ * A reserved range of virtual addresses. A lazy region is backed by frames
+ * only once it is touched, by the page fault handler, with the region's
+ * flags. Any other region is backed by paging_region_map, in chunks of
+ * commit_size bytes, up to what it handed out.
+ */
 struct paging_region {
     lvaddr_t base_addr;
     lvaddr_t current_addr;
     size_t region_size;
     paging_flags_t flags;
-    // TODO: if needed add struct members for tracking state
+    lvaddr_t commit_addr;           ///< End of the part that is backed
+    size_t commit_size;             ///< Chunk size, BASE_PAGE_SIZE unless set after init
+    struct paging_region *next;     ///< Next region of the paging state
+};
+
+/// Page fault counters of a domain, see paging_get_fault_stats
+struct paging_fault_stats {
+    uint64_t faults;        ///< Faults resolved by mapping a new frame
+    uint64_t pages;         ///< Pages mapped by the fault handler
+    uint64_t around_pages;  ///< Of those, pages mapped ahead of an access
+    uint64_t cow_pages;     ///< Copy-on-write pages copied after a write
+    uint64_t unhandled;     ///< Faults outside of any region, or that failed
+};
+
+/// Entries of a page table kept together in one shadow_pt_chunk
+#define SHADOW_PT_CHUNK_ENTRIES 16
+#define SHADOW_PT_CHUNKS        (PTABLE_ENTRIES / SHADOW_PT_CHUNK_ENTRIES)
+
+/**
+ * A frame that the paging state allocated itself, for a lazy region, a
+ * copy-on-write copy or a backed paging region. The mappings of its parts
+ * share it, and the last one to be unmapped frees it.
+ */
+struct paging_frame {
+    struct capref cap;
+    size_t refs;                ///< Mappings of parts of the frame
+};
+
+/**
+ * A mapping that one domain shares copy-on-write with another, see
+ * paging_share_cow and paging_map_cow_ranges. Whoever passes the record on
+ * replaces `frame` with a copy of the cap in the receiving domain.
+ */
+struct paging_cow_range {
+    lvaddr_t vaddr;             ///< Where the sharing domain maps the range
+    size_t bytes;
+    struct capref frame;        ///< Frame that backs the range
+    size_t offset;              ///< Offset of the range into the frame
+    paging_flags_t flags;       ///< Flags to map the range with
+    struct paging_frame *owner; ///< Reference on the frame, if the sharing paging
+                                ///< state allocated it, see paging_unshare_cow
+};
+
+/**
+ * Consecutive entries of one table that map pages or blocks of one frame,
+ * with a single invocation. The entries share this record.
+ */
+struct shadow_pt_mapping {
+    struct capref map;          ///< Mapping cap of all the entries
+    struct capref frame;        ///< Frame they map, kept to map parts of it again
+    struct paging_frame *owner; ///< The frame, if the paging state allocated it
+    size_t offset;              ///< Offset into the frame of the first entry
+    paging_flags_t flags;       ///< Flags they are mapped with
+    uint16_t entry;             ///< First entry
+    uint16_t count;             ///< Number of entries
 };
 
+/// An entry of a page table: the next table, or the mapping of a page or block
+union shadow_pt_entry {
+    struct shadow_pt *child;
+    struct shadow_pt_mapping *mapping;
+};
+
+/// SHADOW_PT_CHUNK_ENTRIES consecutive entries, allocated once one is used
+struct shadow_pt_chunk {
+    union shadow_pt_entry e[SHADOW_PT_CHUNK_ENTRIES];
+};
+
+/**
+ * Shadow of a page table. Only the chunks with used entries exist, so a table
+ * with a single entry costs one shadow_pt and one shadow_pt_chunk.
+ */
 struct shadow_pt {
-    struct capref s_pt_cap_root;
-    struct capref s_pt_cap_map[PTABLE_ENTRIES];
-    struct shadow_pt *s_pt_entries[PTABLE_ENTRIES];
+    struct capref s_pt_cap_root;    ///< VNode cap of this table
+    struct capref s_pt_cap_map;     ///< Mapping of this table in its parent
+    struct capref s_pt_cap_ram;     ///< RAM the table was retyped from
+    uint64_t used[PTABLE_ENTRIES / 64]; ///< Occupancy bitmap of the entries
+    uint64_t leaf[PTABLE_ENTRIES / 64]; ///< Entries that map a page or block
+    struct shadow_pt_chunk *chunks[SHADOW_PT_CHUNKS];
 };
 
 // struct to store the paging status of a process
 struct paging_state {
     struct slot_allocator *slot_alloc;
     struct shadow_pt shadow_pt;
-    struct slab_allocator slabs;
+    struct slab_allocator slabs;        ///< struct shadow_pt
+    struct slab_allocator chunk_slabs;  ///< struct shadow_pt_chunk
+    struct slab_allocator mapping_slabs;    ///< struct shadow_pt_mapping
+    struct slab_allocator frame_slabs;      ///< struct paging_frame
+    struct thread_mutex mutex;          ///< Taken nested, faults come from any thread
+    struct vaddr_tree vaddrs;           ///< Virtual addresses handed out by paging_alloc
+    struct paging_region *regions;      ///< Regions the fault handler backs
+    size_t fault_around;                ///< Pages mapped per fault, at least 1
+    struct paging_fault_stats fault_stats;
 };
 
 
@@ -17,6 +17,7 @@
 #define BARRELFISH_RAM_ALLOC_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <errors/errno.h>
 #include <sys/cdefs.h>
 
@@ -25,12 +26,23 @@ __BEGIN_DECLS
 struct capref;
 
 typedef errval_t (* ram_alloc_func_t)(struct capref *ret, size_t size, size_t alignment);
+typedef errval_t (* ram_alloc_batch_func_t)(struct capref *ret, size_t size,
+                                            size_t alignment, size_t count);
+typedef errval_t (* ram_alloc_frame_func_t)(struct capref *ret, size_t size);
+typedef errval_t (* ram_free_func_t)(struct capref cap);
 
 errval_t ram_alloc_fixed(struct capref *ret, size_t size, size_t alignment);
 errval_t ram_alloc_aligned(struct capref *ret, size_t size, size_t alignment);
 errval_t ram_alloc(struct capref *retcap, size_t size);
+errval_t ram_alloc_batch(struct capref *ret, size_t size, size_t alignment, size_t count);
+bool ram_alloc_has_frame(void);
+errval_t ram_alloc_frame(struct capref *ret, size_t size);
+errval_t ram_free(struct capref cap);
 errval_t ram_available(genpaddr_t *available, genpaddr_t *total);
 errval_t ram_alloc_set(ram_alloc_func_t local_allocator);
+errval_t ram_alloc_set_batch(ram_alloc_batch_func_t local_allocator);
+errval_t ram_alloc_set_frame(ram_alloc_frame_func_t local_allocator);
+errval_t ram_alloc_set_free(ram_free_func_t local_allocator);
 void ram_set_affinity(uint64_t minbase, uint64_t maxlimit);
 void ram_get_affinity(uint64_t *minbase, uint64_t *maxlimit);
 void ram_alloc_init(void);
@@ -0,0 +1,103 @@
+/**
+ * \file
+ * \brief Shared-memory buffer pools between two domains
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef LIBBARRELFISH_SHM_H
+#define LIBBARRELFISH_SHM_H
+
+#include <sys/cdefs.h>
+#include <errors/errno.h>
+#include <aos/types.h>
+#include <aos/caddr.h>
+
+__BEGIN_DECLS
+
+/// Identifies the header of a region, and its layout version
+#define SHM_MAGIC 0x73686d706f6f6c31ULL // "shmpool1"
+
+/// Alignment of the ring indices, so that the two sides do not share cache lines
+#define SHM_CACHE_LINE 64
+
+/**
+ * \brief One direction of buffer hand-off, a single-producer/single-consumer
+ *        ring of slots in the shared frame
+ *
+ * head and tail count slots ever written and read. Each is only written by
+ * one side, so they are on cache lines of their own.
+ */
+struct shm_ring {
+    uint64_t head __attribute__((aligned(SHM_CACHE_LINE)));   ///< Slots written
+    uint64_t tail __attribute__((aligned(SHM_CACHE_LINE)));   ///< Slots read
+};
+
+/**
+ * \brief Start of the shared frame
+ *
+ * It is followed by the slots of the full ring, then the slots of the free
+ * ring, buf_count each. The buffers start at the next page boundary.
+ */
+struct shm_header {
+    uint64_t magic;
+    uint32_t buf_size;          ///< Bytes per buffer, a multiple of SHM_CACHE_LINE
+    uint32_t buf_count;         ///< Number of buffers
+    struct shm_ring full;       ///< Filled buffers, producer to consumer
+    struct shm_ring free;       ///< Released buffers, consumer to producer
+};
+
+/**
+ * \brief One side's view of a pool of buffers in a frame shared by two
+ *        domains
+ *
+ * The creator is the producer: it takes free buffers, fills them and sends
+ * them by index. The domain that attaches to the frame is the consumer: it
+ * receives the buffers and releases them after use, for the producer to fill
+ * again. Buffers move by reference only, their contents are never copied.
+ * Both sides may run on different cores.
+ *
+ * The rings never block. A side that finds nothing to take can poll, or wait
+ * for a message over whichever channel the two domains share. The geometry
+ * is read once, at attach, and every index the peer writes is checked
+ * against it, so a misbehaving peer cannot make this side touch memory
+ * outside of the frame.
+ */
+struct shm_region {
+    struct capref frame;        ///< Frame of the region, to send to the peer
+    struct shm_header *header;  ///< Where the frame is mapped
+    uint64_t *full_slots;
+    uint64_t *free_slots;
+    char *bufs;                 ///< First buffer
+    size_t buf_size;
+    size_t buf_count;
+    size_t bytes;               ///< Size of the frame
+    bool producer;              ///< Whether this side fills the buffers
+};
+
+errval_t shm_create(struct shm_region *shm, size_t buf_size, size_t buf_count);
+errval_t shm_attach(struct shm_region *shm, struct capref frame);
+errval_t shm_destroy(struct shm_region *shm);
+
+errval_t shm_buf_alloc(struct shm_region *shm, size_t *ret_idx, void **ret_buf);
+errval_t shm_buf_send(struct shm_region *shm, size_t idx, size_t len);
+errval_t shm_buf_recv(struct shm_region *shm, size_t *ret_idx, void **ret_buf,
+                      size_t *ret_len);
+errval_t shm_buf_release(struct shm_region *shm, size_t idx);
+
+/// Returns the buffer with index `idx`
+static inline void *shm_buf(struct shm_region *shm, size_t idx)
+{
+    return shm->bufs + idx * shm->buf_size;
+}
+
+__END_DECLS
+
+#endif // LIBBARRELFISH_SHM_H
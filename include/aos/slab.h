@@ -38,6 +38,8 @@ struct slab_allocator {
     size_t blocksize;           ///< Size of blocks managed by this allocator
     slab_refill_func_t refill_func;  ///< Refill function
     bool is_refilling;
+    size_t low_watermark;       ///< slab_refill is due below this, 0 to refill in slab_alloc
+    size_t high_watermark;      ///< Free blocks slab_refill tops up to
 };
 
 void slab_init(struct slab_allocator *slabs, size_t blocksize,
@@ -46,6 +48,9 @@ void slab_grow(struct slab_allocator *slabs, void *buf, size_t buflen);
 void *slab_alloc(struct slab_allocator *slabs);
 void slab_free(struct slab_allocator *slabs, void *block);
 size_t slab_freecount(struct slab_allocator *slabs);
+void slab_set_watermarks(struct slab_allocator *slabs, size_t low, size_t high);
+bool slab_needs_refill(struct slab_allocator *slabs);
+errval_t slab_refill(struct slab_allocator *slabs);
 errval_t slab_default_refill(struct slab_allocator *slabs);
 
 // size of block header
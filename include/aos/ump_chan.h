@@ -0,0 +1,137 @@
+/**
+ * \file
+ * \brief Bidirectional UMP channel
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef BARRELFISH_UMP_CHAN_H
+#define BARRELFISH_UMP_CHAN_H
+
+#include <sys/cdefs.h>
+
+#include <aos/waitset.h>
+#include <aos/systime.h>
+
+__BEGIN_DECLS
+
+/// Size of a message, one cache line
+#define UMP_MSG_BYTES   64
+
+/// Payload words of a message
+#define UMP_MSG_WORDS   ((UMP_MSG_BYTES / sizeof(uint64_t)) - 1)
+
+/// Software-generated interrupt that rings the UMP doorbell of a core
+#define UMP_DOORBELL_SGI    2
+
+/// Default time an adaptive receiver polls an empty ring before it blocks
+#define UMP_SPIN_DEFAULT_NS (20 * 1000)
+
+/**
+ * \brief A message slot in a ring
+ *
+ * The sender writes the payload first and the sequence number last. A slot
+ * holds the message the receiver waits for once its sequence number is the
+ * one the receiver expects, so stale slots from the previous round never
+ * look valid, and an all-zero frame holds no messages.
+ */
+struct ump_msg {
+    uint64_t words[UMP_MSG_WORDS];
+    uint64_t seq;               ///< Number of the message, counting from 1
+} __attribute__((aligned(UMP_MSG_BYTES)));
+
+/**
+ * \brief Lines of a ring that the receiver writes
+ *
+ * `armed` has a line of its own, so that blocking does not make the sender
+ * reload the ack count.
+ */
+struct ump_ack {
+    uint64_t seq;               ///< Messages the receiver has taken
+    uint64_t armed __attribute__((aligned(UMP_MSG_BYTES)));  ///< Receiver waits for the doorbell
+} __attribute__((aligned(UMP_MSG_BYTES)));
+
+/**
+ * \brief One direction of a channel, a ring of message slots and its ack lines
+ */
+struct ump_ring {
+    struct ump_msg *slots;
+    struct ump_ack *ack;        ///< Written by the receiver
+    size_t count;               ///< Number of slots
+};
+
+/**
+ * \brief How the receiver of a channel came by its messages
+ */
+struct ump_chan_stats {
+    uint64_t polled;            ///< Waits that ended while polling
+    uint64_t blocks;            ///< Times the receiver stopped polling and armed the doorbell
+    uint64_t wakeups;           ///< Waits that ended with the doorbell
+    uint64_t doorbells;         ///< Doorbells rung for the peer
+};
+
+/**
+ * \brief A bidirectional UMP channel
+ *
+ * Both sides map the same frame, which holds one ring for each direction.
+ * Every slot of a ring is written by the sender only and the ack count by
+ * the receiver only, so the channel needs no locks and works between cores.
+ * Only the armed line is written by both, with atomic operations.
+ * The sender learns about free slots from the ack line, which it reads only
+ * once the ring looks full; the receiver updates it every few messages.
+ *
+ * Receiving is polled: a registered channel is checked by the dispatcher
+ * whenever it runs, and its closure runs once a message is there. An
+ * adaptive channel polls for `spin_time` only. It then arms the doorbell of
+ * its dispatcher and leaves the dispatcher free to sleep, until the sender
+ * sees the armed line and rings the doorbell with an interrupt.
+ */
+struct ump_chan {
+    struct waitset_chanstate recv_waitset;  ///< State belonging to waitset (for recv)
+    struct ump_ring send;
+    struct ump_ring recv;
+    uint64_t send_seq;          ///< Messages sent
+    uint64_t send_acked;        ///< Messages the peer was last seen to have taken
+    uint64_t recv_seq;          ///< Messages received
+    uint64_t recv_acked;        ///< Messages acknowledged to the peer
+
+    bool adaptive;              ///< Whether the receiver blocks after spin_time
+    bool blocked;               ///< Whether the receiver waits for the doorbell
+    coreid_t peer_core;         ///< Core of the peer's doorbell
+    systime_t spin_time;        ///< How long the receiver polls before blocking
+    systime_t spin_start;       ///< When the receiver started polling
+    struct ump_chan *blocked_next;  ///< Next channel waiting for the doorbell
+    struct ump_chan_stats stats;
+};
+
+errval_t ump_chan_init(struct ump_chan *uc, void *buf, size_t bytes, bool first);
+void ump_chan_destroy(struct ump_chan *uc);
+errval_t ump_chan_send(struct ump_chan *uc, const uint64_t words[UMP_MSG_WORDS]);
+errval_t ump_chan_recv(struct ump_chan *uc, uint64_t words[UMP_MSG_WORDS]);
+errval_t ump_chan_register_recv(struct ump_chan *uc, struct waitset *ws,
+                                struct event_closure closure);
+errval_t ump_chan_deregister_recv(struct ump_chan *uc);
+errval_t ump_chan_doorbell_init(void);
+void ump_chan_set_adaptive(struct ump_chan *uc, coreid_t peer_core, uint64_t spin_ns);
+bool ump_chan_poll_disabled(struct waitset_chanstate *chan, dispatcher_handle_t handle);
+void ump_chan_wake_disabled(dispatcher_handle_t handle);
+
+/**
+ * \brief Returns whether a message is waiting to be received
+ */
+static inline bool ump_chan_can_recv(struct ump_chan *uc)
+{
+    struct ump_msg *msg = &uc->recv.slots[uc->recv_seq % uc->recv.count];
+    return __atomic_load_n(&msg->seq, __ATOMIC_ACQUIRE) == uc->recv_seq + 1;
+}
+
+__END_DECLS
+
+#endif // BARRELFISH_UMP_CHAN_H
@@ -0,0 +1,73 @@
+/**
+ * \file
+ * \brief Allocator of virtual address ranges
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef LIBBARRELFISH_VADDR_TREE_H
+#define LIBBARRELFISH_VADDR_TREE_H
+
+#include <sys/cdefs.h>
+#include <errors/errno.h>
+#include <aos/types.h>
+#include <aos/slab.h>
+
+__BEGIN_DECLS
+
+/// Free nodes below which the owner refills the node slab, one operation takes one
+#define VADDR_TREE_SLAB_LOW_WATERMARK 4
+
+/// Free nodes the node slab is refilled to
+#define VADDR_TREE_SLAB_HIGH_WATERMARK 32
+
+/**
+ * \brief An allocated range of virtual addresses
+ */
+struct vaddr_node {
+    lvaddr_t base;              ///< Start of the range
+    size_t size;                ///< Bytes in the range
+    size_t gap;                 ///< Free bytes between the previous range and this one
+    size_t max_gap;             ///< Largest gap in the subtree rooted at `this` node
+    struct vaddr_node *left;    ///< Ranges with lower base
+    struct vaddr_node *right;   ///< Ranges with higher base
+    int height;                 ///< Height of the subtree rooted at `this` node
+};
+
+/**
+ * \brief Allocated ranges in [start, limit), an AVL tree ordered by base
+ *
+ * Every node knows the free gap in front of it, and the largest gap in its
+ * subtree. First-fit search skips every subtree whose largest gap is too
+ * small, so it takes O(log n) steps unless alignment rules out gaps that are
+ * large enough. Freed ranges merge with their neighbouring gaps by
+ * construction.
+ *
+ * Nodes come from `slabs`, which has watermarks set. The owner refills it
+ * before each operation once slab_needs_refill says so.
+ */
+struct vaddr_tree {
+    struct vaddr_node *root;
+    lvaddr_t start;             ///< Lowest address handed out
+    lvaddr_t limit;             ///< End of the addresses handed out
+    struct slab_allocator slabs;    ///< struct vaddr_node
+};
+
+void vaddr_tree_init(struct vaddr_tree *tree, lvaddr_t start, lvaddr_t limit);
+errval_t vaddr_tree_alloc(struct vaddr_tree *tree, size_t bytes, size_t alignment,
+                          lvaddr_t *ret);
+errval_t vaddr_tree_reserve(struct vaddr_tree *tree, lvaddr_t base, size_t bytes);
+errval_t vaddr_tree_free(struct vaddr_tree *tree, lvaddr_t base, size_t bytes);
+errval_t vaddr_tree_lookup(struct vaddr_tree *tree, lvaddr_t vaddr, lvaddr_t *ret_base,
+                           size_t *ret_bytes);
+
+__END_DECLS
+
+#endif // LIBBARRELFISH_VADDR_TREE_H
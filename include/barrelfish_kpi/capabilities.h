@@ -459,6 +459,7 @@ enum vnode_cmd {
     VNodeCmd_CleanDirtyBits, ///< Cleans all dirty bit in the table
     VNodeCmd_CopyRemap,      ///< Copy and remap page table for copy-on-write
     VNodeCmd_Inherit,        ///< Clone page table
+    VNodeCmd_FlushRange,     ///< Flush the TLB for a range of virtual addresses
 };
 
 /**
@@ -628,6 +629,7 @@ enum id_cmd {
 enum ipi_cmd {
     IPICmd_Send_Start,     ///< Send Startup IPI to a destination core
     IPICmd_Send_Init,      ///< Send Init IPI to a destination core
+    IPICmd_Send_Notify,    ///< Raise a notification SGI on a destination core
 };
 
 /**
@@ -44,6 +44,7 @@ typedef uint64_t genpaddr_t;
 
 /* Global (system-wide) size type, currently 64 bits */
 typedef uint64_t gensize_t;
+#define GENSIZE_MAX UINT64_MAX
 #define PRIuGENSIZE PRIu64
 #define PRIxGENSIZE PRIx64
 
@@ -20,13 +20,36 @@
 #include <aos/types.h>
 #include <aos/capabilities.h>
 #include <aos/slab.h>
+#include <aos/threads.h>
 #include "slot_alloc.h"
 
 __BEGIN_DECLS
 
+/// Number of power-of-two size classes indexing the free nodes
+#define MM_NBINS 64
+
+/// Free nodes below which the node slab is refilled after an operation
+#define MM_SLAB_LOW_WATERMARK 32
+
+/// Free nodes the node slab is refilled to
+#define MM_SLAB_HIGH_WATERMARK 64
+
+/// Maximum number of frames the pre-zeroed pool can hold
+#define MM_ZPOOL_SLOTS 64
+
+/// mm_alloc_flags: return a zero-filled Frame instead of a RAM capability
+#define MM_ALLOC_ZEROED 0x1
+
+/// Objects mm_alloc_batch carves out of one free node, larger batches take several
+#define MM_BATCH_MAX 64
+
+/// Number of latency buckets, bucket i counts operations of [2^i, 2^(i+1)) ns
+#define MM_LATENCY_BUCKETS 32
+
 enum nodetype {
     NodeType_Free,      ///< This region exists and is free
-    NodeType_Allocated  ///< This region exists and is allocated
+    NodeType_Allocated, ///< This region exists and is allocated
+    NodeType_Freeing    ///< This region is allocated and being freed by mm_free
 };
 
 struct capinfo {
@@ -45,6 +68,47 @@ struct mmnode {
     struct mmnode *next;   ///< Next node in the list.
     genpaddr_t base;       ///< Base address of this region
     gensize_t size;        ///< Size of this free region in cap
+    struct mmnode *free_prev; ///< Previous free node in the same size class
+    struct mmnode *free_next; ///< Next free node in the same size class
+    struct mmnode *left;   ///< Nodes with lower base in the address tree
+    struct mmnode *right;  ///< Nodes with higher base in the address tree
+    int height;            ///< Height of the subtree rooted at `this` node
+    gensize_t free_size;   ///< Size if `this` node is in a size class, 0 otherwise
+    gensize_t max_free;    ///< Largest free_size in the subtree rooted at `this` node
+};
+
+/**
+ * \brief Pool of frames that were zeroed ahead of time
+ *
+ * The frames are allocated from the mm like any other region, so the kernel
+ * zeroes them when the pool is refilled instead of on the request path.
+ */
+struct mm_zpool {
+    gensize_t objsize;                   ///< Size of every frame in the pool, 0 if disabled
+    size_t target;                       ///< Number of frames to keep ready
+    size_t count;                        ///< Number of frames currently ready
+    size_t pending;                      ///< Number of frames being zeroed by refills
+    struct capref frames[MM_ZPOOL_SLOTS]; ///< Ready frames, used as a stack
+};
+
+/**
+ * \brief Snapshot of the state of a memory manager, filled in by mm_stats
+ *
+ * Latency percentiles are upper bounds of power-of-two buckets, so they
+ * overestimate by less than a factor of two.
+ */
+struct mm_stats {
+    gensize_t bytes_total;         ///< Bytes added with mm_add
+    gensize_t bytes_free;          ///< Bytes in free nodes
+    gensize_t bytes_allocated;     ///< Bytes in allocated nodes, including the pool
+    size_t nodes_free;             ///< Number of free nodes
+    size_t nodes_allocated;        ///< Number of allocated nodes
+    gensize_t largest_free;        ///< Size of the largest free node
+    size_t free_by_class[MM_NBINS]; ///< Free nodes of [2^i, 2^(i+1)) bytes
+    uint64_t allocs;               ///< Successful calls of mm_alloc_flags
+    uint64_t frees;                ///< Successful calls of mm_free
+    uint64_t alloc_ns_p50, alloc_ns_p90, alloc_ns_p99, alloc_ns_max;
+    uint64_t free_ns_p50, free_ns_p90, free_ns_p99, free_ns_max;
 };
 
 /**
@@ -52,18 +116,36 @@ struct mmnode {
  *
  * This should be opaque from the perspective of the client, but to allow
  * them to allocate its memory, we declare it in the public header.
+ *
+ * All functions except mm_init and mm_destroy may be called concurrently.
+ * `lock` covers the nodes, the pool and the statistics and is only held for
+ * short bookkeeping, never across a syscall. `alloc_lock` serializes the
+ * node slab and the slot allocator. Refilling either of them may allocate
+ * from this mm again, so it is taken nested and never while `lock` is held.
  */
 struct mm {
     struct slab_allocator slabs; ///< Slab allocator used for allocating nodes
     slot_alloc_t slot_alloc;     ///< Slot allocator for allocating cspace
     slot_refill_t slot_refill;   ///< Slot allocator refill function
     void *slot_alloc_inst;       ///< Opaque instance pointer for slot allocator
+    struct thread_mutex lock;    ///< Protects nodes, bins, zpool and statistics
+    struct thread_mutex alloc_lock; ///< Serializes slabs and slot_alloc, nested
     enum objtype objtype;        ///< Type of capabilities stored
     struct mmnode *head;         ///< Head of doubly-linked list of nodes in order
+    struct mmnode *root;         ///< Root of the AVL tree of all nodes by base
+    struct mmnode *bins[MM_NBINS]; ///< Free nodes, binned by floor(log2(size))
+    uint64_t bins_used;          ///< Bitmap of non-empty entries in bins
+    struct mm_zpool zpool;       ///< Pre-zeroed frames for MM_ALLOC_ZEROED
 
     /* statistics */
-    gensize_t stats_bytes_max;
-    gensize_t stats_bytes_available;
+    gensize_t stats_bytes_max;       ///< Bytes added with mm_add
+    gensize_t stats_bytes_available; ///< Bytes in free nodes
+    gensize_t stats_bytes_prezeroed; ///< Zeroed bytes served from the pool
+    gensize_t stats_bytes_zeroed_inline; ///< Zeroed bytes retyped on the request path
+    uint64_t stats_alloc_latency[MM_LATENCY_BUCKETS]; ///< mm_alloc_flags calls by duration
+    uint64_t stats_free_latency[MM_LATENCY_BUCKETS];  ///< mm_free calls by duration
+    uint64_t stats_alloc_ns_max;     ///< Longest mm_alloc_flags call
+    uint64_t stats_free_ns_max;      ///< Longest mm_free call
 };
 
 errval_t mm_init(struct mm *mm, enum objtype objtype,
@@ -74,9 +156,19 @@ errval_t mm_init(struct mm *mm, enum objtype objtype,
 errval_t mm_add(struct mm *mm, struct capref cap, genpaddr_t base, size_t size);
 errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment,
                               struct capref *retcap);
+errval_t mm_alloc_flags(struct mm *mm, size_t size, size_t alignment, int flags,
+                        struct capref *retcap);
 errval_t mm_alloc(struct mm *mm, size_t size, struct capref *retcap);
+errval_t mm_find(struct mm *mm, size_t size, size_t alignment, genpaddr_t *ret_base);
+errval_t mm_alloc_batch(struct mm *mm, size_t size, size_t alignment, size_t count,
+                        struct capref *retcaps);
 errval_t mm_free(struct mm *mm, struct capref cap, genpaddr_t base, gensize_t size);
 void mm_dump_mmnodes(struct mm *mm);
+void mm_stats(struct mm *mm, struct mm_stats *ret);
+errval_t mm_zpool_init(struct mm *mm, gensize_t objsize, size_t target);
+bool mm_zpool_needs_refill(struct mm *mm);
+errval_t mm_zpool_refill(struct mm *mm, size_t max);
+void mm_zpool_stats(struct mm *mm, gensize_t *ret_prezeroed, gensize_t *ret_zeroed_inline);
 void mm_destroy(struct mm *mm);
 
 __END_DECLS
@@ -65,8 +65,12 @@ errval_t irq_table_set(unsigned int nidt, capaddr_t endpoint)
         err = caps_copy_to_cte(&irq_dispatch[nidt], recv, false, 0, 0);
 
         // Correct interrupt forwarding by the distributor must be ensured
-        // in userspace.
-        
+        // in userspace. Software-generated interrupts do not pass the
+        // distributor, they only need enabling on this core.
+        if (err_is_ok(err) && nidt < 16) {
+            err = platform_enable_interrupt(nidt, 0, true, false);
+        }
+
         return err;
     }
 
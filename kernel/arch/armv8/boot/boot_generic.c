@@ -194,6 +194,10 @@ static void configure_tcr(void) {
     tcr_el1 = armv8_TCR_EL1_EPD0_insert(tcr_el1, 0);
     // 48b user VA
     tcr_el1 = armv8_TCR_EL1_T0SZ_insert(tcr_el1, 16);
+    // TTBR0 holds the ASID of the user VSpace, as wide as the core allows
+    tcr_el1 = armv8_TCR_EL1_A1_insert(tcr_el1, 0);
+    tcr_el1 = armv8_TCR_EL1_AS_insert(tcr_el1,
+            armv8_ID_AA64MMFR0_EL1_ASIDBits_rdf(NULL) == 2 ? armv8_bit_16 : armv8_bit_8);
     armv8_TCR_EL1_wr(NULL, tcr_el1);
 }
 
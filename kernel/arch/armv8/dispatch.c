@@ -36,7 +36,7 @@ context_switch(struct dcb *dcb) {
         assert(dcb->disp != 0);
     }
 
-    paging_context_switch(dcb->vspace);
+    paging_context_switch(dcb);
     context_switch_counter++;
 
     if (!dcb->is_vm_guest) {
@@ -0,0 +1,113 @@
+/**
+ * \file
+ * \brief Bulk zeroing of kernel memory using DC ZVA
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <kernel.h>
+#include <string.h>
+#include <memzero.h>
+#include <bitmacros.h>
+#include <dev/armv8_dev.h>
+
+/// Regions smaller than this are zeroed with memset
+#define MEMZERO_BULK_MIN 256
+
+/// Bytes zeroed per iteration of the store loop
+#define MEMZERO_STP_CHUNK 64
+
+/// Bytes zeroed by one DC ZVA, 0 if DC ZVA is prohibited, SIZE_MAX if unknown
+static size_t zva_block_size = SIZE_MAX;
+
+/**
+ * \brief Returns the block size of DC ZVA, or 0 if it must not be used
+ */
+static size_t memzero_zva_block_size(void)
+{
+    if (zva_block_size == SIZE_MAX) {
+        armv8_DCZID_EL0_t dczid = armv8_DCZID_EL0_rd(NULL);
+        if (armv8_DCZID_EL0_DZP_extract(dczid)) {
+            zva_block_size = 0;
+        } else {
+            // BS is the log2 of the block size in 4-byte words
+            zva_block_size = sizeof(uint32_t) << armv8_DCZID_EL0_BS_extract(dczid);
+        }
+        // Small blocks are not faster than the store loop
+        if (zva_block_size < MEMZERO_STP_CHUNK) {
+            zva_block_size = 0;
+        }
+    }
+    return zva_block_size;
+}
+
+/**
+ * \brief Zeroes `n` bytes at `p` with paired stores of the zero register
+ *
+ * \param p Start of the region, aligned to MEMZERO_STP_CHUNK
+ * \param n Size of the region, a multiple of MEMZERO_STP_CHUNK
+ */
+static void memzero_stp(uint8_t *p, size_t n)
+{
+    for (uint8_t *end = p + n; p < end; p += MEMZERO_STP_CHUNK) {
+        __asm volatile("stp xzr, xzr, [%[p]]\n"
+                       "stp xzr, xzr, [%[p], #16]\n"
+                       "stp xzr, xzr, [%[p], #32]\n"
+                       "stp xzr, xzr, [%[p], #48]\n"
+                       : : [p] "r" (p) : "memory");
+    }
+}
+
+/**
+ * \brief Zeroes `n` bytes at `p` with DC ZVA
+ *
+ * \param p Start of the region, aligned to `block`
+ * \param n Size of the region, a multiple of `block`
+ * \param block DC ZVA block size
+ */
+static void memzero_zva(uint8_t *p, size_t n, size_t block)
+{
+    for (uint8_t *end = p + n; p < end; p += block) {
+        __asm volatile("dc zva, %[p]\n" : : [p] "r" (p) : "memory");
+    }
+}
+
+/**
+ * \brief Fills `n` bytes at `s` with zeros
+ *
+ * The unaligned head and tail are handled by memset, the aligned bulk by
+ * DC ZVA if it is permitted and by paired stores otherwise. The memory must
+ * be normal memory, DC ZVA faults on device memory.
+ */
+void *memzero(void *s, size_t n)
+{
+    if (n < MEMZERO_BULK_MIN) {
+        return memset(s, 0, n);
+    }
+
+    size_t block = memzero_zva_block_size();
+    size_t align = block != 0 ? block : MEMZERO_STP_CHUNK;
+
+    uint8_t *start = (uint8_t *)ROUND_UP((uintptr_t)s, align);
+    uint8_t *end = (uint8_t *)ROUND_DOWN((uintptr_t)s + n, align);
+    if (start >= end) {
+        return memset(s, 0, n);
+    }
+
+    memset(s, 0, start - (uint8_t *)s);
+    if (block != 0) {
+        memzero_zva(start, end - start, block);
+    } else {
+        memzero_stp(start, end - start);
+    }
+    memset(end, 0, ((uint8_t *)s + n) - end);
+
+    return s;
+}
@@ -25,6 +25,19 @@
 // ------------------------------------------------------------------------
 // Utility declarations
 
+/**
+ * \brief Makes new entries visible to the table walker
+ *
+ * Only entries that were invalid before are filled in by the map functions.
+ * Invalid entries are never held in the TLB, so there is nothing to flush.
+ */
+inline static void paging_publish_entries(void)
+{
+    __asm volatile("dsb ishst\n"
+                   "isb\n"
+                   : : : "memory");
+}
+
 inline static uintptr_t paging_round_down(uintptr_t address, uintptr_t size)
 {
     return address & ~(size - 1);
@@ -323,6 +336,8 @@ paging_set_flags(union armv8_ttable_entry *entry, uintptr_t kpi_paging_flags)
         entry->page.ap = 0;
 
     entry->page.af = 1;
+    // tagged with the ASID, the TLB keeps it across switches to other VSpaces
+    entry->page.ng = 1;
 }
 
 static errval_t
@@ -403,10 +418,77 @@ caps_map_l0(struct capability* dest,
     debug(SUBSYS_PAGING, "L0 mapping %"PRIuCSLOT". @%p = %08"PRIx32"\n",
               slot, entry, entry->raw);
 
-    sysreg_invalidate_tlb();
+    paging_publish_entries();
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Maps `pte_count` blocks of a frame into an L1 (1 GiB blocks) or
+ *        L2 (2 MiB blocks) table
+ *
+ * Block and page entries keep their attributes in the same bits, so
+ * paging_set_flags applies to both.
+ */
+static errval_t
+caps_map_block(struct capability* dest,
+               cslot_t            slot,
+               struct capability* src,
+               uintptr_t          kpi_paging_flags,
+               uintptr_t          offset,
+               uintptr_t          pte_count,
+               struct cte*        mapping_cte,
+               size_t             block_size)
+{
+    assert(0 == (kpi_paging_flags & ~KPI_PAGING_FLAGS_MASK));
+
+    if (pte_count == 0 || slot + pte_count > VMSAv8_64_PTABLE_NUM_ENTRIES) {
+        return SYS_ERR_VM_MAP_SIZE;
+    }
+
+    // check offset within frame
+    if (!aligned(offset, block_size) ||
+        offset + pte_count * block_size > get_size(src)) {
+        return SYS_ERR_FRAME_OFFSET_INVALID;
+    }
+
+    lpaddr_t src_lpaddr = gen_phys_to_local_phys(get_address(src) + offset);
+    if (!aligned(src_lpaddr, block_size)) {
+        return SYS_ERR_VM_FRAME_UNALIGNED;
+    }
+
+    // Destination
+    lpaddr_t dest_lpaddr = gen_phys_to_local_phys(get_address(dest));
+    lvaddr_t dest_lvaddr = local_phys_to_mem(dest_lpaddr);
+
+    union armv8_ttable_entry *entry = (union armv8_ttable_entry *)dest_lvaddr + slot;
+    for (int i = 0; i < pte_count; i++) {
+        if (entry[i].d.valid) {
+            return SYS_ERR_VNODE_SLOT_INUSE;
+        }
+    }
+
+    create_mapping_cap(mapping_cte, src, cte_for_cap(dest), slot, pte_count);
+
+    for (int i = 0; i < pte_count; i++) {
+        entry->raw = 0;
+        paging_set_flags(entry, kpi_paging_flags);
+        // The block address is aligned, the bits below it stay zero
+        entry->page.base = (src_lpaddr + i * block_size) >> BASE_PAGE_BITS;
+        entry->block_l2.mb0 = 0;
+        entry->block_l2.valid = 1;
+
+        debug(SUBSYS_PAGING, "block mapping %08"PRIxLVADDR"[%"PRIuCSLOT"] @%p = %08"PRIx64"\n",
+               dest_lvaddr, slot, entry, entry->raw);
+
+        entry++;
+    }
+
+    paging_publish_entries();
 
     return SYS_ERR_OK;
 }
+
 static errval_t
 caps_map_l1(struct capability* dest,
             cslot_t            slot,
@@ -433,6 +515,11 @@ caps_map_l1(struct capability* dest,
         return SYS_ERR_VNODE_SLOT_INVALID;
     }
 
+    if (src->type == ObjType_Frame || src->type == ObjType_DevFrame) {
+        return caps_map_block(dest, slot, src, kpi_paging_flags, offset,
+                              pte_count, mapping_cte, VMSAv8_64_L1_BLOCK_SIZE);
+    }
+
     if (pte_count != 1) {
         printf("pte_count = %zu\n",(size_t)pte_count);
         panic("oops: pte_count");
@@ -476,7 +563,7 @@ caps_map_l1(struct capability* dest,
     debug(SUBSYS_PAGING, "L1 mapping %"PRIuCSLOT". @%p = %08"PRIx32"\n",
               slot, entry, entry->raw);
 
-    sysreg_invalidate_tlb();
+    paging_publish_entries();
 
     return SYS_ERR_OK;
 }
@@ -506,6 +593,11 @@ caps_map_l2(struct capability* dest,
         return SYS_ERR_VNODE_SLOT_INVALID;
     }
 
+    if (src->type == ObjType_Frame || src->type == ObjType_DevFrame) {
+        return caps_map_block(dest, slot, src, kpi_paging_flags, offset,
+                              pte_count, mapping_cte, VMSAv8_64_L2_BLOCK_SIZE);
+    }
+
     if (pte_count != 1) {
         printf("pte_count = %zu\n",(size_t) pte_count);
         panic("oops: pte_count");
@@ -546,7 +638,7 @@ caps_map_l2(struct capability* dest,
     debug(SUBSYS_PAGING, "L2 mapping %"PRIuCSLOT". @%p = %08"PRIx32"\n",
               slot, entry, entry->raw);
 
-    sysreg_invalidate_tlb();
+    paging_publish_entries();
 
     return SYS_ERR_OK;
 }
@@ -575,15 +667,15 @@ caps_map_l3(struct capability* dest,
         return SYS_ERR_WRONG_MAPPING;
     }
 
-    // check offset within frame
-    if ((offset + BASE_PAGE_SIZE > get_size(src)) ||
+    // check offset within frame, for all pte_count pages
+    if ((offset + pte_count * BASE_PAGE_SIZE > get_size(src)) ||
         ((offset % BASE_PAGE_SIZE) != 0)) {
         panic("oops: frame offset invalid");
         return SYS_ERR_FRAME_OFFSET_INVALID;
     }
 
     // check mapping does not overlap leaf page table
-    if (slot + pte_count > VMSAv8_64_PTABLE_NUM_ENTRIES ) {
+    if (pte_count == 0 || slot + pte_count > VMSAv8_64_PTABLE_NUM_ENTRIES ) {
         return SYS_ERR_VM_MAP_SIZE;
     }
 
@@ -592,8 +684,10 @@ caps_map_l3(struct capability* dest,
     lvaddr_t dest_lvaddr = local_phys_to_mem(dest_lpaddr);
 
     union armv8_ttable_entry *entry = (union armv8_ttable_entry *)dest_lvaddr + slot;
-    if (entry->page.valid) {
-        panic("Remapping valid page.");
+    for (int i = 0; i < pte_count; i++) {
+        if (entry[i].page.valid) {
+            panic("Remapping valid page.");
+        }
     }
 
     lpaddr_t src_lpaddr = gen_phys_to_local_phys(get_address(src) + offset);
@@ -618,8 +712,7 @@ caps_map_l3(struct capability* dest,
 
     }
 
-    // Flush TLB if remapping.
-    sysreg_invalidate_tlb();
+    paging_publish_entries();
 
     return SYS_ERR_OK;
 }
@@ -734,6 +827,9 @@ errval_t paging_modify_flags(struct capability *mapping, uintptr_t offset,
 
     // check flags
     assert(0 == (kpi_paging_flags & ~KPI_PAGING_FLAGS_MASK));
+    if (info->ptable == NULL) {
+        return SYS_ERR_VNODE_NOT_INSTALLED;
+    }
 
     /* Calculate location of page table entries we need to modify */
     lvaddr_t base = local_phys_to_mem(get_address(&info->ptable->cap)) +
@@ -785,6 +881,8 @@ bool paging_is_region_valid(lvaddr_t buffer, size_t size, uint8_t type)
         for (uint16_t l1idx = first_l1idx; l1idx <= last_l1idx; l1idx++) {
             pte = (union armv8_ttable_entry *)pdpt + l1idx;
             if (!pte->d.valid) { return false; }
+            // a 1 GiB block maps all of it
+            if (!pte->d.mb1) { continue; }
             // calculate which part of pdpt to check
             first_l2idx = l1idx == first_l1idx ? VMSAv8_64_L2_INDEX(buffer) : 0;
             last_l2idx  = l1idx == last_l1idx  ? VMSAv8_64_L2_INDEX(end)  : PTABLE_ENTRIES;
@@ -793,6 +891,8 @@ bool paging_is_region_valid(lvaddr_t buffer, size_t size, uint8_t type)
             for (uint16_t l2idx = first_l2idx; l2idx <= last_l2idx; l2idx++) {
                 pte = (union armv8_ttable_entry *)pdir + l2idx;
                 if (!pte->d.valid) { return false; }
+                // a 2 MiB block maps all of it
+                if (!pte->d.mb1) { continue; }
                 // calculate which part of pdpt to check
                 first_l3idx = l2idx == first_l2idx ? VMSAv8_64_L3_INDEX(buffer) : 0;
                 last_l3idx  = l2idx == last_l2idx  ? VMSAv8_64_L3_INDEX(end)  : PTABLE_ENTRIES;
@@ -832,6 +932,11 @@ void paging_dump_tables(struct dcb *dispatcher)
             // get level1 table
             union armv8_ttable_entry *l1_e = (union armv8_ttable_entry *)l1 + l1_index;
             if (!l1_e->raw) { continue; }
+            if (!l1_e->d.mb1) {
+                printf("  l1 %d: 0x%"PRIxGENPADDR" 1G block\n", l1_index,
+                       (genpaddr_t)(l1_e->d.base) << BASE_PAGE_BITS);
+                continue;
+            }
             genpaddr_t l2_gp = (genpaddr_t)(l1_e->d.base) << BASE_PAGE_BITS;
             lvaddr_t l2 = local_phys_to_mem(gen_phys_to_local_phys(l2_gp));
             printf("  l1 %d -> %p\n", l1_index, l2);
@@ -840,6 +945,11 @@ void paging_dump_tables(struct dcb *dispatcher)
                 // get level2 table
                 union armv8_ttable_entry *l2_e = (union armv8_ttable_entry *)l2 + l2_index;
                 if (!l2_e->raw) { continue; }
+                if (!l2_e->d.mb1) {
+                    printf("    l2 %d: 0x%"PRIxGENPADDR" 2M block\n", l2_index,
+                           (genpaddr_t)(l2_e->d.base) << BASE_PAGE_BITS);
+                    continue;
+                }
                 genpaddr_t l3_gp = (genpaddr_t)(l2_e->d.base) << BASE_PAGE_BITS;
                 lvaddr_t l3 = local_phys_to_mem(gen_phys_to_local_phys(l3_gp));
                 printf("    l2 %d -> %p\n", l2_index, l3);
@@ -858,19 +968,49 @@ void paging_dump_tables(struct dcb *dispatcher)
     }
 }
 
-/* XXX - rewrite this. */
-void paging_context_switch(lpaddr_t ttbr)
+/*
+ * ASIDs tag the TLB entries of user mappings with their VSpace, so switching
+ * between dispatchers does not flush the TLB. Each core hands out its ASIDs
+ * in order, to dispatchers as they first run. The dispatcher keeps its ASID
+ * together with the generation it came from. Once all ASIDs are taken, the
+ * next generation starts with one full flush: every dispatcher takes a new
+ * ASID when it next runs, which recycles those of dispatchers that are gone.
+ * ASID 0 is never handed out, the kernel runs with it before the first
+ * dispatcher.
+ */
+static uint64_t asid_generation;    ///< Current generation, above the ASID bits
+static uint64_t asid_next;          ///< Next ASID to hand out in this generation
+static uint64_t asid_mask;          ///< All bits of an ASID
+
+static uint16_t paging_asid(struct dcb *dcb)
 {
-    assert(ttbr < MEMORY_OFFSET);
-    //assert((ttbr & 0x3fff) == 0);
+    if ((dcb->asid & ~asid_mask) == asid_generation && asid_generation != 0) {
+        return dcb->asid & asid_mask;
+    }
 
-    lpaddr_t old_ttbr = armv8_TTBR0_EL1_rd(NULL);
-    if (ttbr != old_ttbr)
-    {
-        armv8_TTBR0_EL1_wr(NULL, ttbr);
+    if (asid_generation == 0 || asid_next > asid_mask) {
+        // the first generation also drops global entries left from boot
+        asid_mask = armv8_TCR_EL1_AS_rdf(NULL) == armv8_bit_16 ? MASK(16) : MASK(8);
+        asid_generation += asid_mask + 1;
+        asid_next = 1;
         sysreg_invalidate_tlb();
-        //this isn't necessary on gem5, since gem5 doesn't implement the cache
-        //maintenance instructions, but ensures coherency by itself
-        //sysreg_invalidate_i_and_d_caches();
+        __asm volatile("dsb nsh\n"
+                       "isb\n"
+                       : : : "memory");
+    }
+    dcb->asid = asid_generation | asid_next++;
+    return dcb->asid & asid_mask;
+}
+
+void paging_context_switch(struct dcb *dcb)
+{
+    assert(dcb->vspace < MEMORY_OFFSET);
+
+    armv8_TTBR0_EL1_t ttbr = dcb->vspace;
+    ttbr = armv8_TTBR0_EL1_ASID_insert(ttbr, paging_asid(dcb));
+    if (ttbr != armv8_TTBR0_EL1_rd(NULL)) {
+        // base address and ASID change together, no flush needed
+        armv8_TTBR0_EL1_wr(NULL, ttbr);
+        __asm volatile("isb" : : : "memory");
     }
 }
@@ -38,6 +38,7 @@
 #include <kcb.h>
 
 #include <efi.h>
+#include <microbenchmarks.h>
 
 #define CNODE(cte)              get_address(&(cte)->cap)
 
@@ -114,6 +115,8 @@ static void spawn_init_map(union armv8_ttable_entry *l3_table, lvaddr_t l3_base,
     while (bi < li) {
         /* XXX: we should check not to overrun here */
         paging_set_l3_entry(&l3_table[bi], pa_base, l3_flags);
+        // user mappings are tagged with init's ASID
+        l3_table[bi].page.ng = 1;
         pa_base += BASE_PAGE_SIZE;
         bi++;
     }
@@ -373,6 +376,28 @@ static void create_phys_caps(lpaddr_t reserved_start, lpaddr_t reserved_end)
     create_phys_caps_region(reserved_start, reserved_end, last_end_addr, size, RegionType_PhyAddr);
 }
 
+#ifdef CONFIG_MICROBENCHMARKS
+/**
+ * \brief Returns how many bytes of free RAM follow `base` without a gap
+ *
+ * 0 if `base` is not in conventional memory according to the EFI map.
+ */
+static size_t free_ram_after(lpaddr_t base)
+{
+    struct multiboot_tag_efi_mmap *mmap = (struct multiboot_tag_efi_mmap *)
+            local_phys_to_mem(armv8_glbl_core_data->efi_mmap);
+
+    for (size_t i = 0; i < (mmap->size - sizeof(struct multiboot_tag_efi_mmap)) / mmap->descr_size; i++) {
+        efi_memory_descriptor *desc = (efi_memory_descriptor *)(mmap->efi_mmap + mmap->descr_size * i);
+        lpaddr_t end = desc->PhysicalStart + desc->NumberOfPages * BASE_PAGE_SIZE;
+        if (desc->Type == EfiConventionalMemory && desc->PhysicalStart <= base && base < end) {
+            return end - base;
+        }
+    }
+    return 0;
+}
+#endif
+
 static void init_page_tables(void)
 {
     lpaddr_t (*alloc_phys_aligned)(size_t size, size_t align);
@@ -743,6 +768,17 @@ void arm_kernel_startup(void)
         printf("start_free_ram = 0x%lx\n", armv8_glbl_core_data->start_free_ram);
         bsp_init_alloc_addr = armv8_glbl_core_data->start_free_ram;
 
+#ifdef CONFIG_MICROBENCHMARKS
+        /* Nothing has been allocated from free RAM yet, use it as scratch,
+         * as far as the region it lies in reaches */
+        size_t scratch = free_ram_after(bsp_init_alloc_addr);
+        if (scratch > MICROBENCH_BUFFER_SIZE) {
+            scratch = MICROBENCH_BUFFER_SIZE;
+        }
+        microbenchmarks_set_buffer(local_phys_to_mem(bsp_init_alloc_addr), scratch);
+        microbenchmarks_run_all();
+#endif
+
         /* allocate initial KCB */
         kcb_current= (struct kcb *)local_phys_to_mem(
                 bsp_alloc_phys(sizeof(*kcb_current)));
@@ -347,13 +347,14 @@ handle_unmap(
     int argc
     )
 {
-    assert(4 == argc);
+    assert(5 == argc);
 
     struct registers_aarch64_syscall_args* sa = &context->syscall_args;
 
     /* Retrieve arguments */
     capaddr_t  mapping_cptr  = (capaddr_t)sa->arg2;
     int mapping_bits         = (int)sa->arg3 & 0xff;
+    bool flush               = sa->arg4;
 
     errval_t err;
     struct cte *mapping = NULL;
@@ -364,13 +365,39 @@ handle_unmap(
         return SYSRET(err_push(err, SYS_ERR_CAP_NOT_FOUND));
     }
 
-    err = page_mappings_unmap(ptable, mapping);
+    err = page_mappings_unmap(ptable, mapping, flush);
     if (err_is_fail(err)) {
         printk(LOG_NOTE, "%s: page_mappings_unmap: %ld\n", __FUNCTION__, err);
     }
     return SYSRET(err);
 }
 
+/**
+ * \brief Flushes the TLB for [vaddr, vaddr + bytes), after unmapping with the
+ *        flush left out
+ */
+static struct sysret
+handle_flush_range(
+    struct capability* ptable,
+    arch_registers_state_t* context,
+    int argc
+    )
+{
+    assert(4 == argc);
+
+    struct registers_aarch64_syscall_args* sa = &context->syscall_args;
+
+    genvaddr_t vaddr = sa->arg2;
+    size_t bytes     = sa->arg3;
+
+    if (bytes <= BASE_PAGE_SIZE) {
+        do_one_tlb_flush(vaddr);
+    } else {
+        do_selective_tlb_flush(vaddr, vaddr + bytes);
+    }
+    return SYSRET(SYS_ERR_OK);
+}
+
 static struct sysret
 handle_mapping_destroy(
         struct capability *to,
@@ -745,6 +772,35 @@ monitor_spawn_core(
     return sys_monitor_spawn_core(core_id, cpu_type, entry, context_id);
 }
 
+/**
+ * \brief Raises software-generated interrupt `vector` on core `core_id`
+ *
+ * The receiving core delivers it to whichever endpoint is connected to
+ * the vector there, like any other device interrupt.
+ */
+static struct sysret
+handle_ipi_notify(
+    struct capability *kernel_cap,
+    arch_registers_state_t* context,
+    int argc)
+{
+    struct registers_aarch64_syscall_args* sa = &context->syscall_args;
+
+    coreid_t core_id = sa->arg2;
+    uint8_t vector   = sa->arg3;
+
+    if (sa->arg3 > 15) {
+        return SYSRET(SYS_ERR_IRQ_INVALID);
+    }
+    if (core_id > 15) {
+        // gic_raise_softirq only reaches the first 16 cores
+        return SYSRET(SYS_ERR_CORE_NOT_FOUND);
+    }
+
+    gic_raise_softirq(core_id, vector);
+    return SYSRET(SYS_ERR_OK);
+}
+
 static struct sysret
 monitor_identify_cap(
     struct capability *kernel_cap,
@@ -974,6 +1030,7 @@ static invocation_t invocations[ObjType_Num][CAP_MAX_CMD] = {
     [ObjType_VNode_AARCH64_l0] = {
         [VNodeCmd_Map]   = handle_map,
         [VNodeCmd_Unmap] = handle_unmap,
+        [VNodeCmd_FlushRange] = handle_flush_range,
     },
     [ObjType_VNode_AARCH64_l1] = {
         [VNodeCmd_Map]   = handle_map,
@@ -1056,6 +1113,7 @@ static invocation_t invocations[ObjType_Num][CAP_MAX_CMD] = {
     },
     [ObjType_IPI] = {
         [IPICmd_Send_Start]  = monitor_spawn_core,
+        [IPICmd_Send_Notify] = handle_ipi_notify,
     },
     [ObjType_ID] = {
         [IDCmd_Identify] = handle_idcap_identify
@@ -297,9 +297,10 @@ cleanup_last(struct cte *cte, struct cte *ret_ram_cap)
     // When deleting the last copy of a mapping cap, destroy the mapping
     if (type_is_mapping(cte->cap.type)) {
         struct Frame_Mapping *mapping = &cte->cap.u.frame_mapping;
-        // Only if the ptable the mapping is pointing to is a vnode type
-        if (type_is_vnode(mapping->ptable->cap.type)) {
-            err = page_mappings_unmap(&mapping->ptable->cap, cte);
+        // Only if the mapping was not unmapped already, and the ptable the
+        // mapping is pointing to is a vnode type
+        if (mapping->ptable != NULL && type_is_vnode(mapping->ptable->cap.type)) {
+            err = page_mappings_unmap(&mapping->ptable->cap, cte, true);
             if (err_is_fail(err)) {
                 char buf[256];
                 sprint_cap(buf, 256, &cte->cap);
@@ -32,6 +32,7 @@
 #include <trace_definitions/trace_defs.h>
 #include <wakeup.h>
 #include <bitmacros.h>
+#include <memzero.h>
 
 // XXX: remove
 #pragma GCC diagnostic ignored "-Wsuggest-attribute=noreturn"
@@ -543,7 +544,7 @@ static errval_t caps_zero_objects(enum objtype type, lpaddr_t lpaddr,
         debug(SUBSYS_CAPS, "Frame: zeroing %zu bytes @%#"PRIxLPADDR"\n",
                 (size_t)objsize * count, lpaddr);
         TRACE(KERNEL, BZERO, 1);
-        memset((void*)lvaddr, 0, objsize * count);
+        memzero((void*)lvaddr, objsize * count);
         TRACE(KERNEL, BZERO, 0);
         break;
 
@@ -553,7 +554,7 @@ static errval_t caps_zero_objects(enum objtype type, lpaddr_t lpaddr,
                 type == ObjType_L1CNode ? 1 : 2, (size_t)objsize * count,
                 lpaddr);
         TRACE(KERNEL, BZERO, 1);
-        memset((void*)lvaddr, 0, objsize * count);
+        memzero((void*)lvaddr, objsize * count);
         TRACE(KERNEL, BZERO, 0);
         break;
 
@@ -582,7 +583,7 @@ static errval_t caps_zero_objects(enum objtype type, lpaddr_t lpaddr,
         debug(SUBSYS_CAPS, "VNode: zeroing %zu bytes @%#"PRIxLPADDR"\n",
                 (size_t)objsize * count, lpaddr);
         TRACE(KERNEL, BZERO, 1);
-        memset((void*)lvaddr, 0, objsize * count);
+        memzero((void*)lvaddr, objsize * count);
         TRACE(KERNEL, BZERO, 0);
         break;
 
@@ -590,7 +591,7 @@ static errval_t caps_zero_objects(enum objtype type, lpaddr_t lpaddr,
         debug(SUBSYS_CAPS, "Dispatcher: zeroing %zu bytes @%#"PRIxLPADDR"\n",
                 ((size_t) OBJSIZE_DISPATCHER) * count, lpaddr);
         TRACE(KERNEL, BZERO, 1);
-        memset((void*)lvaddr, 0, OBJSIZE_DISPATCHER * count);
+        memzero((void*)lvaddr, OBJSIZE_DISPATCHER * count);
         TRACE(KERNEL, BZERO, 0);
         break;
 
@@ -598,7 +599,7 @@ static errval_t caps_zero_objects(enum objtype type, lpaddr_t lpaddr,
         debug(SUBSYS_CAPS, "KCB: zeroing %zu bytes @%#"PRIxLPADDR"\n",
                 ((size_t) OBJSIZE_KCB) * count, lpaddr);
         TRACE(KERNEL, BZERO, 1);
-        memset((void*)lvaddr, 0, OBJSIZE_KCB * count);
+        memzero((void*)lvaddr, OBJSIZE_KCB * count);
         TRACE(KERNEL, BZERO, 0);
         break;
 
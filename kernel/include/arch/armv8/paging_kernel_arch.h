@@ -162,7 +162,8 @@ void paging_set_l3_entry(union armv8_ttable_entry *l3_entry, lpaddr_t pa, uintpt
 //
 //void paging_set_l3_entry(union armv8_ttable_entry *l2entry, lpaddr_t paddr, uintptr_t flags);
 //
-void paging_context_switch(lpaddr_t table_addr);
+struct dcb;
+void paging_context_switch(struct dcb *dcb);
 
 void paging_arm_reset(lpaddr_t paddr, size_t bytes);
 
@@ -183,21 +184,49 @@ static inline size_t get_pte_size(void) {
     return PTABLE_ENTRY_SIZE;
 }
 
+/// Ranges of more pages than this are flushed with the whole TLB instead
+#define ARMv8_TLB_FLUSH_MAX_PAGES 64
+
+/*
+ * User mappings are tagged with the ASID of their VSpace, and the kernel
+ * does not know which VSpace a table belongs to. The flushes below therefore
+ * drop the addresses from every ASID, and from the TLBs of all cores in the
+ * inner shareable domain.
+ */
+
 static inline void do_one_tlb_flush(genvaddr_t vaddr)
 {
-    // TODO: figure out selective flushing for ARMv8
-    sysreg_invalidate_tlb();
+    __asm volatile("dsb ishst\n"
+                   "tlbi vaae1is, %[page]\n"
+                   "dsb ish\n"
+                   "isb\n"
+                   : : [page] "r" ((vaddr >> BASE_PAGE_BITS) & MASK(44)) : "memory");
 }
 
-static inline void do_selective_tlb_flush(genvaddr_t vaddr, genvaddr_t vend)
+static inline void do_full_tlb_flush(void)
 {
-    // TODO: figure out selective flushing for ARMv8
-    sysreg_invalidate_tlb();
+    __asm volatile("dsb ishst\n"
+                   "tlbi vmalle1is\n"
+                   "dsb ish\n"
+                   "isb\n"
+                   : : : "memory");
 }
 
-static inline void do_full_tlb_flush(void)
+static inline void do_selective_tlb_flush(genvaddr_t vaddr, genvaddr_t vend)
 {
-    sysreg_invalidate_tlb();
+    if (vend - vaddr > ARMv8_TLB_FLUSH_MAX_PAGES * BASE_PAGE_SIZE) {
+        do_full_tlb_flush();
+        return;
+    }
+
+    __asm volatile("dsb ishst" : : : "memory");
+    for (genvaddr_t va = vaddr; va < vend; va += BASE_PAGE_SIZE) {
+        __asm volatile("tlbi vaae1is, %[page]"
+                       : : [page] "r" ((va >> BASE_PAGE_BITS) & MASK(44)));
+    }
+    __asm volatile("dsb ish\n"
+                   "isb\n"
+                   : : : "memory");
 }
 
 
@@ -42,6 +42,7 @@ struct dcb {
     bool                disabled;       ///< Was dispatcher disabled when last saved?
     struct cte          cspace;         ///< Cap slot for CSpace
     lpaddr_t            vspace;         ///< Address of VSpace root
+    uint64_t            asid;           ///< TLB tag of the VSpace and its generation, if any
     struct cte          disp_cte;
     unsigned int        faults_taken;   ///< # of disabled faults or traps taken
     /// Indicates whether this domain shall be executed in VM guest mode
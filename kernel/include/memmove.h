@@ -0,0 +1,25 @@
+/**
+ * \file
+ * \brief Generic memory copy
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __MEMMOVE_H
+#define __MEMMOVE_H
+
+#include <stddef.h>
+
+/**
+ * \brief The portable C memmove, even if the architecture overrides memmove
+ */
+void *memmove_generic(void *s1, const void *s2, size_t n);
+
+#endif // __MEMMOVE_H
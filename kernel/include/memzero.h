@@ -0,0 +1,27 @@
+/**
+ * \file
+ * \brief Bulk zeroing of kernel memory
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef __MEMZERO_H
+#define __MEMZERO_H
+
+#include <stddef.h>
+
+/**
+ * \brief Fills `n` bytes at `s` with zeros
+ *
+ * Architectures can override the generic version, which uses memset.
+ */
+void *memzero(void *s, size_t n);
+
+#endif // __MEMZERO_H
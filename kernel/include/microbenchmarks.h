@@ -13,6 +13,10 @@
 // The number of times the benchmark should run each instruction
 #define MICROBENCH_ITERATIONS 64
 
+// Size of the scratch memory the largest memory benchmarks need, smaller
+// buffers skip them
+#define MICROBENCH_BUFFER_SIZE (32UL << 20)
+
 struct microbench; // forward declaration
 
 /* function that executes a particular microbenchmark, storing its result
@@ -24,8 +28,12 @@ struct microbench {
     const char * NTS name;
     microbench_run_func run_func;
     uint64_t result;
+    size_t bytes;   ///< Bytes processed per iteration, 0 if result is in ticks
+    size_t repeat;  ///< Operations per iteration, set by the benchmark, 0 means 1
+    bool skipped;   ///< Set by the benchmark if the scratch memory is too small
 };
 
+void microbenchmarks_set_buffer(lvaddr_t base, size_t size);
 void microbenchmarks_run_all(void);
 
 extern struct microbench arch_benchmarks[];
@@ -9,9 +9,15 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <memmove.h>
 
 #define LOWBITS (sizeof(uintptr_t)-1)
 
+/*
+ * Architectures can override this with an optimized version. It stays
+ * reachable as memmove_generic, which the copy benchmarks compare against.
+ */
+__attribute__((weak))
 void *memmove(void *s1, const void *s2, size_t n)
 {
     uintptr_t from = (uintptr_t)s2;
@@ -83,3 +89,6 @@ void *memmove(void *s1, const void *s2, size_t n)
     }
     return s1;
 }
+
+void *memmove_generic(void *s1, const void *s2, size_t n)
+    __attribute__((alias("memmove")));
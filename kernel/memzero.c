@@ -0,0 +1,22 @@
+/**
+ * \file
+ * \brief Generic bulk zeroing of kernel memory
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <string.h>
+#include <memzero.h>
+
+__attribute__((weak))
+void *memzero(void *s, size_t n)
+{
+    return memset(s, 0, n);
+}
@@ -22,6 +22,17 @@
 #include <string.h>
 #include <microbenchmarks.h>
 #include <misc.h>
+#include <memzero.h>
+#include <memmove.h>
+#include <systime.h>
+
+/// Scratch memory for the memory benchmarks, provided by the architecture
+static lvaddr_t microbench_buffer;
+static size_t microbench_buffer_size;
+
+// Architectures without benchmarks of their own only run the generic ones
+__attribute__((weak)) struct microbench arch_benchmarks[0];
+__attribute__((weak)) size_t arch_benchmarks_size = 0;
 
 static uint64_t divide_round(uint64_t quotient, uint64_t divisor)
 {
@@ -35,10 +46,129 @@ static uint64_t divide_round(uint64_t quotient, uint64_t divisor)
 
 static int microbench_print(struct microbench *mb, char *buf, size_t len)
 {
+    if (mb->skipped) {
+        return snprintf(buf, len, "skipped, %zu KiB of scratch memory",
+                        microbench_buffer_size >> 10);
+    }
+    if (mb->bytes != 0) {
+        // result is the systime of all iterations, print GB/s with two decimals
+        uint64_t ns = systime_to_ns(mb->result);
+        uint64_t ops = MICROBENCH_ITERATIONS * (mb->repeat == 0 ? 1 : mb->repeat);
+        uint64_t mbps = ns == 0 ? 0 : divide_round(mb->bytes * ops * 1000, ns);
+        return snprintf(buf, len, "%" PRIu64 ".%02" PRIu64 " GB/s",
+                        mbps / 1000, (mbps % 1000) / 10);
+    }
     return snprintf(buf, len, "%" PRIu64 " ticks",
                     divide_round(mb->result, MICROBENCH_ITERATIONS));
 }
 
+static int memzero_bench(struct microbench *mb)
+{
+    mb->skipped = mb->bytes > microbench_buffer_size;
+    if (mb->skipped) {
+        return 0;
+    }
+
+    systime_t start = systime_now();
+    for (int i = 0; i < MICROBENCH_ITERATIONS; i++) {
+        memzero((void *)microbench_buffer, mb->bytes);
+    }
+    mb->result = systime_now() - start;
+    return 0;
+}
+
+static int memset_bench(struct microbench *mb)
+{
+    mb->skipped = mb->bytes > microbench_buffer_size;
+    if (mb->skipped) {
+        return 0;
+    }
+
+    systime_t start = systime_now();
+    for (int i = 0; i < MICROBENCH_ITERATIONS; i++) {
+        memset((void *)microbench_buffer, 0, mb->bytes);
+    }
+    mb->result = systime_now() - start;
+    return 0;
+}
+
+/// Short copies are repeated until an iteration copies at least this much
+#define COPY_BENCH_MIN_BYTES (1UL << 20)
+
+typedef void *(*copy_func)(void *, const void *, size_t);
+
+/**
+ * \brief Copies mb->bytes from the first to the second half of the buffer
+ */
+static int copy_bench(struct microbench *mb, copy_func copy)
+{
+    size_t half = ROUND_DOWN(microbench_buffer_size / 2, BASE_PAGE_SIZE);
+    mb->skipped = mb->bytes > half;
+    if (mb->skipped) {
+        return 0;
+    }
+
+    void *src = (void *)microbench_buffer;
+    void *dst = (void *)(microbench_buffer + half);
+    mb->repeat = mb->bytes < COPY_BENCH_MIN_BYTES
+                 ? COPY_BENCH_MIN_BYTES / mb->bytes : 1;
+
+    systime_t start = systime_now();
+    for (int i = 0; i < MICROBENCH_ITERATIONS; i++) {
+        for (size_t r = 0; r < mb->repeat; r++) {
+            copy(dst, src, mb->bytes);
+        }
+    }
+    mb->result = systime_now() - start;
+    return 0;
+}
+
+static int memcpy_bench(struct microbench *mb)
+{
+    return copy_bench(mb, memcpy);
+}
+
+static int memmove_bench(struct microbench *mb)
+{
+    return copy_bench(mb, memmove);
+}
+
+static int memmove_generic_bench(struct microbench *mb)
+{
+    return copy_bench(mb, memmove_generic);
+}
+
+static struct microbench memory_benchmarks[] = {
+    { .name = "memzero 4 KiB", .run_func = memzero_bench, .bytes = 4UL << 10 },
+    { .name = "memzero 2 MiB", .run_func = memzero_bench, .bytes = 2UL << 20 },
+    { .name = "memzero 32 MiB", .run_func = memzero_bench, .bytes = 32UL << 20 },
+    { .name = "memset 4 KiB", .run_func = memset_bench, .bytes = 4UL << 10 },
+    { .name = "memset 2 MiB", .run_func = memset_bench, .bytes = 2UL << 20 },
+    { .name = "memset 32 MiB", .run_func = memset_bench, .bytes = 32UL << 20 },
+    { .name = "memcpy 8 B", .run_func = memcpy_bench, .bytes = 8 },
+    { .name = "memcpy 64 B", .run_func = memcpy_bench, .bytes = 64 },
+    { .name = "memcpy 512 B", .run_func = memcpy_bench, .bytes = 512 },
+    { .name = "memcpy 4 KiB", .run_func = memcpy_bench, .bytes = 4UL << 10 },
+    { .name = "memcpy 64 KiB", .run_func = memcpy_bench, .bytes = 64UL << 10 },
+    { .name = "memcpy 2 MiB", .run_func = memcpy_bench, .bytes = 2UL << 20 },
+    { .name = "memcpy 16 MiB", .run_func = memcpy_bench, .bytes = 16UL << 20 },
+    { .name = "memmove 8 B", .run_func = memmove_bench, .bytes = 8 },
+    { .name = "memmove 64 B", .run_func = memmove_bench, .bytes = 64 },
+    { .name = "memmove 512 B", .run_func = memmove_bench, .bytes = 512 },
+    { .name = "memmove 4 KiB", .run_func = memmove_bench, .bytes = 4UL << 10 },
+    { .name = "memmove 64 KiB", .run_func = memmove_bench, .bytes = 64UL << 10 },
+    { .name = "memmove 2 MiB", .run_func = memmove_bench, .bytes = 2UL << 20 },
+    { .name = "memmove 16 MiB", .run_func = memmove_bench, .bytes = 16UL << 20 },
+    { .name = "memmove_generic 8 B", .run_func = memmove_generic_bench, .bytes = 8 },
+    { .name = "memmove_generic 64 B", .run_func = memmove_generic_bench, .bytes = 64 },
+    { .name = "memmove_generic 512 B", .run_func = memmove_generic_bench, .bytes = 512 },
+    { .name = "memmove_generic 4 KiB", .run_func = memmove_generic_bench, .bytes = 4UL << 10 },
+    { .name = "memmove_generic 64 KiB", .run_func = memmove_generic_bench, .bytes = 64UL << 10 },
+    { .name = "memmove_generic 2 MiB", .run_func = memmove_generic_bench, .bytes = 2UL << 20 },
+    { .name = "memmove_generic 16 MiB", .run_func = memmove_generic_bench, .bytes = 16UL << 20 },
+};
+#define MEMORY_BENCHMARKS_SIZE (sizeof(memory_benchmarks) / sizeof(memory_benchmarks[0]))
+
 static int microbenchmarks_run(struct microbench *benchs, size_t nbenchs)
 {
     for (size_t i = 0; i < nbenchs; i++) {
@@ -78,11 +208,32 @@ static int microbenchmarks_print_all(struct microbench *benchs, size_t nbenchs)
     return 0;
 }
 
+/**
+ * \brief Sets the scratch memory used by the memory benchmarks
+ *
+ * `size` bytes from `base` must be normal memory that nothing else uses while
+ * the benchmarks run. Benchmarks that need more than `size` bytes are
+ * skipped; MICROBENCH_BUFFER_SIZE bytes are enough for all of them.
+ */
+void microbenchmarks_set_buffer(lvaddr_t base, size_t size)
+{
+    microbench_buffer = base;
+    microbench_buffer_size = size;
+}
+
 void microbenchmarks_run_all(void)
 {
+    bool memory = microbench_buffer_size != 0;
+
     microbenchmarks_run(arch_benchmarks, arch_benchmarks_size);
+    if (memory) {
+        microbenchmarks_run(memory_benchmarks, MEMORY_BENCHMARKS_SIZE);
+    }
 
     printf("\n------------------------ Statistics ------------------------\n");
     microbenchmarks_print_all(arch_benchmarks, arch_benchmarks_size);
+    if (memory) {
+        microbenchmarks_print_all(memory_benchmarks, MEMORY_BENCHMARKS_SIZE);
+    }
     printf("------------------------------------------------------------\n\n");
 }
@@ -294,7 +294,15 @@ delete_mapping:
     return SYS_ERR_OK;
 }
 
-errval_t page_mappings_unmap(struct capability *pgtable, struct cte *mapping)
+/**
+ * \brief Clears the entries of a mapping and detaches the mapping cap from
+ *        the table, so deleting the cap later leaves the entries alone
+ *
+ * \param flush Whether to flush the TLB. Callers that unmap many mappings at
+ *        once pass false and flush the whole range afterwards.
+ */
+errval_t page_mappings_unmap(struct capability *pgtable, struct cte *mapping,
+                             bool flush)
 {
     assert(type_is_vnode(pgtable->type));
     assert(type_is_mapping(mapping->cap.type));
@@ -306,6 +314,10 @@ errval_t page_mappings_unmap(struct capability *pgtable, struct cte *mapping)
     if (!(pgtable->rights & CAPRIGHTS_WRITE)) {
         return SYS_ERR_DEST_CAP_RIGHTS;
     }
+    // The entries may have been reused since the mapping was unmapped
+    if (info->ptable == NULL || get_address(&info->ptable->cap) != get_address(pgtable)) {
+        return SYS_ERR_VNODE_NOT_INSTALLED;
+    }
 
     // calculate page table address
     lvaddr_t pt = local_phys_to_mem(gen_phys_to_local_phys(get_address(pgtable)));
@@ -334,11 +346,12 @@ errval_t page_mappings_unmap(struct capability *pgtable, struct cte *mapping)
     }
 
     do_unmap(pt, slot, info->pte_count);
+    info->ptable = NULL;
 
     // flush TLB for unmapped pages if we got a valid virtual address
     // TODO: heuristic that decides if selective or full flush is more
     //       efficient?
-    if (tlb_flush_necessary) {
+    if (tlb_flush_necessary && flush) {
         if (info->pte_count > 1 || err_is_fail(err)) {
             do_full_tlb_flush();
         } else {
@@ -358,6 +371,9 @@ errval_t paging_tlb_flush_range(struct cte *mapping_cte, size_t offset, size_t p
 
     // reconstruct first virtual address for TLB flushing
     struct cte *leaf_pt = mapping->ptable;
+    if (leaf_pt == NULL) {
+        return SYS_ERR_VNODE_NOT_INSTALLED;
+    }
     if (!type_is_vnode(leaf_pt->cap.type)) {
         return SYS_ERR_VNODE_TYPE;
     }
@@ -425,10 +441,11 @@ errval_t paging_tlb_flush_range(struct cte *mapping_cte, size_t offset, size_t p
             break;
     }
     assert(page_size);
-    // TODO: check what tlb flushing instructions expect for large/huge pages
-    for (int i = 0; i < pages; i++) {
+    // One flush for the whole range, rather than one per page
+    if (pages == 1) {
         do_one_tlb_flush(vaddr);
-        vaddr += page_size;
+    } else {
+        do_selective_tlb_flush(vaddr, vaddr + pages * page_size);
     }
 
     return SYS_ERR_OK;
@@ -118,7 +118,8 @@ memmove(void *dst, const void *src, size_t sz)
 }
 #endif
 
-void *
+// Architectures can override this with an optimized version
+__attribute__((weak)) void *
 memcpy(void *dst, const void *src, size_t len)
 {
     char *d = dst;
@@ -113,6 +113,7 @@ sys_dispatcher_setup(struct capability *to, capaddr_t cptr, uint8_t level,
         return SYSRET(SYS_ERR_DISP_VSPACE_INVALID);
     }
     dcb->vspace = gen_phys_to_local_phys(get_address(vroot));
+    dcb->asid = 0;
 
     /* 3. set dispatcher frame pointer */
     struct cte *dispcte;
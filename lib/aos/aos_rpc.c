@@ -1,6 +1,18 @@
 /**
  * \file
  * \brief RPC Bindings for AOS
+ *
+ * Calls and replies are tagged with an ID, so that a client can have many
+ * calls in flight on one channel and the server can answer them in any
+ * order. Client threads that wait for a reply take turns at receiving: one
+ * thread dispatches the channel's waitset at a time, hands each reply to
+ * the call with its ID, and wakes the others when a call completes.
+ *
+ * Large strings and arrays do not go through the kernel word by word. Each
+ * side of a channel owns a pool of buffers in a frame that it shares with
+ * the other side (see aos/shm.h). The data is copied into as many buffers
+ * as it takes, and for each buffer one fragment tells the peer to take the
+ * next one off the ring.
  */
 
 /*
@@ -14,62 +26,1033 @@
 
 #include <aos/aos.h>
 #include <aos/aos_rpc.h>
+#include <mm/mm.h>
+
+#define AOS_RPC_FLAG_REPLY      0x1     ///< The message answers a call
+#define AOS_RPC_FLAG_FRAGMENT   0x2     ///< The message continues the bulk data of a call
+#define AOS_RPC_FLAG_SHM        0x4     ///< The bulk data is in the shared buffers
+
+/// Bytes of bulk data in one fragment
+#define AOS_RPC_MSG_BYTES       (AOS_RPC_MSG_WORDS * sizeof(uintptr_t))
+
+/// Calls of aos_rpc_get_ram_caps in flight at once
+#define AOS_RPC_RAM_CAPS_WINDOW 16
+
+static inline uintptr_t aos_rpc_header(uint8_t type, uint8_t flags, uint16_t id,
+                                       uint32_t bulk_size)
+{
+    return type | (uintptr_t)flags << 8 | (uintptr_t)id << 16 | (uintptr_t)bulk_size << 32;
+}
+
+static inline uint8_t aos_rpc_header_type(uintptr_t header)
+{
+    return header & 0xff;
+}
+
+static inline uint8_t aos_rpc_header_flags(uintptr_t header)
+{
+    return (header >> 8) & 0xff;
+}
+
+static inline uint16_t aos_rpc_header_id(uintptr_t header)
+{
+    return (header >> 16) & 0xffff;
+}
+
+static inline uint32_t aos_rpc_header_bulk_size(uintptr_t header)
+{
+    return header >> 32;
+}
+
+static void aos_rpc_recv_handler(void *arg);
+
+/**
+ * \brief Receives on the client waitset, unless another thread already does
+ *
+ * Called and returns with rpc->mutex held. If another thread receives and
+ * `block` is set, waits until that thread hands over.
+ */
+static errval_t aos_rpc_dispatch(struct aos_rpc *rpc, bool block)
+{
+    errval_t err;
+
+    if (rpc->receiving) {
+        if (block) {
+            thread_cond_wait(&rpc->cond, &rpc->mutex);
+        }
+        return SYS_ERR_OK;
+    }
+
+    rpc->receiving = true;
+    thread_mutex_unlock(&rpc->mutex);
+    err = block ? event_dispatch(rpc->ws) : event_dispatch_non_block(rpc->ws);
+    if (err_no(err) == LIB_ERR_NO_EVENT) {
+        err = SYS_ERR_OK;
+    }
+    thread_mutex_lock(&rpc->mutex);
+    rpc->receiving = false;
+    thread_cond_broadcast(&rpc->cond);
 
+    // a refill of the slot allocator may call back into this channel, which
+    // works only once this thread no longer counts as the receiver
+    if (rpc->recv_slot_needed) {
+        rpc->recv_slot_needed = false;
+        thread_mutex_unlock(&rpc->mutex);
+        errval_t slot_err = lmp_chan_alloc_recv_slot(&rpc->chan);
+        thread_mutex_lock(&rpc->mutex);
+        if (err_is_fail(slot_err)) {
+            err = err_push(slot_err, LIB_ERR_LMP_ALLOC_RECV_SLOT);
+        }
+    }
+    return err;
+}
+
+/**
+ * \brief Lets the peer make progress while this side cannot send
+ */
+static void aos_rpc_poll(struct aos_rpc *rpc)
+{
+    if (rpc->handler == NULL) {
+        // the peer may be stuck sending replies to this client
+        thread_mutex_lock(&rpc->mutex);
+        aos_rpc_dispatch(rpc, false);
+        thread_mutex_unlock(&rpc->mutex);
+    }
+    thread_yield();
+}
+
+/**
+ * \brief Sends one message, retrying while the peer's endpoint is full
+ */
+static errval_t aos_rpc_send_msg(struct aos_rpc *rpc, uintptr_t header, uintptr_t w1,
+                                 uintptr_t w2, uintptr_t w3, struct capref cap,
+                                 bool give_cap)
+{
+    errval_t err;
+    lmp_send_flags_t flags = LMP_SEND_FLAGS_DEFAULT;
+    if (give_cap) {
+        flags |= LMP_FLAG_GIVEAWAY;
+    }
+
+    if (rpc->transport == AOS_RPC_UMP) {
+        if (!capref_is_null(cap)) {
+            return LIB_ERR_RPC_NO_CAP_TRANSFER;
+        }
+        uint64_t words[UMP_MSG_WORDS] = { header, w1, w2, w3 };
+        while (true) {
+            // the ring has a single producer
+            thread_mutex_lock(&rpc->mutex);
+            err = ump_chan_send(&rpc->ump, words);
+            thread_mutex_unlock(&rpc->mutex);
+            if (err_no(err) != LIB_ERR_UMP_CHAN_FULL) {
+                return err;
+            }
+            aos_rpc_poll(rpc);
+        }
+    }
+
+    while (true) {
+        err = lmp_chan_send4(&rpc->chan, flags, cap, header, w1, w2, w3);
+        if (!lmp_err_is_transient(err)) {
+            break;
+        }
+        aos_rpc_poll(rpc);
+    }
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_LMP_CHAN_SEND);
+    }
+    return SYS_ERR_OK;
+}
 
+/**
+ * \brief Sends bulk data through the shared buffers, one fragment per buffer
+ */
+static errval_t aos_rpc_send_shared(struct aos_rpc *rpc, uintptr_t header,
+                                    const void *bulk, size_t bulk_size)
+{
+    errval_t err;
+
+    size_t offset = 0;
+    while (offset < bulk_size) {
+        size_t idx;
+        void *buf;
+        thread_mutex_lock(&rpc->bulk_mutex);
+        err = shm_buf_alloc(&rpc->bulk_tx, &idx, &buf);
+        if (err_no(err) == BULK_TRANSFER_NO_BUFFER) {
+            // the peer releases buffers as it receives their fragments
+            thread_mutex_unlock(&rpc->bulk_mutex);
+            aos_rpc_poll(rpc);
+            continue;
+        }
+        if (err_is_ok(err)) {
+            size_t len = MIN(bulk_size - offset, rpc->bulk_tx.buf_size);
+            memcpy(buf, (const char *)bulk + offset, len);
+            offset += len;
+            // the ring and the fragments must stay in the same order, so
+            // other threads only get the buffers once the fragment is out
+            err = shm_buf_send(&rpc->bulk_tx, idx, len);
+            if (err_is_ok(err)) {
+                err = aos_rpc_send_msg(rpc, header, 0, 0, 0, NULL_CAP, false);
+            }
+        }
+        thread_mutex_unlock(&rpc->bulk_mutex);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Sends the first message of a call or reply, and its bulk data
+ */
+static errval_t aos_rpc_send(struct aos_rpc *rpc, uint8_t type, uint8_t flags, uint16_t id,
+                             uintptr_t w1, uintptr_t w2, uintptr_t w3,
+                             struct capref cap, bool give_cap,
+                             const void *bulk, size_t bulk_size)
+{
+    errval_t err;
 
+    if (bulk_size > AOS_RPC_BULK_MAX) {
+        return LIB_ERR_RPC_INVALID_MSG;
+    }
 
+    if (bulk_size >= rpc->bulk_threshold
+        && __atomic_load_n(&rpc->bulk_ready, __ATOMIC_ACQUIRE)) {
+        flags |= AOS_RPC_FLAG_SHM;
+    }
 
+    err = aos_rpc_send_msg(rpc, aos_rpc_header(type, flags, id, bulk_size),
+                           w1, w2, w3, cap, give_cap);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    flags |= AOS_RPC_FLAG_FRAGMENT;
+    if (flags & AOS_RPC_FLAG_SHM) {
+        return aos_rpc_send_shared(rpc, aos_rpc_header(type, flags, id, bulk_size),
+                                   bulk, bulk_size);
+    }
+    for (size_t offset = 0; offset < bulk_size; offset += AOS_RPC_MSG_BYTES) {
+        uintptr_t words[AOS_RPC_MSG_WORDS] = { 0 };
+        memcpy(words, (const char *)bulk + offset, MIN(bulk_size - offset, AOS_RPC_MSG_BYTES));
+        err = aos_rpc_send_msg(rpc, aos_rpc_header(type, flags, id, bulk_size),
+                               words[0], words[1], words[2], NULL_CAP, false);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Prepares the bulk buffer for `bulk_size` bytes announced by a header
+ *
+ * If there is no memory, the fragments are still counted, but dropped.
+ */
+static void aos_rpc_bulk_init(void **bulk, size_t *size, size_t *received,
+                              uintptr_t header)
+{
+    *size = aos_rpc_header_bulk_size(header);
+    *received = 0;
+    *bulk = *size > 0 && *size <= AOS_RPC_BULK_MAX ? malloc(*size) : NULL;
+}
+
+/**
+ * \brief Appends the payload of a fragment to a bulk buffer
+ *
+ * The payload is in the words of the fragment, or in the next shared buffer.
+ * If the shared buffer is broken, the bulk data counts as complete.
+ */
+static errval_t aos_rpc_bulk_append(struct aos_rpc *rpc, void *bulk, size_t size,
+                                    size_t *received, struct lmp_recv_msg *msg)
+{
+    errval_t err;
+
+    if (!(aos_rpc_header_flags(msg->words[0]) & AOS_RPC_FLAG_SHM)) {
+        size_t bytes = MIN(size - *received, AOS_RPC_MSG_BYTES);
+        if (bulk != NULL) {
+            memcpy((char *)bulk + *received, &msg->words[1], bytes);
+        }
+        *received += bytes;
+        return SYS_ERR_OK;
+    }
+
+    size_t idx, len;
+    void *buf;
+    if (rpc->bulk_rx.header == NULL) {
+        err = LIB_ERR_RPC_INVALID_MSG;
+    } else {
+        err = shm_buf_recv(&rpc->bulk_rx, &idx, &buf, &len);
+    }
+    if (err_is_ok(err) && (len == 0 || len > size - *received)) {
+        shm_buf_release(&rpc->bulk_rx, idx);
+        err = LIB_ERR_RPC_INVALID_MSG;
+    }
+    if (err_is_fail(err)) {
+        *received = size;
+        return err;
+    }
+
+    if (bulk != NULL) {
+        memcpy((char *)bulk + *received, buf, len);
+    }
+    *received += len;
+    return shm_buf_release(&rpc->bulk_rx, idx);
+}
+
+/**
+ * \brief Drops a fragment that belongs to no call, and frees its shared buffer
+ */
+static void aos_rpc_bulk_drop(struct aos_rpc *rpc, struct lmp_recv_msg *msg)
+{
+    if (aos_rpc_header_flags(msg->words[0]) & AOS_RPC_FLAG_FRAGMENT) {
+        size_t received = 0;
+        aos_rpc_bulk_append(rpc, NULL, AOS_RPC_BULK_MAX, &received, msg);
+    }
+}
+
+/// Called with rpc->mutex held
+static void aos_rpc_handle_reply(struct aos_rpc *rpc, struct lmp_recv_msg *msg,
+                                 struct capref cap)
+{
+    uintptr_t header = msg->words[0];
+    uint16_t id = aos_rpc_header_id(header);
+
+    struct aos_rpc_call **prev = &rpc->calls;
+    while (*prev != NULL && (*prev)->id != id) {
+        prev = &(*prev)->next;
+    }
+    struct aos_rpc_call *call = *prev;
+    if (call == NULL || call->type != aos_rpc_header_type(header)) {
+        DEBUG_ERR(LIB_ERR_RPC_UNKNOWN_CALL, "aos_rpc: reply with ID %u", id);
+        if (!capref_is_null(cap)) {
+            cap_destroy(cap);
+        }
+        aos_rpc_bulk_drop(rpc, msg);
+        return;
+    }
+
+    if (aos_rpc_header_flags(header) & AOS_RPC_FLAG_FRAGMENT) {
+        errval_t err = aos_rpc_bulk_append(rpc, call->bulk, call->bulk_size,
+                                           &call->bulk_received, msg);
+        if (err_is_fail(err) && err_is_ok(call->err)) {
+            call->err = err;
+        }
+    } else {
+        call->err = msg->words[1];
+        memcpy(call->words, &msg->words[2], sizeof(call->words));
+        call->cap = cap;
+        aos_rpc_bulk_init(&call->bulk, &call->bulk_size, &call->bulk_received, header);
+    }
+
+    if (call->bulk_received == call->bulk_size) {
+        if (call->bulk == NULL && call->bulk_size > 0 && err_is_ok(call->err)) {
+            call->err = LIB_ERR_MALLOC_FAIL;
+        }
+        call->done = true;
+        *prev = call->next;
+        thread_cond_broadcast(&rpc->cond);
+    }
+}
+
+/// Called with rpc->mutex held, returns a request once it is complete
+static struct aos_rpc_request *aos_rpc_handle_request(struct aos_rpc *rpc,
+                                                      struct lmp_recv_msg *msg,
+                                                      struct capref cap)
+{
+    uintptr_t header = msg->words[0];
+    uint16_t id = aos_rpc_header_id(header);
+    struct aos_rpc_request *req;
+
+    if (aos_rpc_header_flags(header) & AOS_RPC_FLAG_FRAGMENT) {
+        struct aos_rpc_request **prev = &rpc->requests;
+        while (*prev != NULL && (*prev)->id != id) {
+            prev = &(*prev)->next;
+        }
+        req = *prev;
+        if (req == NULL) {
+            DEBUG_ERR(LIB_ERR_RPC_INVALID_MSG, "aos_rpc: fragment of unknown call %u", id);
+            aos_rpc_bulk_drop(rpc, msg);
+            return NULL;
+        }
+        errval_t err = aos_rpc_bulk_append(rpc, req->bulk, req->bulk_size,
+                                           &req->bulk_received, msg);
+        if (err_is_fail(err) && err_is_ok(req->err)) {
+            req->err = err;
+        }
+        if (req->bulk_received < req->bulk_size) {
+            return NULL;
+        }
+        *prev = req->next;
+    } else {
+        req = calloc(1, sizeof(*req));
+        if (req == NULL) {
+            DEBUG_ERR(LIB_ERR_MALLOC_FAIL, "aos_rpc: dropping call %u", id);
+            if (!capref_is_null(cap)) {
+                cap_destroy(cap);
+            }
+            return NULL;
+        }
+        req->id = id;
+        req->type = aos_rpc_header_type(header);
+        memcpy(req->words, &msg->words[1], sizeof(req->words));
+        req->cap = cap;
+        aos_rpc_bulk_init(&req->bulk, &req->bulk_size, &req->bulk_received, header);
+        if (req->bulk_size > AOS_RPC_BULK_MAX) {
+            req->err = LIB_ERR_RPC_INVALID_MSG;
+        }
+        if (req->bulk_received < req->bulk_size) {
+            req->next = rpc->requests;
+            rpc->requests = req;
+            return NULL;
+        }
+    }
+
+    if (req->bulk == NULL && req->bulk_size > 0 && err_is_ok(req->err)) {
+        req->err = LIB_ERR_MALLOC_FAIL;
+    }
+    return req;
+}
+
+/**
+ * \brief Serves the two calls of aos_rpc_bulk_setup() on the server side
+ *
+ * The first call carries the client's frame and is answered with this
+ * side's. The second one tells that the client has mapped it.
+ */
+static void aos_rpc_bulk_accept(struct aos_rpc *rpc, struct aos_rpc_request *req)
+{
+    errval_t err = req->err;
+    struct capref frame = NULL_CAP;
+
+    if (err_is_fail(err)) {
+        // nothing to set up
+    } else if (capref_is_null(req->cap)) {
+        if (rpc->bulk_tx.header == NULL) {
+            err = LIB_ERR_RPC_INVALID_MSG;
+        } else {
+            __atomic_store_n(&rpc->bulk_ready, true, __ATOMIC_RELEASE);
+        }
+    } else if (rpc->bulk_rx.header != NULL) {
+        err = LIB_ERR_RPC_INVALID_MSG;
+    } else {
+        err = shm_attach(&rpc->bulk_rx, req->cap);
+        if (err_is_ok(err)) {
+            req->cap = NULL_CAP;
+            err = shm_create(&rpc->bulk_tx, AOS_RPC_SHM_BUF_SIZE, AOS_RPC_SHM_BUF_COUNT);
+            if (err_is_ok(err)) {
+                frame = rpc->bulk_tx.frame;
+            } else {
+                shm_destroy(&rpc->bulk_rx);
+            }
+        }
+    }
+
+    if (!capref_is_null(req->cap)) {
+        cap_destroy(req->cap);
+    }
+    err = aos_rpc_reply(rpc, req, err, 0, 0, frame, false, NULL, 0);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "aos_rpc: reply to bulk setup");
+    }
+}
+
+static errval_t aos_rpc_register_recv(struct aos_rpc *rpc)
+{
+    struct event_closure closure = MKCLOSURE(aos_rpc_recv_handler, rpc);
+    if (rpc->transport == AOS_RPC_UMP) {
+        return ump_chan_register_recv(&rpc->ump, rpc->ws, closure);
+    }
+    return lmp_chan_register_recv(&rpc->chan, rpc->ws, closure);
+}
+
+static void aos_rpc_recv_handler(void *arg)
+{
+    struct aos_rpc *rpc = arg;
+    errval_t err;
+
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    struct capref cap = NULL_CAP;
+    if (rpc->transport == AOS_RPC_UMP) {
+        uint64_t words[UMP_MSG_WORDS];
+        err = ump_chan_recv(&rpc->ump, words);
+        if (err_is_ok(err)) {
+            // the RPC layer uses the first words of a slot only
+            msg.buf.msglen = LMP_MSG_LENGTH;
+            memcpy(msg.words, words, sizeof(msg.words));
+        } else if (err_no(err) != LIB_ERR_NO_UMP_MSG) {
+            DEBUG_ERR(err, "aos_rpc: ump_chan_recv");
+        }
+    } else {
+        err = lmp_chan_recv(&rpc->chan, &msg, &cap);
+        if (err_is_fail(err) && !lmp_err_is_transient(err)
+            && err_no(err) != LIB_ERR_NO_LMP_MSG) {
+            DEBUG_ERR(err, "aos_rpc: lmp_chan_recv");
+        }
+    }
+
+    struct aos_rpc_request *req = NULL;
+    thread_mutex_lock(&rpc->mutex);
+    if (err_is_ok(err) && !capref_is_null(cap)) {
+        if (rpc->receiving) {
+            rpc->recv_slot_needed = true;
+        } else {
+            err = lmp_chan_alloc_recv_slot(&rpc->chan);
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "aos_rpc: lmp_chan_alloc_recv_slot");
+            }
+            err = SYS_ERR_OK;
+        }
+    }
+    if (err_is_ok(err)) {
+        if (msg.buf.msglen != LMP_MSG_LENGTH) {
+            DEBUG_ERR(LIB_ERR_RPC_INVALID_MSG, "aos_rpc: message of %zu words",
+                      msg.buf.msglen);
+        } else if (aos_rpc_header_flags(msg.words[0]) & AOS_RPC_FLAG_REPLY) {
+            aos_rpc_handle_reply(rpc, &msg, cap);
+        } else if (rpc->handler != NULL) {
+            req = aos_rpc_handle_request(rpc, &msg, cap);
+        } else {
+            DEBUG_ERR(LIB_ERR_RPC_NOT_SUPPORTED, "aos_rpc: call to a client");
+        }
+    }
+    thread_mutex_unlock(&rpc->mutex);
+
+    err = aos_rpc_register_recv(rpc);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "aos_rpc: register_recv");
+    }
+
+    if (req != NULL && req->type == AOS_RPC_BULK_SETUP) {
+        aos_rpc_bulk_accept(rpc, req);
+    } else if (req != NULL) {
+        rpc->handler(rpc, req);
+    }
+}
+
+/**
+ * \brief Initialize an aos_rpc struct.
+ */
+errval_t aos_rpc_init(struct aos_rpc *rpc)
+{
+    memset(rpc, 0, sizeof(*rpc));
+    lmp_chan_init(&rpc->chan);
+    waitset_init(&rpc->own_ws);
+    rpc->ws = &rpc->own_ws;
+    thread_mutex_init(&rpc->mutex);
+    thread_cond_init(&rpc->cond);
+    thread_mutex_init(&rpc->bulk_mutex);
+    rpc->bulk_threshold = AOS_RPC_SHM_THRESHOLD;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Creates the endpoint of `rpc` in `slot` and starts receiving on it
+ *
+ * On failure, `slot` is left empty.
+ */
+static errval_t aos_rpc_setup(struct aos_rpc *rpc, struct capref slot,
+                              aos_rpc_handler_t handler, struct waitset *ws)
+{
+    errval_t err;
+
+    rpc->handler = handler;
+    if (ws != NULL) {
+        rpc->ws = ws;
+    }
+
+    rpc->chan.local_cap = slot;
+    err = lmp_endpoint_create_in_slot(AOS_RPC_BUF_MSGS * LMP_RECV_LENGTH, slot,
+                                      &rpc->chan.endpoint);
+    if (err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_ENDPOINT_CREATE);
+        goto free_endpoint;
+    }
+
+    err = lmp_chan_alloc_recv_slot(&rpc->chan);
+    if (err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_LMP_ALLOC_RECV_SLOT);
+        goto delete_endpoint;
+    }
+
+    err = aos_rpc_register_recv(rpc);
+    if (err_is_fail(err)) {
+        slot_free(rpc->chan.endpoint->recv_slot);
+        err = err_push(err, LIB_ERR_CHAN_REGISTER_RECV);
+        goto delete_endpoint;
+    }
+    return SYS_ERR_OK;
+
+    // Leave `slot` empty, the caller owns it
+delete_endpoint:
+    cap_delete(slot);
+free_endpoint:
+    if (rpc->chan.endpoint != NULL) {
+        lmp_endpoint_free(rpc->chan.endpoint);
+        rpc->chan.endpoint = NULL;
+    }
+    return err;
+}
+
+/**
+ * \brief Binds a client channel to the server listening on `server_ep`
+ *
+ * Sends a new endpoint of this domain to the server, which answers with an
+ * endpoint of the channel it set up for this client.
+ */
+errval_t aos_rpc_bind(struct aos_rpc *rpc, struct capref server_ep)
+{
+    errval_t err;
+
+    err = aos_rpc_init(rpc);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    struct capref slot;
+    err = slot_alloc(&slot);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_SLOT_ALLOC);
+    }
+    err = aos_rpc_setup(rpc, slot, NULL, NULL);
+    if (err_is_fail(err)) {
+        slot_free(slot);
+        return err_push(err, LIB_ERR_RPC_BIND);
+    }
+
+    rpc->chan.remote_cap = server_ep;
+    struct aos_rpc_call call;
+    err = aos_rpc_call_start(rpc, &call, AOS_RPC_BIND, 0, 0, 0, rpc->chan.local_cap,
+                             NULL, 0);
+    if (err_is_ok(err)) {
+        err = aos_rpc_call_wait(rpc, &call);
+    }
+    if (err_is_ok(err) && capref_is_null(call.cap)) {
+        err = LIB_ERR_RPC_INVALID_MSG;
+    }
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_RPC_BIND);
+    }
+
+    rpc->chan.remote_cap = call.cap;
+    rpc->chan.connstate = LMP_CONNECTED;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Listens for AOS_RPC_BIND calls on a new endpoint in `slot`
+ *
+ * `handler` answers each bind with aos_rpc_accept() and a reply on the new
+ * channel, which carries that channel's endpoint.
+ */
+errval_t aos_rpc_listen(struct aos_rpc *rpc, struct capref slot,
+                        aos_rpc_handler_t handler, struct waitset *ws)
+{
+    errval_t err;
+
+    err = aos_rpc_init(rpc);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    return aos_rpc_setup(rpc, slot, handler, ws);
+}
+
+/**
+ * \brief Sets up the server side of a channel to the client endpoint `client_ep`
+ */
+errval_t aos_rpc_accept(struct aos_rpc *rpc, struct capref client_ep,
+                        aos_rpc_handler_t handler, struct waitset *ws)
+{
+    errval_t err;
+
+    err = aos_rpc_init(rpc);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    struct capref slot;
+    err = slot_alloc(&slot);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_SLOT_ALLOC);
+    }
+    err = aos_rpc_setup(rpc, slot, handler, ws);
+    if (err_is_fail(err)) {
+        slot_free(slot);
+        return err_push(err, LIB_ERR_LMP_CHAN_ACCEPT);
+    }
+
+    rpc->chan.remote_cap = client_ep;
+    rpc->chan.connstate = LMP_CONNECTED;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Sets up one side of a binding over UMP, in a frame both sides have mapped
+ *
+ * There is no bind call: the two sides agree on the frame, and on which of
+ * them is `first`, beforehand, for instance through the URPC frame of a
+ * core. The frame must be zeroed before either side starts. Waiting for
+ * messages polls the ring; ump_chan_set_adaptive() on rpc->ump lets it block
+ * on the doorbell instead after a while.
+ *
+ * \param handler  Handler of a server, or NULL for a client
+ * \param ws       Waitset of a server, or NULL for a client
+ */
+errval_t aos_rpc_ump_init(struct aos_rpc *rpc, void *buf, size_t bytes, bool first,
+                          aos_rpc_handler_t handler, struct waitset *ws)
+{
+    errval_t err;
+
+    err = aos_rpc_init(rpc);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    rpc->transport = AOS_RPC_UMP;
+    rpc->handler = handler;
+    if (ws != NULL) {
+        rpc->ws = ws;
+    }
+    // setting up the shared buffers takes capabilities
+    rpc->bulk_threshold = SIZE_MAX;
+
+    err = ump_chan_init(&rpc->ump, buf, bytes, first);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_UMP_CHAN_INIT);
+    }
+
+    err = aos_rpc_register_recv(rpc);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_CHAN_REGISTER_RECV);
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Sets up the shared buffers of a client channel
+ *
+ * Called on the first call with large bulk data. A client that expects large
+ * replies may call it earlier. If the setup fails, the channel keeps copying
+ * all bulk data into fragments.
+ */
+errval_t aos_rpc_bulk_setup(struct aos_rpc *rpc)
+{
+    errval_t err;
+    struct aos_rpc_call call;
+
+    if (rpc->handler != NULL) {
+        return LIB_ERR_RPC_NOT_SUPPORTED;
+    }
+
+    thread_mutex_lock(&rpc->bulk_mutex);
+    if (rpc->bulk_ready || rpc->bulk_threshold == SIZE_MAX) {
+        thread_mutex_unlock(&rpc->bulk_mutex);
+        return rpc->bulk_ready ? SYS_ERR_OK : LIB_ERR_RPC_NOT_SUPPORTED;
+    }
+
+    err = shm_create(&rpc->bulk_tx, AOS_RPC_SHM_BUF_SIZE, AOS_RPC_SHM_BUF_COUNT);
+    if (err_is_ok(err)) {
+        err = aos_rpc_call_start(rpc, &call, AOS_RPC_BULK_SETUP, 0, 0, 0,
+                                 rpc->bulk_tx.frame, NULL, 0);
+        if (err_is_ok(err)) {
+            err = aos_rpc_call_wait(rpc, &call);
+        }
+        if (err_is_ok(err) && capref_is_null(call.cap)) {
+            err = LIB_ERR_RPC_INVALID_MSG;
+        }
+        if (err_is_ok(err)) {
+            err = shm_attach(&rpc->bulk_rx, call.cap);
+            if (err_is_fail(err)) {
+                cap_destroy(call.cap);
+            }
+        }
+        if (err_is_ok(err)) {
+            err = aos_rpc_call_start(rpc, &call, AOS_RPC_BULK_SETUP, 0, 0, 0, NULL_CAP,
+                                     NULL, 0);
+            if (err_is_ok(err)) {
+                err = aos_rpc_call_wait(rpc, &call);
+            }
+            if (err_is_fail(err)) {
+                shm_destroy(&rpc->bulk_rx);
+            }
+        }
+        if (err_is_fail(err)) {
+            shm_destroy(&rpc->bulk_tx);
+        }
+    }
+
+    if (err_is_ok(err)) {
+        __atomic_store_n(&rpc->bulk_ready, true, __ATOMIC_RELEASE);
+    } else {
+        // the server may hold on to half of the setup, do not try again
+        rpc->bulk_threshold = SIZE_MAX;
+    }
+    thread_mutex_unlock(&rpc->bulk_mutex);
+    return err;
+}
+
+/**
+ * \brief Sends a call without waiting for the reply
+ *
+ * \param call       Filled in with the reply, stays in use until aos_rpc_call_wait()
+ * \param arg1..3    Arguments of the call
+ * \param cap        Capability sent along, or NULL_CAP
+ * \param bulk       String or array sent along, `bulk_size` bytes
+ */
+errval_t aos_rpc_call_start(struct aos_rpc *rpc, struct aos_rpc_call *call,
+                            enum aos_rpc_msg_type type, uintptr_t arg1, uintptr_t arg2,
+                            uintptr_t arg3, struct capref cap, const void *bulk,
+                            size_t bulk_size)
+{
+    errval_t err;
+
+    if (bulk_size >= rpc->bulk_threshold && rpc->handler == NULL
+        && !__atomic_load_n(&rpc->bulk_ready, __ATOMIC_ACQUIRE)) {
+        // without the shared buffers the data goes into fragments
+        aos_rpc_bulk_setup(rpc);
+    }
+
+    memset(call, 0, sizeof(*call));
+    call->type = type;
+    call->cap = NULL_CAP;
+
+    thread_mutex_lock(&rpc->mutex);
+    call->id = rpc->next_id++;
+    call->next = rpc->calls;
+    rpc->calls = call;
+    thread_mutex_unlock(&rpc->mutex);
+
+    err = aos_rpc_send(rpc, type, 0, call->id, arg1, arg2, arg3, cap, false,
+                       bulk, bulk_size);
+    if (err_is_fail(err)) {
+        thread_mutex_lock(&rpc->mutex);
+        struct aos_rpc_call **prev = &rpc->calls;
+        while (*prev != call) {
+            prev = &(*prev)->next;
+        }
+        *prev = call->next;
+        thread_mutex_unlock(&rpc->mutex);
+    }
+    return err;
+}
+
+/**
+ * \brief Waits for the reply to a call started with aos_rpc_call_start()
+ *
+ * \return The error of the transfer, or the one the server returned.
+ */
+errval_t aos_rpc_call_wait(struct aos_rpc *rpc, struct aos_rpc_call *call)
+{
+    errval_t err = SYS_ERR_OK;
+
+    thread_mutex_lock(&rpc->mutex);
+    while (!call->done && err_is_ok(err)) {
+        err = aos_rpc_dispatch(rpc, true);
+    }
+    if (!call->done) {
+        // the channel is broken, the reply will not come
+        struct aos_rpc_call **prev = &rpc->calls;
+        while (*prev != call) {
+            prev = &(*prev)->next;
+        }
+        *prev = call->next;
+    }
+    thread_mutex_unlock(&rpc->mutex);
+
+    return call->done ? call->err : err;
+}
+
+/**
+ * \brief Answers a request and frees it
+ *
+ * \param err        Error the client's call returns
+ * \param res1, res2 Results of the call
+ * \param cap        Capability sent along, or NULL_CAP
+ * \param give_cap   Whether to delete this domain's copy of `cap` once sent
+ * \param bulk       String or array sent along, `bulk_size` bytes
+ */
+errval_t aos_rpc_reply(struct aos_rpc *rpc, struct aos_rpc_request *req, errval_t err,
+                       uintptr_t res1, uintptr_t res2, struct capref cap, bool give_cap,
+                       const void *bulk, size_t bulk_size)
+{
+    errval_t send_err = aos_rpc_send(rpc, req->type, AOS_RPC_FLAG_REPLY, req->id, err,
+                                     res1, res2, cap, give_cap, bulk, bulk_size);
+    free(req->bulk);
+    free(req);
+    return send_err;
+}
+
+/**
+ * \brief Answers a request with `err` on the endpoint `ep` and frees it
+ *
+ * Unlike aos_rpc_reply(), this leaves the channel the request came in on
+ * alone. A listener has no peer, so the server answers a failed bind on the
+ * endpoint the bind carries.
+ */
+errval_t aos_rpc_reply_error(struct capref ep, struct aos_rpc_request *req, errval_t err)
+{
+    errval_t send_err = lmp_ep_send4(ep, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+                                     aos_rpc_header(req->type, AOS_RPC_FLAG_REPLY, req->id, 0),
+                                     err, 0, 0);
+    free(req->bulk);
+    free(req);
+    if (err_is_fail(send_err)) {
+        return err_push(send_err, LIB_ERR_LMP_CHAN_SEND);
+    }
+    return SYS_ERR_OK;
+}
+
+/// Runs a call to completion
+static errval_t aos_rpc_call(struct aos_rpc *rpc, struct aos_rpc_call *call,
+                             enum aos_rpc_msg_type type, uintptr_t arg1, uintptr_t arg2,
+                             const void *bulk, size_t bulk_size)
+{
+    if (rpc == NULL) {
+        return LIB_ERR_RPC_BIND;
+    }
+
+    errval_t err = aos_rpc_call_start(rpc, call, type, arg1, arg2, 0, NULL_CAP,
+                                      bulk, bulk_size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    return aos_rpc_call_wait(rpc, call);
+}
 
 errval_t
 aos_rpc_send_number(struct aos_rpc *rpc, uintptr_t num) {
-    // TODO: implement functionality to send a number over the channel
-    // given channel and wait until the ack gets returned.
-    return SYS_ERR_OK;
+    struct aos_rpc_call call;
+    return aos_rpc_call(rpc, &call, AOS_RPC_NUMBER, num, 0, NULL, 0);
 }
 
 errval_t
 aos_rpc_send_string(struct aos_rpc *rpc, const char *string) {
-    // TODO: implement functionality to send a string over the given channel
-    // and wait for a response.
-    return SYS_ERR_OK;
+    struct aos_rpc_call call;
+    return aos_rpc_call(rpc, &call, AOS_RPC_STRING, 0, 0, string, strlen(string) + 1);
 }
 
 errval_t
 aos_rpc_get_ram_cap(struct aos_rpc *rpc, size_t bytes, size_t alignment,
                     struct capref *ret_cap, size_t *ret_bytes) {
-    // TODO: implement functionality to request a RAM capability over the
-    // given channel and wait until it is delivered.
+    struct aos_rpc_call call;
+    errval_t err = aos_rpc_call(rpc, &call, AOS_RPC_RAM_CAP, bytes, alignment, NULL, 0);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    *ret_cap = call.cap;
+    if (ret_bytes != NULL) {
+        *ret_bytes = call.words[0];
+    }
     return SYS_ERR_OK;
 }
 
+errval_t
+aos_rpc_get_ram_caps(struct aos_rpc *rpc, size_t bytes, size_t alignment,
+                     size_t count, struct capref *ret_caps) {
+    if (rpc == NULL) {
+        return LIB_ERR_RPC_BIND;
+    }
+
+    errval_t err = SYS_ERR_OK;
+    struct aos_rpc_call calls[AOS_RPC_RAM_CAPS_WINDOW];
+    for (size_t base = 0; base < count; base += AOS_RPC_RAM_CAPS_WINDOW) {
+        size_t n = MIN(count - base, AOS_RPC_RAM_CAPS_WINDOW);
+        size_t started;
+        for (started = 0; started < n && err_is_ok(err); started++) {
+            err = aos_rpc_call_start(rpc, &calls[started], AOS_RPC_RAM_CAP, bytes,
+                                     alignment, 0, NULL_CAP, NULL, 0);
+            if (err_is_fail(err)) {
+                break;
+            }
+        }
+
+        // collect every call that went out, so none stays linked to the channel
+        bool ok[AOS_RPC_RAM_CAPS_WINDOW];
+        for (size_t i = 0; i < started; i++) {
+            errval_t call_err = aos_rpc_call_wait(rpc, &calls[i]);
+            ok[i] = err_is_ok(call_err);
+            if (ok[i]) {
+                ret_caps[base + i] = calls[i].cap;
+            } else if (err_is_ok(err)) {
+                err = call_err;
+            }
+        }
+        if (err_is_fail(err)) {
+            // all or nothing: give up the caps of this window and the earlier ones
+            for (size_t i = 0; i < started; i++) {
+                if (ok[i]) {
+                    cap_destroy(ret_caps[base + i]);
+                }
+            }
+            for (size_t i = 0; i < base; i++) {
+                cap_destroy(ret_caps[i]);
+            }
+            return err;
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+errval_t
+aos_rpc_get_mm_stats(struct aos_rpc *rpc, struct mm_stats *ret) {
+    struct aos_rpc_call call;
+    errval_t err = aos_rpc_call(rpc, &call, AOS_RPC_MM_STATS, 0, 0, NULL, 0);
+    if (err_is_ok(err) && call.bulk_size != sizeof(*ret)) {
+        err = LIB_ERR_RPC_INVALID_MSG;
+    }
+    if (err_is_ok(err)) {
+        memcpy(ret, call.bulk, sizeof(*ret));
+    }
+    free(call.bulk);
+    return err;
+}
+
 
 errval_t
 aos_rpc_serial_getchar(struct aos_rpc *rpc, char *retc) {
-    // TODO implement functionality to request a character from
-    // the serial driver.
-    return SYS_ERR_OK;
+    struct aos_rpc_call call;
+    errval_t err = aos_rpc_call(rpc, &call, AOS_RPC_SERIAL_GETCHAR, 0, 0, NULL, 0);
+    if (err_is_ok(err)) {
+        *retc = call.words[0];
+    }
+    return err;
 }
 
 
 errval_t
 aos_rpc_serial_putchar(struct aos_rpc *rpc, char c) {
-    // TODO implement functionality to send a character to the
-    // serial port.
-    return SYS_ERR_OK;
+    struct aos_rpc_call call;
+    return aos_rpc_call(rpc, &call, AOS_RPC_SERIAL_PUTCHAR, c, 0, NULL, 0);
 }
 
 errval_t
 aos_rpc_process_spawn(struct aos_rpc *rpc, char *cmdline,
                       coreid_t core, domainid_t *newpid) {
-    // TODO (M5): implement spawn new process rpc
-    return SYS_ERR_OK;
+    struct aos_rpc_call call;
+    errval_t err = aos_rpc_call(rpc, &call, AOS_RPC_PROCESS_SPAWN, core, 0,
+                                cmdline, strlen(cmdline) + 1);
+    if (err_is_ok(err)) {
+        *newpid = call.words[0];
+    }
+    return err;
 }
 
 
 
 errval_t
 aos_rpc_process_get_name(struct aos_rpc *rpc, domainid_t pid, char **name) {
-    // TODO (M5): implement name lookup for process given a process id
+    struct aos_rpc_call call;
+    errval_t err = aos_rpc_call(rpc, &call, AOS_RPC_PROCESS_GET_NAME, pid, 0, NULL, 0);
+    if (err_is_ok(err) && (call.bulk_size == 0
+                           || ((char *)call.bulk)[call.bulk_size - 1] != '\0')) {
+        err = LIB_ERR_RPC_INVALID_MSG;
+    }
+    if (err_is_fail(err)) {
+        free(call.bulk);
+        return err;
+    }
+    *name = call.bulk;
     return SYS_ERR_OK;
 }
 
@@ -77,7 +1060,17 @@ aos_rpc_process_get_name(struct aos_rpc *rpc, domainid_t pid, char **name) {
 errval_t
 aos_rpc_process_get_all_pids(struct aos_rpc *rpc, domainid_t **pids,
                              size_t *pid_count) {
-    // TODO (M5): implement process id discovery
+    struct aos_rpc_call call;
+    errval_t err = aos_rpc_call(rpc, &call, AOS_RPC_PROCESS_GET_ALL_PIDS, 0, 0, NULL, 0);
+    if (err_is_ok(err) && call.bulk_size % sizeof(domainid_t) != 0) {
+        err = LIB_ERR_RPC_INVALID_MSG;
+    }
+    if (err_is_fail(err)) {
+        free(call.bulk);
+        return err;
+    }
+    *pids = call.bulk;
+    *pid_count = call.bulk_size / sizeof(domainid_t);
     return SYS_ERR_OK;
 }
 
@@ -88,9 +1081,7 @@ aos_rpc_process_get_all_pids(struct aos_rpc *rpc, domainid_t **pids,
  */
 struct aos_rpc *aos_rpc_get_init_channel(void)
 {
-    //TODO: Return channel to talk to init process
-    debug_printf("aos_rpc_get_init_channel NYI\n");
-    return NULL;
+    return get_init_rpc();
 }
 
 /**
@@ -98,10 +1089,8 @@ struct aos_rpc *aos_rpc_get_init_channel(void)
  */
 struct aos_rpc *aos_rpc_get_memory_channel(void)
 {
-    //TODO: Return channel to talk to memory server process (or whoever
-    //implements memory server functionality)
-    debug_printf("aos_rpc_get_memory_channel NYI\n");
-    return NULL;
+    // init serves memory
+    return get_init_rpc();
 }
 
 /**
@@ -109,10 +1098,8 @@ struct aos_rpc *aos_rpc_get_memory_channel(void)
  */
 struct aos_rpc *aos_rpc_get_process_channel(void)
 {
-    //TODO: Return channel to talk to process server process (or whoever
-    //implements process server functionality)
-    debug_printf("aos_rpc_get_process_channel NYI\n");
-    return NULL;
+    // init manages processes
+    return get_init_rpc();
 }
 
 /**
@@ -120,9 +1107,6 @@ struct aos_rpc *aos_rpc_get_process_channel(void)
  */
 struct aos_rpc *aos_rpc_get_serial_channel(void)
 {
-    //TODO: Return channel to talk to serial driver/terminal process (whoever
-    //implements print/read functionality)
-    debug_printf("aos_rpc_get_serial_channel NYI\n");
-    return NULL;
+    // init drives the serial port
+    return get_init_rpc();
 }
-
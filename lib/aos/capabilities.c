@@ -786,7 +786,23 @@ errval_t endpoint_create(size_t buflen, struct capref *retcap,
  */
 errval_t frame_alloc(struct capref *dest, size_t bytes, size_t *retbytes)
 {
-    errval_t err = slot_alloc(dest);
+    errval_t err;
+
+    // The local allocator hands out zeroed frames with their own slot
+    if (ram_alloc_has_frame()) {
+        assert(bytes > 0);
+        bytes = ROUND_UP(bytes, BASE_PAGE_SIZE);
+        err = ram_alloc_frame(dest, bytes);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_RAM_ALLOC);
+        }
+        if (retbytes != NULL) {
+            *retbytes = bytes;
+        }
+        return SYS_ERR_OK;
+    }
+
+    err = slot_alloc(dest);
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_SLOT_ALLOC);
     }
@@ -12,6 +12,7 @@
 
 #include <aos/dispatcher_arch.h>
 #include <aos/except.h>
+#include <aos/paging_types.h>
 
 /// Maximum number of thread-local storage keys
 #define MAX_TLS         16
@@ -48,10 +49,12 @@ struct thread {
     struct tls_dtv      *tls_dtv;           ///< TLS thread vector
     struct thread       *next, *prev;       ///< Next/prev threads in list
     arch_registers_state_t regs  __attribute__ ((aligned (16)));            ///< Register state snapshot
-    void                *stack;             ///< Malloced stack area
+    void                *stack;             ///< Stack area, above the guard page
     void                *stack_top;         ///< Stack bounds
+    struct paging_region stack_region;      ///< Lazily backed stack and guard page
     void                *exception_stack;   ///< Stack for exception handling
     void                *exception_stack_top; ///< Bounds of exception stack
+    void                *paging_exception_stack; ///< Exception stack that paging mapped
     exception_handler_fn exception_handler; ///< Exception handler, or NULL
     void                *userptr;           ///< User's thread local pointer
     void                *userptrs[MAX_TLS]; ///< User's thread local pointers
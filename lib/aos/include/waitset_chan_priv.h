@@ -32,5 +32,9 @@ errval_t waitset_chan_register_polled_disabled(struct waitset *ws,
                                                struct waitset_chanstate *chan,
                                                struct event_closure closure,
                                                dispatcher_handle_t handle);
+errval_t waitset_chan_start_polling_disabled(struct waitset_chanstate *chan,
+                                             dispatcher_handle_t handle);
+errval_t waitset_chan_stop_polling_disabled(struct waitset_chanstate *chan,
+                                            dispatcher_handle_t handle);
 
 #endif // BARRELFISH_WAITSET_CHAN_PRIV_H
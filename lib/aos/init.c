@@ -23,6 +23,7 @@
 #include <barrelfish_kpi/dispatcher_shared.h>
 #include <aos/morecore.h>
 #include <aos/paging.h>
+#include <aos/aos_rpc.h>
 #include <aos/systime.h>
 #include <barrelfish_kpi/domain_params.h>
 
@@ -142,20 +143,24 @@ errval_t barrelfish_init_onthread(struct spawn_domain_params *params)
 
     lmp_endpoint_init();
 
-    // HINT: Use init_domain to check if we are the init domain.
-
-    // TODO MILESTONE 3: register ourselves with init
-    /* allocate lmp channel structure */
-    /* create local endpoint */
-    /* set remote endpoint to init's endpoint */
-    /* set receive handler */
-    /* send local ep to init */
-    /* wait for init to acknowledge receiving the endpoint */
-    /* initialize init RPC client with lmp channel */
-    /* set init RPC client in our program state */
-
-    /* TODO MILESTONE 3: now we should have a channel with init set up and can
-     * use it for the ram allocator */
+    if (!init_domain) {
+        // register with init, and take memory from it from now on
+        struct aos_rpc *rpc = malloc(sizeof(*rpc));
+        if (rpc == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        err = aos_rpc_bind(rpc, cap_initep);
+        if (err_is_fail(err)) {
+            free(rpc);
+            return err_push(err, LIB_ERR_RPC_BIND);
+        }
+        set_init_rpc(rpc);
+
+        err = ram_alloc_set(NULL);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_RAM_ALLOC_SET);
+        }
+    }
 
     // right now we don't have the nameservice & don't need the terminal
     // and domain spanning, so we return here
@@ -26,8 +26,7 @@ extern morecore_free_func_t sys_morecore_free;
 
 // this define makes morecore use an implementation that just has a static
 // 16MB heap.
-// TODO (M4): use a dynamic heap instead,
-#define USE_STATIC_HEAP
+// #define USE_STATIC_HEAP
 
 #ifdef USE_STATIC_HEAP
 
@@ -91,36 +90,111 @@ errval_t morecore_reinit(void)
 #else
 // dynamic heap using lib/aos/paging features
 
+/// Addresses reserved for the heap, it is backed as it grows
+#define MORECORE_VADDR_BYTES (64UL * 1024 * 1024 * 1024)
+
+/// The heap is backed in chunks of this size, which fit a block mapping
+#define MORECORE_COMMIT_BYTES LARGE_PAGE_SIZE
+
+/// Heap for the allocations before there is RAM to back the region with. In
+/// init, that is until main set up the memory allocator.
+#define MORECORE_BOOTSTRAP_BYTES (256 * 1024)
+
+static char bootstrap_mem[MORECORE_BOOTSTRAP_BYTES] __attribute__((aligned(sizeof(Header))));
+static char *bootstrap_end = bootstrap_mem + MORECORE_BOOTSTRAP_BYTES;
+
+/**
+ * \brief Helper function: Returns whether there is RAM for the heap yet
+ *
+ * The fixed allocator that every domain starts with only has a few pages,
+ * which the page tables need.
+ */
+static bool morecore_has_ram(void)
+{
+    return get_ram_alloc_state()->ram_alloc_func != ram_alloc_fixed;
+}
+
 /**
  * \brief Allocate some memory for malloc to use
  *
- * This function will keep trying with smaller and smaller frames till
- * it finds a set of frames that satisfy the requirement. retbytes can
- * be smaller than bytes if we were able to allocate a smaller memory
- * region than requested for.
+ * The memory comes from the end of the heap region, which is backed in
+ * chunks of MORECORE_COMMIT_BYTES. retbytes can be smaller than bytes if the
+ * region is almost exhausted. Until there is RAM, the memory comes from the
+ * static bootstrap heap instead.
+ *
+ * malloc holds the heap mutex already.
  */
 static void *morecore_alloc(size_t bytes, size_t *retbytes)
 {
-    USER_PANIC("NYI \n");
-    return NULL;
+    struct morecore_state *state = get_morecore_state();
+
+    size_t aligned_bytes = ROUND_UP(bytes, sizeof(Header));
+    if (morecore_has_ram()) {
+        void *buf;
+        errval_t err = paging_region_map(&state->region, aligned_bytes, &buf, retbytes);
+        if (err_is_ok(err)) {
+            return buf;
+        }
+        DEBUG_ERR(err, "morecore_alloc: paging_region_map");
+    }
+
+    void *ret = NULL;
+    if (state->freep + aligned_bytes <= bootstrap_end) {
+        ret = state->freep;
+        state->freep += aligned_bytes;
+    } else {
+        aligned_bytes = 0;
+    }
+    *retbytes = aligned_bytes;
+    return ret;
 }
 
+/**
+ * \brief Give memory at the end of the heap back
+ *
+ * Whole chunks past the new end are unmapped and their frames destroyed. The
+ * bootstrap heap is never given back.
+ */
 static void morecore_free(void *base, size_t bytes)
 {
-    USER_PANIC("NYI \n");
+    struct morecore_state *state = get_morecore_state();
+
+    if ((char *)base >= bootstrap_mem && (char *)base < bootstrap_end) {
+        return;
+    }
+    errval_t err = paging_region_unmap(&state->region, (lvaddr_t)base, bytes);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "morecore_free: paging_region_unmap");
+    }
 }
 
 errval_t morecore_init(size_t alignment)
 {
+    errval_t err;
+    struct morecore_state *state = get_morecore_state();
+
     debug_printf("initializing dynamic heap\n");
 
-    USER_PANIC("NYI \n");
+    thread_mutex_init(&state->mutex);
+
+    // Only reserve addresses, nothing is backed before the first allocation
+    err = paging_region_init_aligned(get_current_paging_state(), &state->region,
+                                     MORECORE_VADDR_BYTES,
+                                     MAX(alignment, MORECORE_COMMIT_BYTES),
+                                     VREGION_FLAGS_READ_WRITE);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    state->region.commit_size = MORECORE_COMMIT_BYTES;
+    state->freep = bootstrap_mem;
+
+    sys_morecore_alloc = morecore_alloc;
+    sys_morecore_free = morecore_free;
     return SYS_ERR_OK;
 }
 
 errval_t morecore_reinit(void)
 {
-    USER_PANIC("NYI \n");
     return SYS_ERR_OK;
 }
 
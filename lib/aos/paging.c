@@ -17,18 +17,137 @@
 #include <aos/except.h>
 #include <aos/slab.h>
 #include "threads_priv.h"
+#include "arch/threads.h"
 
 #include <stdio.h>
 #include <string.h>
 
 static struct paging_state current;
 
+/// A mapping needs up to three new tables, and so does the refill's own mapping
+#define PAGING_SLAB_LOW_WATERMARK 8
+
+/// Free shadow tables the slab is refilled to
+#define PAGING_SLAB_HIGH_WATERMARK 16
+
+/// A mapping fills up to a whole table with one invocation, which takes all
+/// its chunks, plus one chunk per table on the way there
+#define PAGING_CHUNK_LOW_WATERMARK  (SHADOW_PT_CHUNKS + PAGING_SLAB_LOW_WATERMARK)
+#define PAGING_CHUNK_HIGH_WATERMARK (2 * SHADOW_PT_CHUNKS)
+
+/// A mapping takes one record per table, and so does the refill's own mapping
+#define PAGING_MAPPING_LOW_WATERMARK 8
+
+/// Free mapping records the slab is refilled to
+#define PAGING_MAPPING_HIGH_WATERMARK 64
+
+/// paging_alloc starts above the fixed mappings that init makes at VADDR_OFFSET
+#define PAGING_DYNAMIC_VADDR (VADDR_OFFSET + 64 * HUGE_PAGE_SIZE)
+
+/// End of the user part of the address space, with 48-bit virtual addresses
+#define PAGING_VADDR_LIMIT ((lvaddr_t)1 << 48)
+
+/// The fault handler maps memory on this, allocating frames and shadow tables
+#define PAGING_EXCEPTION_STACK_SIZE (4 * BASE_PAGE_SIZE)
+
+static void page_fault_handler(enum exception_type type, int subtype, void *addr,
+                               arch_registers_state_t *regs);
+static errval_t paging_map_owned(struct paging_state *st, lvaddr_t vaddr,
+                                 struct capref frame, size_t bytes, int flags);
+
+/**
+ * \brief Returns whether entry `idx` of a shadow table is in use
+ */
+static inline bool shadow_pt_used(struct shadow_pt *pt, size_t idx)
+{
+    return pt->used[idx / 64] & (1ULL << (idx % 64));
+}
+
+static inline void shadow_pt_set_used(struct shadow_pt *pt, size_t idx)
+{
+    pt->used[idx / 64] |= 1ULL << (idx % 64);
+}
+
+/**
+ * \brief Returns whether no entry of a shadow table is in use
+ */
+static inline bool shadow_pt_empty(struct shadow_pt *pt)
+{
+    for (size_t i = 0; i < PTABLE_ENTRIES / 64; i++) {
+        if (pt->used[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Returns whether entry `idx` of a shadow table maps a page or block,
+ *        rather than the next table
+ */
+static inline bool shadow_pt_leaf(struct shadow_pt *pt, size_t idx)
+{
+    return pt->leaf[idx / 64] & (1ULL << (idx % 64));
+}
+
+static inline void shadow_pt_set_leaf(struct shadow_pt *pt, size_t idx)
+{
+    pt->leaf[idx / 64] |= 1ULL << (idx % 64);
+}
+
+/**
+ * \brief Returns entry `idx` of a shadow table, allocating its chunk if needed
+ *
+ * \return The entry, or NULL if no chunk could be allocated
+ */
+static union shadow_pt_entry *shadow_pt_entry(struct paging_state *st,
+                                              struct shadow_pt *pt, size_t idx)
+{
+    struct shadow_pt_chunk **chunk = &pt->chunks[idx / SHADOW_PT_CHUNK_ENTRIES];
+    if (*chunk == NULL) {
+        *chunk = slab_alloc(&st->chunk_slabs);
+        if (*chunk == NULL) {
+            return NULL;
+        }
+        memset(*chunk, 0, sizeof(**chunk));
+    }
+    return &(*chunk)->e[idx % SHADOW_PT_CHUNK_ENTRIES];
+}
+
+/**
+ * \brief Returns entry `idx` of a shadow table, which must be in use
+ */
+static inline union shadow_pt_entry *shadow_pt_lookup(struct shadow_pt *pt, size_t idx)
+{
+    return &pt->chunks[idx / SHADOW_PT_CHUNK_ENTRIES]->e[idx % SHADOW_PT_CHUNK_ENTRIES];
+}
+
+/**
+ * \brief Marks entry `idx` of a shadow table unused, and frees its chunk once
+ *        no entry in the chunk is used any more
+ */
+static void shadow_pt_release(struct paging_state *st, struct shadow_pt *pt, size_t idx)
+{
+    pt->used[idx / 64] &= ~(1ULL << (idx % 64));
+    pt->leaf[idx / 64] &= ~(1ULL << (idx % 64));
+
+    size_t first = idx - idx % SHADOW_PT_CHUNK_ENTRIES;
+    uint64_t mask = ((1ULL << SHADOW_PT_CHUNK_ENTRIES) - 1) << (first % 64);
+    if ((pt->used[first / 64] & mask) == 0) {
+        slab_free(&st->chunk_slabs, pt->chunks[idx / SHADOW_PT_CHUNK_ENTRIES]);
+        pt->chunks[idx / SHADOW_PT_CHUNK_ENTRIES] = NULL;
+    }
+}
+
 /**
  * \brief Helper function that allocates a slot and
  *        creates a aarch64 page table capability for a certain level
+ *
+ * Unlike vnode_create, this keeps the RAM the table is retyped from, so that
+ * it can be returned with ram_free once the table is empty again.
  */
 static errval_t pt_alloc(struct paging_state * st, enum objtype type, 
-                         struct capref *ret) 
+                         struct capref *ret, struct capref *ret_ram) 
 {
     errval_t err;
     err = st->slot_alloc->alloc(st->slot_alloc, ret);
@@ -36,36 +155,62 @@ static errval_t pt_alloc(struct paging_state * st, enum objtype type,
         debug_printf("slot_alloc failed: %s\n", err_getstring(err));
         return err;
     }
-    err = vnode_create(*ret, type);
+    err = ram_alloc_aligned(ret_ram, vnode_objsize(type), vnode_objsize(type));
     if (err_is_fail(err)) {
-        debug_printf("vnode_create failed: %s\n", err_getstring(err));
-        return err;
+        debug_printf("ram_alloc failed: %s\n", err_getstring(err));
+        st->slot_alloc->free(st->slot_alloc, *ret);
+        return err_push(err, LIB_ERR_RAM_ALLOC);
+    }
+    err = cap_retype(*ret, *ret_ram, 0, type, vnode_objsize(type), 1);
+    if (err_is_fail(err)) {
+        debug_printf("cap_retype failed: %s\n", err_getstring(err));
+        st->slot_alloc->free(st->slot_alloc, *ret);
+        ram_free(*ret_ram);
+        return err_push(err, LIB_ERR_CAP_RETYPE);
     }
     return SYS_ERR_OK;
 }
 
-__attribute__((unused)) static errval_t pt_alloc_l1(struct paging_state * st, struct capref *ret)
+/**
+ * \brief Helper function: Deletes a table that pt_alloc created, and returns
+ *        its slot and RAM
+ */
+static errval_t pt_free(struct paging_state *st, struct capref pt, struct capref pt_ram)
+{
+    errval_t err = cap_delete(pt);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_CAP_DELETE);
+    }
+    st->slot_alloc->free(st->slot_alloc, pt);
+    return ram_free(pt_ram);
+}
+
+__attribute__((unused)) static errval_t pt_alloc_l1(struct paging_state * st, struct capref *ret,
+                                                    struct capref *ret_ram)
 {
-    return pt_alloc(st, ObjType_VNode_AARCH64_l1, ret);
+    return pt_alloc(st, ObjType_VNode_AARCH64_l1, ret, ret_ram);
 }
 
-__attribute__((unused)) static errval_t pt_alloc_l2(struct paging_state * st, struct capref *ret)
+__attribute__((unused)) static errval_t pt_alloc_l2(struct paging_state * st, struct capref *ret,
+                                                    struct capref *ret_ram)
 {
-    return pt_alloc(st, ObjType_VNode_AARCH64_l2, ret);
+    return pt_alloc(st, ObjType_VNode_AARCH64_l2, ret, ret_ram);
 }
 
-__attribute__((unused)) static errval_t pt_alloc_l3(struct paging_state * st, struct capref *ret) 
+__attribute__((unused)) static errval_t pt_alloc_l3(struct paging_state * st, struct capref *ret,
+                                                    struct capref *ret_ram)
 {
-    return pt_alloc(st, ObjType_VNode_AARCH64_l3, ret);
+    return pt_alloc(st, ObjType_VNode_AARCH64_l3, ret, ret_ram);
 }
 
 
 /**
- * TODO(M2): Implement this function.
- * TODO(M4): Improve this function.
  * \brief Initialize the paging_state struct for the paging
  *        state of the calling process.
- * 
+ *
+ * The shadow table slabs start out empty. The caller grows them before the
+ * first mapping, or they refill through an already working paging state.
+ *
  * \param st The struct to be initialized, must not be NULL.
  * \param start_vaddr Virtual address allocation should start at
  *        this address.
@@ -77,18 +222,39 @@ __attribute__((unused)) static errval_t pt_alloc_l3(struct paging_state * st, st
 errval_t paging_init_state(struct paging_state *st, lvaddr_t start_vaddr,
                            struct capref pdir, struct slot_allocator *ca)
 {
-    // TODO (M2): Implement state struct initialization
-    // TODO (M4): Implement page fault handler that installs frames when a page fault
-    // occurs and keeps track of the virtual address space.
-    return LIB_ERR_NOT_IMPLEMENTED;
+    memset(st, 0, sizeof(*st));
+    st->slot_alloc = ca;
+    st->shadow_pt.s_pt_cap_root = pdir;
+
+    slab_init(&(st->slabs), sizeof(struct shadow_pt), NULL);
+    slab_set_watermarks(&(st->slabs), PAGING_SLAB_LOW_WATERMARK,
+                        PAGING_SLAB_HIGH_WATERMARK);
+    slab_init(&(st->chunk_slabs), sizeof(struct shadow_pt_chunk), NULL);
+    slab_set_watermarks(&(st->chunk_slabs), PAGING_CHUNK_LOW_WATERMARK,
+                        PAGING_CHUNK_HIGH_WATERMARK);
+    slab_init(&(st->mapping_slabs), sizeof(struct shadow_pt_mapping), NULL);
+    slab_set_watermarks(&(st->mapping_slabs), PAGING_MAPPING_LOW_WATERMARK,
+                        PAGING_MAPPING_HIGH_WATERMARK);
+    // A mapping takes at most one frame record
+    slab_init(&(st->frame_slabs), sizeof(struct paging_frame), NULL);
+    slab_set_watermarks(&(st->frame_slabs), PAGING_MAPPING_LOW_WATERMARK,
+                        PAGING_MAPPING_HIGH_WATERMARK);
+
+    thread_mutex_init(&st->mutex);
+    vaddr_tree_init(&st->vaddrs, start_vaddr, PAGING_VADDR_LIMIT);
+    st->regions = NULL;
+    st->fault_around = PAGING_FAULT_AROUND_DEFAULT;
+
+    return SYS_ERR_OK;
 }
 
 /**
- * TODO(M2): Implement this function.
- * TODO(M4): Improve this function.
  * \brief Initialize the paging_state struct for the paging state
  *        of a child process.
- * 
+ *
+ * The shadow tables live in the calling process, and no fault handler serves
+ * the child's regions.
+ *
  * \param st The struct to be initialized, must not be NULL.
  * \param start_vaddr Virtual address allocation should start at
  *        this address.
@@ -100,10 +266,7 @@ errval_t paging_init_state(struct paging_state *st, lvaddr_t start_vaddr,
 errval_t paging_init_state_foreign(struct paging_state *st, lvaddr_t start_vaddr,
                            struct capref pdir, struct slot_allocator *ca)
 {
-    // TODO (M2): Implement state struct initialization
-    // TODO (M4): Implement page fault handler that installs frames when a page fault
-    // occurs and keeps track of the virtual address space.
-    return LIB_ERR_NOT_IMPLEMENTED;
+    return paging_init_state(st, start_vaddr, pdir, ca);
 }
 
 /**
@@ -112,41 +275,131 @@ errval_t paging_init_state_foreign(struct paging_state *st, lvaddr_t start_vaddr
  */
 errval_t paging_init(void)
 {
+    errval_t err;
     debug_printf("paging_init\n");
-    // TODO (M2): Call paging_init_state for &current
-    // TODO (M4): initialize self-paging handler
-    // TIP: use thread_set_exception_handler() to setup a page fault handler
-    // TIP: Think about the fact that later on, you'll have to make sure that
-    // you can handle page faults in any thread of a domain.
-    // TIP: it might be a good idea to call paging_init_state() from here to
-    // avoid code duplication.
+
+    // The L0 table of every domain is in the first slot of its page cnode
+    struct capref pdir = {
+        .cnode = cnode_page,
+        .slot  = 0
+    };
+    err = paging_init_state(&current, PAGING_DYNAMIC_VADDR, pdir,
+                            get_default_slot_allocator());
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // Nothing is mapped yet that the slabs could refill from
+    static uint8_t nodebuf[SLAB_STATIC_SIZE(64, sizeof(struct shadow_pt))];
+    slab_grow(&current.slabs, nodebuf, sizeof(nodebuf));
+    static uint8_t chunkbuf[SLAB_STATIC_SIZE(PAGING_CHUNK_HIGH_WATERMARK,
+                                             sizeof(struct shadow_pt_chunk))];
+    slab_grow(&current.chunk_slabs, chunkbuf, sizeof(chunkbuf));
+    static uint8_t mappingbuf[SLAB_STATIC_SIZE(PAGING_MAPPING_HIGH_WATERMARK,
+                                               sizeof(struct shadow_pt_mapping))];
+    slab_grow(&current.mapping_slabs, mappingbuf, sizeof(mappingbuf));
+    static uint8_t framebuf[SLAB_STATIC_SIZE(PAGING_MAPPING_HIGH_WATERMARK,
+                                             sizeof(struct paging_frame))];
+    slab_grow(&current.frame_slabs, framebuf, sizeof(framebuf));
+    static uint8_t vaddrbuf[SLAB_STATIC_SIZE(VADDR_TREE_SLAB_HIGH_WATERMARK,
+                                             sizeof(struct vaddr_node))];
+    slab_grow(&current.vaddrs.slabs, vaddrbuf, sizeof(vaddrbuf));
+
     set_current_paging_state(&current);
+
+    // Later threads get theirs in paging_init_onthread
+    static char exception_stack[PAGING_EXCEPTION_STACK_SIZE]
+        __attribute__((aligned(STACK_ALIGNMENT)));
+    err = thread_set_exception_handler(page_fault_handler, NULL, exception_stack,
+                                       exception_stack + sizeof(exception_stack),
+                                       NULL, NULL);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
     return SYS_ERR_OK;
 }
 
 
 /**
  * \brief Initialize per-thread paging state
+ *
+ * Gives thread `t` the page fault handler and an exception stack. The stack
+ * is mapped right away, as a fault on it could not be handled. paging_unmap
+ * on the stack frees it along with its frame.
  */
 void paging_init_onthread(struct thread *t)
 {
-    // TODO (M4): setup exception handler for thread `t'.
+    errval_t err;
+    struct paging_state *st = get_current_paging_state();
+
+    struct capref frame;
+    size_t bytes;
+    err = frame_alloc(&frame, PAGING_EXCEPTION_STACK_SIZE, &bytes);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "paging_init_onthread: frame_alloc");
+        return;
+    }
+
+    void *stack;
+    err = paging_alloc(st, &stack, bytes, BASE_PAGE_SIZE);
+    if (err_is_fail(err)) {
+        cap_destroy(frame);
+    } else {
+        err = paging_map_owned(st, (lvaddr_t)stack, frame, bytes,
+                               VREGION_FLAGS_READ_WRITE);
+        if (err_is_fail(err)) {
+            paging_free(st, stack, bytes);
+        }
+    }
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "paging_init_onthread: mapping the exception stack");
+        return;
+    }
+
+    t->exception_handler = page_fault_handler;
+    t->exception_stack = stack;
+    t->paging_exception_stack = stack;
+    t->exception_stack_top = (char *)stack + bytes;
+}
+
+/**
+ * \brief Helper function: Initializes a region over reserved addresses and
+ *        registers it with the paging state
+ */
+static void paging_region_add(struct paging_state *st, struct paging_region *pr,
+                              lvaddr_t base, size_t size, paging_flags_t flags)
+{
+    pr->base_addr = (lvaddr_t)base;
+    pr->current_addr = pr->base_addr;
+    pr->region_size = size;
+    pr->flags = flags;
+    pr->commit_addr = pr->base_addr;
+    pr->commit_size = BASE_PAGE_SIZE;
+
+    thread_mutex_lock_nested(&st->mutex);
+    pr->next = st->regions;
+    st->regions = pr;
+    thread_mutex_unlock(&st->mutex);
 }
 
 /**
  * \brief Initialize a paging region in `pr`, such that it  starts
  * from base and contains size bytes.
+ *
+ * The addresses are reserved, so paging_alloc will not hand them out. With
+ * VREGION_FLAGS_LAZY, the page fault handler backs the region when it is
+ * touched. Otherwise, paging_region_map backs what it hands out.
  */
 errval_t paging_region_init_fixed(struct paging_state *st, struct paging_region *pr,
                                   lvaddr_t base, size_t size, paging_flags_t flags)
 {
-    pr->base_addr = (lvaddr_t)base;
-    pr->current_addr = pr->base_addr;
-    pr->region_size = size;
-    pr->flags = flags;
+    errval_t err = paging_reserve(st, base, size);
+    if (err_is_fail(err)) {
+        return err;
+    }
 
-    //TODO(M2): Add the region to a datastructure and ensure paging_alloc
-    //will return non-overlapping regions.
+    paging_region_add(st, pr, base, size, flags);
     return SYS_ERR_OK;
 }
 
@@ -164,7 +417,8 @@ errval_t paging_region_init_aligned(struct paging_state *st, struct paging_regio
         return err_push(err, LIB_ERR_VSPACE_MMU_AWARE_INIT);
     }
 
-    return paging_region_init_fixed(st, pr, (lvaddr_t)base, size, flags);
+    paging_region_add(st, pr, (lvaddr_t)base, size, flags);
+    return SYS_ERR_OK;
 }
 
 /**
@@ -180,75 +434,230 @@ errval_t paging_region_init(struct paging_state *st, struct paging_region *pr,
     return paging_region_init_aligned(st, pr, size, BASE_PAGE_SIZE, flags);
 }
 
+/**
+ * \brief Initialize a stack of up to `size` bytes in `pr`, with a guard page
+ *        below it
+ *
+ * The top PAGING_STACK_EAGER_BYTES are backed right away, the page fault
+ * handler backs the rest as the stack grows, along with
+ * PAGING_STACK_SLACK_BYTES below the faulting page. Code running disabled,
+ * which must not fault, thus finds that much stack backed below the deepest
+ * point the thread reached. A fault on the guard page is reported as a stack
+ * overflow. paging_unmap on the region base frees the stack along with the
+ * frames that backed it.
+ *
+ * \param ret_stack Returns the lowest address of the stack, above the guard
+ */
+errval_t paging_region_init_stack(struct paging_state *st, struct paging_region *pr,
+                                  size_t size, void **ret_stack)
+{
+    size = ROUND_UP(size, BASE_PAGE_SIZE);
+    errval_t err = paging_region_init(st, pr, size + BASE_PAGE_SIZE,
+                                      VREGION_FLAGS_READ_WRITE | VREGION_FLAGS_LAZY |
+                                      VREGION_FLAGS_GUARD);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    size_t eager = MIN(size, PAGING_STACK_EAGER_BYTES);
+    lvaddr_t top = pr->base_addr + BASE_PAGE_SIZE + size;
+    struct capref frame;
+    err = frame_alloc(&frame, eager, NULL);
+    if (err_is_fail(err)) {
+        paging_unmap(st, (void *)pr->base_addr);
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
+    err = paging_map_owned(st, top - eager, frame, eager, pr->flags);
+    if (err_is_fail(err)) {
+        paging_unmap(st, (void *)pr->base_addr);
+        return err;
+    }
+
+    *ret_stack = (void *)(pr->base_addr + BASE_PAGE_SIZE);
+    return SYS_ERR_OK;
+}
+
 /**
  * \brief return a pointer to a bit of the paging region `pr`.
  * This function gets used in some of the code that is responsible
  * for allocating Frame (and other) capabilities.
+ *
+ * Unless the region is lazy, the returned bit is backed before returning, so
+ * that allocators that the page fault handler itself uses never fault. The
+ * region is backed in chunks of pr->commit_size bytes, or just the pages
+ * that are needed if memory is short.
  */
 errval_t paging_region_map(struct paging_region *pr, size_t req_size, void **retbuf,
                            size_t *ret_size)
 {
+    errval_t err;
     lvaddr_t end_addr = pr->base_addr + pr->region_size;
     ssize_t rem = end_addr - pr->current_addr;
     if (rem > req_size) {
         // ok
         *retbuf = (void *)pr->current_addr;
         *ret_size = req_size;
-        pr->current_addr += req_size;
     } else if (rem > 0) {
         *retbuf = (void *)pr->current_addr;
         *ret_size = rem;
-        pr->current_addr += rem;
         debug_printf("exhausted paging region, "
                      "expect badness on next allocation\n");
     } else {
         return LIB_ERR_VSPACE_MMU_AWARE_NO_SPACE;
     }
+
+    lvaddr_t end = ROUND_UP(pr->current_addr + *ret_size, BASE_PAGE_SIZE);
+    if (!(pr->flags & VREGION_FLAGS_LAZY) && end > pr->commit_addr) {
+        lvaddr_t commit = MIN(ROUND_UP(end, pr->commit_size),
+                              ROUND_UP(end_addr, BASE_PAGE_SIZE));
+        struct capref frame;
+        size_t bytes;
+        err = frame_alloc(&frame, commit - pr->commit_addr, &bytes);
+        if (err_is_fail(err) && commit > end) {
+            commit = end;
+            err = frame_alloc(&frame, commit - pr->commit_addr, &bytes);
+        }
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_FRAME_ALLOC);
+        }
+        err = paging_map_owned(get_current_paging_state(), pr->commit_addr, frame,
+                               commit - pr->commit_addr, pr->flags);
+        if (err_is_fail(err)) {
+            return err_push(err, LIB_ERR_VSPACE_MMU_AWARE_MAP);
+        }
+        pr->commit_addr = commit;
+    }
+    pr->current_addr += *ret_size;
+
     return SYS_ERR_OK;
 }
 
 /**
- * TODO(M2): As an OPTIONAL part of M2 implement this function
  * \brief free a bit of the paging region `pr`.
  * This function gets used in some of the code that is responsible
  * for allocating Frame (and other) capabilities.
- * NOTE: Implementing this function is optional.
+ *
+ * Only the end of what paging_region_map handed out can be freed. The chunks
+ * past the new end are unmapped and their frames destroyed, except for one
+ * chunk that stays backed, so that a region that shrinks and grows across a
+ * chunk boundary does not map and unmap it every time.
  */
 errval_t paging_region_unmap(struct paging_region *pr, lvaddr_t base, size_t bytes)
 {
     // XXX: should free up some space in paging region, however need to track
     //      holes for non-trivial case
-    return LIB_ERR_NOT_IMPLEMENTED;
+    if (base < pr->base_addr || base + bytes != pr->current_addr) {
+        return LIB_ERR_NOT_IMPLEMENTED;
+    }
+    pr->current_addr = base;
+
+    lvaddr_t keep = ROUND_UP(base, pr->commit_size) + pr->commit_size;
+    if ((pr->flags & VREGION_FLAGS_LAZY) || keep >= pr->commit_addr) {
+        return SYS_ERR_OK;
+    }
+    errval_t err = paging_unmap_range(get_current_paging_state(), keep,
+                                      pr->commit_addr - keep);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    pr->commit_addr = keep;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Helper function: Tops up the nodes of the address tree
+ *
+ * Called with the paging state locked, before touching the tree. The refill
+ * maps its memory at an address from the tree, which takes a node from the
+ * ones that are left.
+ */
+static void paging_vaddrs_refill(struct paging_state *st)
+{
+    if (slab_needs_refill(&st->vaddrs.slabs)) {
+        errval_t err = slab_refill(&st->vaddrs.slabs);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "paging.c/paging_vaddrs_refill: slab_refill");
+        }
+    }
 }
 
-/** 
- * TODO(M2): Implement this function.
+/**
  * \brief Find a bit of free virtual address space that is large enough to accomodate a
  *        buffer of size 'bytes'.
- * 
+ *
+ * Takes the lowest free range that fits, see struct vaddr_tree.
+ *
  * \param st A pointer to the paging state.
  * \param buf This parameter is used to return the free virtual address that was found.
  * \param bytes The number of bytes that need to be free (at the minimum) at the found
  *        virtual address.
- * \param alignment The address needs to be a multiple of 'alignment'.
+ * \param alignment The address needs to be a multiple of 'alignment', a power of two.
  * \return Either SYS_ERR_OK if no error occured or an error
  *        indicating what went wrong otherwise.
  */
 errval_t paging_alloc(struct paging_state *st, void **buf, size_t bytes, size_t alignment)
 {
-    /**
-     * TODO(M2): Implement this function
-     * \brief Find a bit of free virtual address space that is large enough to
-     *        accomodate a buffer of size `bytes`.
-     */
-    *buf = NULL;
+    errval_t err;
+    alignment = MAX(alignment, BASE_PAGE_SIZE);
+    bytes = ROUND_UP(MAX(bytes, 1), BASE_PAGE_SIZE);
+
+    thread_mutex_lock_nested(&st->mutex);
+    paging_vaddrs_refill(st);
+    lvaddr_t base;
+    err = vaddr_tree_alloc(&st->vaddrs, bytes, alignment, &base);
+    thread_mutex_unlock(&st->mutex);
+    if (err_is_fail(err)) {
+        *buf = NULL;
+        return err;
+    }
+
+    *buf = (void *)base;
     return SYS_ERR_OK;
 }
 
 /**
- * TODO(M2): Implement this function.
+ * \brief Reserves the virtual addresses [vaddr, vaddr + bytes), so that
+ *        paging_alloc does not hand them out
+ *
+ * Fails with LIB_ERR_VSPACE_REGION_OVERLAP if any of them are taken.
+ */
+errval_t paging_reserve(struct paging_state *st, lvaddr_t vaddr, size_t bytes)
+{
+    errval_t err;
+    bytes = ROUND_UP(vaddr + MAX(bytes, 1), BASE_PAGE_SIZE) - ROUND_DOWN(vaddr, BASE_PAGE_SIZE);
+    vaddr = ROUND_DOWN(vaddr, BASE_PAGE_SIZE);
+
+    thread_mutex_lock_nested(&st->mutex);
+    paging_vaddrs_refill(st);
+    err = vaddr_tree_reserve(&st->vaddrs, vaddr, bytes);
+    thread_mutex_unlock(&st->mutex);
+    return err;
+}
+
+/**
+ * \brief Returns virtual addresses from paging_alloc or paging_reserve
+ *
+ * Any part of a range can be returned, adjacent free space merges.
+ */
+errval_t paging_free(struct paging_state *st, void *buf, size_t bytes)
+{
+    errval_t err;
+    lvaddr_t vaddr = ROUND_DOWN((lvaddr_t)buf, BASE_PAGE_SIZE);
+    bytes = ROUND_UP((lvaddr_t)buf + MAX(bytes, 1), BASE_PAGE_SIZE) - vaddr;
+
+    thread_mutex_lock_nested(&st->mutex);
+    paging_vaddrs_refill(st);
+    err = vaddr_tree_free(&st->vaddrs, vaddr, bytes);
+    thread_mutex_unlock(&st->mutex);
+    return err;
+}
+
+/**
  * \brief Finds a free virtual address and maps a frame at that address
- * 
+ *
+ * Frames of 2 MiB or more get a 2 MiB aligned address, so that they can be
+ * mapped with blocks if they are aligned physically, too.
+ *
  * \param st A pointer to the paging state.
  * \param buf This will parameter will be used to return the free virtual
  * address at which a new frame as been mapped.
@@ -265,13 +674,19 @@ errval_t paging_alloc(struct paging_state *st, void **buf, size_t bytes, size_t
 errval_t paging_map_frame_attr(struct paging_state *st, void **buf, size_t bytes,
                                struct capref frame, int flags, void *arg1, void *arg2)
 {
+    errval_t err;
 
-    // TODO(M2): Implement me
-    // - Call paging_alloc to get a free virtual address region of the requested size
-    // - Map the user provided frame at the free virtual address
-
-    return LIB_ERR_NOT_IMPLEMENTED;
+    size_t alignment = bytes >= LARGE_PAGE_SIZE ? LARGE_PAGE_SIZE : BASE_PAGE_SIZE;
+    err = paging_alloc(st, buf, bytes, alignment);
+    if (err_is_fail(err)) {
+        return err;
+    }
 
+    err = paging_map_fixed_attr(st, (lvaddr_t)*buf, frame, bytes, flags);
+    if (err_is_fail(err)) {
+        paging_free(st, *buf, bytes);
+    }
+    return err;
 }
 
 errval_t slab_refill_no_pagefault(struct slab_allocator *slabs, struct capref frame,
@@ -281,104 +696,1029 @@ errval_t slab_refill_no_pagefault(struct slab_allocator *slabs, struct capref fr
     return LIB_ERR_NOT_IMPLEMENTED;
 }
 
-errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
-                               struct capref frame, size_t bytes, int flags)
+/**
+ * \brief Helper function: Returns the index of `vaddr` in a table of `level`
+ */
+static inline size_t paging_index(lvaddr_t vaddr, int level)
+{
+    return (vaddr >> (39 - 9 * level)) & 0x1ff;
+}
+
+/**
+ * \brief Helper function: Returns the bytes an entry of a table of `level`
+ *        translates
+ */
+static inline size_t paging_level_size(int level)
 {
-    /**
-     * \brief map a user provided frame at user provided VA.
-     * TODO(M1): Map a frame assuming all mappings will fit into one last level pt
-     * TODO(M2): General case
-     */
+    return (size_t)1 << (39 - 9 * level);
+}
 
+/**
+ * \brief Helper function: Returns whether `vaddr` can be mapped to `paddr` with
+ *        a block of `size`, with `bytes` left to map
+ */
+static inline bool paging_block_fits(lvaddr_t vaddr, genpaddr_t paddr, size_t bytes,
+                                     size_t size)
+{
+    return vaddr % size == 0 && paddr % size == 0 && bytes >= size;
+}
 
-    if (st->slot_alloc == NULL) {
-        st->slot_alloc = get_default_slot_allocator();
+/**
+ * \brief Helper function: Frees a table that shadow_pt_walk created for entry
+ *        `idx` of `pt` but could not map
+ */
+static void shadow_pt_walk_undo(struct paging_state *st, struct shadow_pt *pt, size_t idx,
+                                struct shadow_pt *child)
+{
+    errval_t err = pt_free(st, child->s_pt_cap_root, child->s_pt_cap_ram);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "paging.c/shadow_pt_walk_undo: returning the table fail");
     }
+    slab_free(&(st->slabs), child);
+    shadow_pt_release(st, pt, idx);
+}
 
-    static bool init = true;
-    errval_t err = SYS_ERR_OK;
+/**
+ * \brief Helper function: Returns the shadow table of `level` that holds
+ *        `vaddr`, creating it and the tables above it as needed
+ *
+ * \param level 1 for the L1 table, up to 3 for the L3 table
+ */
+static errval_t shadow_pt_walk(struct paging_state *st, lvaddr_t vaddr, int level,
+                               int flags, struct shadow_pt **ret)
+{
+    errval_t err;
+    errval_t (*pt_alloc_l[3])(struct paging_state * st, struct capref *ret,
+                              struct capref *ret_ram) = {&pt_alloc_l1, &pt_alloc_l2, &pt_alloc_l3};
+    struct shadow_pt *pt = &(st->shadow_pt);
+
+    for (int i = 1; i <= level; i++) {
+        size_t idx = paging_index(vaddr, i-1);
+        union shadow_pt_entry *entry = shadow_pt_entry(st, pt, idx);
+        if (entry == NULL) {
+            DEBUG_ERR(LIB_ERR_SLAB_ALLOC_FAIL, "paging.c/shadow_pt_walk: slab alloc failed for chunk of l%d", i-1);
+            return LIB_ERR_SLAB_ALLOC_FAIL;
+        }
+        if (shadow_pt_used(pt, idx)) {
+            if (shadow_pt_leaf(pt, idx)) {
+                // A block maps this address already
+                return LIB_ERR_PMAP_EXISTING_MAPPING;
+            }
+            pt = entry->child;
+            continue;
+        }
 
-    // Get index
-    capaddr_t lvidx[4];
+        // Allocate s_pt struct. On failure, the chunk of the entry is freed
+        // again if it was allocated for this table alone.
+        struct shadow_pt *child = slab_alloc(&(st->slabs));
+        if (child == NULL) {
+            DEBUG_ERR(LIB_ERR_SLAB_ALLOC_FAIL, "paging.c/shadow_pt_walk: slab alloc failed for l%d", i);
+            shadow_pt_release(st, pt, idx);
+            return LIB_ERR_SLAB_ALLOC_FAIL;
+        }
+        memset(child, 0, sizeof(struct shadow_pt));
 
-    for (int i = 0; i < 4; i++) {
-        lvidx[i] = (capaddr_t)((vaddr >> (39-9*i)) & 0x1ff);
-    }
+        // Allocate pt_capref
+        err = pt_alloc_l[i-1](st, &(child->s_pt_cap_root), &(child->s_pt_cap_ram));
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "paging.c/shadow_pt_walk: pt_alloc_l%d fail", i);
+            slab_free(&(st->slabs), child);
+            shadow_pt_release(st, pt, idx);
+            return err;
+        }
 
-    if (init) {
-        st->shadow_pt.s_pt_cap_root = (struct capref) { // 512 entries
-                .cnode = cnode_page,
-                .slot  = 0
-        };
-        slab_init(&(st->slabs), sizeof(struct shadow_pt), NULL);
-        static uint8_t nodebuf[SLAB_STATIC_SIZE(64, sizeof(struct shadow_pt))];
-        slab_grow(&st->slabs, nodebuf, sizeof(nodebuf));
-        init = false;
-    }
+        // Allocate map_capref l0-2
+        err = slot_alloc(&(child->s_pt_cap_map));
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "paging.c/shadow_pt_walk: slot_alloc of map_l%d fail", i-1);
+            shadow_pt_walk_undo(st, pt, idx, child);
+            return err;
+        }
 
-    struct shadow_pt *shadow_pt_l[4] = {&(st->shadow_pt), NULL, NULL, NULL};
-    errval_t (*pt_alloc_l[3])(struct paging_state * st, struct capref *ret) = {&pt_alloc_l1, &pt_alloc_l2, &pt_alloc_l3};
+        // Write map_capref for writing pt_i in pt_i-1
+        err = vnode_map(pt->s_pt_cap_root, child->s_pt_cap_root, idx, flags, 0, 1, child->s_pt_cap_map);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "paging.c/shadow_pt_walk: vnode_map of lv%didx fail", i-1);
+            slot_free(child->s_pt_cap_map);
+            shadow_pt_walk_undo(st, pt, idx, child);
+            return err_push(err, LIB_ERR_VNODE_MAP);
+        }
+        entry->child = child;
+        shadow_pt_set_used(pt, idx);
+        pt = child;
+    }
 
-    for (int i = 1; i < 4; i++) {
-        shadow_pt_l[i] = shadow_pt_l[i-1]->s_pt_entries[lvidx[i-1]];
-        if (shadow_pt_l[i] == NULL) {
-            // Allocate s_pt struct
-            shadow_pt_l[i] = slab_alloc(&(st->slabs));
-            if (shadow_pt_l[i] == NULL) {
-                DEBUG_ERR(err, "paging.c/paging_map_fixed_attr: slab alloc failed for shadow_pt_l[%d]", i);
-                return err;
-            }
-            shadow_pt_l[i-1]->s_pt_entries[lvidx[i-1]] = shadow_pt_l[i];
-            // Allocate pt_capref
-            err = pt_alloc_l[i-1](st, &(shadow_pt_l[i]->s_pt_cap_root));
-            if (err_is_fail(err)) {
-                DEBUG_ERR(err, "paging.c/paging_map_fixed_attr: pt_alloc_l%d fail", i);
-                return err;
-            }
+    *ret = pt;
+    return SYS_ERR_OK;
+}
 
-            // Allocate map_capref l0-2
-            err = slot_alloc(&(shadow_pt_l[i-1]->s_pt_cap_map[lvidx[i-1]]));
-            if (err_is_fail(err)) {
-                DEBUG_ERR(err, "paging.c/paging_map_fixed_attr: slot_alloc of map_l%d fail", i-1);
-                return err;
-            }
+/**
+ * \brief Helper function: Maps part of a frame into entries `idx` to
+ *        `idx + count - 1` of a table, pages in an L3 table, blocks in an L1 or
+ *        L2 table
+ *
+ * All entries are mapped with one invocation and share one mapping cap. Each
+ * of them points to the same struct shadow_pt_mapping.
+ */
+static errval_t shadow_pt_map(struct paging_state *st, struct shadow_pt *pt, size_t idx,
+                              size_t count, struct capref frame, size_t offset, int flags,
+                              struct paging_frame *owner)
+{
+    errval_t err;
 
-            // Write map_capref for writing pt_i in pt_i-1
-            err = vnode_map(shadow_pt_l[i-1]->s_pt_cap_root, shadow_pt_l[i]->s_pt_cap_root, lvidx[i-1], flags, 0, 1, shadow_pt_l[i-1]->s_pt_cap_map[lvidx[i-1]]);
-            if (err_is_fail(err)) {
-                DEBUG_ERR(err, "paging.c/paging_map_fixed_attr: vnode_map of lv%didx fail", i-1);
-                return err_push(err, LIB_ERR_VNODE_MAP);
-            }
+    for (size_t i = idx; i < idx + count; i++) {
+        if (shadow_pt_used(pt, i)) {
+            return LIB_ERR_PMAP_EXISTING_MAPPING;
+        }
+        // Allocate all chunks up front, the mapping cannot be undone halfway
+        if (shadow_pt_entry(st, pt, i) == NULL) {
+            DEBUG_ERR(LIB_ERR_SLAB_ALLOC_FAIL, "paging.c/shadow_pt_map: slab alloc failed for chunk");
+            return LIB_ERR_SLAB_ALLOC_FAIL;
         }
     }
 
-    // TODO: BUG does not work after 122 uses.
-    // Allocate map_capref l3
-    err = slot_alloc(&(shadow_pt_l[3]->s_pt_cap_map[lvidx[3]]));
+    struct shadow_pt_mapping *m = slab_alloc(&(st->mapping_slabs));
+    if (m == NULL) {
+        DEBUG_ERR(LIB_ERR_SLAB_ALLOC_FAIL, "paging.c/shadow_pt_map: slab alloc failed for mapping");
+        return LIB_ERR_SLAB_ALLOC_FAIL;
+    }
+    m->frame = frame;
+    m->owner = owner;
+    m->offset = offset;
+    m->flags = flags;
+    m->entry = idx;
+    m->count = count;
+
+    err = slot_alloc(&m->map);
     if (err_is_fail(err)) {
-        DEBUG_ERR(err, "paging.c/paging_map_fixed_attr: slot_alloc of map_l%d fail", 3);
+        DEBUG_ERR(err, "paging.c/shadow_pt_map: slot_alloc of mapping fail");
+        slab_free(&(st->mapping_slabs), m);
         return err;
     }
 
-    //static int q = 0;
-    //debug_printf(" ====== %d\n ", q++);
-
-    // Write map_capref for writing frame in pt_3
-    err = vnode_map(shadow_pt_l[3]->s_pt_cap_root, frame, lvidx[3], flags, 0, 1, shadow_pt_l[3]->s_pt_cap_map[lvidx[3]]);
+    // The kernel only takes the access flags, and copy-on-write is read-only
+    int kpi_flags = flags & KPI_PAGING_FLAGS_MASK;
+    if (flags & VREGION_FLAGS_COW) {
+        kpi_flags &= ~KPI_PAGING_FLAGS_WRITE;
+    }
+    err = vnode_map(pt->s_pt_cap_root, frame, idx, kpi_flags, offset, count, m->map);
     if (err_is_fail(err)) {
-        DEBUG_ERR(err, "paging_map_fixed_attr: vnode_map of lv%didx fail", 3);
+        DEBUG_ERR(err, "paging.c/shadow_pt_map: vnode_map fail");
+        slot_free(m->map);
+        slab_free(&(st->mapping_slabs), m);
         return err_push(err, LIB_ERR_VNODE_MAP);
     }
+    for (size_t i = idx; i < idx + count; i++) {
+        shadow_pt_entry(st, pt, i)->mapping = m;
+        shadow_pt_set_used(pt, i);
+        shadow_pt_set_leaf(pt, i);
+    }
+    if (owner != NULL) {
+        owner->refs++;
+    }
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Helper function: Tops up the slabs of the shadow tables
+ *
+ * Called before touching the tables. The refill maps memory through
+ * paging_map_locked, which is safe as no table is half-updated yet.
+ */
+static void paging_slabs_refill(struct paging_state *st)
+{
+    errval_t err;
+    if (slab_needs_refill(&(st->slabs))) {
+        err = slab_refill(&(st->slabs));
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "paging.c/paging_slabs_refill: slab_refill");
+        }
+    }
+    if (slab_needs_refill(&(st->chunk_slabs))) {
+        err = slab_refill(&(st->chunk_slabs));
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "paging.c/paging_slabs_refill: slab_refill of chunks");
+        }
+    }
+    if (slab_needs_refill(&(st->mapping_slabs))) {
+        err = slab_refill(&(st->mapping_slabs));
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "paging.c/paging_slabs_refill: slab_refill of mappings");
+        }
+    }
+    if (slab_needs_refill(&(st->frame_slabs))) {
+        err = slab_refill(&(st->frame_slabs));
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "paging.c/paging_slabs_refill: slab_refill of frames");
+        }
+    }
+}
+
+/**
+ * \brief Helper function: Drops a reference to a frame the paging state
+ *        allocated, and frees the frame with the last one
+ */
+static void paging_frame_put(struct paging_state *st, struct paging_frame *owner)
+{
+    assert(owner->refs > 0);
+    if (--owner->refs > 0) {
+        return;
+    }
+    errval_t err = ram_free(owner->cap);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "paging.c/paging_frame_put: ram_free");
+    }
+    slab_free(&(st->frame_slabs), owner);
+}
+
+/**
+ * \brief Helper function: Maps `bytes` of a frame, starting at `frame_offset`
+ *        into it, at `vaddr`, with the paging state locked
+ *
+ * `owner` is the frame record if the paging state allocated the frame, or
+ * NULL.
+ */
+static errval_t paging_map_locked(struct paging_state *st, lvaddr_t vaddr,
+                                  struct capref frame, size_t frame_offset,
+                                  size_t bytes, int flags, struct paging_frame *owner)
+{
+    errval_t err;
+
+    if (vaddr % BASE_PAGE_SIZE != 0 || frame_offset % BASE_PAGE_SIZE != 0) {
+        return LIB_ERR_VREGION_BAD_ALIGNMENT;
+    }
+
+    struct frame_identity id;
+    err = frame_identify(frame, &id);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_PMAP_FRAME_IDENTIFY);
+    }
+    bytes = ROUND_UP(bytes, BASE_PAGE_SIZE);
+    if (frame_offset > id.bytes || bytes > id.bytes - frame_offset) {
+        return LIB_ERR_PMAP_FRAME_SIZE;
+    }
+    if ((flags & VREGION_FLAGS_LARGE) &&
+        (vaddr % LARGE_PAGE_SIZE != 0 || (id.base + frame_offset) % LARGE_PAGE_SIZE != 0 ||
+         bytes % LARGE_PAGE_SIZE != 0)) {
+        return LIB_ERR_VREGION_BAD_ALIGNMENT;
+    }
+
+    for (size_t offset = 0; offset < bytes; ) {
+        paging_slabs_refill(st);
+
+        lvaddr_t va = vaddr + offset;
+        genpaddr_t pa = id.base + frame_offset + offset;
+        int level = 3;
+        size_t size = BASE_PAGE_SIZE;
+        if (paging_block_fits(va, pa, bytes - offset, HUGE_PAGE_SIZE)) {
+            level = 1;
+            size = HUGE_PAGE_SIZE;
+        } else if (paging_block_fits(va, pa, bytes - offset, LARGE_PAGE_SIZE)) {
+            level = 2;
+            size = LARGE_PAGE_SIZE;
+        }
+
+        // Map as much as fits in this table with one invocation. A run of
+        // pages ends where the table does, which is where a block could start.
+        size_t idx = paging_index(va, level);
+        size_t count = MIN((bytes - offset) / size, PTABLE_ENTRIES - idx);
+
+        struct shadow_pt *pt;
+        err = shadow_pt_walk(st, va, level, flags & KPI_PAGING_FLAGS_MASK, &pt);
+        if (err_is_ok(err)) {
+            err = shadow_pt_map(st, pt, idx, count, frame, frame_offset + offset, flags,
+                                owner);
+        }
+        if (err_is_fail(err)) {
+            // Unmap the runs mapped so far, the range is either mapped as a
+            // whole or not at all
+            if (offset > 0) {
+                errval_t unmap_err = paging_unmap_range(st, vaddr, offset);
+                if (err_is_fail(unmap_err)) {
+                    DEBUG_ERR(unmap_err, "paging.c/paging_map_locked: paging_unmap_range");
+                }
+            }
+            return err;
+        }
+        offset += count * size;
+    }
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief map a user provided frame at user provided VA.
+ *
+ * Every part of the range that is aligned to 1 GiB or 2 MiB, both in the
+ * virtual and the physical address space, is mapped with a block, the rest
+ * with pages. Consecutive entries of one table are mapped with a single
+ * invocation, so a range takes about one per table. With VREGION_FLAGS_LARGE,
+ * a range that cannot be mapped with blocks alone is refused with
+ * LIB_ERR_VREGION_BAD_ALIGNMENT.
+ *
+ * With VREGION_FLAGS_COW, the frame is mapped read-only and may be mapped
+ * elsewhere, too. The first write to a page gives the page a private copy,
+ * writable if the flags allow writes. Writable mappings of the frame that
+ * are not copy-on-write still change it, paging_share_cow turns them into
+ * copy-on-write ones first. Only the fault handler of the domain that uses
+ * `st` makes the copies, so another domain gets its copy-on-write mappings
+ * through paging_map_cow_ranges, rather than having them mapped into its
+ * paging state.
+ *
+ * If mapping fails, the parts of the range that were mapped are unmapped
+ * again.
+ */
+errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
+                               struct capref frame, size_t bytes, int flags)
+{
+    thread_mutex_lock_nested(&st->mutex);
+    errval_t err = paging_map_locked(st, vaddr, frame, 0, bytes, flags, NULL);
+    thread_mutex_unlock(&st->mutex);
+    return err;
+}
+
+/**
+ * \brief Helper function: Maps `bytes` of a frame that the paging state
+ *        allocated at `vaddr`, and hands the frame over to the mapping
+ *
+ * Once it is unmapped, the frame is freed. The frame is also handed over if
+ * mapping fails, and freed, as a failed mapping leaves nothing mapped.
+ */
+static errval_t paging_map_owned(struct paging_state *st, lvaddr_t vaddr,
+                                 struct capref frame, size_t bytes, int flags)
+{
+    thread_mutex_lock_nested(&st->mutex);
+    paging_slabs_refill(st);
+    struct paging_frame *owner = slab_alloc(&(st->frame_slabs));
+    if (owner == NULL) {
+        thread_mutex_unlock(&st->mutex);
+        cap_destroy(frame);
+        return LIB_ERR_SLAB_ALLOC_FAIL;
+    }
+    owner->cap = frame;
+    // Hold a reference while mapping, so that a failure frees what is unused
+    owner->refs = 1;
+    errval_t err = paging_map_locked(st, vaddr, frame, 0, bytes, flags, owner);
+    paging_frame_put(st, owner);
+    thread_mutex_unlock(&st->mutex);
+    return err;
+}
+
+/**
+ * \brief Sets how many pages the fault handler maps per fault
+ *
+ * The window is aligned to its size and clipped to the faulting region, so a
+ * sequential pass over a lazy region faults once per window. Pages in the
+ * window that are mapped already are left alone.
+ *
+ * \param pages Pages per fault, 0 and 1 both map only the faulting page
+ */
+void paging_set_fault_around(struct paging_state *st, size_t pages)
+{
+    thread_mutex_lock_nested(&st->mutex);
+    st->fault_around = MAX(pages, 1);
+    thread_mutex_unlock(&st->mutex);
+}
+
+/**
+ * \brief Returns the page fault counters of a paging state
+ */
+void paging_get_fault_stats(struct paging_state *st, struct paging_fault_stats *ret)
+{
+    thread_mutex_lock_nested(&st->mutex);
+    *ret = st->fault_stats;
+    thread_mutex_unlock(&st->mutex);
+}
+
+/**
+ * \brief Helper function: Returns the mapping of the page or block at `vaddr`,
+ *        or NULL if nothing is mapped there
+ *
+ * \param ret_pt Returns the table that holds the mapping
+ * \param ret_level Returns the level of that table
+ */
+static struct shadow_pt_mapping *shadow_pt_find(struct paging_state *st, lvaddr_t vaddr,
+                                                struct shadow_pt **ret_pt, int *ret_level)
+{
+    struct shadow_pt *pt = &(st->shadow_pt);
+    for (int level = 0; level <= 3; level++) {
+        size_t idx = paging_index(vaddr, level);
+        if (!shadow_pt_used(pt, idx)) {
+            return NULL;
+        }
+        if (shadow_pt_leaf(pt, idx)) {
+            *ret_pt = pt;
+            *ret_level = level;
+            return shadow_pt_lookup(pt, idx)->mapping;
+        }
+        pt = shadow_pt_lookup(pt, idx)->child;
+    }
+    return NULL;
+}
+
+/**
+ * \brief Helper function: Returns whether a page or block maps `vaddr`
+ */
+static bool shadow_pt_is_mapped(struct paging_state *st, lvaddr_t vaddr)
+{
+    struct shadow_pt *pt;
+    int level;
+    return shadow_pt_find(st, vaddr, &pt, &level) != NULL;
+}
+
+/**
+ * \brief Helper function: Returns the lazy region that holds `vaddr`, or NULL
+ */
+static struct paging_region *paging_region_find_lazy(struct paging_state *st,
+                                                      lvaddr_t vaddr)
+{
+    for (struct paging_region *pr = st->regions; pr != NULL; pr = pr->next) {
+        if ((pr->flags & VREGION_FLAGS_LAZY) && vaddr >= pr->base_addr &&
+            vaddr - pr->base_addr < pr->region_size) {
+            return pr;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Helper function: Returns whether a region's flags allow the access
+ *        that faulted
+ */
+static bool paging_fault_allowed(paging_flags_t flags, int subtype)
+{
+    switch (subtype) {
+    case PAGEFLT_READ:
+        return flags & VREGION_FLAGS_READ;
+    case PAGEFLT_WRITE:
+        return flags & VREGION_FLAGS_WRITE;
+    case PAGEFLT_EXEC:
+        return flags & VREGION_FLAGS_EXECUTE;
+    default:
+        return false;
+    }
+}
+
+/**
+ * \brief Helper function: Gives the copy-on-write page at `page` a private
+ *        copy of its frame, after a write to it
+ *
+ * `m` is the copy-on-write mapping of `page`, in a table of `level`. If the
+ * copy cannot be mapped, the page is mapped copy-on-write again.
+ */
+static errval_t paging_cow_fault(struct paging_state *st, lvaddr_t page,
+                                 struct shadow_pt_mapping *m, int level)
+{
+    errval_t err;
+
+    // The shared frame is held on to until the copy replaces the page
+    size_t size = paging_level_size(level);
+    lvaddr_t start = ROUND_DOWN(page, size * PTABLE_ENTRIES) + m->entry * size;
+    struct shadow_pt_mapping old = *m;
+    old.offset += page - start;
+    old.flags &= ~VREGION_FLAGS_LARGE;
+    if (old.owner != NULL) {
+        old.owner->refs++;
+    }
+
+    struct capref frame;
+    size_t bytes;
+    err = frame_alloc(&frame, BASE_PAGE_SIZE, &bytes);
+    if (err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_FRAME_ALLOC);
+        goto out;
+    }
+
+    // Fill the copy through a second mapping, the page stays readable meanwhile
+    void *copy;
+    err = paging_map_frame_attr(st, &copy, BASE_PAGE_SIZE, frame,
+                                VREGION_FLAGS_READ_WRITE, NULL, NULL);
+    if (err_is_fail(err)) {
+        cap_destroy(frame);
+        goto out;
+    }
+    memcpy(copy, (void *)page, BASE_PAGE_SIZE);
+    err = paging_unmap(st, copy);
+    if (err_is_fail(err)) {
+        cap_destroy(frame);
+        goto out;
+    }
+
+    // Splits a block or a run of shared pages, the rest stays copy-on-write
+    err = paging_unmap_range(st, page, BASE_PAGE_SIZE);
+    if (err_is_fail(err)) {
+        cap_destroy(frame);
+        goto out;
+    }
+    err = paging_map_owned(st, page, frame, BASE_PAGE_SIZE,
+                           old.flags & ~VREGION_FLAGS_COW);
+    if (err_is_fail(err)) {
+        errval_t map_err = paging_map_locked(st, page, old.frame, old.offset,
+                                             BASE_PAGE_SIZE, old.flags, old.owner);
+        if (err_is_fail(map_err)) {
+            DEBUG_ERR(map_err, "paging.c/paging_cow_fault: mapping the page again");
+        }
+        goto out;
+    }
+
+    st->fault_stats.cow_pages++;
+
+out:
+    if (old.owner != NULL) {
+        paging_frame_put(st, old.owner);
+    }
+    return err;
+}
+
+/**
+ * \brief Helper function: Backs the page at `vaddr` with a new frame, or
+ *        copies it if it is copy-on-write and the access was a write
+ *
+ * The frame also backs the unmapped pages next to it in the fault-around
+ * window, so all of them take a single frame and mapping.
+ */
+static errval_t paging_handle_fault(struct paging_state *st, lvaddr_t vaddr,
+                                    int subtype)
+{
+    errval_t err = SYS_ERR_OK;
+    lvaddr_t page = ROUND_DOWN(vaddr, BASE_PAGE_SIZE);
+
+    thread_mutex_lock_nested(&st->mutex);
+
+    struct shadow_pt *pt;
+    int level;
+    struct shadow_pt_mapping *m = shadow_pt_find(st, page, &pt, &level);
+    if (m != NULL) {
+        if (!paging_fault_allowed(m->flags, subtype)) {
+            err = LIB_ERR_VREGION_PAGEFAULT_HANDLER;
+        } else if ((m->flags & VREGION_FLAGS_COW) && subtype == PAGEFLT_WRITE) {
+            err = paging_cow_fault(st, page, m, level);
+            if (err_is_fail(err)) {
+                err = err_push(err, LIB_ERR_VREGION_PAGEFAULT_HANDLER);
+            }
+        }
+        // Otherwise another thread mapped or copied the page first, retry
+        goto out;
+    }
+
+    struct paging_region *pr = paging_region_find_lazy(st, vaddr);
+    if (pr == NULL) {
+        err = LIB_ERR_VSPACE_PAGEFAULT_ADDR_NOT_FOUND;
+        goto out;
+    }
+    if (!paging_fault_allowed(pr->flags, subtype)) {
+        err = LIB_ERR_VREGION_PAGEFAULT_HANDLER;
+        goto out;
+    }
+    lvaddr_t base = pr->base_addr;
+    if (pr->flags & VREGION_FLAGS_GUARD) {
+        if (page == base) {
+            err = LIB_ERR_VSPACE_STACK_OVERFLOW;
+            goto out;
+        }
+        base += BASE_PAGE_SIZE;
+    }
+
+    size_t window = st->fault_around * BASE_PAGE_SIZE;
+    lvaddr_t start = MAX(page - page % window, base);
+    if (pr->flags & VREGION_FLAGS_GUARD) {
+        // Stacks grow down, keep some stack below the faulting page backed
+        start = MIN(start, page - MIN(page - base, PAGING_STACK_SLACK_BYTES));
+    }
+    lvaddr_t end = MIN(page - page % window + window,
+                       ROUND_UP(pr->base_addr + pr->region_size, BASE_PAGE_SIZE));
+    lvaddr_t lo = page;
+    lvaddr_t hi = page + BASE_PAGE_SIZE;
+    while (lo > start && !shadow_pt_is_mapped(st, lo - BASE_PAGE_SIZE)) {
+        lo -= BASE_PAGE_SIZE;
+    }
+    while (hi < end && !shadow_pt_is_mapped(st, hi)) {
+        hi += BASE_PAGE_SIZE;
+    }
+
+    struct capref frame;
+    size_t bytes;
+    err = frame_alloc(&frame, hi - lo, &bytes);
+    if (err_is_fail(err) && hi - lo > BASE_PAGE_SIZE) {
+        // Memory is short, back just the page that is needed
+        lo = page;
+        hi = page + BASE_PAGE_SIZE;
+        err = frame_alloc(&frame, hi - lo, &bytes);
+    }
+    if (err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_FRAME_ALLOC);
+        goto out;
+    }
+
+    err = paging_map_owned(st, lo, frame, hi - lo, pr->flags);
+    if (err_is_fail(err)) {
+        err = err_push(err, LIB_ERR_VREGION_PAGEFAULT_HANDLER);
+        goto out;
+    }
+
+    st->fault_stats.faults++;
+    st->fault_stats.pages += (hi - lo) / BASE_PAGE_SIZE;
+    st->fault_stats.around_pages += (hi - lo) / BASE_PAGE_SIZE - 1;
+
+out:
+    if (err_is_fail(err)) {
+        st->fault_stats.unhandled++;
+    }
+    thread_mutex_unlock(&st->mutex);
+    return err;
+}
+
+/**
+ * \brief Exception handler of every thread, backs lazy regions on first touch
+ *        and copies copy-on-write pages on first write
+ *
+ * Any other fault or exception is fatal for the domain.
+ */
+static void page_fault_handler(enum exception_type type, int subtype, void *addr,
+                               arch_registers_state_t *regs)
+{
+    if (type == EXCEPT_PAGEFAULT) {
+        errval_t err = paging_handle_fault(get_current_paging_state(),
+                                           (lvaddr_t)addr, subtype);
+        if (err_is_ok(err)) {
+            return;
+        }
+        DEBUG_ERR(err, "unhandled page fault (type %d) on %p at IP %p",
+                  subtype, addr, (void *)registers_get_ip(regs));
+    } else {
+        debug_printf("unhandled exception %d.%d on %p at IP %p\n", type, subtype,
+                     addr, (void *)registers_get_ip(regs));
+    }
+    abort();
+}
+
+/**
+ * \brief Flushes the TLB for [vaddr, vaddr + bytes) of a paging state
+ *
+ * Unmapping leaves the TLB alone, so that a range is flushed once rather than
+ * once per mapping.
+ */
+errval_t paging_tlb_flush_range(struct paging_state *st, lvaddr_t vaddr, size_t bytes)
+{
+    return invoke_vnode_flush_range(st->shadow_pt.s_pt_cap_root, vaddr, bytes);
+}
+
+/**
+ * \brief Helper function: Unmaps all entries of a mapping and deletes its cap,
+ *        leaving the TLB alone
+ */
+static errval_t shadow_pt_unmap(struct paging_state *st, struct shadow_pt *pt,
+                                struct shadow_pt_mapping *m)
+{
+    errval_t err;
+
+    err = vnode_unmap_noflush(pt->s_pt_cap_root, m->map);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "paging.c/shadow_pt_unmap: vnode_unmap fail");
+        return err_push(err, LIB_ERR_VNODE_UNMAP);
+    }
+    // The kernel detached the cap, deleting it does not touch the table again
+    err = cap_destroy(m->map);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "paging.c/shadow_pt_unmap: cap_destroy of mapping fail");
+    }
+    if (m->owner != NULL) {
+        paging_frame_put(st, m->owner);
+    }
+
+    for (size_t i = m->entry; i < m->entry + m->count; i++) {
+        shadow_pt_release(st, pt, i);
+    }
+    slab_free(&(st->mapping_slabs), m);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Helper function: Unmaps the empty table in entry `idx` of `parent`,
+ *        and returns its RAM
+ */
+static errval_t shadow_pt_free(struct paging_state *st, struct shadow_pt *parent,
+                               size_t idx)
+{
+    errval_t err;
+    struct shadow_pt *pt = shadow_pt_lookup(parent, idx)->child;
+    assert(shadow_pt_empty(pt));
+
+    err = vnode_unmap_noflush(parent->s_pt_cap_root, pt->s_pt_cap_map);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "paging.c/shadow_pt_free: vnode_unmap fail");
+        return err_push(err, LIB_ERR_VNODE_UNMAP);
+    }
+    shadow_pt_release(st, parent, idx);
+
+    // The table is gone from the tree, so failures below only leak
+    err = cap_destroy(pt->s_pt_cap_map);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "paging.c/shadow_pt_free: cap_destroy of mapping fail");
+    }
+    err = pt_free(st, pt->s_pt_cap_root, pt->s_pt_cap_ram);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "paging.c/shadow_pt_free: returning the table fail");
+    }
+    slab_free(&(st->slabs), pt);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Helper function: Makes sure that no mapping crosses `vaddr`, by
+ *        mapping the parts of one that does again, on either side
+ */
+static errval_t paging_split_locked(struct paging_state *st, lvaddr_t vaddr)
+{
+    errval_t err;
+    struct shadow_pt *pt;
+    int level;
+    struct shadow_pt_mapping *m = shadow_pt_find(st, vaddr, &pt, &level);
+    if (m == NULL) {
+        return SYS_ERR_OK;
+    }
+
+    size_t size = paging_level_size(level);
+    lvaddr_t start = ROUND_DOWN(vaddr, size * PTABLE_ENTRIES) + m->entry * size;
+    lvaddr_t end = start + m->count * size;
+    if (start == vaddr) {
+        return SYS_ERR_OK;
+    }
 
+    // Blocks cannot cross vaddr any more, so the parts may take pages. A
+    // frame of the paging state is held on to until the parts map it.
+    struct shadow_pt_mapping old = *m;
+    old.flags &= ~VREGION_FLAGS_LARGE;
+    if (old.owner != NULL) {
+        old.owner->refs++;
+    }
+    err = shadow_pt_unmap(st, pt, m);
+    if (err_is_ok(err)) {
+        err = paging_map_locked(st, start, old.frame, old.offset, vaddr - start,
+                                old.flags, old.owner);
+    }
+    if (err_is_ok(err)) {
+        err = paging_map_locked(st, vaddr, old.frame, old.offset + (vaddr - start),
+                                end - vaddr, old.flags, old.owner);
+    }
+    if (old.owner != NULL) {
+        paging_frame_put(st, old.owner);
+    }
     return err;
 }
 
 /**
- * \brief unmap a user provided frame, and return the VA of the mapped
- *        frame in `buf`.
- * NOTE: Implementing this function is optional.
+ * \brief Helper function: Unmaps everything in [start, end) below the table
+ *        `pt` of `level`, whose first entry translates `base`
+ *
+ * No mapping may cross start or end. Tables that are left empty are freed.
+ */
+static errval_t shadow_pt_unmap_range(struct paging_state *st, struct shadow_pt *pt,
+                                      int level, lvaddr_t base, lvaddr_t start,
+                                      lvaddr_t end)
+{
+    errval_t err;
+    size_t size = paging_level_size(level);
+    size_t last = (end - 1 - base) / size;
+
+    for (size_t idx = (start - base) / size; idx <= last; idx++) {
+        if (!shadow_pt_used(pt, idx)) {
+            continue;
+        }
+        union shadow_pt_entry *entry = shadow_pt_lookup(pt, idx);
+        if (shadow_pt_leaf(pt, idx)) {
+            struct shadow_pt_mapping *m = entry->mapping;
+            assert(m->entry == idx && m->entry + m->count - 1 <= last);
+            idx += m->count - 1;
+            err = shadow_pt_unmap(st, pt, m);
+            if (err_is_fail(err)) {
+                return err;
+            }
+            continue;
+        }
+
+        struct shadow_pt *child = entry->child;
+        lvaddr_t child_base = base + idx * size;
+        err = shadow_pt_unmap_range(st, child, level + 1, child_base,
+                                    MAX(start, child_base), MIN(end, child_base + size));
+        if (err_is_fail(err)) {
+            return err;
+        }
+        if (shadow_pt_empty(child)) {
+            err = shadow_pt_free(st, pt, idx);
+            if (err_is_fail(err)) {
+                return err;
+            }
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Unmaps everything in [vaddr, vaddr + bytes), and frees the page
+ *        tables that are left empty
+ *
+ * A mapping that reaches past either end is mapped again on the part outside
+ * of the range. The addresses stay allocated and the frames are left to
+ * their owner. The TLB is flushed once, for the whole range.
+ */
+errval_t paging_unmap_range(struct paging_state *st, lvaddr_t vaddr, size_t bytes)
+{
+    errval_t err;
+    lvaddr_t start = ROUND_DOWN(vaddr, BASE_PAGE_SIZE);
+    lvaddr_t end = ROUND_UP(vaddr + bytes, BASE_PAGE_SIZE);
+    if (bytes == 0) {
+        return SYS_ERR_OK;
+    }
+    if (end < start || end > PAGING_VADDR_LIMIT) {
+        return LIB_ERR_VSPACE_VREGION_NOT_FOUND;
+    }
+
+    thread_mutex_lock_nested(&st->mutex);
+    err = paging_split_locked(st, start);
+    if (err_is_ok(err) && end < PAGING_VADDR_LIMIT) {
+        err = paging_split_locked(st, end);
+    }
+    if (err_is_ok(err)) {
+        err = shadow_pt_unmap_range(st, &(st->shadow_pt), 0, 0, start, end);
+    }
+    // Also after a failure, part of the range may be unmapped already
+    errval_t flush_err = paging_tlb_flush_range(st, start, end - start);
+    thread_mutex_unlock(&st->mutex);
+
+    return err_is_fail(err) ? err : flush_err;
+}
+
+/**
+ * \brief Unmaps the range that paging_alloc, paging_map_frame_attr or
+ *        paging_region_init handed out at `region`, and frees its addresses
+ *
+ * Regions over the range are dropped. Frames are left to their owner, except
+ * the ones the paging state allocated itself, see struct paging_frame, which
+ * are freed.
  */
 errval_t paging_unmap(struct paging_state *st, const void *region)
 {
-    return LIB_ERR_NOT_IMPLEMENTED;
+    errval_t err;
+    lvaddr_t base;
+    size_t bytes;
+
+    thread_mutex_lock_nested(&st->mutex);
+    err = vaddr_tree_lookup(&st->vaddrs, (lvaddr_t)region, &base, &bytes);
+    if (err_is_ok(err) && base != (lvaddr_t)region) {
+        err = LIB_ERR_VSPACE_VREGION_NOT_FOUND;
+    }
+    if (err_is_fail(err)) {
+        goto out;
+    }
+
+    err = paging_unmap_range(st, base, bytes);
+    if (err_is_fail(err)) {
+        goto out;
+    }
+
+    for (struct paging_region **pr = &st->regions; *pr != NULL; ) {
+        if ((*pr)->base_addr >= base && (*pr)->base_addr - base < bytes) {
+            *pr = (*pr)->next;
+        } else {
+            pr = &(*pr)->next;
+        }
+    }
+    paging_vaddrs_refill(st);
+    err = vaddr_tree_free(&st->vaddrs, base, bytes);
+
+out:
+    thread_mutex_unlock(&st->mutex);
+    return err;
+}
+
+/**
+ * \brief Makes the mappings in [vaddr, vaddr + bytes) copy-on-write, and
+ *        describes them so that another domain can map them, too
+ *
+ * Writable mappings are made read-only in hardware. The first write to one
+ * of their pages, by this domain, gives the page a private copy, so neither
+ * side sees the writes of the other. A mapping that reaches past either end
+ * of the range is split first. Unmapped pages are skipped, a lazy region
+ * backs them with new frames later.
+ *
+ * Frames that the paging state allocated itself stay allocated until
+ * paging_unshare_cow is called on the records, even if this domain unmaps
+ * them. The records are meant for spawn, or anything else that sets up
+ * another domain: it copies each frame cap to the other domain, which then
+ * maps the records with paging_map_cow_ranges.
+ *
+ * \param ranges Filled with one record per mapping
+ * \param max Number of records that fit into `ranges`
+ * \param ret_count Returns the number of records
+ * \return LIB_ERR_VSPACE_COW_RANGES if more than `max` mappings are in the
+ *         range. The first `max` of them are shared then, see `ret_count`.
+ */
+errval_t paging_share_cow(struct paging_state *st, lvaddr_t vaddr, size_t bytes,
+                          struct paging_cow_range *ranges, size_t max, size_t *ret_count)
+{
+    errval_t err;
+    lvaddr_t start = ROUND_DOWN(vaddr, BASE_PAGE_SIZE);
+    lvaddr_t end = ROUND_UP(vaddr + bytes, BASE_PAGE_SIZE);
+    *ret_count = 0;
+    if (bytes == 0) {
+        return SYS_ERR_OK;
+    }
+    if (end < start || end > PAGING_VADDR_LIMIT) {
+        return LIB_ERR_VSPACE_VREGION_NOT_FOUND;
+    }
+
+    thread_mutex_lock_nested(&st->mutex);
+    err = paging_split_locked(st, start);
+    if (err_is_ok(err) && end < PAGING_VADDR_LIMIT) {
+        err = paging_split_locked(st, end);
+    }
+
+    for (lvaddr_t va = start; va < end && err_is_ok(err); ) {
+        struct shadow_pt *pt;
+        int level;
+        struct shadow_pt_mapping *m = shadow_pt_find(st, va, &pt, &level);
+        if (m == NULL) {
+            va += BASE_PAGE_SIZE;
+            continue;
+        }
+        size_t size = paging_level_size(level);
+        lvaddr_t mstart = ROUND_DOWN(va, size * PTABLE_ENTRIES) + m->entry * size;
+        if (*ret_count == max) {
+            err = LIB_ERR_VSPACE_COW_RANGES;
+            break;
+        }
+
+        if ((m->flags & VREGION_FLAGS_WRITE) && !(m->flags & VREGION_FLAGS_COW)) {
+            int kpi_flags = m->flags & KPI_PAGING_FLAGS_MASK & ~KPI_PAGING_FLAGS_WRITE;
+            err = invoke_mapping_modify_flags(m->map, 0, m->count, kpi_flags, mstart);
+            if (err_is_fail(err)) {
+                err = err_push(err, LIB_ERR_PMAP_MODIFY_FLAGS);
+                break;
+            }
+            m->flags |= VREGION_FLAGS_COW;
+        }
+        if (m->owner != NULL) {
+            m->owner->refs++;
+        }
+
+        struct paging_cow_range *r = &ranges[(*ret_count)++];
+        r->vaddr = mstart;
+        r->bytes = m->count * size;
+        r->frame = m->frame;
+        r->offset = m->offset;
+        r->flags = m->flags & ~VREGION_FLAGS_LARGE;
+        r->owner = m->owner;
+        va = mstart + r->bytes;
+    }
+    thread_mutex_unlock(&st->mutex);
+    return err;
+}
+
+/**
+ * \brief Drops the references paging_share_cow took on frames that the
+ *        paging state allocated, once the other domain is done with them
+ *
+ * Frames that are no longer mapped here are freed.
+ */
+void paging_unshare_cow(struct paging_state *st, struct paging_cow_range *ranges,
+                        size_t count)
+{
+    thread_mutex_lock_nested(&st->mutex);
+    for (size_t i = 0; i < count; i++) {
+        if (ranges[i].owner != NULL) {
+            paging_frame_put(st, ranges[i].owner);
+            ranges[i].owner = NULL;
+        }
+    }
+    thread_mutex_unlock(&st->mutex);
+}
+
+/**
+ * \brief Maps the ranges that another domain shared with paging_share_cow,
+ *        each at the address it has there
+ *
+ * This is how a domain learns about its copy-on-write mappings: its paging
+ * state records them like any other, and its fault handler copies a page on
+ * the first write. The frame caps in the records must be in this domain's
+ * cspace. The addresses are not reserved, they must lie outside of what
+ * paging_alloc hands out, or be reserved with paging_reserve first. If a
+ * range fails to map, the ranges mapped before it stay mapped.
+ */
+errval_t paging_map_cow_ranges(struct paging_state *st,
+                               const struct paging_cow_range *ranges, size_t count)
+{
+    errval_t err = SYS_ERR_OK;
+    thread_mutex_lock_nested(&st->mutex);
+    for (size_t i = 0; i < count && err_is_ok(err); i++) {
+        const struct paging_cow_range *r = &ranges[i];
+        paging_flags_t flags = r->flags;
+        if (flags & VREGION_FLAGS_WRITE) {
+            flags |= VREGION_FLAGS_COW;
+        }
+        err = paging_map_locked(st, r->vaddr, r->frame, r->offset, r->bytes, flags, NULL);
+    }
+    thread_mutex_unlock(&st->mutex);
+    return err;
 }
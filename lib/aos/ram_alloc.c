@@ -19,8 +19,14 @@
 /* remote (indirect through a channel) version of ram_alloc, for most domains */
 static errval_t ram_alloc_remote(struct capref *ret, size_t size, size_t alignment)
 {
-    //TODO(M3): Implement me!
-    return LIB_ERR_NOT_IMPLEMENTED;
+    return aos_rpc_get_ram_cap(aos_rpc_get_memory_channel(), size, alignment, ret, NULL);
+}
+
+/* remote version of ram_alloc_batch, with all requests of a batch in flight at once */
+static errval_t ram_alloc_remote_batch(struct capref *ret, size_t size, size_t alignment,
+                                       size_t count)
+{
+    return aos_rpc_get_ram_caps(aos_rpc_get_memory_channel(), size, alignment, count, ret);
 }
 
 
@@ -97,6 +103,81 @@ errval_t ram_alloc(struct capref *ret, size_t size)
     return ram_alloc_aligned(ret, size, BASE_PAGE_SIZE);
 }
 
+/**
+ * \brief Allocates `count` equally sized memory regions as RAM capabilities
+ *
+ * Uses the batch function of the local allocator if one is set, otherwise
+ * falls back to allocating the capabilities one by one. If one of them
+ * fails, the ones allocated before it are freed again.
+ *
+ * \param ret Array of `count` caprefs, filled-in with the allocated caps
+ * \param size Amount of RAM per capability, in bytes
+ * \param alignment Alignment of every capability
+ * \param count Number of capabilities to allocate
+ */
+errval_t ram_alloc_batch(struct capref *ret, size_t size, size_t alignment, size_t count)
+{
+    struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
+    if (ram_alloc_state->ram_alloc_batch_func != NULL) {
+        return ram_alloc_state->ram_alloc_batch_func(ret, size, alignment, count);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        errval_t err = ram_alloc_aligned(&ret[i], size, alignment);
+        if (err_is_fail(err)) {
+            // Give back what was allocated, the caller only sees the error
+            while (i-- > 0) {
+                ram_free(ret[i]);
+            }
+            return err;
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Returns whether a local allocator for zero-filled frames is set
+ */
+bool ram_alloc_has_frame(void)
+{
+    return get_ram_alloc_state()->ram_alloc_frame_func != NULL;
+}
+
+/**
+ * \brief Allocates a zero-filled Frame capability from the local allocator
+ *
+ * The allocator may hand out frames that were zeroed ahead of time, so no
+ * retype is needed on the caller's side.
+ *
+ * \param ret Pointer to capref struct, filled-in with the allocated frame
+ * \param size Size of the frame, in bytes
+ */
+errval_t ram_alloc_frame(struct capref *ret, size_t size)
+{
+    struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
+    if (ram_alloc_state->ram_alloc_frame_func == NULL) {
+        return LIB_ERR_NOT_IMPLEMENTED;
+    }
+    return ram_alloc_state->ram_alloc_frame_func(ret, size);
+}
+
+/**
+ * \brief Returns a RAM capability from ram_alloc to the local allocator
+ *
+ * Without a local free function, the capability is only destroyed, and the
+ * memory stays allocated.
+ *
+ * \param cap The capability, which must not have descendants any more
+ */
+errval_t ram_free(struct capref cap)
+{
+    struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
+    if (ram_alloc_state->ram_free_func != NULL) {
+        return ram_alloc_state->ram_free_func(cap);
+    }
+    return cap_destroy(cap);
+}
+
 errval_t ram_available(genpaddr_t *available, genpaddr_t *total)
 {
     // TODO: Implement protocol to check amount of ram available with memserv
@@ -114,6 +195,9 @@ void ram_alloc_init(void)
     ram_alloc_state->mem_connect_err  = 0;
     thread_mutex_init(&ram_alloc_state->ram_alloc_lock);
     ram_alloc_state->ram_alloc_func   = NULL;
+    ram_alloc_state->ram_alloc_batch_func = NULL;
+    ram_alloc_state->ram_alloc_frame_func = NULL;
+    ram_alloc_state->ram_free_func    = NULL;
     ram_alloc_state->default_minbase  = 0;
     ram_alloc_state->default_maxlimit = 0;
     ram_alloc_state->base_capnum      = 0;
@@ -132,9 +216,52 @@ errval_t ram_alloc_set(ram_alloc_func_t local_allocator)
     /* Special case */
     if (local_allocator != NULL) {
         ram_alloc_state->ram_alloc_func = local_allocator;
+        ram_alloc_state->ram_alloc_batch_func = NULL;
+        ram_alloc_state->ram_alloc_frame_func = NULL;
+        ram_alloc_state->ram_free_func = NULL;
         return SYS_ERR_OK;
     }
 
     ram_alloc_state->ram_alloc_func = ram_alloc_remote;
+    ram_alloc_state->ram_alloc_batch_func = ram_alloc_remote_batch;
+    ram_alloc_state->ram_alloc_frame_func = NULL;
+    ram_alloc_state->ram_free_func = NULL;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Set the batch allocation function of ram_alloc_batch
+ *
+ * If local_allocator is NULL, batches are allocated one cap at a time
+ * through the function set with ram_alloc_set.
+ */
+errval_t ram_alloc_set_batch(ram_alloc_batch_func_t local_allocator)
+{
+    struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
+    ram_alloc_state->ram_alloc_batch_func = local_allocator;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Set the allocator used by frame_alloc for zero-filled frames
+ *
+ * If local_allocator is NULL, frame_alloc retypes RAM from ram_alloc.
+ */
+errval_t ram_alloc_set_frame(ram_alloc_frame_func_t local_allocator)
+{
+    struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
+    ram_alloc_state->ram_alloc_frame_func = local_allocator;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Set the function that ram_free returns capabilities to
+ *
+ * If local_allocator is NULL, ram_free only destroys the capabilities.
+ */
+errval_t ram_alloc_set_free(ram_free_func_t local_allocator)
+{
+    struct ram_alloc_state *ram_alloc_state = get_ram_alloc_state();
+    ram_alloc_state->ram_free_func = local_allocator;
     return SYS_ERR_OK;
 }
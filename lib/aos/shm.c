@@ -0,0 +1,299 @@
+/**
+ * \file
+ * \brief Shared-memory buffer pools between two domains
+ *
+ * A region is one frame: the header with the indices of two rings, the slots
+ * of the rings, and the buffers from the next page boundary on. The producer
+ * takes indices from the free ring and puts (index, length) pairs on the
+ * full ring; the consumer does the reverse. Each index of a ring is written
+ * by one side only, so the rings need no locks, only acquire loads of the
+ * peer's index and release stores of the own one.
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <aos/aos.h>
+#include <aos/paging.h>
+#include <aos/shm.h>
+
+/// Largest number of buffers in a region, indices must fit the upper half of a slot
+#define SHM_MAX_BUFS (1UL << 20)
+
+static inline uint64_t shm_slot_pack(size_t idx, size_t len)
+{
+    return ((uint64_t)idx << 32) | len;
+}
+
+static inline size_t shm_slots_offset(void)
+{
+    return ROUND_UP(sizeof(struct shm_header), SHM_CACHE_LINE);
+}
+
+static inline size_t shm_bufs_offset(size_t buf_count)
+{
+    return ROUND_UP(shm_slots_offset() + 2 * buf_count * sizeof(uint64_t),
+                    BASE_PAGE_SIZE);
+}
+
+/**
+ * \brief Takes the next slot of `ring` on the side that reads it.
+ */
+static bool shm_ring_pop(struct shm_ring *ring, uint64_t *slots, size_t count,
+                         uint64_t *ret)
+{
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == tail || head - tail > count) {
+        // a head more than `count` ahead is the peer's fault, treat it as empty
+        return false;
+    }
+
+    *ret = slots[tail % count];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * \brief Puts a slot on `ring` on the side that writes it.
+ */
+static bool shm_ring_push(struct shm_ring *ring, uint64_t *slots, size_t count,
+                          uint64_t slot)
+{
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= count) {
+        return false;
+    }
+
+    slots[head % count] = slot;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void shm_region_setup(struct shm_region *shm, void *base, size_t buf_size,
+                             size_t buf_count)
+{
+    shm->header = base;
+    shm->full_slots = (uint64_t *)((char *)base + shm_slots_offset());
+    shm->free_slots = shm->full_slots + buf_count;
+    shm->bufs = (char *)base + shm_bufs_offset(buf_count);
+    shm->buf_size = buf_size;
+    shm->buf_count = buf_count;
+}
+
+/**
+ * \brief Creates a region of `buf_count` buffers of `buf_size` bytes, with
+ *        this domain as the producer
+ *
+ * \param shm        The region to initialize
+ * \param buf_size   Bytes per buffer, rounded up to a multiple of SHM_CACHE_LINE
+ * \param buf_count  Number of buffers
+ *
+ * Send shm->frame to the peer, which passes it to shm_attach().
+ */
+errval_t shm_create(struct shm_region *shm, size_t buf_size, size_t buf_count)
+{
+    errval_t err;
+
+    buf_size = ROUND_UP(buf_size, SHM_CACHE_LINE);
+    if (buf_size == 0 || buf_size > UINT32_MAX) {
+        return BULK_TRANSFER_ALLOC_BUFFER_SIZE;
+    }
+    if (buf_count == 0 || buf_count > SHM_MAX_BUFS) {
+        return BULK_TRANSFER_ALLOC_BUFFER_COUNT;
+    }
+
+    size_t bytes = shm_bufs_offset(buf_count) + buf_size * buf_count;
+    err = frame_alloc(&shm->frame, bytes, &shm->bytes);
+    if (err_is_fail(err)) {
+        return err_push(err, BULK_TRANSFER_MEM);
+    }
+
+    void *base;
+    err = paging_map_frame_attr(get_current_paging_state(), &base, shm->bytes,
+                                shm->frame, VREGION_FLAGS_READ_WRITE, NULL, NULL);
+    if (err_is_fail(err)) {
+        cap_destroy(shm->frame);
+        return err_push(err, BULK_TRANSFER_POOL_MAP);
+    }
+
+    shm_region_setup(shm, base, buf_size, buf_count);
+    shm->producer = true;
+
+    struct shm_header *header = shm->header;
+    header->buf_size = buf_size;
+    header->buf_count = buf_count;
+    header->full.head = header->full.tail = 0;
+    header->free.tail = 0;
+    for (size_t i = 0; i < buf_count; i++) {
+        shm->free_slots[i] = i;
+    }
+    header->free.head = buf_count;
+
+    // the peer checks the magic first, publish it last
+    __atomic_store_n(&header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Maps a region that a peer created, with this domain as the consumer
+ *
+ * \param shm    The region to initialize
+ * \param frame  The frame of the region, as received from the producer
+ *
+ * The region owns `frame` afterwards, shm_destroy() deletes it.
+ */
+errval_t shm_attach(struct shm_region *shm, struct capref frame)
+{
+    errval_t err;
+
+    struct frame_identity id;
+    err = frame_identify(frame, &id);
+    if (err_is_fail(err)) {
+        return err_push(err, BULK_TRANSFER_POOL_INVALD);
+    }
+    if (id.bytes < BASE_PAGE_SIZE) {
+        return BULK_TRANSFER_POOL_INVALD;
+    }
+
+    void *base;
+    err = paging_map_frame_attr(get_current_paging_state(), &base, id.bytes, frame,
+                                VREGION_FLAGS_READ_WRITE, NULL, NULL);
+    if (err_is_fail(err)) {
+        return err_push(err, BULK_TRANSFER_POOL_MAP);
+    }
+
+    // read the geometry once, the producer may change the header at any time
+    struct shm_header *header = base;
+    size_t buf_size = header->buf_size;
+    size_t buf_count = header->buf_count;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) {
+        err = BULK_TRANSFER_POOL_INVALD;
+    } else if (buf_size == 0 || buf_size % SHM_CACHE_LINE != 0) {
+        err = BULK_TRANSFER_ALLOC_BUFFER_SIZE;
+    } else if (buf_count == 0 || buf_count > SHM_MAX_BUFS
+               || shm_bufs_offset(buf_count) > id.bytes
+               || (id.bytes - shm_bufs_offset(buf_count)) / buf_size < buf_count) {
+        err = BULK_TRANSFER_ALLOC_BUFFER_COUNT;
+    }
+    if (err_is_fail(err)) {
+        paging_unmap(get_current_paging_state(), base);
+        return err;
+    }
+
+    shm->frame = frame;
+    shm->bytes = id.bytes;
+    shm_region_setup(shm, base, buf_size, buf_count);
+    shm->producer = false;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Unmaps a region and deletes this domain's copy of its frame
+ *
+ * The memory stays with the peer until it destroys its side too.
+ */
+errval_t shm_destroy(struct shm_region *shm)
+{
+    errval_t err;
+
+    err = paging_unmap(get_current_paging_state(), shm->header);
+    if (err_is_fail(err)) {
+        return err_push(err, BULK_TRANSFER_POOL_UNMAP);
+    }
+    shm->header = NULL;
+    shm->bufs = NULL;
+
+    return cap_destroy(shm->frame);
+}
+
+/**
+ * \brief Takes a free buffer to fill, on the producer side
+ *
+ * \return BULK_TRANSFER_NO_BUFFER if the consumer holds all of them.
+ */
+errval_t shm_buf_alloc(struct shm_region *shm, size_t *ret_idx, void **ret_buf)
+{
+    assert(shm->producer);
+
+    uint64_t slot;
+    if (!shm_ring_pop(&shm->header->free, shm->free_slots, shm->buf_count, &slot)) {
+        return BULK_TRANSFER_NO_BUFFER;
+    }
+    if (slot >= shm->buf_count) {
+        return BULK_TRANSFER_BUFFER_INVALID;
+    }
+
+    *ret_idx = slot;
+    *ret_buf = shm_buf(shm, slot);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Hands the first `len` bytes of buffer `idx` to the consumer
+ */
+errval_t shm_buf_send(struct shm_region *shm, size_t idx, size_t len)
+{
+    assert(shm->producer);
+
+    if (idx >= shm->buf_count || len > shm->buf_size) {
+        return BULK_TRANSFER_INVALID_ARGUMENT;
+    }
+    if (!shm_ring_push(&shm->header->full, shm->full_slots, shm->buf_count,
+                       shm_slot_pack(idx, len))) {
+        return BULK_TRANSFER_BUFFER_STATE;
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Takes the next buffer the producer sent, on the consumer side
+ *
+ * The buffer stays valid until it is passed to shm_buf_release().
+ *
+ * \return BULK_TRANSFER_NO_BUFFER if no buffer is pending.
+ */
+errval_t shm_buf_recv(struct shm_region *shm, size_t *ret_idx, void **ret_buf,
+                      size_t *ret_len)
+{
+    assert(!shm->producer);
+
+    uint64_t slot;
+    if (!shm_ring_pop(&shm->header->full, shm->full_slots, shm->buf_count, &slot)) {
+        return BULK_TRANSFER_NO_BUFFER;
+    }
+
+    size_t idx = slot >> 32;
+    size_t len = slot & 0xffffffff;
+    if (idx >= shm->buf_count || len > shm->buf_size) {
+        return BULK_TRANSFER_BUFFER_INVALID;
+    }
+
+    *ret_idx = idx;
+    *ret_buf = shm_buf(shm, idx);
+    *ret_len = len;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Returns buffer `idx` to the producer once the consumer is done with it
+ */
+errval_t shm_buf_release(struct shm_region *shm, size_t idx)
+{
+    assert(!shm->producer);
+
+    if (idx >= shm->buf_count) {
+        return BULK_TRANSFER_INVALID_ARGUMENT;
+    }
+    if (!shm_ring_push(&shm->header->free, shm->free_slots, shm->buf_count, idx)) {
+        return BULK_TRANSFER_BUFFER_STATE;
+    }
+    return SYS_ERR_OK;
+}
@@ -25,6 +25,9 @@ struct block_head {
 
 STATIC_ASSERT_SIZEOF(struct block_head, SLAB_BLOCK_HDRSIZE);
 
+/// Without watermarks, slab_alloc refills once fewer blocks are free
+#define SLAB_INLINE_REFILL_MIN 7
+
 /**
  * \brief Initialise a new slab allocator
  *
@@ -39,6 +42,71 @@ void slab_init(struct slab_allocator *slabs, size_t blocksize,
     slabs->blocksize = SLAB_REAL_BLOCKSIZE(blocksize);
     slabs->refill_func = refill_func;
     slabs->is_refilling = false;
+    slabs->low_watermark = 0;
+    slabs->high_watermark = 0;
+}
+
+/**
+ * \brief Switches a slab allocator to refilling at watermarks
+ *
+ * slab_alloc then no longer refills while free blocks are left, as the
+ * refill may need the very allocator that is in the middle of using the
+ * slab. Instead, the owner calls slab_refill at a point where it holds no
+ * half-updated state, whenever slab_needs_refill says so. The `low` free
+ * blocks that are left must cover everything allocated while refilling.
+ *
+ * \param slabs Pointer to slab allocator instance
+ * \param low Number of free blocks below which a refill is due
+ * \param high Number of free blocks a refill tops up to, at least `low`
+ */
+void slab_set_watermarks(struct slab_allocator *slabs, size_t low, size_t high)
+{
+    assert(low <= high);
+    slabs->low_watermark = low;
+    slabs->high_watermark = high;
+}
+
+/**
+ * \brief Returns whether the free blocks fell below the low watermark
+ *
+ * \param slabs Pointer to slab allocator instance
+ */
+bool slab_needs_refill(struct slab_allocator *slabs)
+{
+    return !slabs->is_refilling && slab_freecount(slabs) < slabs->low_watermark;
+}
+
+/**
+ * \brief Refills the slab allocator up to its high watermark
+ *
+ * Calls the refill function until enough blocks are free. Nested calls made
+ * while the refill function runs return right away.
+ *
+ * \param slabs Pointer to slab allocator instance
+ */
+errval_t slab_refill(struct slab_allocator *slabs)
+{
+    if (slabs->is_refilling) {
+        return SYS_ERR_OK;
+    }
+
+    size_t freecount = slab_freecount(slabs);
+    while (freecount < slabs->high_watermark) {
+        errval_t err = slabs->refill_func != NULL ? slabs->refill_func(slabs)
+                                                  : slab_default_refill(slabs);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        // Stop if the refill function did not add anything
+        size_t new_freecount = slab_freecount(slabs);
+        if (new_freecount <= freecount) {
+            break;
+        }
+        freecount = new_freecount;
+    }
+
+    return SYS_ERR_OK;
 }
 
 
@@ -87,9 +155,8 @@ void slab_grow(struct slab_allocator *slabs, void *buf, size_t buflen)
 void *slab_alloc(struct slab_allocator *slabs)
 {
     errval_t err;
-    /* refill if needed */
-    size_t free_cnt_old = slab_freecount(slabs);
-    if (free_cnt_old < 7) {
+    /* refill if needed, with watermarks this is up to the owner */
+    if (slabs->low_watermark == 0 && slab_freecount(slabs) < SLAB_INLINE_REFILL_MIN) {
         err = slab_default_refill(slabs);
         if (err_is_fail(err)) {
             DEBUG_ERR(err, "slab.c/slab_alloc: slab refill_func failed");
@@ -200,7 +267,7 @@ static errval_t slab_refill_pages(struct slab_allocator *slabs, size_t bytes)
     slabs->is_refilling = true;
 
     struct capref frame;
-    static lvaddr_t vaddr = (VADDR_OFFSET + 0x1000);   // Arbitrary address
+    void *buf;
 
     err = frame_alloc(&frame, bytes, &bytes);
     if (err_is_fail(err)) {
@@ -208,14 +275,14 @@ static errval_t slab_refill_pages(struct slab_allocator *slabs, size_t bytes)
         goto out;
     }
 
-    err = paging_map_fixed_attr(get_current_paging_state(), vaddr, frame, bytes, VREGION_FLAGS_READ_WRITE);
+    err = paging_map_frame_attr(get_current_paging_state(), &buf, bytes, frame,
+                                VREGION_FLAGS_READ_WRITE, NULL, NULL);
     if (err_is_fail(err)) {
-        DEBUG_ERR(err, "slab.c/slab_refill_pages: paging_map_fixed_attr fail");
+        DEBUG_ERR(err, "slab.c/slab_refill_pages: paging_map_frame_attr fail");
         goto out;
     }
 
-    slab_grow(slabs, (void *) vaddr, bytes);
-    vaddr += 0x1000;     // Next entry in pt_l3
+    slab_grow(slabs, buf, bytes);
 
 out:
     slabs->is_refilling = false;
@@ -225,12 +292,13 @@ out:
 /**
  * \brief General-purpose implementation of a slab allocate/refill function
  *
- * Allocates and maps a single page (FIXME: make configurable) and adds it
- * to the allocator.
+ * Allocates and maps a single page, or as many as it takes to hold one
+ * block, and adds it to the allocator.
  *
  * \param slabs Pointer to slab allocator instance
  */
 errval_t slab_default_refill(struct slab_allocator *slabs)
 {
-    return slab_refill_pages(slabs, BASE_PAGE_SIZE);
+    return slab_refill_pages(slabs, ROUND_UP(SLAB_STATIC_SIZE(1, slabs->blocksize),
+                                             BASE_PAGE_SIZE));
 }
@@ -327,7 +327,17 @@ static void free_thread(struct thread *thread)
     ldt_free_segment(thread->thread_seg_selector);
 #endif
 
-    free(thread->stack);
+    struct paging_state *st = get_current_paging_state();
+    errval_t err = paging_unmap(st, (void *)thread->stack_region.base_addr);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "free_thread: unmapping the stack");
+    }
+    if (thread->paging_exception_stack != NULL) {
+        err = paging_unmap(st, thread->paging_exception_stack);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "free_thread: unmapping the exception stack");
+        }
+    }
     if (thread->tls_dtv != NULL) {
         free(thread->tls_dtv);
     }
@@ -344,6 +354,9 @@ static void free_thread(struct thread *thread)
 /**
  * \brief Creates a new thread that will not be runnable
  *
+ * The stack only reserves `stacksize` bytes of addresses, with a guard page
+ * below them. Pages are backed as the stack grows into them.
+ *
  * \param start_func Function to run on the new thread
  * \param arg Argument to pass to function
  * \param stacksize Size of stack, in bytes
@@ -353,12 +366,7 @@ static void free_thread(struct thread *thread)
 struct thread *thread_create_unrunnable(thread_func_t start_func, void *arg,
                                         size_t stacksize)
 {
-    // allocate stack
     assert((stacksize % sizeof(uintptr_t)) == 0);
-    void *stack = malloc(stacksize);
-    if (stack == NULL) {
-        return NULL;
-    }
 
     // allocate space for TCB + initial TLS data
     // no mutex as it may deadlock: see comment for thread_slabs_spinlock
@@ -368,7 +376,6 @@ struct thread *thread_create_unrunnable(thread_func_t start_func, void *arg,
     release_spinlock(&thread_slabs_spinlock);
     // thread_mutex_unlock(&thread_slabs_mutex);
     if (space == NULL) {
-        free(stack);
         return NULL;
     }
 
@@ -382,6 +389,19 @@ struct thread *thread_create_unrunnable(thread_func_t start_func, void *arg,
     thread_init(curdispatcher(), newthread);
     newthread->slab = space;
 
+    // allocate stack
+    void *stack;
+    errval_t err = paging_region_init_stack(get_current_paging_state(),
+                                            &newthread->stack_region, stacksize,
+                                            &stack);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "error allocating stack for new thread");
+        acquire_spinlock(&thread_slabs_spinlock);
+        slab_free(&thread_slabs, space);
+        release_spinlock(&thread_slabs_spinlock);
+        return NULL;
+    }
+
     if (tls_block_total_len > 0) {
         // populate initial TLS data from pristine copy
         assert(tls_block_init_len <= tls_block_total_len);
@@ -403,26 +423,22 @@ struct thread *thread_create_unrunnable(thread_func_t start_func, void *arg,
     // FIXME: make arch-specific
 #if defined(__x86_64__) || defined(__k1om__)
     // create segment for TCB
-    errval_t err = ldt_alloc_segment(newthread, &newthread->thread_seg_selector);
+    err = ldt_alloc_segment(newthread, &newthread->thread_seg_selector);
     if (err_is_fail(err)) {
         DEBUG_ERR(err, "error allocating LDT segment for new thread");
         free_thread(newthread);
-        free(stack);
         return NULL;
     }
 #endif
 
     // init stack
     newthread->stack = stack;
-    newthread->stack_top = (char *)stack + stacksize;
-
-    // waste space for alignment, if malloc gave us an unaligned stack
-    newthread->stack_top = (char *)newthread->stack_top
-        - (lvaddr_t)newthread->stack_top % STACK_ALIGNMENT;
+    newthread->stack_top = (char *)stack + ROUND_UP(stacksize, BASE_PAGE_SIZE);
 
     static uintptr_t thread_id = 1;
     newthread->id = thread_id ++;
 
+    newthread->paging_exception_stack = NULL;
     paging_init_onthread(newthread);
 
 
@@ -0,0 +1,364 @@
+/**
+ * \file
+ * \brief Bidirectional UMP channel
+ *
+ * The frame is split in two halves, one ring per direction. Each half is a
+ * run of message slots followed by the ack lines of that ring. The side that
+ * passes `first` sends on the lower half, the other one on the upper half.
+ *
+ * An adaptive receiver that blocks sets the armed line of its ring, fences,
+ * and looks at the ring once more. The sender publishes a message, fences,
+ * and looks at the armed line. So either the receiver sees the message, or
+ * the sender sees the line and rings the doorbell: an interrupt on the
+ * receiver's core, delivered to an endpoint of its dispatcher. The
+ * dispatcher drains the endpoint whenever it polls its channels, and takes
+ * the blocked channels that have a message from there.
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <aos/aos.h>
+#include <aos/ump_chan.h>
+#include <aos/waitset_chan.h>
+#include <aos/inthandler.h>
+#include <aos/kernel_cap_invocations.h>
+#include "waitset_chan_priv.h"
+
+/// This dispatcher's doorbell, NULL until ump_chan_doorbell_init()
+static struct lmp_endpoint *doorbell;
+
+/// Channels of this dispatcher that wait for the doorbell
+static struct ump_chan *blocked_chans;
+
+static void ump_ring_init(struct ump_ring *ring, void *base, size_t bytes)
+{
+    ring->count = (bytes - sizeof(struct ump_ack)) / UMP_MSG_BYTES;
+    ring->slots = base;
+    ring->ack = (struct ump_ack *)&ring->slots[ring->count];
+}
+
+static inline struct ump_chan *ump_chan_of(struct waitset_chanstate *chan)
+{
+    return (struct ump_chan *)((char *)chan - offsetof(struct ump_chan, recv_waitset));
+}
+
+/// Takes a channel off the list of blocked ones, must be called when disabled
+static void ump_chan_unblock_disabled(struct ump_chan *uc)
+{
+    if (!uc->blocked) {
+        return;
+    }
+    for (struct ump_chan **p = &blocked_chans; *p != NULL; p = &(*p)->blocked_next) {
+        if (*p == uc) {
+            *p = uc->blocked_next;
+            break;
+        }
+    }
+    uc->blocked = false;
+    uc->blocked_next = NULL;
+    __atomic_store_n(&uc->recv.ack->armed, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief Initialises one side of a channel in a frame both sides have mapped
+ *
+ * \param uc     Channel
+ * \param buf    Where the frame is mapped, aligned to UMP_MSG_BYTES
+ * \param bytes  Size of the frame, a multiple of 2 * UMP_MSG_BYTES, and at
+ *               least 6 * UMP_MSG_BYTES
+ * \param first  Whether this is the side that sends on the lower half
+ *
+ * The frame must be zeroed before either side uses the channel.
+ */
+errval_t ump_chan_init(struct ump_chan *uc, void *buf, size_t bytes, bool first)
+{
+    if ((lvaddr_t)buf % UMP_MSG_BYTES != 0) {
+        return LIB_ERR_UMP_BUFADDR_INVALID;
+    }
+    if (bytes % (2 * UMP_MSG_BYTES) != 0) {
+        return LIB_ERR_UMP_BUFSIZE_INVALID;
+    }
+    if (bytes / 2 < sizeof(struct ump_ack) + UMP_MSG_BYTES) {
+        // every ring needs one slot besides its ack lines
+        return LIB_ERR_UMP_FRAME_OVERFLOW;
+    }
+
+    size_t half = bytes / 2;
+    char *lower = buf;
+    char *upper = lower + half;
+    ump_ring_init(&uc->send, first ? lower : upper, half);
+    ump_ring_init(&uc->recv, first ? upper : lower, half);
+    uc->send_seq = uc->send_acked = 0;
+    uc->recv_seq = uc->recv_acked = 0;
+    uc->adaptive = uc->blocked = false;
+    uc->peer_core = 0;
+    uc->spin_time = uc->spin_start = 0;
+    uc->blocked_next = NULL;
+    memset(&uc->stats, 0, sizeof(uc->stats));
+    waitset_chanstate_init(&uc->recv_waitset, CHANTYPE_UMP_IN);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Stops receiving on a channel; the frame stays with the caller
+ */
+void ump_chan_destroy(struct ump_chan *uc)
+{
+    dispatcher_handle_t handle = disp_disable();
+    ump_chan_unblock_disabled(uc);
+    disp_enable(handle);
+
+    waitset_chanstate_destroy(&uc->recv_waitset);
+}
+
+/**
+ * \brief Sets up the doorbell of this dispatcher, so that its adaptive
+ *        channels can block
+ *
+ * The doorbell is an endpoint connected to UMP_DOORBELL_SGI of this core.
+ * Each core has one such vector, so one dispatcher per core can have a
+ * doorbell. Needs cap_irq.
+ */
+errval_t ump_chan_doorbell_init(void)
+{
+    errval_t err;
+
+    if (doorbell != NULL) {
+        return SYS_ERR_OK;
+    }
+
+    struct capref dest;
+    err = inthandler_alloc_dest_irq_cap(UMP_DOORBELL_SGI, &dest);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_UMP_DOORBELL_INIT);
+    }
+
+    // a doorbell carries nothing, one buffered message is all it needs
+    struct capref epcap;
+    struct lmp_endpoint *ep;
+    err = endpoint_create(LMP_RECV_LENGTH, &epcap, &ep);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_ENDPOINT_CREATE);
+    }
+
+    err = invoke_irqdest_connect(dest, epcap);
+    if (err_is_fail(err)) {
+        lmp_endpoint_free(ep);
+        return err_push(err, LIB_ERR_UMP_DOORBELL_INIT);
+    }
+
+    doorbell = ep;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Lets the receiver of a channel block after polling for a while
+ *
+ * \param uc         Channel
+ * \param peer_core  Core of the peer, whose doorbell this side rings
+ * \param spin_ns    How long to poll an empty ring before blocking, 0 to
+ *                   block right away
+ *
+ * Both sides must call it, each with the core of the other, before the
+ * first message. The receiver only blocks once its dispatcher has a
+ * doorbell, see ump_chan_doorbell_init(); ringing the peer's takes cap_ipi.
+ */
+void ump_chan_set_adaptive(struct ump_chan *uc, coreid_t peer_core, uint64_t spin_ns)
+{
+    uc->adaptive = true;
+    uc->peer_core = peer_core;
+    uc->spin_time = ns_to_systime(spin_ns);
+}
+
+/**
+ * \brief Sends a message
+ *
+ * \return LIB_ERR_UMP_CHAN_FULL if the peer has not taken enough messages
+ *         yet, try again later.
+ */
+errval_t ump_chan_send(struct ump_chan *uc, const uint64_t words[UMP_MSG_WORDS])
+{
+    if (uc->send_seq - uc->send_acked >= uc->send.count) {
+        // only look at the peer's line when the ring seems full
+        uc->send_acked = __atomic_load_n(&uc->send.ack->seq, __ATOMIC_ACQUIRE);
+        if (uc->send_seq - uc->send_acked >= uc->send.count) {
+            return LIB_ERR_UMP_CHAN_FULL;
+        }
+    }
+
+    struct ump_msg *msg = &uc->send.slots[uc->send_seq % uc->send.count];
+    for (size_t i = 0; i < UMP_MSG_WORDS; i++) {
+        msg->words[i] = words[i];
+    }
+    uc->send_seq++;
+    // the payload must be visible before the sequence number that validates it
+    __atomic_store_n(&msg->seq, uc->send_seq, __ATOMIC_RELEASE);
+
+    if (uc->adaptive) {
+        // orders the message before the armed line, see the top of the file
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&uc->send.ack->armed, __ATOMIC_RELAXED) != 0
+            && __atomic_exchange_n(&uc->send.ack->armed, 0, __ATOMIC_RELAXED) != 0) {
+            errval_t err = invoke_ipi_notify(uc->peer_core, UMP_DOORBELL_SGI);
+            if (err_is_fail(err)) {
+                // the message is sent, failing the call would send it twice
+                DEBUG_ERR(err_push(err, LIB_ERR_UMP_DOORBELL), "ump_chan_send");
+            } else {
+                uc->stats.doorbells++;
+            }
+        }
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Receives a message
+ *
+ * \return LIB_ERR_NO_UMP_MSG if there is none.
+ */
+errval_t ump_chan_recv(struct ump_chan *uc, uint64_t words[UMP_MSG_WORDS])
+{
+    if (!ump_chan_can_recv(uc)) {
+        return LIB_ERR_NO_UMP_MSG;
+    }
+
+    struct ump_msg *msg = &uc->recv.slots[uc->recv_seq % uc->recv.count];
+    for (size_t i = 0; i < UMP_MSG_WORDS; i++) {
+        words[i] = msg->words[i];
+    }
+    uc->recv_seq++;
+
+    // acknowledge in batches, the sender only waits for it once the ring is full
+    if (uc->recv_seq - uc->recv_acked >= MAX(uc->recv.count / 4, 1)) {
+        uc->recv_acked = uc->recv_seq;
+        __atomic_store_n(&uc->recv.ack->seq, uc->recv_seq, __ATOMIC_RELEASE);
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Register an event handler to be notified when messages can be received
+ *
+ * In the future, call the closure on the given waitset when a message can be
+ * received on the channel. A channel may only be registered with a single
+ * receive event handler on a single waitset at any one time.
+ *
+ * \param uc UMP channel
+ * \param ws Waitset
+ * \param closure Event handler
+ */
+errval_t ump_chan_register_recv(struct ump_chan *uc, struct waitset *ws,
+                                struct event_closure closure)
+{
+    if (ump_chan_can_recv(uc)) {
+        uc->stats.polled++;
+        return waitset_chan_trigger_closure(ws, &uc->recv_waitset, closure);
+    }
+    uc->spin_start = systime_now();
+    return waitset_chan_register_polled(ws, &uc->recv_waitset, closure);
+}
+
+/**
+ * \brief Cancel an event registration made with ump_chan_register_recv()
+ *
+ * \param uc UMP channel
+ */
+errval_t ump_chan_deregister_recv(struct ump_chan *uc)
+{
+    dispatcher_handle_t handle = disp_disable();
+    ump_chan_unblock_disabled(uc);
+    errval_t err = waitset_chan_deregister_disabled(&uc->recv_waitset, handle);
+    disp_enable(handle);
+    return err;
+}
+
+/**
+ * \brief Checks a polled channel, called by the dispatcher when disabled
+ *
+ * Triggers the channel if it can receive. An adaptive channel that has
+ * polled for long enough blocks instead: it stops being polled until the
+ * doorbell rings.
+ *
+ * \return Whether the channel left the polled queue.
+ */
+bool ump_chan_poll_disabled(struct waitset_chanstate *chan, dispatcher_handle_t handle)
+{
+    struct ump_chan *uc = ump_chan_of(chan);
+    errval_t err;
+
+    if (!ump_chan_can_recv(uc)) {
+        if (!uc->adaptive || doorbell == NULL
+            || systime_now() - uc->spin_start < uc->spin_time) {
+            return false;
+        }
+
+        // arm, then look once more, see the top of the file
+        __atomic_store_n(&uc->recv.ack->armed, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!ump_chan_can_recv(uc)) {
+            err = waitset_chan_stop_polling_disabled(chan, handle);
+            assert_disabled(err_is_ok(err));
+            uc->blocked = true;
+            uc->blocked_next = blocked_chans;
+            blocked_chans = uc;
+            uc->stats.blocks++;
+            return true;
+        }
+        // the peer may still ring, the doorbell just finds nothing then
+        __atomic_store_n(&uc->recv.ack->armed, 0, __ATOMIC_RELAXED);
+    }
+
+    uc->stats.polled++;
+    err = waitset_chan_trigger_disabled(chan, handle);
+    assert_disabled(err_is_ok(err));
+    return true;
+}
+
+/**
+ * \brief Wakes the blocked channels if the doorbell rang, called by the
+ *        dispatcher when disabled
+ *
+ * Channels with a message are triggered. The ones whose sender took the
+ * armed line but whose message is not visible yet go back to polling. The
+ * others keep waiting.
+ */
+void ump_chan_wake_disabled(dispatcher_handle_t handle)
+{
+    if (doorbell == NULL || !lmp_endpoint_can_recv(doorbell)) {
+        return;
+    }
+    // the messages are empty, skipping them is all it takes to drain them
+    doorbell->k.consumed = doorbell->k.delivered;
+
+    struct ump_chan *uc = blocked_chans;
+    blocked_chans = NULL;
+    while (uc != NULL) {
+        struct ump_chan *next = uc->blocked_next;
+        errval_t err = SYS_ERR_OK;
+
+        if (ump_chan_can_recv(uc)) {
+            uc->blocked = false;
+            uc->blocked_next = NULL;
+            __atomic_store_n(&uc->recv.ack->armed, 0, __ATOMIC_RELAXED);
+            uc->stats.wakeups++;
+            err = waitset_chan_trigger_disabled(&uc->recv_waitset, handle);
+        } else if (__atomic_load_n(&uc->recv.ack->armed, __ATOMIC_RELAXED) == 0) {
+            uc->blocked = false;
+            uc->blocked_next = NULL;
+            uc->spin_start = systime_now();
+            err = waitset_chan_start_polling_disabled(&uc->recv_waitset, handle);
+        } else {
+            uc->blocked_next = blocked_chans;
+            blocked_chans = uc;
+        }
+        assert_disabled(err_is_ok(err));
+        uc = next;
+    }
+}
@@ -0,0 +1,385 @@
+/**
+ * \file
+ * \brief Allocator of virtual address ranges
+ *
+ * The tree holds the allocated ranges. A free range is the gap in front of
+ * the range that follows it, or the tail behind the last range. Each node
+ * caches the largest gap in its subtree, which is recomputed together with
+ * the height whenever the subtree changes.
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <aos/aos.h>
+#include <aos/vaddr_tree.h>
+
+static inline int vaddr_tree_height(struct vaddr_node *node)
+{
+    return node == NULL ? 0 : node->height;
+}
+
+static inline size_t vaddr_tree_max_gap(struct vaddr_node *node)
+{
+    return node == NULL ? 0 : node->max_gap;
+}
+
+static inline void vaddr_tree_update(struct vaddr_node *node)
+{
+    node->height = 1 + MAX(vaddr_tree_height(node->left), vaddr_tree_height(node->right));
+    node->max_gap = MAX(node->gap, MAX(vaddr_tree_max_gap(node->left),
+                                       vaddr_tree_max_gap(node->right)));
+}
+
+static struct vaddr_node *vaddr_tree_rotate_right(struct vaddr_node *node)
+{
+    struct vaddr_node *l = node->left;
+    node->left = l->right;
+    l->right = node;
+    vaddr_tree_update(node);
+    vaddr_tree_update(l);
+    return l;
+}
+
+static struct vaddr_node *vaddr_tree_rotate_left(struct vaddr_node *node)
+{
+    struct vaddr_node *r = node->right;
+    node->right = r->left;
+    r->left = node;
+    vaddr_tree_update(node);
+    vaddr_tree_update(r);
+    return r;
+}
+
+/**
+ * \brief Helper function: Restores the AVL property of a subtree
+ *
+ * \param node Root of a subtree whose children differ in height by at most 2
+ *
+ * \returns The new root of the subtree
+ */
+static struct vaddr_node *vaddr_tree_balance(struct vaddr_node *node)
+{
+    vaddr_tree_update(node);
+    int balance = vaddr_tree_height(node->left) - vaddr_tree_height(node->right);
+
+    if (balance > 1) {
+        if (vaddr_tree_height(node->left->left) < vaddr_tree_height(node->left->right)) {
+            node->left = vaddr_tree_rotate_left(node->left);
+        }
+        return vaddr_tree_rotate_right(node);
+    }
+    if (balance < -1) {
+        if (vaddr_tree_height(node->right->right) < vaddr_tree_height(node->right->left)) {
+            node->right = vaddr_tree_rotate_right(node->right);
+        }
+        return vaddr_tree_rotate_left(node);
+    }
+    return node;
+}
+
+/**
+ * \brief Helper function: Inserts a node as a leaf and rebalances
+ *
+ * \param root Root of the (sub)tree
+ * \param node The node, its base must not be in the tree yet
+ *
+ * \returns The new root of the (sub)tree
+ */
+static struct vaddr_node *vaddr_tree_insert(struct vaddr_node *root,
+                                            struct vaddr_node *node)
+{
+    if (root == NULL) {
+        node->left = NULL;
+        node->right = NULL;
+        vaddr_tree_update(node);
+        return node;
+    }
+
+    assert(node->base != root->base);
+    if (node->base < root->base) {
+        root->left = vaddr_tree_insert(root->left, node);
+    } else {
+        root->right = vaddr_tree_insert(root->right, node);
+    }
+    return vaddr_tree_balance(root);
+}
+
+static struct vaddr_node *vaddr_tree_remove_min(struct vaddr_node *root,
+                                                struct vaddr_node **ret_min)
+{
+    if (root->left == NULL) {
+        *ret_min = root;
+        return root->right;
+    }
+    root->left = vaddr_tree_remove_min(root->left, ret_min);
+    return vaddr_tree_balance(root);
+}
+
+/**
+ * \brief Helper function: Removes the node with the given base
+ *
+ * \param root Root of the (sub)tree
+ * \param base Base address of the node, must be in the tree
+ *
+ * \returns The new root of the (sub)tree
+ */
+static struct vaddr_node *vaddr_tree_remove(struct vaddr_node *root, lvaddr_t base)
+{
+    assert(root != NULL);
+
+    if (base < root->base) {
+        root->left = vaddr_tree_remove(root->left, base);
+    } else if (base > root->base) {
+        root->right = vaddr_tree_remove(root->right, base);
+    } else {
+        if (root->left == NULL || root->right == NULL) {
+            return root->left != NULL ? root->left : root->right;
+        }
+        struct vaddr_node *successor;
+        struct vaddr_node *right = vaddr_tree_remove_min(root->right, &successor);
+        successor->left = root->left;
+        successor->right = right;
+        root = successor;
+    }
+    return vaddr_tree_balance(root);
+}
+
+/**
+ * \brief Helper function: Updates the nodes from the root down to the node
+ *        at `base`, after that node's gap changed
+ */
+static void vaddr_tree_update_path(struct vaddr_node *root, lvaddr_t base)
+{
+    if (root == NULL) {
+        return;
+    }
+    if (base < root->base) {
+        vaddr_tree_update_path(root->left, base);
+    } else if (base > root->base) {
+        vaddr_tree_update_path(root->right, base);
+    }
+    vaddr_tree_update(root);
+}
+
+/**
+ * \brief Helper function: Finds the range with the highest base <= `base`,
+ *        and the range after it
+ *
+ * Either is NULL if there is no such range.
+ */
+static void vaddr_tree_neighbours(struct vaddr_tree *tree, lvaddr_t base,
+                                  struct vaddr_node **ret_prev,
+                                  struct vaddr_node **ret_next)
+{
+    *ret_prev = NULL;
+    *ret_next = NULL;
+    for (struct vaddr_node *node = tree->root; node != NULL; ) {
+        if (node->base <= base) {
+            *ret_prev = node;
+            node = node->right;
+        } else {
+            *ret_next = node;
+            node = node->left;
+        }
+    }
+}
+
+/**
+ * \brief Helper function: Finds the lowest address in the gaps of a subtree
+ *        where `bytes` fit at `alignment`
+ */
+static bool vaddr_tree_find_gap(struct vaddr_node *node, size_t bytes, size_t alignment,
+                                lvaddr_t *ret)
+{
+    if (node == NULL || node->max_gap < bytes) {
+        return false;
+    }
+    if (vaddr_tree_find_gap(node->left, bytes, alignment, ret)) {
+        return true;
+    }
+
+    lvaddr_t gap_start = node->base - node->gap;
+    lvaddr_t base = ROUND_UP(gap_start, alignment);
+    if (base >= gap_start && base <= node->base && node->base - base >= bytes) {
+        *ret = base;
+        return true;
+    }
+    return vaddr_tree_find_gap(node->right, bytes, alignment, ret);
+}
+
+/**
+ * \brief Helper function: Records [base, base + bytes) as allocated
+ *
+ * \param prev The range before it, or NULL
+ * \param next The range after it, or NULL. As the in-order successor of a new
+ *        leaf, it is on the insertion path and gets updated there.
+ */
+static errval_t vaddr_tree_add(struct vaddr_tree *tree, lvaddr_t base, size_t bytes,
+                               struct vaddr_node *prev, struct vaddr_node *next)
+{
+    struct vaddr_node *node = slab_alloc(&tree->slabs);
+    if (node == NULL) {
+        return LIB_ERR_SLAB_ALLOC_FAIL;
+    }
+    node->base = base;
+    node->size = bytes;
+    node->gap = base - (prev != NULL ? prev->base + prev->size : tree->start);
+    if (next != NULL) {
+        next->gap = next->base - (base + bytes);
+    }
+    tree->root = vaddr_tree_insert(tree->root, node);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Initializes an empty tree
+ *
+ * \param tree Tree to initialize
+ * \param start Lowest address to hand out
+ * \param limit End of the addresses to hand out
+ */
+void vaddr_tree_init(struct vaddr_tree *tree, lvaddr_t start, lvaddr_t limit)
+{
+    assert(start <= limit);
+    tree->root = NULL;
+    tree->start = start;
+    tree->limit = limit;
+    slab_init(&tree->slabs, sizeof(struct vaddr_node), NULL);
+    slab_set_watermarks(&tree->slabs, VADDR_TREE_SLAB_LOW_WATERMARK,
+                        VADDR_TREE_SLAB_HIGH_WATERMARK);
+}
+
+/**
+ * \brief Allocates the lowest free range of `bytes` that starts at a multiple
+ *        of `alignment`
+ *
+ * \param tree Tree to allocate from
+ * \param bytes Size of the range, not zero
+ * \param alignment A power of two, or zero for no alignment
+ * \param ret Returns the base of the range
+ */
+errval_t vaddr_tree_alloc(struct vaddr_tree *tree, size_t bytes, size_t alignment,
+                          lvaddr_t *ret)
+{
+    assert(bytes > 0);
+    assert((alignment & (alignment - 1)) == 0);
+    alignment = MAX(alignment, 1);
+
+    lvaddr_t base;
+    if (!vaddr_tree_find_gap(tree->root, bytes, alignment, &base)) {
+        // Behind the last range
+        lvaddr_t end = tree->start;
+        for (struct vaddr_node *node = tree->root; node != NULL; node = node->right) {
+            end = node->base + node->size;
+        }
+        base = ROUND_UP(end, alignment);
+        if (base < end || base > tree->limit || tree->limit - base < bytes) {
+            return LIB_ERR_VSPACE_MMU_AWARE_NO_SPACE;
+        }
+    }
+
+    struct vaddr_node *prev, *next;
+    vaddr_tree_neighbours(tree, base, &prev, &next);
+    errval_t err = vaddr_tree_add(tree, base, bytes, prev, next);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    *ret = base;
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Allocates [base, base + bytes), which must be free
+ */
+errval_t vaddr_tree_reserve(struct vaddr_tree *tree, lvaddr_t base, size_t bytes)
+{
+    if (bytes == 0 || base < tree->start || base > tree->limit ||
+        tree->limit - base < bytes) {
+        return LIB_ERR_VSPACE_ADD_REGION;
+    }
+
+    struct vaddr_node *prev, *next;
+    vaddr_tree_neighbours(tree, base, &prev, &next);
+    if ((prev != NULL && prev->base + prev->size > base) ||
+        (next != NULL && base + bytes > next->base)) {
+        return LIB_ERR_VSPACE_REGION_OVERLAP;
+    }
+    return vaddr_tree_add(tree, base, bytes, prev, next);
+}
+
+/**
+ * \brief Frees [base, base + bytes), which must lie within one allocated range
+ *
+ * Freeing the middle of a range splits it, which takes a node.
+ */
+errval_t vaddr_tree_free(struct vaddr_tree *tree, lvaddr_t base, size_t bytes)
+{
+    struct vaddr_node *node, *next;
+    vaddr_tree_neighbours(tree, base, &node, &next);
+    if (node == NULL || bytes == 0 || base + bytes < base ||
+        base + bytes > node->base + node->size) {
+        return LIB_ERR_VSPACE_VREGION_NOT_FOUND;
+    }
+
+    lvaddr_t end = base + bytes;
+    lvaddr_t node_end = node->base + node->size;
+    if (base == node->base && end == node_end) {
+        if (next != NULL) {
+            next->gap += node->gap + node->size;
+        }
+        tree->root = vaddr_tree_remove(tree->root, base);
+        slab_free(&tree->slabs, node);
+        // The successor need not be on the removal path
+        if (next != NULL) {
+            vaddr_tree_update_path(tree->root, next->base);
+        }
+    } else if (base == node->base) {
+        node->base = end;
+        node->size -= bytes;
+        node->gap += bytes;
+        vaddr_tree_update_path(tree->root, node->base);
+    } else if (end == node_end) {
+        node->size -= bytes;
+        if (next != NULL) {
+            next->gap += bytes;
+            vaddr_tree_update_path(tree->root, next->base);
+        }
+    } else {
+        struct vaddr_node *tail = slab_alloc(&tree->slabs);
+        if (tail == NULL) {
+            return LIB_ERR_SLAB_ALLOC_FAIL;
+        }
+        tail->base = end;
+        tail->size = node_end - end;
+        tail->gap = bytes;
+        node->size = base - node->base;
+        tree->root = vaddr_tree_insert(tree->root, tail);
+    }
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Finds the allocated range that holds `vaddr`
+ *
+ * \param ret_base Returns the start of the range
+ * \param ret_bytes Returns the size of the range
+ */
+errval_t vaddr_tree_lookup(struct vaddr_tree *tree, lvaddr_t vaddr, lvaddr_t *ret_base,
+                           size_t *ret_bytes)
+{
+    struct vaddr_node *node, *next;
+    vaddr_tree_neighbours(tree, vaddr, &node, &next);
+    if (node == NULL || vaddr - node->base >= node->size) {
+        return LIB_ERR_VSPACE_VREGION_NOT_FOUND;
+    }
+    *ret_base = node->base;
+    *ret_bytes = node->size;
+    return SYS_ERR_OK;
+}
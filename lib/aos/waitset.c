@@ -23,6 +23,7 @@
 #include <aos/waitset_chan.h>
 #include <aos/threads.h>
 #include <aos/dispatch.h>
+#include <aos/ump_chan.h>
 #include "threads_priv.h"
 #include "waitset_chan_priv.h"
 #include <stdio.h>
@@ -223,11 +224,22 @@ void poll_channels_disabled(dispatcher_handle_t handle) {
     struct dispatcher_generic *dp = get_dispatcher_generic(handle);
     struct waitset_chanstate *chan;
 
+    // UMP channels waiting for their doorbell are not on the polled queue
+    ump_chan_wake_disabled(handle);
+
     if (!dp->polled_channels)
         return;
     chan = dp->polled_channels;
     do {
         switch (chan->chantype) {
+        case CHANTYPE_UMP_IN:
+            if (ump_chan_poll_disabled(chan, handle)) {
+                // triggering or blocking took the channel off the queue we
+                // walk, the others are polled the next time
+                return;
+            }
+            chan = chan->polled_next;
+            break;
         case CHANTYPE_LWIP_SOCKET:
             arranet_polling_loop_proxy();
             break;
@@ -704,6 +716,66 @@ errval_t waitset_chan_register_polled(struct waitset *ws,
     return err;
 }
 
+/**
+ * \brief Mark an idle channel as polled
+ *
+ * The channel is checked whenever the dispatcher polls its channels. It must
+ * already be registered; a channel that is polled or pending stays as it is.
+ * This function must only be called when disabled.
+ *
+ * \param chan Waitset's per-channel state
+ * \param handle Current dispatcher
+ */
+errval_t waitset_chan_start_polling_disabled(struct waitset_chanstate *chan,
+                                             dispatcher_handle_t handle)
+{
+    struct waitset *ws = chan->waitset;
+    if (ws == NULL) {
+        return LIB_ERR_CHAN_NOT_REGISTERED;
+    }
+
+    assert_disabled(chan->state != CHAN_UNREGISTERED);
+    if (chan->state != CHAN_IDLE) {
+        return SYS_ERR_OK;
+    }
+
+    dequeue(&ws->idle, chan);
+    enqueue(&ws->polled, chan);
+    chan->state = CHAN_POLLED;
+    enqueue_polled(&get_dispatcher_generic(handle)->polled_channels, chan);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Stop polling a channel, making it idle again
+ *
+ * The channel stays registered, and can still be triggered. A channel that
+ * is idle or pending stays as it is.
+ * This function must only be called when disabled.
+ *
+ * \param chan Waitset's per-channel state
+ * \param handle Current dispatcher
+ */
+errval_t waitset_chan_stop_polling_disabled(struct waitset_chanstate *chan,
+                                            dispatcher_handle_t handle)
+{
+    struct waitset *ws = chan->waitset;
+    if (ws == NULL) {
+        return LIB_ERR_CHAN_NOT_REGISTERED;
+    }
+
+    assert_disabled(chan->state != CHAN_UNREGISTERED);
+    if (chan->state != CHAN_POLLED) {
+        return SYS_ERR_OK;
+    }
+
+    dequeue(&ws->polled, chan);
+    dequeue_polled(&get_dispatcher_generic(handle)->polled_channels, chan);
+    enqueue(&ws->idle, chan);
+    chan->state = CHAN_IDLE;
+    return SYS_ERR_OK;
+}
+
 /**
  * \brief Cancel a previous callback registration
  *
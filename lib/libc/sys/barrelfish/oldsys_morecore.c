@@ -26,6 +26,9 @@ typedef void (*morecore_free_func_t)(void *base, size_t bytes);
 morecore_alloc_func_t sys_morecore_alloc;
 morecore_free_func_t sys_morecore_free;
 
+/// Smallest free block at the end of the heap that lesscore gives back
+#define LESSCORE_MIN_BYTES (2 * 1024 * 1024)
+
 /**
  * \brief sbrk() equivalent.
  *
@@ -67,7 +70,30 @@ Header *morecore(unsigned nu)
 void lesscore(void)
 {
 #if defined(__arm__) || defined(__aarch64__)
-    // Not implemented
+    struct morecore_state *state = get_morecore_state();
+    Header *eaddr = (Header *)state->region.current_addr;
+
+    assert(sys_morecore_free);
+
+    // The block that free just merged into is freep, or the one after it
+    Header *prevp = state->header_freep, *p = prevp->s.ptr;
+    if (prevp + prevp->s.size == eaddr) {
+        p = prevp;
+    } else if (p + p->s.size != eaddr) {
+        return;
+    }
+    if (p->s.size * sizeof(Header) < LESSCORE_MIN_BYTES) {
+        return;
+    }
+    if (p == state->header_freep) {
+        for (prevp = p->s.ptr; prevp->s.ptr != p; prevp = prevp->s.ptr);
+    }
+
+    prevp->s.ptr = p->s.ptr;
+    state->header_freep = prevp;
+
+    // Give back the memory
+    sys_morecore_free(p, p->s.size * sizeof(Header));
 
 #else
     struct morecore_state *state = get_morecore_state();
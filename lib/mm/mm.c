@@ -3,9 +3,346 @@
  * \brief A library for managing physical memory (i.e., caps)
  */
 
+#include <string.h>
 #include <mm/mm.h>
 #include <aos/debug.h>
 #include <aos/solution.h>
+#include <aos/systime.h>
+
+/**
+ * \brief Helper function: Returns the size class of a free region
+ *
+ * \param size Size of the region, must not be 0
+ */
+static inline size_t mm_bin_index(gensize_t size)
+{
+    assert(size != 0);
+    return (MM_NBINS - 1) - __builtin_clzll(size);
+}
+
+static void mm_tree_refresh(struct mmnode *root, genpaddr_t base);
+
+/**
+ * \brief Helper function: Inserts a free mmnode into its size class
+ *
+ * The node must be in the address tree, whose free sizes are updated.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param mmnode Pointer to the free mmnode
+ */
+static void mm_bin_insert(struct mm *mm, struct mmnode *mmnode)
+{
+    assert(mmnode->type == NodeType_Free);
+    size_t bin = mm_bin_index(mmnode->size);
+
+    mmnode->free_size = mmnode->size;
+    mm_tree_refresh(mm->root, mmnode->base);
+
+    mmnode->free_prev = NULL;
+    mmnode->free_next = mm->bins[bin];
+    if (mm->bins[bin] != NULL) {
+        mm->bins[bin]->free_prev = mmnode;
+    }
+    mm->bins[bin] = mmnode;
+    mm->bins_used |= BIT(bin);
+}
+
+/**
+ * \brief Helper function: Removes a free mmnode from its size class
+ *
+ * Must be called before the size of the node changes, and while the node is
+ * still in the address tree.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param mmnode Pointer to the free mmnode
+ */
+static void mm_bin_remove(struct mm *mm, struct mmnode *mmnode)
+{
+    size_t bin = mm_bin_index(mmnode->size);
+
+    if (mmnode->free_prev != NULL) {
+        mmnode->free_prev->free_next = mmnode->free_next;
+    } else {
+        assert(mm->bins[bin] == mmnode);
+        mm->bins[bin] = mmnode->free_next;
+    }
+    if (mmnode->free_next != NULL) {
+        mmnode->free_next->free_prev = mmnode->free_prev;
+    }
+    if (mm->bins[bin] == NULL) {
+        mm->bins_used &= ~BIT(bin);
+    }
+
+    mmnode->free_prev = NULL;
+    mmnode->free_next = NULL;
+    mmnode->free_size = 0;
+    mm_tree_refresh(mm->root, mmnode->base);
+}
+
+/**
+ * \brief Helper function: Returns the padding needed to align an mmnode
+ *
+ * \param mmnode Pointer to the mmnode
+ * \param alignment Requested alignment in bytes
+ */
+static inline gensize_t mmnode_align_offset(struct mmnode *mmnode, size_t alignment)
+{
+    return (alignment - (mmnode->base % alignment)) % alignment;
+}
+
+static struct mmnode *mm_tree_find_fit(struct mmnode *root, gensize_t size,
+                                       size_t alignment, gensize_t *ret_offset);
+
+/**
+ * \brief Helper function: Finds a free mmnode that fits an aligned request
+ *
+ * The head of the request's own size class is tried first. Next comes the
+ * head of the first non-empty class large enough to absorb any alignment
+ * padding, in which every node fits. Both take constant time. Only when all
+ * of these classes are empty is the address tree searched, in O(log n)
+ * unless alignment rules out nodes that are large enough.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param size Amount of RAM requested, in bytes
+ * \param alignment Requested alignment in bytes
+ * \param ret_offset Filled-in with the alignment padding of the returned node
+ *
+ * \returns Pointer to a fitting free mmnode or NULL if there is none
+ */
+static struct mmnode *mm_find_free(struct mm *mm, gensize_t size, size_t alignment,
+                                   gensize_t *ret_offset)
+{
+    struct mmnode *cm = mm->bins[mm_bin_index(size)];
+    if (cm != NULL) {
+        gensize_t offset = mmnode_align_offset(cm, alignment);
+        if (cm->size >= size + offset) {
+            *ret_offset = offset;
+            return cm;
+        }
+    }
+
+    // Every node of at least 2^bin >= size + alignment - 1 bytes fits
+    gensize_t worst = size + alignment - 1;
+    size_t bin = mm_bin_index(worst) + (worst & (worst - 1) ? 1 : 0);
+    if (bin < MM_NBINS) {
+        uint64_t candidates = mm->bins_used & ~MASK(bin);
+        if (candidates != 0) {
+            cm = mm->bins[__builtin_ctzll(candidates)];
+            *ret_offset = mmnode_align_offset(cm, alignment);
+            assert(cm->size >= size + *ret_offset);
+            return cm;
+        }
+    }
+
+    return mm_tree_find_fit(mm->root, size, alignment, ret_offset);
+}
+
+static inline int mm_tree_height(struct mmnode *mmnode)
+{
+    return mmnode == NULL ? 0 : mmnode->height;
+}
+
+static inline gensize_t mm_tree_max_free(struct mmnode *mmnode)
+{
+    return mmnode == NULL ? 0 : mmnode->max_free;
+}
+
+static inline void mm_tree_update(struct mmnode *mmnode)
+{
+    mmnode->height = 1 + MAX(mm_tree_height(mmnode->left), mm_tree_height(mmnode->right));
+    mmnode->max_free = MAX(mmnode->free_size, MAX(mm_tree_max_free(mmnode->left),
+                                                  mm_tree_max_free(mmnode->right)));
+}
+
+/**
+ * \brief Helper function: Updates max_free on the path to the node at `base`
+ *
+ * Called after the free_size of that node changed.
+ *
+ * \param root Root of the (sub)tree
+ * \param base Base address of the node, must be in the tree
+ */
+static void mm_tree_refresh(struct mmnode *root, genpaddr_t base)
+{
+    assert(root != NULL);
+    if (base < root->base) {
+        mm_tree_refresh(root->left, base);
+    } else if (base > root->base) {
+        mm_tree_refresh(root->right, base);
+    }
+    mm_tree_update(root);
+}
+
+/**
+ * \brief Helper function: Finds the free node with the lowest base that fits
+ *        an aligned request
+ *
+ * Subtrees without a free node of `size` bytes are skipped.
+ *
+ * \param root Root of the (sub)tree
+ * \param size Amount of RAM requested, in bytes
+ * \param alignment Requested alignment in bytes
+ * \param ret_offset Filled-in with the alignment padding of the returned node
+ *
+ * \returns Pointer to a fitting free mmnode or NULL if there is none
+ */
+static struct mmnode *mm_tree_find_fit(struct mmnode *root, gensize_t size,
+                                       size_t alignment, gensize_t *ret_offset)
+{
+    if (root == NULL || root->max_free < size) {
+        return NULL;
+    }
+
+    struct mmnode *cm = mm_tree_find_fit(root->left, size, alignment, ret_offset);
+    if (cm != NULL) {
+        return cm;
+    }
+    if (root->free_size >= size) {
+        gensize_t offset = mmnode_align_offset(root, alignment);
+        if (root->free_size >= size + offset) {
+            *ret_offset = offset;
+            return root;
+        }
+    }
+    return mm_tree_find_fit(root->right, size, alignment, ret_offset);
+}
+
+static struct mmnode *mm_tree_rotate_right(struct mmnode *mmnode)
+{
+    struct mmnode *l = mmnode->left;
+    mmnode->left = l->right;
+    l->right = mmnode;
+    mm_tree_update(mmnode);
+    mm_tree_update(l);
+    return l;
+}
+
+static struct mmnode *mm_tree_rotate_left(struct mmnode *mmnode)
+{
+    struct mmnode *r = mmnode->right;
+    mmnode->right = r->left;
+    r->left = mmnode;
+    mm_tree_update(mmnode);
+    mm_tree_update(r);
+    return r;
+}
+
+/**
+ * \brief Helper function: Restores the AVL property of a subtree
+ *
+ * \param mmnode Root of a subtree whose children differ in height by at most 2
+ *
+ * \returns The new root of the subtree
+ */
+static struct mmnode *mm_tree_balance(struct mmnode *mmnode)
+{
+    mm_tree_update(mmnode);
+    int balance = mm_tree_height(mmnode->left) - mm_tree_height(mmnode->right);
+
+    if (balance > 1) {
+        if (mm_tree_height(mmnode->left->left) < mm_tree_height(mmnode->left->right)) {
+            mmnode->left = mm_tree_rotate_left(mmnode->left);
+        }
+        return mm_tree_rotate_right(mmnode);
+    }
+    if (balance < -1) {
+        if (mm_tree_height(mmnode->right->right) < mm_tree_height(mmnode->right->left)) {
+            mmnode->right = mm_tree_rotate_right(mmnode->right);
+        }
+        return mm_tree_rotate_left(mmnode);
+    }
+    return mmnode;
+}
+
+/**
+ * \brief Helper function: Inserts an mmnode into the address tree
+ *
+ * \param root Root of the (sub)tree
+ * \param mmnode Pointer to the mmnode, its base must not be in the tree yet
+ *
+ * \returns The new root of the (sub)tree
+ */
+static struct mmnode *mm_tree_insert(struct mmnode *root, struct mmnode *mmnode)
+{
+    if (root == NULL) {
+        mmnode->left = NULL;
+        mmnode->right = NULL;
+        mmnode->height = 1;
+        mmnode->max_free = mmnode->free_size;
+        return mmnode;
+    }
+
+    assert(mmnode->base != root->base);
+    if (mmnode->base < root->base) {
+        root->left = mm_tree_insert(root->left, mmnode);
+    } else {
+        root->right = mm_tree_insert(root->right, mmnode);
+    }
+    return mm_tree_balance(root);
+}
+
+static struct mmnode *mm_tree_remove_min(struct mmnode *root, struct mmnode **ret_min)
+{
+    if (root->left == NULL) {
+        *ret_min = root;
+        return root->right;
+    }
+    root->left = mm_tree_remove_min(root->left, ret_min);
+    return mm_tree_balance(root);
+}
+
+/**
+ * \brief Helper function: Removes the mmnode with the given base from the address tree
+ *
+ * \param root Root of the (sub)tree
+ * \param base Base address of the mmnode, must be in the tree
+ *
+ * \returns The new root of the (sub)tree
+ */
+static struct mmnode *mm_tree_remove(struct mmnode *root, genpaddr_t base)
+{
+    assert(root != NULL);
+
+    if (base < root->base) {
+        root->left = mm_tree_remove(root->left, base);
+    } else if (base > root->base) {
+        root->right = mm_tree_remove(root->right, base);
+    } else {
+        if (root->left == NULL || root->right == NULL) {
+            return root->left != NULL ? root->left : root->right;
+        }
+        struct mmnode *successor;
+        struct mmnode *right = mm_tree_remove_min(root->right, &successor);
+        successor->left = root->left;
+        successor->right = right;
+        root = successor;
+    }
+    return mm_tree_balance(root);
+}
+
+/**
+ * \brief Helper function: Finds the mmnode with the highest base <= `base`
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param base Address to look up
+ *
+ * \returns The mmnode or NULL if all nodes lie above `base`
+ */
+static struct mmnode *mm_tree_find_floor(struct mm *mm, genpaddr_t base)
+{
+    struct mmnode *floor = NULL;
+    for (struct mmnode *cm = mm->root; cm != NULL; ) {
+        if (cm->base == base) {
+            return cm;
+        } else if (cm->base < base) {
+            floor = cm;
+            cm = cm->right;
+        } else {
+            cm = cm->left;
+        }
+    }
+    return floor;
+}
 
 /**
  * \brief Helper function:
@@ -13,19 +350,183 @@
  *
  * \param mm Pointer to MM allocator instance data
  * \param mmnode_left Pointer to the mmnode_left to split
+ * \param mmnode_right Pointer to an unused mmnode receiving the right block
  * \param size The size of the first block of the split
  */
-static void mmnode_split(struct mmnode *mmnode_left, struct mmnode *mmnode_right, gensize_t size)
+static void mmnode_split(struct mm *mm, struct mmnode *mmnode_left,
+                         struct mmnode *mmnode_right, gensize_t size)
 {
+    assert(size < mmnode_left->size);
+
     mmnode_right->type = mmnode_left->type;
     mmnode_right->cap = mmnode_left->cap;
     mmnode_right->prev = mmnode_left;
     mmnode_right->next = mmnode_left->next;
     mmnode_right->base = mmnode_left->base + size;
     mmnode_right->size = mmnode_left->size - size;
+    mmnode_right->free_prev = NULL;
+    mmnode_right->free_next = NULL;
+    mmnode_right->free_size = 0;
 
+    if (mmnode_left->next != NULL) {
+        mmnode_left->next->prev = mmnode_right;
+    }
     mmnode_left->size = size;
     mmnode_left->next = mmnode_right;
+
+    mm->root = mm_tree_insert(mm->root, mmnode_right);
+}
+
+/**
+ * \brief Helper function: Allocates an unused mmnode
+ *
+ * Must not be called with mm->lock held, as the slab may refill from this mm.
+ *
+ * \param mm Pointer to MM allocator instance data
+ */
+static struct mmnode *mm_node_alloc(struct mm *mm)
+{
+    thread_mutex_lock_nested(&mm->alloc_lock);
+    struct mmnode *mmnode = slab_alloc(&(mm->slabs));
+    thread_mutex_unlock(&mm->alloc_lock);
+    return mmnode;
+}
+
+/**
+ * \brief Helper function: Adds an unused mmnode to a list of nodes to free
+ *
+ * Nodes that become unused while mm->lock is held are collected in a list
+ * linked through `next` and given back with mm_node_free once it is released.
+ *
+ * \param list Pointer to the head of the list
+ * \param mmnode Pointer to the unused mmnode, may be NULL
+ */
+static inline void mm_node_defer_free(struct mmnode **list, struct mmnode *mmnode)
+{
+    if (mmnode != NULL) {
+        mmnode->next = *list;
+        *list = mmnode;
+    }
+}
+
+/**
+ * \brief Helper function: Gives a list of unused mmnodes back to the slab
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param list Head of the list built with mm_node_defer_free, may be NULL
+ */
+static void mm_node_free(struct mm *mm, struct mmnode *list)
+{
+    if (list == NULL) {
+        return;
+    }
+
+    thread_mutex_lock_nested(&mm->alloc_lock);
+    while (list != NULL) {
+        struct mmnode *next = list->next;
+        slab_free(&(mm->slabs), list);
+        list = next;
+    }
+    thread_mutex_unlock(&mm->alloc_lock);
+}
+
+/**
+ * \brief Helper function: Tops up the node slab once it runs low
+ *
+ * The refill allocates memory from this mm, which takes nodes from the
+ * reserve left below the low watermark. Called at the end of operations,
+ * when no lock is held and no node is half-updated.
+ *
+ * \param mm Pointer to MM allocator instance data
+ */
+static void mm_slab_refill(struct mm *mm)
+{
+    thread_mutex_lock_nested(&mm->alloc_lock);
+    if (slab_needs_refill(&(mm->slabs))) {
+        errval_t err = slab_refill(&(mm->slabs));
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "mm.c/mm_slab_refill: slab_refill");
+        }
+    }
+    thread_mutex_unlock(&mm->alloc_lock);
+}
+
+/**
+ * \brief Helper function: Allocates a slot for a retyped capability
+ *
+ * Must not be called with mm->lock held, as the slot allocator may refill
+ * from this mm.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param retcap Pointer to capref struct, filled-in with the slot
+ */
+static errval_t mm_slot_alloc(struct mm *mm, struct capref *retcap)
+{
+    thread_mutex_lock_nested(&mm->alloc_lock);
+    errval_t err = mm->slot_alloc(mm->slot_alloc_inst, 1, retcap);
+    thread_mutex_unlock(&mm->alloc_lock);
+    return err;
+}
+
+/**
+ * \brief Helper function: Gives back an empty slot from mm_slot_alloc
+ *
+ * The slot allocators of mm have no free function. Their slots go back with
+ * slot_free, as they do when mm_free destroys a capability.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param cap The slot, which must be empty
+ */
+static void mm_slot_free(struct mm *mm, struct capref cap)
+{
+    thread_mutex_lock_nested(&mm->alloc_lock);
+    errval_t err = slot_free(cap);
+    thread_mutex_unlock(&mm->alloc_lock);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "mm.c/mm_slot_free: slot_free");
+    }
+}
+
+/**
+ * \brief Helper function: Adds the duration of an operation to a latency histogram
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param hist Histogram of the operation, MM_LATENCY_BUCKETS entries
+ * \param max Pointer to the longest duration of the operation so far
+ * \param start Time at which the operation started
+ */
+static void mm_latency_record(struct mm *mm, uint64_t *hist, uint64_t *max,
+                              systime_t start)
+{
+    uint64_t ns = systime_to_ns(systime_now() - start);
+    size_t bucket = ns == 0 ? 0 : MIN(mm_bin_index(ns), MM_LATENCY_BUCKETS - 1);
+
+    thread_mutex_lock(&mm->lock);
+    hist[bucket]++;
+    *max = MAX(*max, ns);
+    thread_mutex_unlock(&mm->lock);
+}
+
+/**
+ * \brief Helper function: Returns an upper bound of a latency percentile
+ *
+ * \param hist Latency histogram, MM_LATENCY_BUCKETS entries
+ * \param count Number of operations in the histogram
+ * \param max Longest duration, bounds the result
+ * \param percent Percentile to return, 1..100
+ */
+static uint64_t mm_latency_percentile(const uint64_t *hist, uint64_t count,
+                                      uint64_t max, unsigned percent)
+{
+    uint64_t rank = (count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < MM_LATENCY_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= rank && seen != 0) {
+            return MIN((2ULL << i) - 1, max);
+        }
+    }
+    return max;
 }
 
 /**
@@ -50,11 +551,33 @@ errval_t mm_init(struct mm *mm, enum objtype objtype,
     }
 
     slab_init(&(mm->slabs), sizeof(struct mmnode), slab_refill_func);
+    slab_set_watermarks(&(mm->slabs), MM_SLAB_LOW_WATERMARK, MM_SLAB_HIGH_WATERMARK);
     mm->slot_alloc = slot_alloc_func;
     mm->slot_refill = slot_refill_func;
     mm->slot_alloc_inst = slot_alloc_inst;
     mm->objtype = objtype;
+    thread_mutex_init(&mm->lock);
+    thread_mutex_init(&mm->alloc_lock);
     mm->head = NULL;
+    mm->root = NULL;
+    for (size_t i = 0; i < MM_NBINS; i++) {
+        mm->bins[i] = NULL;
+    }
+    mm->bins_used = 0;
+    mm->zpool.objsize = 0;
+    mm->zpool.target = 0;
+    mm->zpool.count = 0;
+    mm->zpool.pending = 0;
+    mm->stats_bytes_max = 0;
+    mm->stats_bytes_available = 0;
+    mm->stats_bytes_prezeroed = 0;
+    mm->stats_bytes_zeroed_inline = 0;
+    for (size_t i = 0; i < MM_LATENCY_BUCKETS; i++) {
+        mm->stats_alloc_latency[i] = 0;
+        mm->stats_free_latency[i] = 0;
+    }
+    mm->stats_alloc_ns_max = 0;
+    mm->stats_free_ns_max = 0;
 
     return SYS_ERR_OK;
 }
@@ -62,6 +585,8 @@ errval_t mm_init(struct mm *mm, enum objtype objtype,
 /**
  * \brief Destroys an MM allocator instance data with all its nodes and capabilities
  *
+ * Must not run concurrently with any other function on the same mm.
+ *
  * \param mm Pointer to MM allocator instance data
  */
 void mm_destroy(struct mm *mm)
@@ -90,8 +615,19 @@ void mm_destroy(struct mm *mm)
             return;
         }
 
+        mm->head = nm;
         slab_free(&(mm->slabs), cm);
     }
+
+    mm->root = NULL;
+    for (size_t i = 0; i < MM_NBINS; i++) {
+        mm->bins[i] = NULL;
+    }
+    mm->bins_used = 0;
+    // Pooled frames were revoked with their parent capabilities
+    mm->zpool.count = 0;
+    mm->stats_bytes_max = 0;
+    mm->stats_bytes_available = 0;
 }
 
 /**
@@ -109,83 +645,184 @@ errval_t mm_add(struct mm *mm, struct capref cap, genpaddr_t base, size_t size)
         return MM_ERR_NOT_FOUND;
     }
 
+    if (size == 0) {
+        return MM_ERR_MM_ADD;
+    }
+
     struct capinfo capinfo_new = {
         .cap = cap,
         .base = base,
         .size = (genpaddr_t) size
     };
 
-    struct mmnode* mmnode_new = slab_alloc(&(mm->slabs));
+    struct mmnode* mmnode_new = mm_node_alloc(mm);
+    if (mmnode_new == NULL) {
+        return err_push(LIB_ERR_SLAB_ALLOC_FAIL, MM_ERR_NEW_NODE);
+    }
+
+    thread_mutex_lock(&mm->lock);
+
+    // Keep the node list in address order and reject overlapping regions
+    struct mmnode *prev = mm_tree_find_floor(mm, base);
+    struct mmnode *next = prev != NULL ? prev->next : mm->head;
+    if ((prev != NULL && prev->base + prev->size > base) ||
+        (next != NULL && base + size > next->base)) {
+        thread_mutex_unlock(&mm->lock);
+        mmnode_new->next = NULL;
+        mm_node_free(mm, mmnode_new);
+        return MM_ERR_ALREADY_PRESENT;
+    }
+
     mmnode_new->type = NodeType_Free;
     mmnode_new->cap = capinfo_new;
-    mmnode_new->prev = NULL;
-    mmnode_new->next = NULL;
+    mmnode_new->prev = prev;
+    mmnode_new->next = next;
     mmnode_new->base = base;
     mmnode_new->size = (gensize_t) size;
+    mmnode_new->free_size = 0;
 
-    if (mm->head == NULL) {
-        mm->head = mmnode_new;
+    if (prev != NULL) {
+        prev->next = mmnode_new;
     } else {
-        mmnode_new->next = mm->head;
         mm->head = mmnode_new;
     }
+    if (next != NULL) {
+        next->prev = mmnode_new;
+    }
+    mm->root = mm_tree_insert(mm->root, mmnode_new);
+    mm_bin_insert(mm, mmnode_new);
+    mm->stats_bytes_max += size;
+    mm->stats_bytes_available += size;
 
+    thread_mutex_unlock(&mm->lock);
     return SYS_ERR_OK;
 }
 
 /**
- * \brief Allocates aligned memory in the form of a RAM capability
+ * \brief Helper function: Marks a node free and merges it with its free neighbours
+ *
+ * Only neighbours that lie in the same capinfo region are merged, as
+ * retyping never crosses the boundary of the original cap. This keeps the
+ * number of nodes bounded by the number of allocations plus regions.
+ * Must be called with mm->lock held.
  *
  * \param mm Pointer to MM allocator instance data
- * \param size Amount of RAM to allocate, in bytes
- * \param alignment Alignment of RAM to allocate slot used for the cap in #ret, if any
+ * \param mmnode Pointer to the allocated mmnode
+ * \param unused Merged nodes are added to this list, see mm_node_defer_free
+ */
+static void mmnode_release(struct mm *mm, struct mmnode *mmnode, struct mmnode **unused)
+{
+    mmnode->type = NodeType_Free;
+    mm->stats_bytes_available += mmnode->size;
+
+    struct mmnode *next = mmnode->next;
+    if (next != NULL && next->type == NodeType_Free && capcmp(mmnode->cap.cap, next->cap.cap)) {
+        mm_bin_remove(mm, next);
+        mm->root = mm_tree_remove(mm->root, next->base);
+        mmnode->size += next->size;
+        mmnode->next = next->next;
+        if (next->next != NULL) {
+            next->next->prev = mmnode;
+        }
+        mm_node_defer_free(unused, next);
+    }
+
+    struct mmnode *prev = mmnode->prev;
+    if (prev != NULL && prev->type == NodeType_Free && capcmp(mmnode->cap.cap, prev->cap.cap)) {
+        mm_bin_remove(mm, prev);
+        mm->root = mm_tree_remove(mm->root, mmnode->base);
+        prev->size += mmnode->size;
+        prev->next = mmnode->next;
+        if (mmnode->next != NULL) {
+            mmnode->next->prev = prev;
+        }
+        mm_node_defer_free(unused, mmnode);
+        mmnode = prev;
+    }
+
+    mm_bin_insert(mm, mmnode);
+}
+
+/**
+ * \brief Helper function: Allocates a region and retypes it to `objtype`
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param size Amount of RAM to allocate, in bytes, page aligned
+ * \param alignment Alignment of RAM to allocate, page aligned
+ * \param objtype Type of the returned capability
  * \param retcap Pointer to capref struct, filled-in with allocated cap location
  */
-errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment, struct capref *retcap)
+static errval_t mm_alloc_node(struct mm *mm, size_t size, size_t alignment,
+                              enum objtype objtype, struct capref *retcap)
 {
     errval_t err = SYS_ERR_OK;
-    struct mmnode *nm = slab_alloc(&(mm->slabs)); // must be called before choosing cm!!!
-    // LOCK NM
-    if (mm == NULL) {
-        DEBUG_ERR(MM_ERR_NOT_FOUND, "mm.c/mm_alloc_aligned: mm is null");
-        return MM_ERR_NOT_FOUND;
+    struct mmnode *unused = NULL;
+
+    // An aligned allocation splits a node in up to three parts. Get the nodes
+    // first, as slab_alloc may refill and allocate from this mm itself.
+    struct mmnode *nm_head = mm_node_alloc(mm);
+    struct mmnode *nm_tail = mm_node_alloc(mm);
+    if (nm_head == NULL || nm_tail == NULL) {
+        mm_node_defer_free(&unused, nm_head);
+        mm_node_defer_free(&unused, nm_tail);
+        mm_node_free(mm, unused);
+        return err_push(LIB_ERR_SLAB_ALLOC_FAIL, MM_ERR_NEW_NODE);
     }
 
-    // Handle alignment
-    struct mmnode *cm = mm->head;
-    size_t offset = (alignment - ((cm->base)%alignment))%alignment;
+    thread_mutex_lock(&mm->lock);
+
     // Search free matching (large enough) node
-    for (; cm != NULL && (cm->type != NodeType_Free || (cm->size - offset) < size); cm = cm->next) {
-        offset = (alignment - ((cm->base)%alignment))%alignment;
-    }
-    // LOCK CM
+    gensize_t offset;
+    struct mmnode *cm = mm_find_free(mm, size, alignment, &offset);
     if (cm == NULL) {
+        thread_mutex_unlock(&mm->lock);
+        mm_node_defer_free(&unused, nm_head);
+        mm_node_defer_free(&unused, nm_tail);
+        mm_node_free(mm, unused);
         DEBUG_ERR(MM_ERR_FIND_NODE, "mm_alloc_aligned: cm is null -> no large enough mmnode found\n");
         return MM_ERR_FIND_NODE;
     }
+    mm_bin_remove(mm, cm);
 
     // Node fragmentation
     if (offset != 0) {
-        mmnode_split(cm, nm, offset);
-        // UNLOCK NM + CM
-        return mm_alloc_aligned(mm, size, alignment, retcap);
+        mmnode_split(mm, cm, nm_head, offset);
+        mm_bin_insert(mm, cm);
+        cm = nm_head;
+        nm_head = NULL;
+    }
+    if (cm->size > size) {
+        mmnode_split(mm, cm, nm_tail, size);
+        mm_bin_insert(mm, nm_tail);
+        nm_tail = NULL;
     }
-
-    mmnode_split(cm, nm, size);
     cm->type = NodeType_Allocated;
-    // UNLOCK CM + NM
+    mm->stats_bytes_available -= cm->size;
+
+    // The node is ours now, the rest runs without holding the lock
+    thread_mutex_unlock(&mm->lock);
+    mm_node_defer_free(&unused, nm_head);
+    mm_node_defer_free(&unused, nm_tail);
+    mm_node_free(mm, unused);
+    unused = NULL;
 
     // Cap fragmentation
-    assert(retcap != NULL);
-    mm->slot_alloc(mm->slot_alloc_inst, 1, retcap);
+    err = mm_slot_alloc(mm, retcap);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "mm.c/mm_alloc_aligned: slot_alloc");
+        err = err_push(err, LIB_ERR_SLOT_ALLOC);
+        goto fail;
+    }
 
     //debug_printf("CAP_RETYPING: %lx, %lx\n", (cm->base)-(cm->cap.base), (cm->base)-(cm->cap.base)+size);
-    err = cap_retype(*retcap, cm->cap.cap, (cm->base)-(cm->cap.base), mm->objtype, (gensize_t) size, 1);
+    err = cap_retype(*retcap, cm->cap.cap, (cm->base)-(cm->cap.base), objtype, (gensize_t) size, 1);
     if (err_is_fail(err)) {
         DEBUG_ERR(err, "mm.c/mm_alloc_aligned: cap_retype");
-        return err_push(err, SYS_ERR_RETYPE_CREATE);
+        err = err_push(err, SYS_ERR_RETYPE_CREATE);
+        goto fail;
     }
 
+    thread_mutex_lock_nested(&mm->alloc_lock);
     static bool init = true;
     if (init) {
         errval_t alloc(void *inst, uint64_t i, struct capref *cap) {
@@ -195,36 +832,317 @@ errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment, struct c
         mm->slot_alloc = alloc;
         init = false;
     }
+    thread_mutex_unlock(&mm->alloc_lock);
+
+    mm_slab_refill(mm);
+    return err;
+
+fail:
+    thread_mutex_lock(&mm->lock);
+    mmnode_release(mm, cm, &unused);
+    thread_mutex_unlock(&mm->lock);
+    mm_node_free(mm, unused);
+    return err;
+}
+
+/**
+ * \brief Allocates aligned memory with allocation flags
+ *
+ * With MM_ALLOC_ZEROED the returned capability is a zero-filled Frame. If
+ * the request matches the pre-zeroed pool, a frame of the pool is handed out
+ * and no retype (and thus no kernel zeroing) happens on this path. Otherwise
+ * the region is retyped into a Frame directly and the kernel zeroes it inline.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param size Amount of RAM to allocate, in bytes
+ * \param alignment Alignment of RAM to allocate
+ * \param flags Combination of MM_ALLOC_* flags
+ * \param retcap Pointer to capref struct, filled-in with allocated cap location
+ */
+static errval_t mm_alloc_request(struct mm *mm, size_t size, size_t alignment,
+                                 int flags, struct capref *retcap)
+{
+    errval_t err;
+    if (mm == NULL) {
+        DEBUG_ERR(MM_ERR_NOT_FOUND, "mm.c/mm_alloc_flags: mm is null");
+        return MM_ERR_NOT_FOUND;
+    }
+    assert(retcap != NULL);
+
+    // Retype offsets have to be page aligned
+    size = ROUND_UP(size, BASE_PAGE_SIZE);
+    if (size == 0) {
+        return MM_ERR_OUT_OF_BOUNDS;
+    }
+    alignment = ROUND_UP(MAX(alignment, BASE_PAGE_SIZE), BASE_PAGE_SIZE);
 
+    if (!(flags & MM_ALLOC_ZEROED)) {
+        return mm_alloc_node(mm, size, alignment, mm->objtype, retcap);
+    }
+
+    // Pooled frames are only guaranteed to be page aligned
+    struct mm_zpool *zp = &mm->zpool;
+    thread_mutex_lock(&mm->lock);
+    if (zp->count > 0 && size == zp->objsize && alignment == BASE_PAGE_SIZE) {
+        *retcap = zp->frames[--zp->count];
+        mm->stats_bytes_prezeroed += size;
+        thread_mutex_unlock(&mm->lock);
+        return SYS_ERR_OK;
+    }
+    thread_mutex_unlock(&mm->lock);
+
+    err = mm_alloc_node(mm, size, alignment, ObjType_Frame, retcap);
+    if (err_is_ok(err)) {
+        thread_mutex_lock(&mm->lock);
+        mm->stats_bytes_zeroed_inline += size;
+        thread_mutex_unlock(&mm->lock);
+    }
+    return err;
+}
+
+errval_t mm_alloc_flags(struct mm *mm, size_t size, size_t alignment, int flags,
+                        struct capref *retcap)
+{
+    systime_t start = systime_now();
+    errval_t err = mm_alloc_request(mm, size, alignment, flags, retcap);
+    if (err_is_ok(err)) {
+        mm_latency_record(mm, mm->stats_alloc_latency, &mm->stats_alloc_ns_max, start);
+    }
     return err;
 }
 
+/**
+ * \brief Allocates aligned memory in the form of a RAM capability
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param size Amount of RAM to allocate, in bytes
+ * \param alignment Alignment of RAM to allocate slot used for the cap in #ret, if any
+ * \param retcap Pointer to capref struct, filled-in with allocated cap location
+ */
+errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment, struct capref *retcap)
+{
+    return mm_alloc_flags(mm, size, alignment, 0, retcap);
+}
+
 errval_t mm_alloc(struct mm *mm, size_t size, struct capref *retcap)
 {
     return mm_alloc_aligned(mm, size, BASE_PAGE_SIZE, retcap);
 }
 
 /**
- * \brief Helper function: Merge free node with its free successor
+ * \brief Looks up the free node an allocation would be carved out of,
+ *        without allocating
+ *
+ * Takes the same path through the size classes and the tree as
+ * mm_alloc_aligned, so it measures the lookup on its own.
  *
  * \param mm Pointer to MM allocator instance data
- * \param mmnode Pointer to the mmnode
+ * \param size Amount of RAM, in bytes
+ * \param alignment Alignment of the RAM
+ * \param ret_base Filled-in with the address the allocation would start at
+ *
+ * \return MM_ERR_FIND_NODE if no free node fits
  */
-static void successor_merge(struct mm *mm, struct mmnode *mmnode)
+errval_t mm_find(struct mm *mm, size_t size, size_t alignment, genpaddr_t *ret_base)
 {
-    if (mmnode != NULL && mmnode->next != NULL && mmnode->type == NodeType_Free && mmnode->next->type == NodeType_Free && capcmp(mmnode->cap.cap, mmnode->next->cap.cap)) {
-        mmnode->size = mmnode->size + mmnode->next->size;
-        if (mmnode->next->next != NULL) {
-            mmnode->next = mmnode->next->next;
-            slab_free(&(mm->slabs), mmnode->next->prev);
-            mmnode->next->prev = mmnode;
-        } else {
-            slab_free(&(mm->slabs), mmnode->next);
-            mmnode->next = NULL;
+    size = ROUND_UP(size, BASE_PAGE_SIZE);
+    alignment = ROUND_UP(MAX(alignment, BASE_PAGE_SIZE), BASE_PAGE_SIZE);
+
+    thread_mutex_lock(&mm->lock);
+    gensize_t offset;
+    struct mmnode *cm = mm_find_free(mm, size, alignment, &offset);
+    if (cm != NULL) {
+        *ret_base = cm->base + offset;
+    }
+    thread_mutex_unlock(&mm->lock);
+    return cm == NULL ? MM_ERR_FIND_NODE : SYS_ERR_OK;
+}
+
+/**
+ * \brief Helper function: Frees the first `count` capabilities of a batch
+ *        that failed, the caller only sees the error
+ */
+static void mm_free_batch(struct mm *mm, struct capref *caps, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        struct capability c;
+        if (err_is_ok(cap_direct_identify(caps[i], &c))) {
+            mm_free(mm, caps[i], get_address(&c), get_size(&c));
         }
     }
 }
 
+/**
+ * \brief Allocates `count` equally sized and aligned RAM capabilities
+ *
+ * Up to MM_BATCH_MAX objects are carved out of a single free node, a larger
+ * batch takes one node per MM_BATCH_MAX objects. Slots are allocated one by
+ * one, but every run of consecutive slots is filled with a single retype.
+ * Each returned cap can be freed individually with mm_free. If the batch
+ * fails, nothing of it stays allocated.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param size Amount of RAM per capability, in bytes
+ * \param alignment Alignment of every capability
+ * \param count Number of capabilities to allocate
+ * \param retcaps Array of `count` caprefs, filled-in with the allocated caps
+ */
+errval_t mm_alloc_batch(struct mm *mm, size_t size, size_t alignment, size_t count,
+                        struct capref *retcaps)
+{
+    errval_t err = SYS_ERR_OK;
+    if (mm == NULL) {
+        DEBUG_ERR(MM_ERR_NOT_FOUND, "mm.c/mm_alloc_batch: mm is null");
+        return MM_ERR_NOT_FOUND;
+    }
+    assert(retcaps != NULL);
+
+    size = ROUND_UP(size, BASE_PAGE_SIZE);
+    alignment = ROUND_UP(MAX(alignment, BASE_PAGE_SIZE), BASE_PAGE_SIZE);
+    if (size == 0 || count == 0 || count > GENSIZE_MAX / size) {
+        return MM_ERR_OUT_OF_BOUNDS;
+    }
+
+    // Bounds the nodes on the stack below
+    if (count > MM_BATCH_MAX) {
+        for (size_t i = 0; i < count; i += MM_BATCH_MAX) {
+            err = mm_alloc_batch(mm, size, alignment, MIN(count - i, MM_BATCH_MAX),
+                                 &retcaps[i]);
+            if (err_is_fail(err)) {
+                mm_free_batch(mm, retcaps, i);
+                return err;
+            }
+        }
+        return SYS_ERR_OK;
+    }
+
+    // Objects of a single retype are back to back, so only the first one
+    // would be aligned.
+    if (size % alignment != 0 || count == 1) {
+        for (size_t i = 0; i < count; i++) {
+            err = mm_alloc_aligned(mm, size, alignment, &retcaps[i]);
+            if (err_is_fail(err)) {
+                mm_free_batch(mm, retcaps, i);
+                return err;
+            }
+        }
+        return SYS_ERR_OK;
+    }
+
+    // One node per object plus one for the alignment padding in front
+    struct mmnode *nodes[MM_BATCH_MAX + 1];
+    struct mmnode *unused = NULL;
+    for (size_t i = 0; i <= count; i++) {
+        nodes[i] = mm_node_alloc(mm);
+        if (nodes[i] == NULL) {
+            while (i-- > 0) {
+                mm_node_defer_free(&unused, nodes[i]);
+            }
+            mm_node_free(mm, unused);
+            return err_push(LIB_ERR_SLAB_ALLOC_FAIL, MM_ERR_NEW_NODE);
+        }
+    }
+    size_t nodes_used = 0;
+
+    thread_mutex_lock(&mm->lock);
+
+    gensize_t offset;
+    struct mmnode *cm = mm_find_free(mm, (gensize_t) size * count, alignment, &offset);
+    if (cm == NULL) {
+        thread_mutex_unlock(&mm->lock);
+        for (size_t i = 0; i <= count; i++) {
+            mm_node_defer_free(&unused, nodes[i]);
+        }
+        mm_node_free(mm, unused);
+        DEBUG_ERR(MM_ERR_FIND_NODE, "mm_alloc_batch: no large enough mmnode found\n");
+        return MM_ERR_FIND_NODE;
+    }
+    mm_bin_remove(mm, cm);
+
+    if (offset != 0) {
+        mmnode_split(mm, cm, nodes[nodes_used++], offset);
+        mm_bin_insert(mm, cm);
+        cm = cm->next;
+    }
+
+    struct mmnode *first = cm;
+    for (size_t i = 0; i < count; i++) {
+        if (cm->size > size) {
+            mmnode_split(mm, cm, nodes[nodes_used++], size);
+            if (i + 1 == count) {
+                mm_bin_insert(mm, cm->next);
+            }
+        }
+        cm->type = NodeType_Allocated;
+        mm->stats_bytes_available -= cm->size;
+        cm = cm->next;
+    }
+    thread_mutex_unlock(&mm->lock);
+    while (nodes_used <= count) {
+        mm_node_defer_free(&unused, nodes[nodes_used++]);
+    }
+    mm_node_free(mm, unused);
+    unused = NULL;
+
+    // Allocate the slots and retype every consecutive run at once. The nodes
+    // of the batch are allocated, so their base and cap do not change.
+    size_t done = 0;
+    size_t slots = 0;
+    for (; slots < count; slots++) {
+        err = mm_slot_alloc(mm, &retcaps[slots]);
+        if (err_is_fail(err)) {
+            err = err_push(err, LIB_ERR_SLOT_ALLOC);
+            goto fail;
+        }
+    }
+
+    cm = first;
+    while (done < count) {
+        size_t run = 1;
+        while (done + run < count &&
+               cnodecmp(retcaps[done + run].cnode, retcaps[done].cnode) &&
+               retcaps[done + run].slot == retcaps[done].slot + run) {
+            run++;
+        }
+
+        err = cap_retype(retcaps[done], cm->cap.cap, (cm->base)-(cm->cap.base),
+                         mm->objtype, (gensize_t) size, run);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "mm.c/mm_alloc_batch: cap_retype");
+            err = err_push(err, SYS_ERR_RETYPE_CREATE);
+            goto fail;
+        }
+
+        done += run;
+        for (size_t i = 0; i < run; i++) {
+            cm = cm->next;
+        }
+    }
+
+    mm_slab_refill(mm);
+    return SYS_ERR_OK;
+
+fail:
+    // Destroy what was retyped, free the empty slots and give all nodes of
+    // the batch back
+    for (size_t i = 0; i < done; i++) {
+        cap_destroy(retcaps[i]);
+    }
+    for (size_t i = done; i < slots; i++) {
+        mm_slot_free(mm, retcaps[i]);
+    }
+    thread_mutex_lock(&mm->lock);
+    cm = first;
+    for (size_t i = 0; i < count; i++) {
+        struct mmnode *next = cm->next;
+        mmnode_release(mm, cm, &unused);
+        cm = next;
+    }
+    thread_mutex_unlock(&mm->lock);
+    mm_node_free(mm, unused);
+    return err;
+}
+
 /**
  * \brief Freeing allocated RAM and associated capability
  *
@@ -235,29 +1153,208 @@ static void successor_merge(struct mm *mm, struct mmnode *mmnode)
  */
 errval_t mm_free(struct mm *mm, struct capref cap, genpaddr_t base, gensize_t size)
 {
-    // Find the node on that address
-    errval_t err = SYS_ERR_OK;
-    struct mmnode *cm;
-    for (cm = mm->head; cm != NULL && cm->base != base; cm = cm->next);
-
-    if (cm == NULL) {
+    if (mm == NULL) {
         DEBUG_ERR(MM_ERR_NOT_FOUND, "mm.c/mm_free: mm is null");
         return MM_ERR_NOT_FOUND;
     }
 
-    // Free node
+    // Find the node on that address
+    systime_t start = systime_now();
+    errval_t err = SYS_ERR_OK;
+    thread_mutex_lock(&mm->lock);
+    struct mmnode *cm = mm_tree_find_floor(mm, base);
+    if (cm == NULL || cm->base != base || cm->type != NodeType_Allocated) {
+        thread_mutex_unlock(&mm->lock);
+        DEBUG_ERR(MM_ERR_NOT_FOUND, "mm.c/mm_free: no allocated node at base");
+        return MM_ERR_NOT_FOUND;
+    }
     assert(cm->size == size);
-    cm->type = NodeType_Free;
-
-    // Fusion with possible free predecessor
-    successor_merge(mm, cm);
-    successor_merge(mm, cm->prev);
+    // Claim the node, so that a concurrent free of the same region fails
+    cm->type = NodeType_Freeing;
+    thread_mutex_unlock(&mm->lock);
 
     //debug_printf("FREERETYPING: %lx, %lx\n", base-(cm->cap.base), base-(cm->cap.base)+size);
     err = cap_destroy(cap);
     if (err_is_fail(err)) {
-        DEBUG_ERR(err, "mm.c/mm_alloc_aligned: cap_destroy");
+        thread_mutex_lock(&mm->lock);
+        cm->type = NodeType_Allocated;
+        thread_mutex_unlock(&mm->lock);
+        DEBUG_ERR(err, "mm.c/mm_free: cap_destroy");
         return err_push(err, LIB_ERR_CAP_DESTROY);
     }
+
+    // Free node and fuse it with free neighbours
+    struct mmnode *unused = NULL;
+    thread_mutex_lock(&mm->lock);
+    mmnode_release(mm, cm, &unused);
+    thread_mutex_unlock(&mm->lock);
+    mm_node_free(mm, unused);
+
+    mm_latency_record(mm, mm->stats_free_latency, &mm->stats_free_ns_max, start);
     return err;
 }
+
+/**
+ * \brief Returns a snapshot of the fragmentation and latency statistics
+ *
+ * The latency percentiles are upper bounds: durations are counted in
+ * power-of-two buckets of nanoseconds, and the upper end of the bucket holding
+ * the percentile is reported.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param ret Filled with the statistics
+ */
+void mm_stats(struct mm *mm, struct mm_stats *ret)
+{
+    assert(mm != NULL && ret != NULL);
+    memset(ret, 0, sizeof(*ret));
+
+    thread_mutex_lock(&mm->lock);
+    ret->bytes_total = mm->stats_bytes_max;
+    ret->bytes_free = mm->stats_bytes_available;
+    ret->bytes_allocated = mm->stats_bytes_max - mm->stats_bytes_available;
+
+    for (struct mmnode *cm = mm->head; cm != NULL; cm = cm->next) {
+        if (cm->type == NodeType_Free) {
+            ret->nodes_free++;
+            ret->free_by_class[mm_bin_index(cm->size)]++;
+            ret->largest_free = MAX(ret->largest_free, cm->size);
+        } else {
+            ret->nodes_allocated++;
+        }
+    }
+
+    for (size_t i = 0; i < MM_LATENCY_BUCKETS; i++) {
+        ret->allocs += mm->stats_alloc_latency[i];
+        ret->frees += mm->stats_free_latency[i];
+    }
+    uint64_t *ah = mm->stats_alloc_latency, *fh = mm->stats_free_latency;
+    uint64_t amax = mm->stats_alloc_ns_max, fmax = mm->stats_free_ns_max;
+    ret->alloc_ns_p50 = mm_latency_percentile(ah, ret->allocs, amax, 50);
+    ret->alloc_ns_p90 = mm_latency_percentile(ah, ret->allocs, amax, 90);
+    ret->alloc_ns_p99 = mm_latency_percentile(ah, ret->allocs, amax, 99);
+    ret->alloc_ns_max = amax;
+    ret->free_ns_p50 = mm_latency_percentile(fh, ret->frees, fmax, 50);
+    ret->free_ns_p90 = mm_latency_percentile(fh, ret->frees, fmax, 90);
+    ret->free_ns_p99 = mm_latency_percentile(fh, ret->frees, fmax, 99);
+    ret->free_ns_max = fmax;
+    thread_mutex_unlock(&mm->lock);
+}
+
+/**
+ * \brief Prints all nodes of the MM allocator
+ *
+ * \param mm Pointer to MM allocator instance data
+ */
+void mm_dump_mmnodes(struct mm *mm)
+{
+    thread_mutex_lock(&mm->lock);
+    for (struct mmnode *cm = mm->head; cm != NULL; cm = cm->next) {
+        debug_printf("mmnode %s base=0x%"PRIxGENPADDR" size=0x%"PRIxGENSIZE"\n",
+                     cm->type == NodeType_Free ? "free " : "alloc",
+                     cm->base, cm->size);
+    }
+    thread_mutex_unlock(&mm->lock);
+}
+
+/**
+ * \brief Enables the pool of pre-zeroed frames
+ *
+ * The pool starts out empty, it is filled by calls to mm_zpool_refill.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param objsize Size of the pooled frames, requests of exactly this size are
+ *                served from the pool
+ * \param target Number of frames to keep ready, at most MM_ZPOOL_SLOTS
+ */
+errval_t mm_zpool_init(struct mm *mm, gensize_t objsize, size_t target)
+{
+    if (mm == NULL) {
+        DEBUG_ERR(MM_ERR_NOT_FOUND, "mm.c/mm_zpool_init: mm is null");
+        return MM_ERR_NOT_FOUND;
+    }
+    if (objsize == 0 || objsize % BASE_PAGE_SIZE != 0 || target > MM_ZPOOL_SLOTS) {
+        return MM_ERR_OUT_OF_BOUNDS;
+    }
+
+    thread_mutex_lock(&mm->lock);
+    mm->zpool.objsize = objsize;
+    mm->zpool.target = target;
+    thread_mutex_unlock(&mm->lock);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Returns whether the pool of pre-zeroed frames is below its target
+ *
+ * \param mm Pointer to MM allocator instance data
+ */
+bool mm_zpool_needs_refill(struct mm *mm)
+{
+    thread_mutex_lock(&mm->lock);
+    bool needs_refill = mm->zpool.count < mm->zpool.target;
+    thread_mutex_unlock(&mm->lock);
+    return needs_refill;
+}
+
+/**
+ * \brief Zeroes frames ahead of time until the pool reaches its target
+ *
+ * Meant to be called when the core is otherwise idle. If the mm runs out of
+ * memory, the target is lowered so that the caller stops retrying.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param max Maximum number of frames to add in this call
+ */
+errval_t mm_zpool_refill(struct mm *mm, size_t max)
+{
+    struct mm_zpool *zp = &mm->zpool;
+
+    for (size_t i = 0; i < max; i++) {
+        // Reserve a place in the pool, so concurrent refills cannot overfill it
+        thread_mutex_lock(&mm->lock);
+        if (zp->count + zp->pending >= zp->target) {
+            thread_mutex_unlock(&mm->lock);
+            break;
+        }
+        zp->pending++;
+        thread_mutex_unlock(&mm->lock);
+
+        // The kernel zeroes the frame as part of this retype
+        struct capref frame;
+        errval_t err = mm_alloc_node(mm, zp->objsize, BASE_PAGE_SIZE, ObjType_Frame,
+                                     &frame);
+
+        thread_mutex_lock(&mm->lock);
+        zp->pending--;
+        if (err_is_fail(err)) {
+            zp->target = zp->count + zp->pending;
+            thread_mutex_unlock(&mm->lock);
+            return err;
+        }
+        zp->frames[zp->count++] = frame;
+        thread_mutex_unlock(&mm->lock);
+    }
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Returns how many bytes of MM_ALLOC_ZEROED requests were served
+ * from the pool and how many were zeroed on the request path
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param ret_prezeroed Filled-in with the bytes served from the pool
+ * \param ret_zeroed_inline Filled-in with the bytes zeroed on the request path
+ */
+void mm_zpool_stats(struct mm *mm, gensize_t *ret_prezeroed, gensize_t *ret_zeroed_inline)
+{
+    thread_mutex_lock(&mm->lock);
+    if (ret_prezeroed != NULL) {
+        *ret_prezeroed = mm->stats_bytes_prezeroed;
+    }
+    if (ret_zeroed_inline != NULL) {
+        *ret_zeroed_inline = mm->stats_bytes_zeroed_inline;
+    }
+    thread_mutex_unlock(&mm->lock);
+}
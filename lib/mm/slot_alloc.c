@@ -17,6 +17,11 @@
 #include <mm/slot_alloc.h>
 #include <stdio.h>
 
+/// Slots kept back in the current cnode for refilling the next one
+#define SLOT_PREALLOC_RESERVE 8
+
+static bool is_refilling = false;
+
 static errval_t rootcn_alloc(void *st, size_t reqsize, struct capref *ret)
 {
     return mm_alloc(st, reqsize, ret);
@@ -27,7 +32,6 @@ errval_t slot_prealloc_refill(void *this)
 {
     struct slot_prealloc *sa = this;
     uint8_t refill = !sa->current;
-    static bool is_refilling = false;
     errval_t err = SYS_ERR_OK;
 
     if (is_refilling) {
@@ -94,14 +98,20 @@ errval_t slot_alloc_prealloc(void *inst, uint64_t nslots, struct capref *ret)
         init = false;
     }
 
-    if (this->meta[this->current].free < nslots) {
-        /*
-        debug_printf("slot_prealloc: switching cnodes %d->%d\n",
-                this->current, !this->current);
-        */
-        // Allocate from next cnode
-        this->current = !this->current;
+    // Refill the next cnode while this one still has slots for the refill
+    // itself, only the refill may use the last SLOT_PREALLOC_RESERVE slots
+    if (this->meta[this->current].free < nslots + SLOT_PREALLOC_RESERVE) {
         slot_prealloc_refill(this);
+        if (this->meta[!this->current].free == L2_CNODE_SLOTS) {
+            /*
+            debug_printf("slot_prealloc: switching cnodes %d->%d\n",
+                    this->current, !this->current);
+            */
+            // Allocate from next cnode
+            this->current = !this->current;
+        } else if (!is_refilling) {
+            return MM_ERR_SLOT_NOSLOTS;
+        }
     }
 
     if (this->meta[this->current].free < nslots) {
@@ -0,0 +1,540 @@
+/**
+ * \file
+ * \brief Throughput benchmarks for lib/mm, the slab, slot and virtual address
+ *        allocators
+ *
+ * The simulated cspace is cheap compared to real capability invocations, so
+ * these numbers are mostly the bookkeeping of the allocators themselves.
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include "mmbench.h"
+
+/// Simulated RAM of the benchmarked mm, nothing of it is backed by host memory
+#define BENCH_RAM_BYTES (64UL << 30)
+
+/// Allocations live at the same time in the alloc/free benchmarks
+#define BENCH_LIVE 1024
+
+/// Allocations live at the same time per thread, as in usr/init/benchmark.c
+#define BENCH_THREAD_LIVE 16
+
+#define BENCH_MAX_THREADS 64
+
+/// Free 4 KiB holes in front of the large free node in the lookup benchmark
+#define BENCH_FIND_HOLES 4096
+
+static void bench_print(const char *name, size_t ops, uint64_t ns)
+{
+    printf("%-40s %10.1f ns/op %12.0f ops/s\n", name, ops ? (double)ns / ops : 0.0,
+           ns ? ops * 1e9 / ns : 0.0);
+}
+
+static void bench_print_latency(struct mm *mm)
+{
+    struct mm_stats st;
+    mm_stats(mm, &st);
+    printf("%-40s p50 %" PRIu64 " p90 %" PRIu64 " p99 %" PRIu64 " max %" PRIu64 " ns\n",
+           "  mm_alloc latency", st.alloc_ns_p50, st.alloc_ns_p90, st.alloc_ns_p99,
+           st.alloc_ns_max);
+    printf("%-40s p50 %" PRIu64 " p90 %" PRIu64 " p99 %" PRIu64 " max %" PRIu64 " ns\n",
+           "  mm_free latency", st.free_ns_p50, st.free_ns_p90, st.free_ns_p99,
+           st.free_ns_max);
+}
+
+static void bench_fail(const char *what, errval_t err)
+{
+    fprintf(stderr, "mmbench: %s: %s\n", what, err_getstring(err));
+    exit(EXIT_FAILURE);
+}
+
+struct bench_alloc {
+    struct capref cap;
+    genpaddr_t base;
+    gensize_t size;
+};
+
+static void bench_identify(struct bench_alloc *a)
+{
+    struct capability c;
+    errval_t err = cap_direct_identify(a->cap, &c);
+    if (err_is_fail(err)) {
+        bench_fail("cap_direct_identify", err);
+    }
+    a->base = get_address(&c);
+    a->size = get_size(&c);
+}
+
+/**
+ * \brief Allocates BENCH_LIVE regions, then frees them, until `ops` are done
+ *
+ * \param fragment Keep every other allocation of the first round, so that
+ *                 the later rounds run on a fragmented mm
+ * \param shuffle Free in random order instead of allocation order
+ */
+static void bench_mm_alloc_free(const char *name, size_t ops, size_t size,
+                                size_t alignment, bool fragment, bool shuffle)
+{
+    static struct mmbench_mm m;
+    static struct bench_alloc live[BENCH_LIVE], kept[BENCH_LIVE];
+    gensize_t region = BENCH_RAM_BYTES;
+    errval_t err = mmbench_mm_init(&m, &region, 1);
+    if (err_is_fail(err)) {
+        bench_fail("mmbench_mm_init", err);
+    }
+
+    struct rng rng;
+    rng_seed(&rng, 1);
+    size_t nkept = 0;
+    if (fragment) {
+        for (size_t i = 0; i < BENCH_LIVE; i++) {
+            err = mm_alloc_aligned(&m.mm, size, alignment, &live[i].cap);
+            if (err_is_fail(err)) {
+                bench_fail("mm_alloc_aligned", err);
+            }
+            bench_identify(&live[i]);
+        }
+        for (size_t i = 0; i < BENCH_LIVE; i++) {
+            if (i % 2) {
+                err = mm_free(&m.mm, live[i].cap, live[i].base, live[i].size);
+            } else {
+                kept[nkept++] = live[i];
+            }
+        }
+    }
+
+    uint64_t alloc_ns = 0, free_ns = 0;
+    size_t done = 0;
+    while (done < ops) {
+        size_t n = MIN(ops - done, BENCH_LIVE);
+
+        systime_t start = systime_now();
+        for (size_t i = 0; i < n; i++) {
+            err = mm_alloc_aligned(&m.mm, size, alignment, &live[i].cap);
+            if (err_is_fail(err)) {
+                bench_fail("mm_alloc_aligned", err);
+            }
+        }
+        alloc_ns += systime_to_ns(systime_now() - start);
+
+        for (size_t i = 0; i < n; i++) {
+            bench_identify(&live[i]);
+        }
+        if (shuffle) {
+            for (size_t i = n - 1; i > 0; i--) {
+                size_t j = rng_range(&rng, i + 1);
+                struct bench_alloc tmp = live[i];
+                live[i] = live[j];
+                live[j] = tmp;
+            }
+        }
+
+        start = systime_now();
+        for (size_t i = 0; i < n; i++) {
+            err = mm_free(&m.mm, live[i].cap, live[i].base, live[i].size);
+            if (err_is_fail(err)) {
+                bench_fail("mm_free", err);
+            }
+        }
+        free_ns += systime_to_ns(systime_now() - start);
+        done += n;
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s alloc", name);
+    bench_print(label, ops, alloc_ns);
+    snprintf(label, sizeof(label), "%s free", name);
+    bench_print(label, ops, free_ns);
+    bench_print_latency(&m.mm);
+
+    for (size_t i = 0; i < nkept; i++) {
+        mm_free(&m.mm, kept[i].cap, kept[i].base, kept[i].size);
+    }
+    mmbench_mm_destroy(&m);
+}
+
+/**
+ * \brief Helper function: Looks up the lowest free node that fits by walking
+ *        the node list, as mm did before it had size classes and a tree
+ */
+static errval_t bench_find_linear(struct mm *mm, size_t size, size_t alignment,
+                                  genpaddr_t *ret_base)
+{
+    errval_t err = MM_ERR_FIND_NODE;
+    thread_mutex_lock(&mm->lock);
+    for (struct mmnode *cm = mm->head; cm != NULL; cm = cm->next) {
+        gensize_t offset = (alignment - cm->base % alignment) % alignment;
+        if (cm->type == NodeType_Free && cm->size >= size + offset) {
+            *ret_base = cm->base + offset;
+            err = SYS_ERR_OK;
+            break;
+        }
+    }
+    thread_mutex_unlock(&mm->lock);
+    return err;
+}
+
+/**
+ * \brief Helper function: Times `ops` lookups with mm_find and with the
+ *        linear scan, and prints both and their ratio
+ */
+static void bench_mm_find_size(const char *name, struct mm *mm, size_t ops,
+                               size_t size, size_t alignment)
+{
+    genpaddr_t indexed = 0, linear = 0;
+
+    systime_t start = systime_now();
+    for (size_t i = 0; i < ops; i++) {
+        errval_t err = mm_find(mm, size, alignment, &indexed);
+        if (err_is_fail(err)) {
+            bench_fail("mm_find", err);
+        }
+    }
+    uint64_t indexed_ns = systime_to_ns(systime_now() - start);
+
+    start = systime_now();
+    for (size_t i = 0; i < ops; i++) {
+        errval_t err = bench_find_linear(mm, size, alignment, &linear);
+        if (err_is_fail(err)) {
+            bench_fail("bench_find_linear", err);
+        }
+    }
+    uint64_t linear_ns = systime_to_ns(systime_now() - start);
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s, indexed", name);
+    bench_print(label, ops, indexed_ns);
+    snprintf(label, sizeof(label), "%s, linear scan", name);
+    bench_print(label, ops, linear_ns);
+    printf("%-40s %10.1fx\n", "  linear scan / indexed",
+           indexed_ns ? (double)linear_ns / indexed_ns : 0.0);
+}
+
+/**
+ * \brief Compares the free node lookup of mm with a linear scan of the nodes
+ *
+ * BENCH_FIND_HOLES free pages sit between allocated ones in front of the
+ * rest of the RAM. A page fits into the first hole, so both lookups are
+ * short. Two pages fit only behind all holes, which the linear scan walks
+ * through every time.
+ */
+static void bench_mm_find(size_t ops)
+{
+    static struct mmbench_mm m;
+    static struct bench_alloc live[2 * BENCH_FIND_HOLES];
+    gensize_t region = BENCH_RAM_BYTES;
+    errval_t err = mmbench_mm_init(&m, &region, 1);
+    if (err_is_fail(err)) {
+        bench_fail("mmbench_mm_init", err);
+    }
+
+    for (size_t i = 0; i < 2 * BENCH_FIND_HOLES; i++) {
+        err = mm_alloc(&m.mm, BASE_PAGE_SIZE, &live[i].cap);
+        if (err_is_fail(err)) {
+            bench_fail("mm_alloc", err);
+        }
+        bench_identify(&live[i]);
+    }
+    for (size_t i = 0; i < 2 * BENCH_FIND_HOLES; i += 2) {
+        mm_free(&m.mm, live[i].cap, live[i].base, live[i].size);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "mm_find 4K, %d holes", BENCH_FIND_HOLES);
+    bench_mm_find_size(name, &m.mm, ops, BASE_PAGE_SIZE, BASE_PAGE_SIZE);
+    snprintf(name, sizeof(name), "mm_find 8K, %d holes", BENCH_FIND_HOLES);
+    bench_mm_find_size(name, &m.mm, ops, 2 * BASE_PAGE_SIZE, BASE_PAGE_SIZE);
+
+    for (size_t i = 1; i < 2 * BENCH_FIND_HOLES; i += 2) {
+        mm_free(&m.mm, live[i].cap, live[i].base, live[i].size);
+    }
+    mmbench_mm_destroy(&m);
+}
+
+/**
+ * \brief Compares mm_alloc_batch with as many single allocations
+ */
+static void bench_mm_batch(size_t ops, size_t count)
+{
+    static struct mmbench_mm m;
+    static struct bench_alloc live[BENCH_LIVE];
+    struct capref caps[count];
+    gensize_t region = BENCH_RAM_BYTES;
+    errval_t err = mmbench_mm_init(&m, &region, 1);
+    if (err_is_fail(err)) {
+        bench_fail("mmbench_mm_init", err);
+    }
+
+    uint64_t ns = 0;
+    size_t done = 0;
+    while (done < ops) {
+        size_t n = MIN(ops - done, BENCH_LIVE / count * count);
+
+        systime_t start = systime_now();
+        for (size_t i = 0; i < n; i += count) {
+            err = mm_alloc_batch(&m.mm, BASE_PAGE_SIZE, BASE_PAGE_SIZE, count, caps);
+            if (err_is_fail(err)) {
+                bench_fail("mm_alloc_batch", err);
+            }
+            for (size_t k = 0; k < count; k++) {
+                live[i + k].cap = caps[k];
+            }
+        }
+        ns += systime_to_ns(systime_now() - start);
+
+        for (size_t i = 0; i < n; i++) {
+            bench_identify(&live[i]);
+            mm_free(&m.mm, live[i].cap, live[i].base, live[i].size);
+        }
+        done += n;
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "mm_alloc_batch 4K x%zu, per object", count);
+    bench_print(label, done, ns);
+    mmbench_mm_destroy(&m);
+}
+
+void bench_mm(size_t ops)
+{
+    bench_mm_alloc_free("mm 4K", ops, BASE_PAGE_SIZE, BASE_PAGE_SIZE, false, false);
+    bench_mm_alloc_free("mm 4K random free", ops, BASE_PAGE_SIZE, BASE_PAGE_SIZE,
+                        false, true);
+    bench_mm_alloc_free("mm 4K fragmented", ops, BASE_PAGE_SIZE, BASE_PAGE_SIZE,
+                        true, true);
+    bench_mm_alloc_free("mm 64K", ops, 64UL << 10, BASE_PAGE_SIZE, false, true);
+    bench_mm_alloc_free("mm 2M", ops, 2UL << 20, BASE_PAGE_SIZE, false, true);
+    bench_mm_alloc_free("mm 4K aligned to 2M", ops, BASE_PAGE_SIZE, 2UL << 20,
+                        false, true);
+    bench_mm_batch(ops, 16);
+    bench_mm_find(ops);
+}
+
+struct bench_thread {
+    pthread_t thread;
+    struct mm *mm;
+    size_t iterations;
+    errval_t err;
+};
+
+static void *bench_thread_main(void *arg)
+{
+    struct bench_thread *bt = arg;
+    struct bench_alloc live[BENCH_THREAD_LIVE];
+
+    for (size_t i = 0; i < bt->iterations; i++) {
+        struct bench_alloc *a = &live[i % BENCH_THREAD_LIVE];
+        if (i >= BENCH_THREAD_LIVE) {
+            bt->err = mm_free(bt->mm, a->cap, a->base, a->size);
+            if (err_is_fail(bt->err)) {
+                return NULL;
+            }
+        }
+        bt->err = mm_alloc(bt->mm, BASE_PAGE_SIZE, &a->cap);
+        if (err_is_fail(bt->err)) {
+            return NULL;
+        }
+        bench_identify(a);
+    }
+
+    for (size_t k = 0; k < MIN(bt->iterations, BENCH_THREAD_LIVE); k++) {
+        bt->err = mm_free(bt->mm, live[k].cap, live[k].base, live[k].size);
+        if (err_is_fail(bt->err)) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Measures allocations per second with 1, 2, 4, ... threads
+ *
+ * Same pattern as benchmark_mm_threads in init: every thread allocates pages
+ * and frees them again, with up to BENCH_THREAD_LIVE allocated at a time.
+ */
+void bench_mm_threads(size_t ops, size_t max_threads)
+{
+    static struct mmbench_mm m;
+    struct bench_thread threads[BENCH_MAX_THREADS];
+    gensize_t region = BENCH_RAM_BYTES;
+    errval_t err = mmbench_mm_init(&m, &region, 1);
+    if (err_is_fail(err)) {
+        bench_fail("mmbench_mm_init", err);
+    }
+
+    for (size_t nthreads = 1; nthreads <= MIN(max_threads, BENCH_MAX_THREADS);
+         nthreads *= 2) {
+        systime_t start = systime_now();
+        for (size_t t = 0; t < nthreads; t++) {
+            threads[t].mm = &m.mm;
+            threads[t].iterations = ops / nthreads;
+            threads[t].err = SYS_ERR_OK;
+            pthread_create(&threads[t].thread, NULL, bench_thread_main, &threads[t]);
+        }
+        for (size_t t = 0; t < nthreads; t++) {
+            pthread_join(threads[t].thread, NULL);
+            if (err_is_fail(threads[t].err)) {
+                bench_fail("bench_mm_threads", threads[t].err);
+            }
+        }
+        uint64_t ns = systime_to_ns(systime_now() - start);
+
+        char label[64];
+        snprintf(label, sizeof(label), "mm 4K alloc+free, %zu threads", nthreads);
+        bench_print(label, ops / nthreads * nthreads, ns);
+    }
+
+    mmbench_mm_destroy(&m);
+}
+
+static errval_t bench_slab_refill(struct slab_allocator *slabs)
+{
+    size_t bytes = SLAB_STATIC_SIZE(256, slabs->blocksize);
+    void *buf = malloc(bytes);
+    if (buf == NULL) {
+        return LIB_ERR_SLAB_ALLOC_FAIL;
+    }
+    slab_grow(slabs, buf, bytes);
+    return SYS_ERR_OK;
+}
+
+void bench_slab(size_t ops)
+{
+    static void *live[BENCH_LIVE];
+    struct slab_allocator slabs;
+
+    // Host memory only: the refill function grows the slab with malloc
+    slab_init(&slabs, sizeof(struct mmnode), bench_slab_refill);
+    slab_set_watermarks(&slabs, 1, 1);
+    for (size_t i = 0; i < BENCH_LIVE / 256 + 1; i++) {
+        bench_slab_refill(&slabs);
+    }
+
+    systime_t start = systime_now();
+    for (size_t i = 0; i < ops; i++) {
+        slab_free(&slabs, slab_alloc(&slabs));
+    }
+    bench_print("slab_alloc+slab_free", ops, systime_to_ns(systime_now() - start));
+
+    uint64_t alloc_ns = 0, free_ns = 0;
+    size_t done = 0;
+    while (done < ops) {
+        size_t n = MIN(ops - done, BENCH_LIVE);
+        start = systime_now();
+        for (size_t i = 0; i < n; i++) {
+            live[i] = slab_alloc(&slabs);
+        }
+        alloc_ns += systime_to_ns(systime_now() - start);
+        start = systime_now();
+        for (size_t i = 0; i < n; i++) {
+            slab_free(&slabs, live[i]);
+        }
+        free_ns += systime_to_ns(systime_now() - start);
+        done += n;
+    }
+    bench_print("slab_alloc, 1024 live", ops, alloc_ns);
+    bench_print("slab_free, 1024 live", ops, free_ns);
+}
+
+void bench_slots(size_t ops)
+{
+    static struct mmbench_mm m;
+    gensize_t region = BENCH_RAM_BYTES;
+    errval_t err = mmbench_mm_init(&m, &region, 1);
+    if (err_is_fail(err)) {
+        bench_fail("mmbench_mm_init", err);
+    }
+
+    // Allocates from the slot allocator of the mm, as init does. Refills are
+    // guarded by a global flag, a second preallocating allocator on the same
+    // mm could not refill the slots of the mm while refilling its own.
+    struct capref cap;
+
+    // The simulated root CNode limits how many CNodes can be created
+    size_t n = MIN(ops, (ROOTCN_SLOTS / 2) * L2_CNODE_SLOTS);
+    systime_t start = systime_now();
+    for (size_t i = 0; i < n; i++) {
+        err = slot_alloc_prealloc(&m.slots, 1, &cap);
+        if (err_is_fail(err)) {
+            bench_fail("slot_alloc_prealloc", err);
+        }
+    }
+    bench_print("slot_alloc_prealloc", n, systime_to_ns(systime_now() - start));
+
+    mmbench_mm_destroy(&m);
+}
+
+/// Ranges live at the same time in the virtual address benchmark
+#define BENCH_VADDR_LIVE (16 * BENCH_LIVE)
+
+/// Size and alignment of the aligned allocations, a 2 MiB block
+#define BENCH_VADDR_ALIGNED (512 * BASE_PAGE_SIZE)
+
+void bench_vaddr(size_t ops)
+{
+    static lvaddr_t live[BENCH_VADDR_LIVE];
+    static size_t live_bytes[BENCH_VADDR_LIVE];
+    struct vaddr_tree tree;
+    struct rng rng;
+    errval_t err;
+
+    rng_seed(&rng, 1);
+    vaddr_tree_init(&tree, (lvaddr_t)1 << 30, (lvaddr_t)1 << 48);
+    tree.slabs.refill_func = bench_slab_refill;
+    for (size_t i = 0; i < BENCH_VADDR_LIVE / 256 + 1; i++) {
+        bench_slab_refill(&tree.slabs);
+    }
+
+    // Fill, then free every other range so the gaps are fragmented
+    for (size_t i = 0; i < BENCH_VADDR_LIVE; i++) {
+        live_bytes[i] = (1 + rng_range(&rng, 16)) * BASE_PAGE_SIZE;
+        err = vaddr_tree_alloc(&tree, live_bytes[i], BASE_PAGE_SIZE, &live[i]);
+        if (err_is_fail(err)) {
+            bench_fail("vaddr_tree_alloc", err);
+        }
+    }
+    for (size_t i = 0; i < BENCH_VADDR_LIVE; i += 2) {
+        vaddr_tree_free(&tree, live[i], live_bytes[i]);
+        live_bytes[i] = 0;
+    }
+
+    // Replace a random range per operation, sizes vary so most gaps are too small
+    systime_t start = systime_now();
+    for (size_t i = 0; i < ops; i++) {
+        size_t j = rng_range(&rng, BENCH_VADDR_LIVE);
+        if (live_bytes[j] != 0) {
+            vaddr_tree_free(&tree, live[j], live_bytes[j]);
+        }
+        if (slab_needs_refill(&tree.slabs)) {
+            slab_refill(&tree.slabs);
+        }
+        live_bytes[j] = (1 + rng_range(&rng, 32)) * BASE_PAGE_SIZE;
+        err = vaddr_tree_alloc(&tree, live_bytes[j], BASE_PAGE_SIZE, &live[j]);
+        if (err_is_fail(err)) {
+            bench_fail("vaddr_tree_alloc", err);
+        }
+    }
+    bench_print("vaddr_tree_free+alloc, 8192 live", ops, systime_to_ns(systime_now() - start));
+
+    start = systime_now();
+    for (size_t i = 0; i < ops; i++) {
+        if (slab_needs_refill(&tree.slabs)) {
+            slab_refill(&tree.slabs);
+        }
+        lvaddr_t base;
+        err = vaddr_tree_alloc(&tree, BENCH_VADDR_ALIGNED, BENCH_VADDR_ALIGNED, &base);
+        if (err_is_fail(err)) {
+            bench_fail("vaddr_tree_alloc", err);
+        }
+        vaddr_tree_free(&tree, base, BENCH_VADDR_ALIGNED);
+    }
+    bench_print("vaddr_tree_alloc+free, 2 MiB aligned", ops, systime_to_ns(systime_now() - start));
+}
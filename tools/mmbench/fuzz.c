@@ -0,0 +1,1110 @@
+/**
+ * \file
+ * \brief Randomized invariant checks for lib/mm, the slab, slot and virtual
+ *        address allocators
+ *
+ * Every fuzzer keeps a shadow of what it was handed out and checks each
+ * result against the shadow and the simulated cspace. The mm fuzzers also
+ * walk the node list, the address tree and the size classes of the mm and
+ * compare them with mm_stats. A failure prints the seed and the operation
+ * so that it can be replayed with `mmbench -s <seed> fuzz`.
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdarg.h>
+#include "mmbench.h"
+
+struct fuzz {
+    const char *name;
+    uint64_t seed;
+    size_t op;
+    struct rng rng;
+};
+
+static int fuzz_failed(struct fuzz *f, int line, const char *cond, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "%s: FAILED at op %zu (seed %" PRIu64 "), line %d: %s\n    ",
+            f->name, f->op, f->seed, line, cond);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    return -1;
+}
+
+#define CHECK(f, cond, ...) do { \
+    if (!(cond)) { \
+        return fuzz_failed(f, __LINE__, #cond, __VA_ARGS__); \
+    } \
+} while (0)
+
+#define CHECK_OK(f, err, what) \
+    CHECK(f, err_is_ok(err), "%s: %s", what, err_getstring(err))
+
+/* shadow of the live allocations */
+
+struct live {
+    struct capref cap;
+    genpaddr_t base;
+    gensize_t size;
+};
+
+/// Live allocations, sorted by base
+struct shadow {
+    struct live *v;
+    size_t n, max;
+    gensize_t bytes;
+};
+
+/// Returns the index of the first allocation at or above `base`
+static size_t shadow_lower_bound(struct shadow *sh, genpaddr_t base)
+{
+    size_t lo = 0, hi = sh->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sh->v[mid].base < base) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/// Adds an allocation, returns false if it overlaps one that is live
+static bool shadow_insert(struct shadow *sh, struct live l)
+{
+    size_t i = shadow_lower_bound(sh, l.base);
+    if ((i > 0 && sh->v[i - 1].base + sh->v[i - 1].size > l.base) ||
+        (i < sh->n && l.base + l.size > sh->v[i].base)) {
+        return false;
+    }
+
+    if (sh->n == sh->max) {
+        sh->max = MAX(2 * sh->max, 256);
+        sh->v = realloc(sh->v, sh->max * sizeof(struct live));
+        assert(sh->v != NULL);
+    }
+    memmove(&sh->v[i + 1], &sh->v[i], (sh->n - i) * sizeof(struct live));
+    sh->v[i] = l;
+    sh->n++;
+    sh->bytes += l.size;
+    return true;
+}
+
+static struct live shadow_remove(struct shadow *sh, size_t i)
+{
+    struct live l = sh->v[i];
+    memmove(&sh->v[i], &sh->v[i + 1], (sh->n - i - 1) * sizeof(struct live));
+    sh->n--;
+    sh->bytes -= l.size;
+    return l;
+}
+
+/// Removes the allocation at `base`, returns false if there is none
+static bool shadow_remove_base(struct shadow *sh, genpaddr_t base, struct live *ret)
+{
+    size_t i = shadow_lower_bound(sh, base);
+    if (i == sh->n || sh->v[i].base != base) {
+        return false;
+    }
+    *ret = shadow_remove(sh, i);
+    return true;
+}
+
+/* mm */
+
+/**
+ * \brief Checks a capability returned by the mm and describes it in `ret`
+ */
+static int check_cap(struct fuzz *f, struct mmbench_mm *m, struct capref cap,
+                     enum objtype type, size_t size, size_t alignment,
+                     struct live *ret)
+{
+    struct capability c;
+    errval_t err = cap_direct_identify(cap, &c);
+    CHECK_OK(f, err, "returned cap does not exist");
+    CHECK(f, c.type == type, "cap has type %d instead of %d", c.type, type);
+    CHECK(f, c.bytes == ROUND_UP(size, BASE_PAGE_SIZE),
+          "cap has 0x%" PRIxGENSIZE " bytes for a request of 0x%zx", c.bytes, size);
+    CHECK(f, c.base % alignment == 0,
+          "cap at 0x%" PRIxGENPADDR " is not aligned to 0x%zx", c.base, alignment);
+
+    bool in_region = false;
+    for (size_t i = 0; i < m->nregions; i++) {
+        in_region |= c.base >= m->region_base[i] &&
+                     c.base + c.bytes <= m->region_base[i] + m->region_size[i];
+    }
+    CHECK(f, in_region, "cap at 0x%" PRIxGENPADDR " is outside of all regions", c.base);
+
+    *ret = (struct live) { .cap = cap, .base = c.base, .size = c.bytes };
+    return 0;
+}
+
+/// Returns whether a free node could hold the request, mm->lock must not be held
+static bool mm_fits(struct mm *mm, gensize_t size, size_t alignment)
+{
+    size = ROUND_UP(size, BASE_PAGE_SIZE);
+    alignment = ROUND_UP(MAX(alignment, BASE_PAGE_SIZE), BASE_PAGE_SIZE);
+
+    bool fits = false;
+    thread_mutex_lock(&mm->lock);
+    for (struct mmnode *cm = mm->head; cm != NULL && !fits; cm = cm->next) {
+        gensize_t offset = (alignment - cm->base % alignment) % alignment;
+        fits = cm->type == NodeType_Free && cm->size >= size + offset;
+    }
+    thread_mutex_unlock(&mm->lock);
+    return fits;
+}
+
+/**
+ * \brief Returns whether an allocation failed for lack of a CNode for its slot
+ *
+ * The request took at most `nodes` free nodes, so that is only right if no
+ * more than that could hold a CNode. Pass a NULL mm if other threads allocate
+ * concurrently, to check the error only.
+ */
+static bool mm_out_of_slots(struct mm *mm, errval_t err, size_t nodes)
+{
+    if (err_no(err) != LIB_ERR_SLOT_ALLOC ||
+        err_no(err >> ERR_CODE_BITS) != MM_ERR_SLOT_NOSLOTS) {
+        return false;
+    }
+    if (mm == NULL) {
+        return true;
+    }
+
+    size_t n = 0;
+    thread_mutex_lock(&mm->lock);
+    for (struct mmnode *cm = mm->head; cm != NULL; cm = cm->next) {
+        gensize_t offset = (BASE_PAGE_SIZE - cm->base % BASE_PAGE_SIZE) % BASE_PAGE_SIZE;
+        n += cm->type == NodeType_Free && cm->size >= OBJSIZE_L2CNODE + offset;
+    }
+    thread_mutex_unlock(&mm->lock);
+    return n <= nodes;
+}
+
+/// Checks that the AVL tree is balanced and has the nodes in list order
+static int check_tree(struct fuzz *f, struct mmnode *node, struct mmnode **next,
+                      int *height)
+{
+    if (node == NULL) {
+        *height = 0;
+        return 0;
+    }
+
+    int hl, hr;
+    if (check_tree(f, node->left, next, &hl) != 0) {
+        return -1;
+    }
+    CHECK(f, node == *next, "address tree and node list differ at 0x%" PRIxGENPADDR,
+          node->base);
+    *next = node->next;
+    if (check_tree(f, node->right, next, &hr) != 0) {
+        return -1;
+    }
+
+    CHECK(f, node->height == 1 + MAX(hl, hr), "wrong height %d at 0x%" PRIxGENPADDR,
+          node->height, node->base);
+    CHECK(f, hl - hr <= 1 && hr - hl <= 1, "unbalanced at 0x%" PRIxGENPADDR, node->base);
+    CHECK(f, node->free_size == (node->type == NodeType_Free ? node->size : 0),
+          "wrong free size 0x%" PRIxGENSIZE " at 0x%" PRIxGENPADDR, node->free_size,
+          node->base);
+    gensize_t max_free = node->free_size;
+    if (node->left != NULL) {
+        max_free = MAX(max_free, node->left->max_free);
+    }
+    if (node->right != NULL) {
+        max_free = MAX(max_free, node->right->max_free);
+    }
+    CHECK(f, node->max_free == max_free, "wrong max free size 0x%" PRIxGENSIZE " at 0x%"
+          PRIxGENPADDR, node->max_free, node->base);
+    *height = node->height;
+    return 0;
+}
+
+/**
+ * \brief Checks the internal structure of the mm against itself and the shadow
+ *
+ * Every allocated byte is either live in the shadow, ready in the pool of
+ * zeroed frames, or was handed to ram_alloc for slab refills.
+ */
+static int check_mm(struct fuzz *f, struct mmbench_mm *m, struct shadow *sh)
+{
+    struct mm *mm = &m->mm;
+    size_t nfree = 0, nalloc = 0;
+    gensize_t free_bytes = 0, alloc_bytes = 0;
+
+    thread_mutex_lock(&mm->lock);
+    struct mmnode *prev = NULL;
+    size_t li = 0;
+    for (struct mmnode *cm = mm->head; cm != NULL; prev = cm, cm = cm->next) {
+        CHECK(f, cm->prev == prev, "broken prev link at 0x%" PRIxGENPADDR, cm->base);
+        CHECK(f, cm->size > 0 && cm->size % BASE_PAGE_SIZE == 0 &&
+                 cm->base % BASE_PAGE_SIZE == 0,
+              "node 0x%" PRIxGENPADDR "+0x%" PRIxGENSIZE " not page aligned",
+              cm->base, cm->size);
+        CHECK(f, cm->base >= cm->cap.base && cm->base + cm->size <= cm->cap.base + cm->cap.size,
+              "node 0x%" PRIxGENPADDR " outside of its cap", cm->base);
+        if (prev != NULL) {
+            CHECK(f, prev->base + prev->size <= cm->base,
+                  "nodes overlap at 0x%" PRIxGENPADDR, cm->base);
+            CHECK(f, !(prev->type == NodeType_Free && cm->type == NodeType_Free &&
+                       capcmp(prev->cap.cap, cm->cap.cap)),
+                  "free neighbours at 0x%" PRIxGENPADDR " not merged", cm->base);
+        }
+
+        if (cm->type == NodeType_Free) {
+            nfree++;
+            free_bytes += cm->size;
+            continue;
+        }
+        nalloc++;
+        alloc_bytes += cm->size;
+
+        // Both lists are sorted, every live allocation must have its node
+        if (li < sh->n && sh->v[li].base == cm->base) {
+            CHECK(f, sh->v[li].size == cm->size, "node 0x%" PRIxGENPADDR " has size 0x%"
+                  PRIxGENSIZE " instead of 0x%" PRIxGENSIZE, cm->base, cm->size,
+                  sh->v[li].size);
+            li++;
+        }
+        CHECK(f, li == sh->n || sh->v[li].base > cm->base,
+              "no allocated node for 0x%" PRIxGENPADDR, sh->v[li].base);
+    }
+    CHECK(f, li == sh->n, "no allocated node for 0x%" PRIxGENPADDR, sh->v[li].base);
+
+    struct mmnode *next = mm->head;
+    int height;
+    if (check_tree(f, mm->root, &next, &height) != 0) {
+        return -1;
+    }
+    CHECK(f, next == NULL, "node 0x%" PRIxGENPADDR " missing in address tree", next->base);
+
+    size_t nbinned = 0;
+    for (size_t i = 0; i < MM_NBINS; i++) {
+        CHECK(f, !(mm->bins_used & BIT(i)) == (mm->bins[i] == NULL),
+              "bins_used wrong for size class %zu", i);
+        struct mmnode *bprev = NULL;
+        for (struct mmnode *cm = mm->bins[i]; cm != NULL; bprev = cm, cm = cm->free_next) {
+            CHECK(f, cm->type == NodeType_Free, "allocated node 0x%" PRIxGENPADDR
+                  " in size class %zu", cm->base, i);
+            CHECK(f, 63 - __builtin_clzll(cm->size) == i, "node 0x%" PRIxGENPADDR
+                  " of size 0x%" PRIxGENSIZE " in size class %zu", cm->base, cm->size, i);
+            CHECK(f, cm->free_prev == bprev, "broken size class link at 0x%" PRIxGENPADDR,
+                  cm->base);
+            nbinned++;
+        }
+    }
+    CHECK(f, nbinned == nfree, "%zu free nodes but %zu in size classes", nfree, nbinned);
+
+    size_t pooled = mm->zpool.count;
+    gensize_t pooled_bytes = pooled * mm->zpool.objsize;
+    thread_mutex_unlock(&mm->lock);
+
+    struct mm_stats st;
+    mm_stats(mm, &st);
+    CHECK(f, st.bytes_total == m->bytes, "mm_stats: 0x%" PRIxGENSIZE " bytes total",
+          st.bytes_total);
+    CHECK(f, st.bytes_free == free_bytes && st.bytes_allocated == alloc_bytes,
+          "mm_stats: 0x%" PRIxGENSIZE " bytes free, 0x%" PRIxGENSIZE " allocated, nodes"
+          " have 0x%" PRIxGENSIZE " and 0x%" PRIxGENSIZE, st.bytes_free,
+          st.bytes_allocated, free_bytes, alloc_bytes);
+    CHECK(f, st.nodes_free == nfree && st.nodes_allocated == nalloc,
+          "mm_stats: %zu free and %zu allocated nodes", st.nodes_free, st.nodes_allocated);
+
+    CHECK(f, alloc_bytes == sh->bytes + pooled_bytes + stub_ram_bytes(),
+          "0x%" PRIxGENSIZE " bytes allocated, 0x%" PRIxGENSIZE " live, 0x%"
+          PRIxGENSIZE " pooled, 0x%" PRIxGENSIZE " to ram_alloc", alloc_bytes,
+          sh->bytes, pooled_bytes, stub_ram_bytes());
+    CHECK(f, nalloc == sh->n + pooled + stub_ram_count(),
+          "%zu allocated nodes, %zu live, %zu pooled, %zu to ram_alloc", nalloc,
+          sh->n, pooled, stub_ram_count());
+    return 0;
+}
+
+static int fuzz_mm_alloc(struct fuzz *f, struct mmbench_mm *m, struct shadow *sh, int flags)
+{
+    struct mm *mm = &m->mm;
+    size_t size = rng_pages(&f->rng, 10) * BASE_PAGE_SIZE;
+    if (rng_range(&f->rng, 2)) {
+        size -= rng_range(&f->rng, BASE_PAGE_SIZE);
+    }
+    size_t alignment = BASE_PAGE_SIZE;
+    if (rng_range(&f->rng, 4) == 0) {
+        alignment <<= rng_range(&f->rng, 10);
+    }
+    if ((flags & MM_ALLOC_ZEROED) && mm->zpool.objsize != 0 && rng_range(&f->rng, 2)) {
+        size = mm->zpool.objsize;
+        alignment = BASE_PAGE_SIZE;
+    }
+
+    bool fits = mm_fits(mm, size, alignment);
+    struct capref cap;
+    errval_t err = mm_alloc_flags(mm, size, alignment, flags, &cap);
+    if (err_is_fail(err) && mm_out_of_slots(mm, err, 1)) {
+        return 0;
+    }
+    if (err_is_fail(err)) {
+        CHECK(f, err_no(err) == MM_ERR_FIND_NODE || err_no(err) == MM_ERR_NEW_NODE,
+              "mm_alloc_flags(0x%zx, 0x%zx, %d): %s", size, alignment, flags,
+              err_getstring(err));
+        CHECK(f, !fits, "mm_alloc_flags(0x%zx, 0x%zx, %d) failed with a fitting free node",
+              size, alignment, flags);
+        return 0;
+    }
+
+    struct live l;
+    enum objtype type = flags & MM_ALLOC_ZEROED ? ObjType_Frame : ObjType_RAM;
+    if (check_cap(f, m, cap, type, size, alignment, &l) != 0) {
+        return -1;
+    }
+    CHECK(f, shadow_insert(sh, l), "0x%" PRIxGENPADDR "+0x%" PRIxGENSIZE
+          " overlaps a live allocation", l.base, l.size);
+    return 0;
+}
+
+static int fuzz_mm_batch(struct fuzz *f, struct mmbench_mm *m, struct shadow *sh)
+{
+    struct mm *mm = &m->mm;
+    size_t count = 2 + rng_range(&f->rng, 15);
+    if (rng_range(&f->rng, 8) == 0) {
+        // Takes more than one chunk of MM_BATCH_MAX objects
+        count = MM_BATCH_MAX + 1 + rng_range(&f->rng, MM_BATCH_MAX);
+    }
+    size_t size = rng_pages(&f->rng, 4) * BASE_PAGE_SIZE;
+    size_t alignment = BASE_PAGE_SIZE << rng_range(&f->rng, 3);
+
+    // Objects share one node only if every one of them is aligned. Slot
+    // refills between the chunks of a larger batch may take what fit before.
+    bool fits = count > MM_BATCH_MAX ? false
+              : size % alignment == 0 ? mm_fits(mm, size * count, alignment)
+                                      : mm_fits(mm, size, alignment);
+    struct capref caps[count];
+    errval_t err = mm_alloc_batch(mm, size, alignment, count, caps);
+    if (err_is_fail(err) &&
+        mm_out_of_slots(mm, err, size % alignment == 0 ? 1 : count)) {
+        return 0;
+    }
+    if (err_is_fail(err)) {
+        CHECK(f, err_no(err) == MM_ERR_FIND_NODE || err_no(err) == MM_ERR_NEW_NODE,
+              "mm_alloc_batch(0x%zx, 0x%zx, %zu): %s", size, alignment, count,
+              err_getstring(err));
+        CHECK(f, size % alignment != 0 || !fits, "mm_alloc_batch(0x%zx, 0x%zx, %zu)"
+              " failed with a fitting free node", size, alignment, count);
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct live l;
+        if (check_cap(f, m, caps[i], ObjType_RAM, size, alignment, &l) != 0) {
+            return -1;
+        }
+        CHECK(f, shadow_insert(sh, l), "batch object %zu at 0x%" PRIxGENPADDR
+              " overlaps a live allocation", i, l.base);
+    }
+    return 0;
+}
+
+static int fuzz_mm_free(struct fuzz *f, struct mmbench_mm *m, struct shadow *sh, size_t i)
+{
+    struct live l = shadow_remove(sh, i);
+    errval_t err = mm_free(&m->mm, l.cap, l.base, l.size);
+    CHECK_OK(f, err, "mm_free");
+
+    struct capability c;
+    err = cap_direct_identify(l.cap, &c);
+    CHECK(f, err_no(err) == SYS_ERR_CAP_NOT_FOUND, "mm_free left the cap behind");
+
+    // Freeing twice must be refused
+    if (rng_range(&f->rng, 8) == 0) {
+        err = mm_free(&m->mm, l.cap, l.base, l.size);
+        CHECK(f, err_no(err) == MM_ERR_NOT_FOUND, "second mm_free of 0x%" PRIxGENPADDR
+              ": %s", l.base, err_getstring(err));
+    }
+    return 0;
+}
+
+/// Frees with a base inside of an allocation or outside of all regions
+static int fuzz_mm_bad_free(struct fuzz *f, struct mmbench_mm *m, struct shadow *sh)
+{
+    errval_t err;
+    struct live *l = sh->n > 0 ? &sh->v[rng_range(&f->rng, sh->n)] : NULL;
+    if (l != NULL && l->size > BASE_PAGE_SIZE) {
+        err = mm_free(&m->mm, l->cap, l->base + BASE_PAGE_SIZE, l->size - BASE_PAGE_SIZE);
+        CHECK(f, err_no(err) == MM_ERR_NOT_FOUND, "mm_free inside of 0x%" PRIxGENPADDR
+              ": %s", l->base, err_getstring(err));
+        struct capability c;
+        CHECK_OK(f, cap_direct_identify(l->cap, &c), "refused mm_free destroyed the cap");
+    }
+
+    err = mm_free(&m->mm, NULL_CAP, MMBENCH_RAM_BASE - BASE_PAGE_SIZE, BASE_PAGE_SIZE);
+    CHECK(f, err_no(err) == MM_ERR_NOT_FOUND, "mm_free below all regions: %s",
+          err_getstring(err));
+    return 0;
+}
+
+/// Frees everything and checks that every region is one free node again
+static int fuzz_mm_drain(struct fuzz *f, struct mmbench_mm *m, struct shadow *sh)
+{
+    while (sh->n > 0) {
+        if (fuzz_mm_free(f, m, sh, rng_range(&f->rng, sh->n)) != 0) {
+            return -1;
+        }
+    }
+    if (check_mm(f, m, sh) != 0) {
+        return -1;
+    }
+
+    if (stub_ram_count() == 0 && m->mm.zpool.count == 0) {
+        struct mm_stats st;
+        mm_stats(&m->mm, &st);
+        CHECK(f, st.nodes_free == m->nregions && st.nodes_allocated == 0,
+              "%zu free nodes left for %zu regions", st.nodes_free, m->nregions);
+    }
+    return 0;
+}
+
+static void fuzz_mm_regions(struct fuzz *f, gensize_t *regions, size_t *nregions)
+{
+    *nregions = 1 + rng_range(&f->rng, 6);
+    for (size_t i = 0; i < *nregions; i++) {
+        regions[i] = (256 + rng_range(&f->rng, 16384)) * BASE_PAGE_SIZE;
+    }
+}
+
+/**
+ * \brief Runs random allocations and frees on a single thread
+ *
+ * Checks the result of every operation, and the structure of the mm every
+ * now and then. Failed allocations are only accepted if no free node could
+ * have held them.
+ */
+int fuzz_mm(uint64_t seed, size_t ops)
+{
+    static struct mmbench_mm m;
+    struct fuzz f = { .name = "fuzz_mm", .seed = seed };
+    struct shadow sh = { 0 };
+    rng_seed(&f.rng, seed);
+
+    gensize_t regions[MMBENCH_MAX_REGIONS];
+    size_t nregions;
+    fuzz_mm_regions(&f, regions, &nregions);
+    errval_t err = mmbench_mm_init(&m, regions, nregions);
+    CHECK_OK(&f, err, "mmbench_mm_init");
+
+    // Regions must not overlap
+    struct capref cap;
+    err = stub_ram_create(&cap, MMBENCH_RAM_BASE + BASE_PAGE_SIZE, BASE_PAGE_SIZE);
+    CHECK_OK(&f, err, "stub_ram_create");
+    err = mm_add(&m.mm, cap, MMBENCH_RAM_BASE + BASE_PAGE_SIZE, BASE_PAGE_SIZE);
+    CHECK(&f, err_no(err) == MM_ERR_ALREADY_PRESENT, "overlapping mm_add: %s",
+          err_getstring(err));
+    cap_destroy(cap);
+
+    bool zpool = rng_range(&f.rng, 2);
+    if (zpool) {
+        err = mm_zpool_init(&m.mm, (1 + rng_range(&f.rng, 4)) * BASE_PAGE_SIZE,
+                            1 + rng_range(&f.rng, 16));
+        CHECK_OK(&f, err, "mm_zpool_init");
+    }
+
+    int r = 0;
+    for (f.op = 0; f.op < ops && r == 0; f.op++) {
+        unsigned what = rng_range(&f.rng, 100);
+        if (what < 40) {
+            r = fuzz_mm_alloc(&f, &m, &sh, 0);
+        } else if (what < 48) {
+            r = fuzz_mm_alloc(&f, &m, &sh, MM_ALLOC_ZEROED);
+        } else if (what < 53) {
+            r = fuzz_mm_batch(&f, &m, &sh);
+        } else if (what < 90) {
+            r = sh.n > 0 ? fuzz_mm_free(&f, &m, &sh, rng_range(&f.rng, sh.n)) : 0;
+        } else if (what < 93) {
+            r = fuzz_mm_bad_free(&f, &m, &sh);
+        } else if (what < 96 && zpool) {
+            // Running out of memory stops the refill early
+            err = mm_zpool_refill(&m.mm, 1 + rng_range(&f.rng, 4));
+            CHECK(&f, err_is_ok(err) || mm_out_of_slots(&m.mm, err, 1) ||
+                  ((err_no(err) == MM_ERR_FIND_NODE || err_no(err) == MM_ERR_NEW_NODE) &&
+                   !mm_fits(&m.mm, m.mm.zpool.objsize, BASE_PAGE_SIZE)),
+                  "mm_zpool_refill: %s", err_getstring(err));
+        } else {
+            r = check_mm(&f, &m, &sh);
+        }
+    }
+    if (r == 0) {
+        r = fuzz_mm_drain(&f, &m, &sh);
+    }
+
+    free(sh.v);
+    mmbench_mm_destroy(&m);
+    return r;
+}
+
+/* mm, concurrently */
+
+struct fuzz_thread {
+    struct fuzz f;
+    pthread_t thread;
+    struct mmbench_mm *m;
+    size_t ops;
+    struct shadow own;           ///< Allocations of this thread
+    int ret;
+};
+
+/// Allocations of all threads, to catch overlaps between threads
+static struct shadow fuzz_threads_live;
+static pthread_mutex_t fuzz_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int fuzz_thread_run(struct fuzz_thread *t)
+{
+    struct fuzz *f = &t->f;
+    struct mm *mm = &t->m->mm;
+    errval_t err;
+
+    for (f->op = 0; f->op < t->ops; f->op++) {
+        unsigned what = rng_range(&f->rng, 100);
+        if (what < 50) {
+            size_t size = rng_pages(&f->rng, 6) * BASE_PAGE_SIZE;
+            size_t alignment = BASE_PAGE_SIZE << rng_range(&f->rng, 4);
+            struct capref cap;
+            err = mm_alloc_aligned(mm, size, alignment, &cap);
+            if (err_is_fail(err)) {
+                CHECK(f, err_no(err) == MM_ERR_FIND_NODE || err_no(err) == MM_ERR_NEW_NODE ||
+                      mm_out_of_slots(NULL, err, 0),
+                      "mm_alloc_aligned(0x%zx, 0x%zx): %s", size, alignment,
+                      err_getstring(err));
+                continue;
+            }
+
+            struct live l;
+            if (check_cap(f, t->m, cap, ObjType_RAM, size, alignment, &l) != 0) {
+                return -1;
+            }
+            pthread_mutex_lock(&fuzz_threads_lock);
+            bool ok = shadow_insert(&fuzz_threads_live, l);
+            pthread_mutex_unlock(&fuzz_threads_lock);
+            CHECK(f, ok, "0x%" PRIxGENPADDR "+0x%" PRIxGENSIZE " overlaps a live allocation",
+                  l.base, l.size);
+            shadow_insert(&t->own, l);
+        } else if (what < 97) {
+            if (t->own.n == 0) {
+                continue;
+            }
+            struct live l = shadow_remove(&t->own, rng_range(&f->rng, t->own.n));
+            pthread_mutex_lock(&fuzz_threads_lock);
+            struct live g;
+            bool ok = shadow_remove_base(&fuzz_threads_live, l.base, &g);
+            pthread_mutex_unlock(&fuzz_threads_lock);
+            CHECK(f, ok, "allocation 0x%" PRIxGENPADDR " vanished", l.base);
+
+            err = mm_free(mm, l.cap, l.base, l.size);
+            CHECK_OK(f, err, "mm_free");
+        } else {
+            struct mm_stats st;
+            mm_stats(mm, &st);
+            CHECK(f, st.bytes_free + st.bytes_allocated == st.bytes_total,
+                  "mm_stats: inconsistent byte counts");
+        }
+    }
+    return 0;
+}
+
+static void *fuzz_thread_main(void *arg)
+{
+    struct fuzz_thread *t = arg;
+    t->ret = fuzz_thread_run(t);
+    return NULL;
+}
+
+/// Number of allocations fuzz_mm_double_free frees twice
+#define FUZZ_DOUBLE_FREE 256
+
+/// One of the threads of fuzz_mm_double_free
+struct fuzz_double_free {
+    pthread_t thread;
+    struct mm *mm;
+    struct live *v;
+    size_t n;
+    pthread_barrier_t *start;    ///< Lets both threads start at once
+    size_t freed;                ///< Number of successful frees
+    errval_t err;                ///< Last error other than MM_ERR_NOT_FOUND
+};
+
+static void *fuzz_double_free_main(void *arg)
+{
+    struct fuzz_double_free *d = arg;
+    pthread_barrier_wait(d->start);
+    for (size_t i = 0; i < d->n; i++) {
+        errval_t err = mm_free(d->mm, d->v[i].cap, d->v[i].base, d->v[i].size);
+        if (err_is_ok(err)) {
+            d->freed++;
+        } else if (err_no(err) != MM_ERR_NOT_FOUND) {
+            d->err = err;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Frees the same allocations from two threads at once
+ *
+ * Every allocation must be freed exactly once, the other mm_free must fail
+ * with MM_ERR_NOT_FOUND.
+ */
+static int fuzz_mm_double_free(struct fuzz *f, struct mmbench_mm *m)
+{
+    struct live v[FUZZ_DOUBLE_FREE];
+    size_t n;
+    for (n = 0; n < FUZZ_DOUBLE_FREE; n++) {
+        struct capref cap;
+        errval_t err = mm_alloc(&m->mm, BASE_PAGE_SIZE, &cap);
+        if (err_is_fail(err)) {
+            break;
+        }
+        if (check_cap(f, m, cap, ObjType_RAM, BASE_PAGE_SIZE, BASE_PAGE_SIZE, &v[n]) != 0) {
+            return -1;
+        }
+    }
+
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, 2);
+    struct fuzz_double_free d[2];
+    for (size_t i = 0; i < 2; i++) {
+        d[i] = (struct fuzz_double_free) { .mm = &m->mm, .v = v, .n = n,
+                                           .start = &start, .err = SYS_ERR_OK };
+        int r = pthread_create(&d[i].thread, NULL, fuzz_double_free_main, &d[i]);
+        assert(r == 0);
+    }
+    for (size_t i = 0; i < 2; i++) {
+        pthread_join(d[i].thread, NULL);
+    }
+    pthread_barrier_destroy(&start);
+    for (size_t i = 0; i < 2; i++) {
+        CHECK_OK(f, d[i].err, "concurrent mm_free");
+    }
+    CHECK(f, d[0].freed + d[1].freed == n, "concurrent mm_free freed %zu of %zu allocations",
+          d[0].freed + d[1].freed, n);
+
+    struct shadow none = { 0 };
+    return check_mm(f, m, &none);
+}
+
+/**
+ * \brief Runs random allocations and frees on `nthreads` threads sharing an mm
+ *
+ * The threads check for overlapping allocations as they go, the structure
+ * of the mm is checked once they are done. Finally, two threads free the
+ * same allocations, see fuzz_mm_double_free.
+ */
+int fuzz_mm_threads(uint64_t seed, size_t ops, size_t nthreads)
+{
+    static struct mmbench_mm m;
+    struct fuzz f = { .name = "fuzz_mm_threads", .seed = seed };
+    rng_seed(&f.rng, seed);
+
+    gensize_t regions[MMBENCH_MAX_REGIONS];
+    size_t nregions;
+    fuzz_mm_regions(&f, regions, &nregions);
+    errval_t err = mmbench_mm_init(&m, regions, nregions);
+    CHECK_OK(&f, err, "mmbench_mm_init");
+
+    struct fuzz_thread *threads = calloc(nthreads, sizeof(struct fuzz_thread));
+    assert(threads != NULL);
+    for (size_t i = 0; i < nthreads; i++) {
+        threads[i].f = (struct fuzz) { .name = "fuzz_mm_threads", .seed = seed };
+        rng_seed(&threads[i].f.rng, seed * nthreads + i);
+        threads[i].m = &m;
+        threads[i].ops = ops / nthreads;
+        int r = pthread_create(&threads[i].thread, NULL, fuzz_thread_main, &threads[i]);
+        assert(r == 0);
+    }
+
+    int r = 0;
+    for (size_t i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        r |= threads[i].ret;
+    }
+
+    f.op = ops;
+    if (r == 0) {
+        r = fuzz_mm_drain(&f, &m, &fuzz_threads_live);
+    }
+    if (r == 0) {
+        r = fuzz_mm_double_free(&f, &m);
+    }
+
+    for (size_t i = 0; i < nthreads; i++) {
+        free(threads[i].own.v);
+    }
+    free(threads);
+    free(fuzz_threads_live.v);
+    fuzz_threads_live = (struct shadow) { 0 };
+    mmbench_mm_destroy(&m);
+    return r;
+}
+
+/* slab allocator */
+
+#define FUZZ_SLAB_MAX_LIVE 4096
+#define FUZZ_SLAB_MAX_BUFS 1024
+
+static void *fuzz_slab_bufs[FUZZ_SLAB_MAX_BUFS];
+static size_t fuzz_slab_nbufs;
+
+static errval_t fuzz_slab_refill(struct slab_allocator *slabs)
+{
+    if (fuzz_slab_nbufs == FUZZ_SLAB_MAX_BUFS) {
+        return LIB_ERR_SLAB_ALLOC_FAIL;
+    }
+    size_t bytes = SLAB_STATIC_SIZE(1 + rand() % 64, slabs->blocksize);
+    void *buf = malloc(bytes);
+    assert(buf != NULL);
+    fuzz_slab_bufs[fuzz_slab_nbufs++] = buf;
+    slab_grow(slabs, buf, bytes);
+    return SYS_ERR_OK;
+}
+
+static size_t slab_totalcount(struct slab_allocator *slabs)
+{
+    size_t ret = 0;
+    for (struct slab_head *sh = slabs->slabs; sh != NULL; sh = sh->next) {
+        ret += sh->total;
+    }
+    return ret;
+}
+
+/**
+ * \brief Runs random slab_alloc and slab_free calls
+ *
+ * Every live block is filled with its own pattern, which is checked when it
+ * is freed. Half of the runs use watermarks and refill with slab_refill.
+ */
+int fuzz_slab(uint64_t seed, size_t ops)
+{
+    static struct mmbench_mm m;
+    struct fuzz f = { .name = "fuzz_slab", .seed = seed };
+    rng_seed(&f.rng, seed);
+    srand(seed);
+
+    // The default refill maps frames from an mm, like in init
+    gensize_t region = 64UL << 20;
+    errval_t err = mmbench_mm_init(&m, &region, 1);
+    CHECK_OK(&f, err, "mmbench_mm_init");
+
+    struct slab_allocator slabs;
+    size_t blocksize = 1 + rng_range(&f.rng, 256);
+    bool watermarks = rng_range(&f.rng, 2);
+    slab_init(&slabs, blocksize, rng_range(&f.rng, 2) ? fuzz_slab_refill : NULL);
+    if (watermarks) {
+        size_t low = 1 + rng_range(&f.rng, 32);
+        slab_set_watermarks(&slabs, low, low + rng_range(&f.rng, 64));
+    }
+    blocksize = slabs.blocksize;
+
+    void *live[FUZZ_SLAB_MAX_LIVE];
+    uint8_t tags[FUZZ_SLAB_MAX_LIVE];
+    size_t nlive = 0;
+    int r = 0;
+
+    for (f.op = 0; f.op < ops && r == 0; f.op++) {
+        if (rng_range(&f.rng, 100) < 55 && nlive < FUZZ_SLAB_MAX_LIVE) {
+            uint8_t *block = slab_alloc(&slabs);
+            if (block == NULL) {
+                // Only watermark mode without a refill function runs dry
+                CHECK(&f, watermarks && slabs.refill_func == NULL,
+                      "slab_alloc failed with %zu blocks live", nlive);
+                err = slab_refill(&slabs);
+                CHECK_OK(&f, err, "slab_refill");
+                continue;
+            }
+            for (size_t i = 0; i < nlive; i++) {
+                CHECK(&f, (uint8_t *)live[i] + blocksize <= block ||
+                          block + blocksize <= (uint8_t *)live[i],
+                      "block %p overlaps live block %p", block, live[i]);
+            }
+            tags[nlive] = rng_next(&f.rng);
+            memset(block, tags[nlive], blocksize);
+            live[nlive++] = block;
+        } else if (nlive > 0) {
+            size_t i = rng_range(&f.rng, nlive);
+            uint8_t *block = live[i];
+            for (size_t j = 0; j < blocksize; j++) {
+                CHECK(&f, block[j] == tags[i], "block %p corrupted at byte %zu", block, j);
+            }
+            slab_free(&slabs, block);
+            live[i] = live[--nlive];
+            tags[i] = tags[nlive];
+        }
+
+        CHECK(&f, slab_freecount(&slabs) + nlive == slab_totalcount(&slabs),
+              "%zu free and %zu live blocks out of %zu", slab_freecount(&slabs), nlive,
+              slab_totalcount(&slabs));
+
+        if (watermarks && slab_needs_refill(&slabs)) {
+            err = slab_refill(&slabs);
+            CHECK_OK(&f, err, "slab_refill");
+            CHECK(&f, slab_freecount(&slabs) >= slabs.high_watermark,
+                  "slab_refill left %zu free blocks", slab_freecount(&slabs));
+        }
+    }
+
+    while (fuzz_slab_nbufs > 0) {
+        free(fuzz_slab_bufs[--fuzz_slab_nbufs]);
+    }
+    mmbench_mm_destroy(&m);
+    return r;
+}
+
+/* slot allocators */
+
+/// Fills the slots to check that they exist and were not handed out before
+static int fuzz_slots_claim(struct fuzz *f, const char *name, struct capref cap,
+                            size_t nslots)
+{
+    for (size_t i = 0; i < nslots; i++) {
+        struct capref slot = cap;
+        slot.slot += i;
+        errval_t err = cap_create(slot, ObjType_ID, 0);
+        CHECK(f, err_is_ok(err), "%s: slot %zu of %zu at cnode 0x%x slot %u: %s", name,
+              i, nslots, cap.cnode.cnode, cap.slot, err_getstring(err));
+    }
+    return 0;
+}
+
+/**
+ * \brief Allocates random numbers of slots from slot_alloc_prealloc and
+ * slot_alloc_basecn and checks that no slot is handed out twice
+ */
+int fuzz_slots(uint64_t seed, size_t ops)
+{
+    static struct mmbench_mm m;
+    struct fuzz f = { .name = "fuzz_slots", .seed = seed };
+    rng_seed(&f.rng, seed);
+
+    gensize_t region = 256UL << 20;
+    errval_t err = mmbench_mm_init(&m, &region, 1);
+    CHECK_OK(&f, err, "mmbench_mm_init");
+
+    struct slot_prealloc prealloc;
+    struct capref cnode;
+    err = stub_cnode_create(&cnode);
+    CHECK_OK(&f, err, "stub_cnode_create");
+    err = slot_prealloc_init(&prealloc, cnode, L2_CNODE_SLOTS, &m.mm);
+    CHECK_OK(&f, err, "slot_prealloc_init");
+
+    struct slot_alloc_basecn basecn;
+    err = slot_alloc_basecn_init(&basecn);
+    CHECK_OK(&f, err, "slot_alloc_basecn_init");
+
+    int r = 0;
+    for (f.op = 0; f.op < ops && r == 0; f.op++) {
+        struct capref cap;
+        uint64_t nslots;
+        if (rng_range(&f.rng, 2)) {
+            nslots = 1 + rng_range(&f.rng, rng_range(&f.rng, 8) ? 8 : L2_CNODE_SLOTS - 1);
+            err = slot_alloc_prealloc(&prealloc, nslots, &cap);
+            CHECK_OK(&f, err, "slot_alloc_prealloc");
+            r = fuzz_slots_claim(&f, "slot_alloc_prealloc", cap, nslots);
+        } else {
+            nslots = 1 + rng_range(&f.rng, 32);
+            err = slot_alloc_basecn(&basecn, nslots, &cap);
+            CHECK_OK(&f, err, "slot_alloc_basecn");
+            r = fuzz_slots_claim(&f, "slot_alloc_basecn", cap, nslots);
+        }
+    }
+
+    mmbench_mm_destroy(&m);
+    return r;
+}
+
+/* virtual address tree */
+
+#define FUZZ_VADDR_START (1UL << 30)
+#define FUZZ_VADDR_LIMIT (FUZZ_VADDR_START + (1UL << 32))
+
+/// Checks balance, gaps and largest gaps, and that the nodes equal the shadow
+static int check_vaddr_tree(struct fuzz *f, struct vaddr_tree *tree, struct vaddr_node *node,
+                            struct shadow *sh, size_t *next, int *height)
+{
+    if (node == NULL) {
+        *height = 0;
+        return 0;
+    }
+
+    int hl, hr;
+    if (check_vaddr_tree(f, tree, node->left, sh, next, &hl) != 0) {
+        return -1;
+    }
+    CHECK(f, *next < sh->n && node->base == sh->v[*next].base &&
+             node->size == sh->v[*next].size,
+          "tree has [0x%zx, +0x%zx) where the shadow has entry %zu", node->base,
+          node->size, *next);
+    lvaddr_t prev_end = *next == 0 ? tree->start : sh->v[*next - 1].base + sh->v[*next - 1].size;
+    CHECK(f, node->gap == node->base - prev_end, "gap 0x%zx at 0x%zx, expected 0x%zx",
+          node->gap, node->base, node->base - prev_end);
+    (*next)++;
+    if (check_vaddr_tree(f, tree, node->right, sh, next, &hr) != 0) {
+        return -1;
+    }
+
+    size_t max_gap = node->gap;
+    max_gap = MAX(max_gap, node->left != NULL ? node->left->max_gap : 0);
+    max_gap = MAX(max_gap, node->right != NULL ? node->right->max_gap : 0);
+    CHECK(f, node->max_gap == max_gap, "largest gap 0x%zx at 0x%zx, expected 0x%zx",
+          node->max_gap, node->base, max_gap);
+    CHECK(f, node->height == 1 + MAX(hl, hr), "wrong height %d at 0x%zx",
+          node->height, node->base);
+    CHECK(f, hl - hr <= 1 && hr - hl <= 1, "unbalanced at 0x%zx", node->base);
+    *height = node->height;
+    return 0;
+}
+
+/// Returns the first-fit address for `bytes` at `alignment`, or 0 if none fits
+static lvaddr_t shadow_first_fit(struct shadow *sh, size_t bytes, size_t alignment)
+{
+    lvaddr_t prev_end = FUZZ_VADDR_START;
+    for (size_t i = 0; i <= sh->n; i++) {
+        lvaddr_t end = i < sh->n ? sh->v[i].base : FUZZ_VADDR_LIMIT;
+        lvaddr_t base = ROUND_UP(prev_end, alignment);
+        if (base <= end && end - base >= bytes) {
+            return base;
+        }
+        if (i < sh->n) {
+            prev_end = sh->v[i].base + sh->v[i].size;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief Runs random allocations, fixed reservations and partial frees on a
+ * vaddr_tree and compares every result with a first-fit search of the shadow
+ */
+int fuzz_vaddr(uint64_t seed, size_t ops)
+{
+    struct fuzz f = { .name = "fuzz_vaddr", .seed = seed };
+    rng_seed(&f.rng, seed);
+    srand(seed);
+
+    struct vaddr_tree tree;
+    vaddr_tree_init(&tree, FUZZ_VADDR_START, FUZZ_VADDR_LIMIT);
+    tree.slabs.refill_func = fuzz_slab_refill;
+
+    struct shadow sh = { 0 };
+    errval_t err;
+    int r = 0;
+
+    for (f.op = 0; f.op < ops && r == 0; f.op++) {
+        if (slab_needs_refill(&tree.slabs)) {
+            err = slab_refill(&tree.slabs);
+            CHECK_OK(&f, err, "slab_refill");
+        }
+
+        unsigned op = rng_range(&f.rng, 100);
+        size_t bytes = rng_pages(&f.rng, 14) * BASE_PAGE_SIZE;
+        if (op < 40) {
+            size_t alignment = BASE_PAGE_SIZE << rng_range(&f.rng, 12);
+            lvaddr_t expected = shadow_first_fit(&sh, bytes, alignment);
+            lvaddr_t base;
+            err = vaddr_tree_alloc(&tree, bytes, alignment, &base);
+            if (expected == 0) {
+                CHECK(&f, err_no(err) == LIB_ERR_VSPACE_MMU_AWARE_NO_SPACE,
+                      "allocated 0x%zx bytes at 0x%zx, but none fit: %s", bytes,
+                      base, err_getstring(err));
+                continue;
+            }
+            CHECK_OK(&f, err, "vaddr_tree_alloc");
+            CHECK(&f, base == expected, "0x%zx bytes aligned to 0x%zx at 0x%zx, "
+                  "first fit is 0x%zx", bytes, alignment, base, expected);
+            struct live l = { .base = base, .size = bytes };
+            CHECK(&f, shadow_insert(&sh, l), "0x%zx overlaps a live range", base);
+        } else if (op < 50) {
+            lvaddr_t base = FUZZ_VADDR_START - BASE_PAGE_SIZE +
+                            rng_range(&f.rng, (FUZZ_VADDR_LIMIT - FUZZ_VADDR_START) /
+                                              BASE_PAGE_SIZE) * BASE_PAGE_SIZE;
+            struct live l = { .base = base, .size = bytes };
+            bool in_range = base >= FUZZ_VADDR_START && base + bytes <= FUZZ_VADDR_LIMIT;
+            err = vaddr_tree_reserve(&tree, base, bytes);
+            if (in_range && shadow_insert(&sh, l)) {
+                CHECK_OK(&f, err, "vaddr_tree_reserve");
+            } else {
+                CHECK(&f, err_is_fail(err), "reserved 0x%zx bytes at taken 0x%zx",
+                      bytes, base);
+            }
+        } else if (op < 95 && sh.n > 0) {
+            // Free all of a range, or its head, its tail or a hole in it
+            size_t i = rng_range(&f.rng, sh.n);
+            struct live l = sh.v[i];
+            size_t pages = l.size / BASE_PAGE_SIZE;
+            size_t first = 0, count = pages;
+            if (pages > 1 && rng_range(&f.rng, 2)) {
+                first = rng_range(&f.rng, pages);
+                count = 1 + rng_range(&f.rng, pages - first);
+            }
+            lvaddr_t base = l.base + first * BASE_PAGE_SIZE;
+            lvaddr_t found_base;
+            size_t found_bytes;
+            err = vaddr_tree_lookup(&tree, base, &found_base, &found_bytes);
+            CHECK_OK(&f, err, "vaddr_tree_lookup");
+            CHECK(&f, found_base == l.base && found_bytes == l.size,
+                  "0x%zx is in [0x%zx, +0x%zx), found [0x%zx, +0x%zx)", base, l.base,
+                  l.size, found_base, found_bytes);
+            err = vaddr_tree_free(&tree, base, count * BASE_PAGE_SIZE);
+            CHECK_OK(&f, err, "vaddr_tree_free");
+
+            shadow_remove(&sh, i);
+            if (first > 0) {
+                struct live head = { .base = l.base, .size = first * BASE_PAGE_SIZE };
+                shadow_insert(&sh, head);
+            }
+            if (first + count < pages) {
+                lvaddr_t end = base + count * BASE_PAGE_SIZE;
+                struct live tail = { .base = end, .size = l.base + l.size - end };
+                shadow_insert(&sh, tail);
+            }
+        } else {
+            // Free a range that reaches beyond the allocated one
+            lvaddr_t base = FUZZ_VADDR_START +
+                            rng_range(&f.rng, (FUZZ_VADDR_LIMIT - FUZZ_VADDR_START) /
+                                              BASE_PAGE_SIZE) * BASE_PAGE_SIZE;
+            size_t i = shadow_lower_bound(&sh, base + 1);
+            bool inside = i > 0 && base + bytes <= sh.v[i - 1].base + sh.v[i - 1].size;
+            lvaddr_t found_base;
+            size_t found_bytes;
+            err = vaddr_tree_lookup(&tree, base, &found_base, &found_bytes);
+            bool held = i > 0 && base < sh.v[i - 1].base + sh.v[i - 1].size;
+            CHECK(&f, err_is_ok(err) == held, "lookup of 0x%zx: %s", base,
+                  err_getstring(err));
+            if (!inside) {
+                err = vaddr_tree_free(&tree, base, bytes);
+                CHECK(&f, err_no(err) == LIB_ERR_VSPACE_VREGION_NOT_FOUND,
+                      "freed 0x%zx bytes at 0x%zx outside any range: %s", bytes, base,
+                      err_getstring(err));
+            }
+        }
+
+        size_t next = 0;
+        int height;
+        r = check_vaddr_tree(&f, &tree, tree.root, &sh, &next, &height);
+        if (r == 0) {
+            CHECK(&f, next == sh.n, "tree has %zu ranges, shadow %zu", next, sh.n);
+        }
+    }
+
+    free(sh.v);
+    while (fuzz_slab_nbufs > 0) {
+        free(fuzz_slab_bufs[--fuzz_slab_nbufs]);
+    }
+    return r;
+}
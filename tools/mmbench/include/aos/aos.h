@@ -0,0 +1,227 @@
+/**
+ * \file
+ * \brief Host stand-in for the parts of libaos the allocators depend on
+ *
+ * The other headers in this directory include this one. Capabilities live in
+ * a cspace simulated by stubs.c: the root CNode holds L2 CNodes, which hold
+ * RAM, Frame and other capabilities with their physical base and size.
+ * Retypes, deletes and CNode creation check their arguments like the kernel
+ * does, so allocator bugs show up as errors instead of silent corruption.
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef MMBENCH_AOS_H
+#define MMBENCH_AOS_H
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <bitmacros.h>
+#include <errors/errno.h>
+
+/* types */
+
+typedef uint64_t genpaddr_t;
+typedef uint64_t gensize_t;
+typedef uintptr_t lvaddr_t;
+typedef uint32_t capaddr_t;
+typedef uint32_t cslot_t;
+
+#define PRIxGENPADDR PRIx64
+#define PRIxGENSIZE  PRIx64
+#define GENSIZE_MAX  UINT64_MAX
+
+#define BASE_PAGE_SIZE 4096UL
+
+#define STATIC_ASSERT_SIZEOF(tname, n) \
+    _Static_assert(sizeof(tname) == (n), "sizeof(" #tname ") != " #n)
+
+/* capabilities */
+
+enum objtype {
+    ObjType_Null,
+    ObjType_RAM,
+    ObjType_Frame,
+    ObjType_L2CNode,
+    ObjType_ID,
+    ObjType_Num
+};
+
+#define OBJBITS_CTE             6
+#define L2_CNODE_BITS           8
+#define L2_CNODE_SLOTS          (1UL << L2_CNODE_BITS)
+#define OBJSIZE_L2CNODE         (L2_CNODE_SLOTS * (1UL << OBJBITS_CTE))
+
+/// Number of slots of the simulated root CNode
+#define ROOTCN_SLOTS            4096
+#define ROOTCN_SLOT_SLOT_ALLOC0 7
+/// First root slot handed out by slot_alloc_root
+#define ROOTCN_FREE_SLOTS       16
+#define ROOTCN_SLOT_ADDR(slot)  ((slot) << L2_CNODE_BITS)
+#define CPTR_ROOTCN             0
+
+enum cnode_type {
+    CNODE_TYPE_ROOT = 0,
+    CNODE_TYPE_OTHER,
+    CNODE_TYPE_COUNT,
+};
+
+struct cnoderef {
+    capaddr_t croot;
+    capaddr_t cnode;
+    enum cnode_type level;
+} __attribute__((packed));
+
+struct capref {
+    struct cnoderef cnode;
+    cslot_t slot;
+};
+
+#define NULL_CAP (struct capref){ { 0, 0, CNODE_TYPE_ROOT }, 0 }
+
+static inline bool cnodecmp(struct cnoderef c1, struct cnoderef c2)
+{
+    return (c1.cnode == c2.cnode && c1.croot == c2.croot && c1.level == c2.level);
+}
+
+static inline bool capcmp(struct capref c1, struct capref c2)
+{
+    return c1.slot == c2.slot && cnodecmp(c1.cnode, c2.cnode);
+}
+
+/// What cap_direct_identify reports about a capability
+struct capability {
+    enum objtype type;
+    genpaddr_t base;
+    gensize_t bytes;
+};
+
+static inline genpaddr_t get_address(struct capability *cap)
+{
+    return cap->base;
+}
+
+static inline gensize_t get_size(struct capability *cap)
+{
+    return cap->bytes;
+}
+
+errval_t cap_retype(struct capref dest_start, struct capref src, gensize_t offset,
+                    enum objtype new_type, gensize_t objsize, size_t count);
+errval_t cap_create(struct capref dest, enum objtype type, size_t bytes);
+errval_t cap_revoke(struct capref cap);
+errval_t cap_destroy(struct capref cap);
+errval_t cap_direct_identify(struct capref cap, struct capability *ret);
+errval_t cnode_create_from_mem(struct capref dest, struct capref src,
+                               enum objtype cntype, struct cnoderef *cnoderef,
+                               size_t slots);
+
+/* slot allocators */
+
+struct slot_allocator {
+    errval_t (*alloc)(struct slot_allocator *ca, struct capref *cap);
+    errval_t (*free)(struct slot_allocator *ca, struct capref cap);
+};
+
+struct multi_slot_allocator {
+    struct slot_allocator a;      ///< Public data
+};
+
+/// Not simulated, slot_alloc_dynamic fails
+struct range_slot_allocator {
+    struct capref cnode_cap;
+};
+
+struct slot_allocator *get_default_slot_allocator(void);
+errval_t slot_alloc(struct capref *ret);
+errval_t slot_free(struct capref ret);
+errval_t slot_alloc_root(struct capref *ret);
+typedef errval_t (*cn_ram_alloc_func_t)(void *st, size_t reqbits, struct capref *ret);
+errval_t root_slot_allocator_refill(cn_ram_alloc_func_t myalloc, void *allocst);
+errval_t range_slot_alloc(struct range_slot_allocator *alloc, cslot_t nslots,
+                          struct capref *ret);
+errval_t range_slot_alloc_refill(struct range_slot_allocator *alloc, cslot_t slots);
+
+/* memory */
+
+errval_t ram_alloc(struct capref *retcap, size_t size);
+errval_t frame_alloc(struct capref *dest, size_t bytes, size_t *retbytes);
+
+struct paging_state;
+
+#define VREGION_FLAGS_READ_WRITE 0x3
+
+struct paging_state *get_current_paging_state(void);
+errval_t paging_map_frame_attr(struct paging_state *st, void **buf, size_t bytes,
+                               struct capref frame, int flags, void *arg1, void *arg2);
+
+/* threads */
+
+/// Mutex that, like the libaos one, deadlocks when taken twice unless nested
+struct thread_mutex {
+    pthread_mutex_t mutex;
+    pthread_t holder;
+    unsigned locked;
+};
+
+void thread_mutex_init(struct thread_mutex *mutex);
+void thread_mutex_lock(struct thread_mutex *mutex);
+void thread_mutex_lock_nested(struct thread_mutex *mutex);
+bool thread_mutex_trylock(struct thread_mutex *mutex);
+void thread_mutex_unlock(struct thread_mutex *mutex);
+
+/* time */
+
+typedef uint64_t systime_t;
+
+systime_t systime_now(void);
+
+static inline uint64_t systime_to_ns(systime_t time)
+{
+    return time;
+}
+
+/* debugging */
+
+void debug_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void debug_err(const char *file, const char *func, int line, errval_t err,
+               const char *msg, ...) __attribute__((format(printf, 5, 6)));
+
+#define DEBUG_ERR(err, msg...) debug_err(__FILE__, __func__, __LINE__, err, msg)
+
+#define USER_PANIC(msg...) do { \
+    debug_printf("PANIC %s:%d: ", __FILE__, __LINE__); \
+    fprintf(stderr, msg); \
+    abort(); \
+} while (0)
+
+/* host only: setting up the simulated system */
+
+/// Prints DEBUG_ERR and debug_printf output, off by default
+extern bool stub_verbose;
+
+void stub_cspace_init(void);
+errval_t stub_ram_create(struct capref *ret, genpaddr_t base, gensize_t size);
+errval_t stub_cnode_create(struct capref *ret);
+struct mm;
+void stub_ram_alloc_set(struct mm *mm);
+gensize_t stub_ram_bytes(void);
+size_t stub_ram_count(void);
+size_t stub_caps_live(void);
+
+#endif // MMBENCH_AOS_H
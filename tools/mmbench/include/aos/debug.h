@@ -0,0 +1,20 @@
+/**
+ * \file
+ * \brief Host stand-in for <aos/debug.h>, see <aos/aos.h>
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef MMBENCH_AOS_DEBUG_H
+#define MMBENCH_AOS_DEBUG_H
+
+#include <aos/aos.h>
+
+#endif // MMBENCH_AOS_DEBUG_H
@@ -0,0 +1,93 @@
+/**
+ * \file
+ * \brief Host stand-in for the error codes generated from errno.fugu
+ *
+ * Only the codes used by the allocators under test and by the stubs exist.
+ * Error values stack codes like the generated header does, the topmost code
+ * in the lowest ERR_CODE_BITS bits.
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef MMBENCH_ERRORS_ERRNO_H
+#define MMBENCH_ERRORS_ERRNO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uintptr_t errval_t;
+
+#define ERR_CODES(X) \
+    X(SYS_ERR_OK) \
+    X(ERR_INVALID_ARGS) \
+    X(SYS_ERR_CAP_NOT_FOUND) \
+    X(SYS_ERR_SLOTS_INVALID) \
+    X(SYS_ERR_SLOTS_IN_USE) \
+    X(SYS_ERR_INVALID_SOURCE_TYPE) \
+    X(SYS_ERR_ILLEGAL_DEST_TYPE) \
+    X(SYS_ERR_INVALID_SIZE) \
+    X(SYS_ERR_RETYPE_INVALID_OFFSET) \
+    X(SYS_ERR_RETYPE_CREATE) \
+    X(LIB_ERR_CAP_DESTROY) \
+    X(LIB_ERR_CNODE_CREATE) \
+    X(LIB_ERR_FRAME_ALLOC) \
+    X(LIB_ERR_PMAP_MAP) \
+    X(LIB_ERR_RAM_ALLOC) \
+    X(LIB_ERR_RAM_ALLOC_UNSET) \
+    X(LIB_ERR_REMOTE_REVOKE) \
+    X(LIB_ERR_ROOTSA_RESIZE) \
+    X(LIB_ERR_SLAB_ALLOC_FAIL) \
+    X(LIB_ERR_SLOT_ALLOC) \
+    X(LIB_ERR_SLOT_ALLOC_INIT) \
+    X(LIB_ERR_SLOT_ALLOC_NO_SPACE) \
+    X(LIB_ERR_VSPACE_ADD_REGION) \
+    X(LIB_ERR_VSPACE_MMU_AWARE_NO_SPACE) \
+    X(LIB_ERR_VSPACE_REGION_OVERLAP) \
+    X(LIB_ERR_VSPACE_VREGION_NOT_FOUND) \
+    X(MM_ERR_ALREADY_PRESENT) \
+    X(MM_ERR_FIND_NODE) \
+    X(MM_ERR_MM_ADD) \
+    X(MM_ERR_NEW_NODE) \
+    X(MM_ERR_NOT_FOUND) \
+    X(MM_ERR_OUT_OF_BOUNDS) \
+    X(MM_ERR_SLOT_MM_ALLOC) \
+    X(MM_ERR_SLOT_NOSLOTS)
+
+#define ERR_CODE_ENUM(name) name,
+enum err_code {
+    ERR_CODES(ERR_CODE_ENUM)
+};
+#undef ERR_CODE_ENUM
+
+#define ERR_CODE_BITS 10
+
+static inline enum err_code err_no(errval_t errval)
+{
+    return (enum err_code)(errval & ((1UL << ERR_CODE_BITS) - 1));
+}
+
+static inline errval_t err_push(errval_t errval, enum err_code errcode)
+{
+    return (errval << ERR_CODE_BITS) | errcode;
+}
+
+static inline bool err_is_ok(errval_t errval)
+{
+    return err_no(errval) == SYS_ERR_OK;
+}
+
+static inline bool err_is_fail(errval_t errval)
+{
+    return !err_is_ok(errval);
+}
+
+const char *err_getstring(errval_t errval);
+
+#endif // MMBENCH_ERRORS_ERRNO_H
@@ -0,0 +1,179 @@
+/**
+ * \file
+ * \brief Runs lib/mm, the slab, slot and virtual address allocators on the host
+ *
+ * mmbench links the unmodified allocator sources against a simulated
+ * capability layer (see include/aos/aos.h), so that allocator changes can be
+ * fuzzed and measured in seconds, without booting init. It is built for the
+ * build machine:
+ *
+ *     make tools/bin/mmbench
+ *
+ * Usage: mmbench [-s seed] [-r rounds] [-n ops] [-t threads] [-v] [fuzz|bench]...
+ *
+ * `fuzz` runs `rounds` seeds starting at `seed` through all fuzzers and
+ * exits with an error on the first failure, `bench` prints throughputs.
+ * Without a command, both run. The defaults of 4 rounds of 10000 ops finish
+ * in a few seconds; longer fuzzing runs raise them with -r and -n.
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <getopt.h>
+#include "mmbench.h"
+
+/**
+ * \brief Sets up an mm the way init does: a preallocating slot allocator,
+ * a static buffer of nodes and one RAM capability per region
+ *
+ * Regions are placed one after the other from MMBENCH_RAM_BASE, every other
+ * one directly adjacent to the previous one. ram_alloc is served from the mm.
+ * Resets the simulated cspace.
+ *
+ * \param m Instance to initialize
+ * \param regions Size of every region, page aligned
+ * \param nregions Number of regions, at most MMBENCH_MAX_REGIONS
+ */
+errval_t mmbench_mm_init(struct mmbench_mm *m, const gensize_t *regions,
+                         size_t nregions)
+{
+    errval_t err;
+    assert(nregions <= MMBENCH_MAX_REGIONS);
+    stub_cspace_init();
+
+    struct capref cnode_cap;
+    err = stub_cnode_create(&cnode_cap);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    err = slot_prealloc_init(&m->slots, cnode_cap, L2_CNODE_SLOTS, &m->mm);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    err = mm_init(&m->mm, ObjType_RAM, NULL, slot_alloc_prealloc, slot_prealloc_refill,
+                  &m->slots);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    slab_grow(&m->mm.slabs, m->nodebuf, sizeof(m->nodebuf));
+    stub_ram_alloc_set(&m->mm);
+
+    genpaddr_t base = MMBENCH_RAM_BASE;
+    m->nregions = nregions;
+    m->bytes = 0;
+    for (size_t i = 0; i < nregions; i++) {
+        struct capref cap;
+        err = stub_ram_create(&cap, base, regions[i]);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        err = mm_add(&m->mm, cap, base, regions[i]);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        m->region_base[i] = base;
+        m->region_size[i] = regions[i];
+        m->bytes += regions[i];
+        base += regions[i] + (i % 2) * BASE_PAGE_SIZE;
+    }
+    return SYS_ERR_OK;
+}
+
+void mmbench_mm_destroy(struct mmbench_mm *m)
+{
+    stub_ram_alloc_set(NULL);
+    mm_destroy(&m->mm);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-s seed] [-r rounds] [-n ops] [-t threads] [-v] "
+            "[fuzz|bench]...\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+static int run_fuzz(uint64_t seed, size_t rounds, size_t ops, size_t threads)
+{
+    systime_t start = systime_now();
+    for (uint64_t s = seed; s < seed + rounds; s++) {
+        if (fuzz_mm(s, ops) != 0 || fuzz_mm_threads(s, ops, threads) != 0 ||
+            fuzz_slab(s, ops) != 0 || fuzz_slots(s, ops / 16) != 0 ||
+            fuzz_vaddr(s, ops) != 0) {
+            return -1;
+        }
+    }
+    uint64_t ms = systime_to_ns(systime_now() - start) / 1000000;
+    printf("fuzz: %zu rounds of %zu ops passed in %" PRIu64 " ms\n", rounds, ops, ms);
+    return 0;
+}
+
+static void run_bench(size_t ops, size_t threads)
+{
+    bench_mm(ops);
+    bench_mm_threads(ops, threads);
+    bench_slab(ops);
+    bench_slots(ops);
+    bench_vaddr(ops);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t seed = 1;
+    size_t rounds = 4;
+    size_t ops = 10000;
+    size_t threads = 4;
+
+    int c;
+    while ((c = getopt(argc, argv, "s:r:n:t:v")) != -1) {
+        switch (c) {
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            rounds = 1;
+            break;
+        case 'r':
+            rounds = strtoull(optarg, NULL, 0);
+            break;
+        case 'n':
+            ops = strtoull(optarg, NULL, 0);
+            break;
+        case 't':
+            threads = strtoull(optarg, NULL, 0);
+            break;
+        case 'v':
+            stub_verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (ops == 0 || threads == 0) {
+        usage(argv[0]);
+    }
+
+    bool fuzz = optind == argc, bench = optind == argc;
+    for (int i = optind; i < argc; i++) {
+        if (strcmp(argv[i], "fuzz") == 0) {
+            fuzz = true;
+        } else if (strcmp(argv[i], "bench") == 0) {
+            bench = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (fuzz && run_fuzz(seed, rounds, ops, threads) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (bench) {
+        run_bench(ops, threads);
+    }
+    return EXIT_SUCCESS;
+}
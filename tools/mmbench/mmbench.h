@@ -0,0 +1,87 @@
+/**
+ * \file
+ * \brief Host fuzzer and benchmarks for lib/mm, the slab and the slot allocators
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef MMBENCH_H
+#define MMBENCH_H
+
+#include <aos/aos.h>
+#include <aos/slab.h>
+#include <mm/mm.h>
+#include <aos/vaddr_tree.h>
+
+/// Base of the first simulated RAM region
+#define MMBENCH_RAM_BASE (1UL << 30)
+
+/// xorshift64* generator, one per thread
+struct rng {
+    uint64_t state;
+};
+
+static inline void rng_seed(struct rng *rng, uint64_t seed)
+{
+    rng->state = seed * 0x9e3779b97f4a7c15ULL + 1;
+}
+
+static inline uint64_t rng_next(struct rng *rng)
+{
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return rng->state * 0x2545f4914f6cdd1dULL;
+}
+
+/// Uniform in [0, n)
+static inline uint64_t rng_range(struct rng *rng, uint64_t n)
+{
+    return rng_next(rng) % n;
+}
+
+/// Number of pages, mostly small with a long tail up to 2^maxbits pages
+static inline size_t rng_pages(struct rng *rng, unsigned maxbits)
+{
+    unsigned bits = rng_range(rng, maxbits + 1);
+    return 1 + rng_range(rng, 1UL << bits);
+}
+
+/// Maximum number of RAM regions of a struct mmbench_mm
+#define MMBENCH_MAX_REGIONS 16
+
+/// An mm set up like init sets up its own
+struct mmbench_mm {
+    struct mm mm;
+    struct slot_prealloc slots;
+    uint8_t nodebuf[SLAB_STATIC_SIZE(64, sizeof(struct mmnode))];
+    genpaddr_t region_base[MMBENCH_MAX_REGIONS];
+    gensize_t region_size[MMBENCH_MAX_REGIONS];
+    size_t nregions;
+    gensize_t bytes;                 ///< Sum of all regions
+};
+
+errval_t mmbench_mm_init(struct mmbench_mm *m, const gensize_t *regions,
+                         size_t nregions);
+void mmbench_mm_destroy(struct mmbench_mm *m);
+
+int fuzz_mm(uint64_t seed, size_t ops);
+int fuzz_mm_threads(uint64_t seed, size_t ops, size_t nthreads);
+int fuzz_slab(uint64_t seed, size_t ops);
+int fuzz_slots(uint64_t seed, size_t ops);
+int fuzz_vaddr(uint64_t seed, size_t ops);
+
+void bench_mm(size_t ops);
+void bench_mm_threads(size_t ops, size_t max_threads);
+void bench_slab(size_t ops);
+void bench_slots(size_t ops);
+void bench_vaddr(size_t ops);
+
+#endif // MMBENCH_H
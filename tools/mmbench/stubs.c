@@ -0,0 +1,651 @@
+/**
+ * \file
+ * \brief Simulated cspace, memory and threads for running the allocators on the host
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <aos/aos.h>
+#include <mm/mm.h>
+
+bool stub_verbose = false;
+
+/// Where ram_alloc gets memory from
+static struct mm *ram_mm;
+/// Memory taken from ram_mm by ram_alloc and for CNodes
+static gensize_t ram_bytes;
+static size_t ram_count;
+
+/* cspace */
+
+struct stub_cte {
+    enum objtype type;
+    genpaddr_t base;
+    gensize_t bytes;
+    bool counted;                ///< Counted in stub_ram_bytes already
+};
+
+/// Protects all of the cspace and the default slot allocator
+static pthread_mutex_t cspace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stub_cte rootcn[ROOTCN_SLOTS];
+/// Slots of the L2 CNode stored in the root slot of the same index
+static struct stub_cte *l2cn[ROOTCN_SLOTS];
+static cslot_t rootcn_next = ROOTCN_FREE_SLOTS;
+static size_t caps_live;
+
+/// Default slot allocator: recycles freed slots, then fills fresh CNodes
+static struct {
+    struct multi_slot_allocator msa;
+    struct capref cur;           ///< Next never used slot
+    struct capref *freed;        ///< Slots given back with slot_free
+    size_t nfreed, maxfreed;
+} defsa;
+
+static struct stub_cte *cte_lookup(struct capref cap)
+{
+    if (cap.cnode.level == CNODE_TYPE_ROOT) {
+        return cap.slot < ROOTCN_SLOTS ? &rootcn[cap.slot] : NULL;
+    }
+
+    capaddr_t rslot = cap.cnode.cnode >> L2_CNODE_BITS;
+    if (cap.cnode.level != CNODE_TYPE_OTHER || (cap.cnode.cnode & MASK(L2_CNODE_BITS)) ||
+        rslot >= ROOTCN_SLOTS || l2cn[rslot] == NULL || cap.slot >= L2_CNODE_SLOTS) {
+        return NULL;
+    }
+    return &l2cn[rslot][cap.slot];
+}
+
+static struct capref rootcn_cap(cslot_t slot)
+{
+    return (struct capref) {
+        .cnode = { .croot = CPTR_ROOTCN, .cnode = 0, .level = CNODE_TYPE_ROOT },
+        .slot = slot
+    };
+}
+
+static errval_t rootcn_slot_alloc(cslot_t *ret)
+{
+    for (size_t i = 0; i < ROOTCN_SLOTS - ROOTCN_FREE_SLOTS; i++) {
+        cslot_t slot = rootcn_next;
+        rootcn_next = rootcn_next + 1 < ROOTCN_SLOTS ? rootcn_next + 1 : ROOTCN_FREE_SLOTS;
+        if (rootcn[slot].type == ObjType_Null) {
+            *ret = slot;
+            return SYS_ERR_OK;
+        }
+    }
+    return LIB_ERR_SLOT_ALLOC_NO_SPACE;
+}
+
+/// Places an L2 CNode in an empty root slot
+static void l2cn_create(cslot_t rslot, struct cnoderef *ret)
+{
+    assert(rootcn[rslot].type == ObjType_Null && l2cn[rslot] == NULL);
+    l2cn[rslot] = calloc(L2_CNODE_SLOTS, sizeof(struct stub_cte));
+    if (l2cn[rslot] == NULL) {
+        USER_PANIC("out of host memory for CNodes\n");
+    }
+    rootcn[rslot] = (struct stub_cte) { ObjType_L2CNode, 0, OBJSIZE_L2CNODE, false };
+    caps_live++;
+
+    ret->croot = CPTR_ROOTCN;
+    ret->cnode = ROOTCN_SLOT_ADDR(rslot);
+    ret->level = CNODE_TYPE_OTHER;
+}
+
+static errval_t default_slot_alloc(struct slot_allocator *ca, struct capref *cap)
+{
+    pthread_mutex_lock(&cspace_lock);
+    if (defsa.nfreed > 0) {
+        *cap = defsa.freed[--defsa.nfreed];
+        pthread_mutex_unlock(&cspace_lock);
+        return SYS_ERR_OK;
+    }
+
+    if (defsa.cur.cnode.level != CNODE_TYPE_OTHER || defsa.cur.slot == L2_CNODE_SLOTS) {
+        cslot_t rslot;
+        errval_t err = rootcn_slot_alloc(&rslot);
+        if (err_is_fail(err)) {
+            pthread_mutex_unlock(&cspace_lock);
+            return err_push(err, LIB_ERR_SLOT_ALLOC);
+        }
+        l2cn_create(rslot, &defsa.cur.cnode);
+        defsa.cur.slot = 0;
+    }
+    *cap = defsa.cur;
+    defsa.cur.slot++;
+    pthread_mutex_unlock(&cspace_lock);
+    return SYS_ERR_OK;
+}
+
+static errval_t default_slot_free(struct slot_allocator *ca, struct capref cap)
+{
+    pthread_mutex_lock(&cspace_lock);
+    if (defsa.nfreed == defsa.maxfreed) {
+        defsa.maxfreed = MAX(2 * defsa.maxfreed, 1024);
+        defsa.freed = realloc(defsa.freed, defsa.maxfreed * sizeof(struct capref));
+        if (defsa.freed == NULL) {
+            USER_PANIC("out of host memory for slots\n");
+        }
+    }
+    defsa.freed[defsa.nfreed++] = cap;
+    pthread_mutex_unlock(&cspace_lock);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Resets the simulated cspace to an empty root CNode
+ *
+ * The L2 CNode used by slot_alloc_basecn is created up front, like init
+ * finds it in its cspace at startup.
+ */
+void stub_cspace_init(void)
+{
+    pthread_mutex_lock(&cspace_lock);
+    for (size_t i = 0; i < ROOTCN_SLOTS; i++) {
+        free(l2cn[i]);
+        l2cn[i] = NULL;
+        rootcn[i].type = ObjType_Null;
+    }
+    caps_live = 0;
+    rootcn_next = ROOTCN_FREE_SLOTS;
+
+    struct cnoderef basecn;
+    l2cn_create(ROOTCN_SLOT_SLOT_ALLOC0, &basecn);
+
+    defsa.msa.a.alloc = default_slot_alloc;
+    defsa.msa.a.free = default_slot_free;
+    defsa.cur = NULL_CAP;
+    defsa.nfreed = 0;
+    pthread_mutex_unlock(&cspace_lock);
+}
+
+/**
+ * \brief Creates a RAM capability out of nothing, like the ones in bootinfo
+ */
+errval_t stub_ram_create(struct capref *ret, genpaddr_t base, gensize_t size)
+{
+    if (base % BASE_PAGE_SIZE != 0 || size == 0 || size % BASE_PAGE_SIZE != 0) {
+        return SYS_ERR_INVALID_SIZE;
+    }
+    errval_t err = slot_alloc(ret);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    pthread_mutex_lock(&cspace_lock);
+    *cte_lookup(*ret) = (struct stub_cte) { ObjType_RAM, base, size, false };
+    caps_live++;
+    pthread_mutex_unlock(&cspace_lock);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Creates an empty L2 CNode and returns its first slot
+ */
+errval_t stub_cnode_create(struct capref *ret)
+{
+    pthread_mutex_lock(&cspace_lock);
+    cslot_t rslot;
+    errval_t err = rootcn_slot_alloc(&rslot);
+    if (err_is_ok(err)) {
+        l2cn_create(rslot, &ret->cnode);
+        ret->slot = 0;
+    }
+    pthread_mutex_unlock(&cspace_lock);
+    return err;
+}
+
+/**
+ * \brief Returns the number of non-empty slots in the cspace
+ */
+size_t stub_caps_live(void)
+{
+    pthread_mutex_lock(&cspace_lock);
+    size_t ret = caps_live;
+    pthread_mutex_unlock(&cspace_lock);
+    return ret;
+}
+
+errval_t cap_retype(struct capref dest_start, struct capref src, gensize_t offset,
+                    enum objtype new_type, gensize_t objsize, size_t count)
+{
+    errval_t err = SYS_ERR_OK;
+    pthread_mutex_lock(&cspace_lock);
+
+    struct stub_cte *s = cte_lookup(src);
+    if (s == NULL || s->type == ObjType_Null) {
+        err = SYS_ERR_CAP_NOT_FOUND;
+        goto out;
+    }
+    if (s->type != ObjType_RAM && s->type != ObjType_Frame) {
+        err = SYS_ERR_INVALID_SOURCE_TYPE;
+        goto out;
+    }
+    if (new_type != ObjType_Frame && !(new_type == ObjType_RAM && s->type == ObjType_RAM)) {
+        err = SYS_ERR_ILLEGAL_DEST_TYPE;
+        goto out;
+    }
+    if (count == 0 || objsize == 0 || objsize % BASE_PAGE_SIZE != 0 ||
+        objsize * count > s->bytes || offset > s->bytes - objsize * count) {
+        err = SYS_ERR_INVALID_SIZE;
+        goto out;
+    }
+    if (offset % BASE_PAGE_SIZE != 0) {
+        err = SYS_ERR_RETYPE_INVALID_OFFSET;
+        goto out;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct capref dest = dest_start;
+        dest.slot += i;
+        struct stub_cte *d = cte_lookup(dest);
+        if (d == NULL) {
+            err = SYS_ERR_SLOTS_INVALID;
+            goto out;
+        }
+        if (d->type != ObjType_Null) {
+            err = SYS_ERR_SLOTS_IN_USE;
+            goto out;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct capref dest = dest_start;
+        dest.slot += i;
+        *cte_lookup(dest) = (struct stub_cte) {
+            .type = new_type,
+            .base = s->base + offset + i * objsize,
+            .bytes = objsize
+        };
+    }
+    caps_live += count;
+
+out:
+    pthread_mutex_unlock(&cspace_lock);
+    return err;
+}
+
+errval_t cap_create(struct capref dest, enum objtype type, size_t bytes)
+{
+    errval_t err = SYS_ERR_OK;
+    pthread_mutex_lock(&cspace_lock);
+    struct stub_cte *d = cte_lookup(dest);
+    if (d == NULL) {
+        err = SYS_ERR_SLOTS_INVALID;
+    } else if (d->type != ObjType_Null) {
+        err = SYS_ERR_SLOTS_IN_USE;
+    } else {
+        *d = (struct stub_cte) { type, 0, bytes, false };
+        caps_live++;
+    }
+    pthread_mutex_unlock(&cspace_lock);
+    return err;
+}
+
+/// Descendants are not tracked, so there is nothing to revoke
+errval_t cap_revoke(struct capref cap)
+{
+    pthread_mutex_lock(&cspace_lock);
+    struct stub_cte *c = cte_lookup(cap);
+    errval_t err = c == NULL || c->type == ObjType_Null ? SYS_ERR_CAP_NOT_FOUND
+                                                        : SYS_ERR_OK;
+    pthread_mutex_unlock(&cspace_lock);
+    return err;
+}
+
+errval_t cap_destroy(struct capref cap)
+{
+    pthread_mutex_lock(&cspace_lock);
+    struct stub_cte *c = cte_lookup(cap);
+    if (c == NULL || c->type == ObjType_Null) {
+        pthread_mutex_unlock(&cspace_lock);
+        return SYS_ERR_CAP_NOT_FOUND;
+    }
+    if (c->type == ObjType_L2CNode && cap.cnode.level == CNODE_TYPE_ROOT) {
+        free(l2cn[cap.slot]);
+        l2cn[cap.slot] = NULL;
+    }
+    c->type = ObjType_Null;
+    caps_live--;
+    pthread_mutex_unlock(&cspace_lock);
+
+    if (cap.cnode.level == CNODE_TYPE_ROOT) {
+        return SYS_ERR_OK;
+    }
+    return slot_free(cap);
+}
+
+errval_t cap_direct_identify(struct capref cap, struct capability *ret)
+{
+    errval_t err = SYS_ERR_OK;
+    pthread_mutex_lock(&cspace_lock);
+    struct stub_cte *c = cte_lookup(cap);
+    if (c == NULL || c->type == ObjType_Null) {
+        err = SYS_ERR_CAP_NOT_FOUND;
+    } else {
+        *ret = (struct capability) { c->type, c->base, c->bytes };
+    }
+    pthread_mutex_unlock(&cspace_lock);
+    return err;
+}
+
+errval_t cnode_create_from_mem(struct capref dest, struct capref src,
+                               enum objtype cntype, struct cnoderef *cnoderef,
+                               size_t slots)
+{
+    errval_t err = SYS_ERR_OK;
+    pthread_mutex_lock(&cspace_lock);
+
+    struct stub_cte *s = cte_lookup(src);
+    if (s == NULL || s->type != ObjType_RAM) {
+        err = SYS_ERR_INVALID_SOURCE_TYPE;
+        goto out;
+    }
+    if (cntype != ObjType_L2CNode || slots != L2_CNODE_SLOTS) {
+        err = SYS_ERR_ILLEGAL_DEST_TYPE;
+        goto out;
+    }
+    if (s->bytes < OBJSIZE_L2CNODE) {
+        err = SYS_ERR_INVALID_SIZE;
+        goto out;
+    }
+    // L2 CNodes are only reachable from the root CNode
+    if (dest.cnode.level != CNODE_TYPE_ROOT || dest.slot >= ROOTCN_SLOTS) {
+        err = SYS_ERR_SLOTS_INVALID;
+        goto out;
+    }
+    if (rootcn[dest.slot].type != ObjType_Null) {
+        err = SYS_ERR_SLOTS_IN_USE;
+        goto out;
+    }
+
+    l2cn_create(dest.slot, cnoderef);
+    if (!s->counted) {
+        s->counted = true;
+        __atomic_fetch_add(&ram_bytes, s->bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ram_count, 1, __ATOMIC_RELAXED);
+    }
+
+out:
+    pthread_mutex_unlock(&cspace_lock);
+    return err;
+}
+
+/* slot allocators */
+
+struct slot_allocator *get_default_slot_allocator(void)
+{
+    return &defsa.msa.a;
+}
+
+errval_t slot_alloc(struct capref *ret)
+{
+    return defsa.msa.a.alloc(&defsa.msa.a, ret);
+}
+
+errval_t slot_free(struct capref ret)
+{
+    return defsa.msa.a.free(&defsa.msa.a, ret);
+}
+
+errval_t slot_alloc_root(struct capref *ret)
+{
+    pthread_mutex_lock(&cspace_lock);
+    cslot_t slot;
+    errval_t err = rootcn_slot_alloc(&slot);
+    pthread_mutex_unlock(&cspace_lock);
+    if (err_is_ok(err)) {
+        *ret = rootcn_cap(slot);
+    }
+    return err;
+}
+
+/// The simulated root CNode has a fixed size
+errval_t root_slot_allocator_refill(cn_ram_alloc_func_t myalloc, void *allocst)
+{
+    return SYS_ERR_OK;
+}
+
+errval_t range_slot_alloc(struct range_slot_allocator *alloc, cslot_t nslots,
+                          struct capref *ret)
+{
+    return LIB_ERR_SLOT_ALLOC;
+}
+
+errval_t range_slot_alloc_refill(struct range_slot_allocator *alloc, cslot_t slots)
+{
+    return LIB_ERR_SLOT_ALLOC;
+}
+
+/* memory */
+
+/**
+ * \brief Makes ram_alloc, and thus frame_alloc and slab refills, use `mm`
+ *
+ * This is what init does with its own mm, so refills recurse into the
+ * allocator under test.
+ */
+void stub_ram_alloc_set(struct mm *mm)
+{
+    ram_mm = mm;
+    __atomic_store_n(&ram_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ram_count, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief Returns the bytes taken from the mm by the simulated system
+ *
+ * This is the RAM handed out by ram_alloc and the RAM turned into CNodes
+ * since stub_ram_alloc_set, each capability counted once.
+ */
+gensize_t stub_ram_bytes(void)
+{
+    return __atomic_load_n(&ram_bytes, __ATOMIC_RELAXED);
+}
+
+/// Number of capabilities counted in stub_ram_bytes
+size_t stub_ram_count(void)
+{
+    return __atomic_load_n(&ram_count, __ATOMIC_RELAXED);
+}
+
+errval_t ram_alloc(struct capref *retcap, size_t size)
+{
+    if (ram_mm == NULL) {
+        return LIB_ERR_RAM_ALLOC_UNSET;
+    }
+    errval_t err = mm_alloc(ram_mm, size, retcap);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_RAM_ALLOC);
+    }
+
+    pthread_mutex_lock(&cspace_lock);
+    struct stub_cte *c = cte_lookup(*retcap);
+    c->counted = true;
+    __atomic_fetch_add(&ram_bytes, c->bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ram_count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&cspace_lock);
+    return SYS_ERR_OK;
+}
+
+errval_t frame_alloc(struct capref *dest, size_t bytes, size_t *retbytes)
+{
+    bytes = ROUND_UP(bytes, BASE_PAGE_SIZE);
+
+    struct capref ram;
+    errval_t err = ram_alloc(&ram, bytes);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
+    err = slot_alloc(dest);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
+    err = cap_retype(*dest, ram, 0, ObjType_Frame, bytes, 1);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_FRAME_ALLOC);
+    }
+    cap_destroy(ram);
+
+    if (retbytes != NULL) {
+        *retbytes = bytes;
+    }
+    return SYS_ERR_OK;
+}
+
+struct paging_state *get_current_paging_state(void)
+{
+    static char state;
+    return (struct paging_state *)&state;
+}
+
+/**
+ * \brief Backs `bytes` at an address the host picks with anonymous memory
+ *
+ * Fails if the frame is too small.
+ */
+errval_t paging_map_frame_attr(struct paging_state *st, void **buf, size_t bytes,
+                               struct capref frame, int flags, void *arg1, void *arg2)
+{
+    struct capability c;
+    errval_t err = cap_direct_identify(frame, &c);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_PMAP_MAP);
+    }
+    if (c.type != ObjType_Frame || c.bytes < bytes) {
+        return LIB_ERR_PMAP_MAP;
+    }
+
+    bytes = ROUND_UP(bytes, BASE_PAGE_SIZE);
+    void *addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    if (addr == MAP_FAILED) {
+        return LIB_ERR_PMAP_MAP;
+    }
+    *buf = addr;
+    return SYS_ERR_OK;
+}
+
+/* threads */
+
+static bool mutex_held(struct thread_mutex *mutex)
+{
+    return __atomic_load_n(&mutex->locked, __ATOMIC_RELAXED) > 0 &&
+           pthread_equal(__atomic_load_n(&mutex->holder, __ATOMIC_RELAXED),
+                         pthread_self());
+}
+
+static void mutex_acquire(struct thread_mutex *mutex)
+{
+    pthread_mutex_lock(&mutex->mutex);
+    __atomic_store_n(&mutex->holder, pthread_self(), __ATOMIC_RELAXED);
+    __atomic_store_n(&mutex->locked, 1, __ATOMIC_RELAXED);
+}
+
+void thread_mutex_init(struct thread_mutex *mutex)
+{
+    pthread_mutex_init(&mutex->mutex, NULL);
+    mutex->locked = 0;
+}
+
+void thread_mutex_lock(struct thread_mutex *mutex)
+{
+    if (mutex_held(mutex)) {
+        USER_PANIC("thread_mutex_lock: mutex already held by this thread\n");
+    }
+    mutex_acquire(mutex);
+}
+
+void thread_mutex_lock_nested(struct thread_mutex *mutex)
+{
+    if (mutex_held(mutex)) {
+        mutex->locked++;
+        return;
+    }
+    mutex_acquire(mutex);
+}
+
+bool thread_mutex_trylock(struct thread_mutex *mutex)
+{
+    if (pthread_mutex_trylock(&mutex->mutex) != 0) {
+        return false;
+    }
+    __atomic_store_n(&mutex->holder, pthread_self(), __ATOMIC_RELAXED);
+    __atomic_store_n(&mutex->locked, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+void thread_mutex_unlock(struct thread_mutex *mutex)
+{
+    if (!mutex_held(mutex)) {
+        USER_PANIC("thread_mutex_unlock: mutex not held by this thread\n");
+    }
+    if (mutex->locked > 1) {
+        mutex->locked--;
+        return;
+    }
+    __atomic_store_n(&mutex->locked, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mutex->mutex);
+}
+
+/* time */
+
+systime_t systime_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (systime_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* debugging */
+
+#define ERR_CODE_NAME(name) #name,
+static const char *err_names[] = {
+    ERR_CODES(ERR_CODE_NAME)
+};
+#undef ERR_CODE_NAME
+
+const char *err_getstring(errval_t errval)
+{
+    enum err_code code = err_no(errval);
+    return code < ARRAY_LENGTH(err_names) ? err_names[code] : "unknown error";
+}
+
+void debug_printf(const char *fmt, ...)
+{
+    if (!stub_verbose) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "mmbench: ");
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+void debug_err(const char *file, const char *func, int line, errval_t err,
+               const char *msg, ...)
+{
+    if (!stub_verbose) {
+        return;
+    }
+    va_list args;
+    va_start(args, msg);
+    fprintf(stderr, "mmbench: %s:%d %s: ", file, line, func);
+    vfprintf(stderr, msg, args);
+    va_end(args);
+    for (errval_t e = err; err_no(e) != SYS_ERR_OK; e >>= ERR_CODE_BITS) {
+        fprintf(stderr, "\n    %s", err_getstring(e));
+    }
+    fprintf(stderr, "\n");
+}
@@ -0,0 +1,1218 @@
+/**
+ * \file
+ * \brief Benchmarks run by init
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <aos/aos.h>
+#include <aos/aos_rpc.h>
+#include <aos/paging.h>
+#include <aos/shm.h>
+#include <aos/systime.h>
+#include <mm/mm.h>
+
+#include "benchmark.h"
+#include "mem_alloc.h"
+
+/// Number of regions kept allocated at the same time
+#define BENCH_MM_LIVE 256
+
+/// Number of regions each thread of the threaded benchmark keeps allocated
+#define BENCH_MM_THREAD_LIVE 16
+
+/// Maximum number of threads of the threaded benchmark
+#define BENCH_MM_MAX_THREADS 16
+
+/// Records for the original mapping of the copy-on-write benchmark
+#define BENCH_COW_RANGES 16
+
+/// Where the TLB benchmark maps its buffers, away from anything else init maps
+#define BENCH_TLB_VADDR (VADDR_OFFSET + 16 * HUGE_PAGE_SIZE)
+
+/**
+ * \brief Helper function: xorshift step, deterministic across runs
+ */
+static inline uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/**
+ * \brief Allocates and frees `iterations` mixed-size regions from `mm`
+ *
+ * Sizes range from 4 KiB to 256 KiB with alignments from 4 KiB to 64 KiB.
+ * Up to BENCH_MM_LIVE regions are kept allocated so the free space
+ * fragments like it does on a running system. The lookup of free nodes on
+ * its own is compared with a linear scan by the bench mode of tools/mmbench.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param iterations Total number of allocations and frees
+ */
+errval_t benchmark_mm_alloc_free(struct mm *mm, size_t iterations)
+{
+    errval_t err;
+    static struct capref live[BENCH_MM_LIVE];
+    static struct capability live_id[BENCH_MM_LIVE];
+    size_t nlive = 0;
+    uint64_t rnd = 88172645463325252ULL;
+
+    systime_t alloc_time = 0, free_time = 0;
+    size_t allocs = 0, frees = 0;
+
+    for (size_t i = 0; i < iterations; i++) {
+        uint64_t r = bench_rand(&rnd);
+        if (nlive == 0 || (nlive < BENCH_MM_LIVE && (r & 1))) {
+            size_t size = BASE_PAGE_SIZE << ((r >> 8) % 7);
+            size_t alignment = BASE_PAGE_SIZE << ((r >> 16) % 5);
+
+            systime_t start = systime_now();
+            err = mm_alloc_aligned(mm, size, alignment, &live[nlive]);
+            alloc_time += systime_now() - start;
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "benchmark_mm_alloc_free: mm_alloc_aligned");
+                return err;
+            }
+
+            err = cap_direct_identify(live[nlive], &live_id[nlive]);
+            if (err_is_fail(err)) {
+                return err;
+            }
+            nlive++;
+            allocs++;
+        } else {
+            size_t k = (r >> 24) % nlive;
+
+            systime_t start = systime_now();
+            err = mm_free(mm, live[k], get_address(&live_id[k]), get_size(&live_id[k]));
+            free_time += systime_now() - start;
+            if (err_is_fail(err)) {
+                DEBUG_ERR(err, "benchmark_mm_alloc_free: mm_free");
+                return err;
+            }
+
+            nlive--;
+            live[k] = live[nlive];
+            live_id[k] = live_id[nlive];
+            frees++;
+        }
+    }
+
+    while (nlive > 0) {
+        nlive--;
+        err = mm_free(mm, live[nlive], get_address(&live_id[nlive]),
+                      get_size(&live_id[nlive]));
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    debug_printf("benchmark_mm_alloc_free: %zu allocs, avg %" PRIu64 " ns\n",
+                 allocs, allocs ? systime_to_ns(alloc_time) / allocs : 0);
+    debug_printf("benchmark_mm_alloc_free: %zu frees, avg %" PRIu64 " ns\n",
+                 frees, frees ? systime_to_ns(free_time) / frees : 0);
+
+    return SYS_ERR_OK;
+}
+
+/// Arguments of a thread of benchmark_mm_threads
+struct bench_mm_thread {
+    struct mm *mm;
+    size_t iterations;
+    errval_t err;
+};
+
+/**
+ * \brief Helper function: Allocates and frees pages until the iterations are done
+ */
+static int bench_mm_thread_func(void *arg)
+{
+    struct bench_mm_thread *bt = arg;
+    struct capref live[BENCH_MM_THREAD_LIVE];
+    struct capability live_id[BENCH_MM_THREAD_LIVE];
+
+    bt->err = SYS_ERR_OK;
+    for (size_t i = 0; i < bt->iterations; i++) {
+        size_t k = i % BENCH_MM_THREAD_LIVE;
+        if (i >= BENCH_MM_THREAD_LIVE) {
+            bt->err = mm_free(bt->mm, live[k], get_address(&live_id[k]),
+                              get_size(&live_id[k]));
+            if (err_is_fail(bt->err)) {
+                return 1;
+            }
+        }
+
+        bt->err = mm_alloc(bt->mm, BASE_PAGE_SIZE, &live[k]);
+        if (err_is_fail(bt->err)) {
+            return 1;
+        }
+        bt->err = cap_direct_identify(live[k], &live_id[k]);
+        if (err_is_fail(bt->err)) {
+            return 1;
+        }
+    }
+
+    size_t nlive = MIN(bt->iterations, BENCH_MM_THREAD_LIVE);
+    for (size_t k = 0; k < nlive; k++) {
+        bt->err = mm_free(bt->mm, live[k], get_address(&live_id[k]),
+                          get_size(&live_id[k]));
+        if (err_is_fail(bt->err)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Measures allocations per second with a growing number of threads
+ *
+ * For 1, 2, 4, ... up to `max_threads` threads, every thread allocates
+ * `iterations` pages from `mm` and frees them again, keeping up to
+ * BENCH_MM_THREAD_LIVE of them allocated at the same time.
+ *
+ * \param mm Pointer to MM allocator instance data
+ * \param max_threads Largest number of threads, at most BENCH_MM_MAX_THREADS
+ * \param iterations Number of allocations per thread
+ */
+errval_t benchmark_mm_threads(struct mm *mm, size_t max_threads, size_t iterations)
+{
+    errval_t err = SYS_ERR_OK;
+    struct bench_mm_thread args[BENCH_MM_MAX_THREADS];
+    struct thread *threads[BENCH_MM_MAX_THREADS];
+
+    if (max_threads == 0 || max_threads > BENCH_MM_MAX_THREADS) {
+        return ERR_INVALID_ARGS;
+    }
+
+    for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        systime_t start = systime_now();
+        for (size_t t = 0; t < nthreads; t++) {
+            args[t].mm = mm;
+            args[t].iterations = iterations;
+            threads[t] = thread_create(bench_mm_thread_func, &args[t]);
+            if (threads[t] == NULL) {
+                // Wait for the ones that are running already
+                nthreads = t;
+                err = LIB_ERR_THREAD_CREATE;
+                break;
+            }
+        }
+        for (size_t t = 0; t < nthreads; t++) {
+            errval_t join_err = thread_join(threads[t], NULL);
+            if (err_is_ok(err) && err_is_fail(join_err)) {
+                err = join_err;
+            }
+            if (err_is_ok(err) && err_is_fail(args[t].err)) {
+                err = args[t].err;
+            }
+        }
+        uint64_t ns = systime_to_ns(systime_now() - start);
+
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_mm_threads");
+            return err;
+        }
+
+        uint64_t allocs = (uint64_t)nthreads * iterations;
+        debug_printf("benchmark_mm_threads: %zu threads, %" PRIu64 " allocs/s\n",
+                     nthreads, ns ? allocs * 1000000000 / ns : 0);
+    }
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Compares random accesses through 4 KiB pages and 2 MiB blocks
+ *
+ * Maps the same frame twice, once 2 MiB aligned, which maps it with blocks,
+ * and once a page off, which takes pages. Then reads one word of `accesses`
+ * random pages through either mapping. With pages, nearly every access
+ * misses the TLB once the buffer is larger than the TLB reaches.
+ *
+ * Both mappings are unmapped again afterwards.
+ *
+ * \param bytes Size of the buffer, rounded up to 2 MiB
+ * \param accesses Number of reads through each mapping
+ */
+errval_t benchmark_paging_tlb(size_t bytes, size_t accesses)
+{
+    errval_t err;
+    struct paging_state *st = get_current_paging_state();
+    bytes = ROUND_UP(bytes, LARGE_PAGE_SIZE);
+
+    struct capref ram, frame;
+    err = ram_alloc_aligned(&ram, bytes, LARGE_PAGE_SIZE);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_paging_tlb: ram_alloc_aligned");
+        return err;
+    }
+    err = slot_alloc(&frame);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    err = cap_retype(frame, ram, 0, ObjType_Frame, bytes, 1);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_paging_tlb: cap_retype");
+        return err;
+    }
+
+    lvaddr_t large = BENCH_TLB_VADDR;
+    lvaddr_t small = large + ROUND_UP(bytes, HUGE_PAGE_SIZE) + BASE_PAGE_SIZE;
+    err = paging_map_fixed_attr(st, large, frame, bytes,
+                                VREGION_FLAGS_READ_WRITE | VREGION_FLAGS_LARGE);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_paging_tlb: mapping with blocks");
+        return err;
+    }
+    err = paging_map_fixed_attr(st, small, frame, bytes, VREGION_FLAGS_READ_WRITE);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_paging_tlb: mapping with pages");
+        return err;
+    }
+
+    const char *names[2] = { "4 KiB pages", "2 MiB blocks" };
+    lvaddr_t bases[2] = { small, large };
+    size_t pages = bytes / BASE_PAGE_SIZE;
+    for (int m = 0; m < 2; m++) {
+        volatile uint64_t *buf = (volatile uint64_t *)bases[m];
+        uint64_t rnd = 88172645463325252ULL;
+        uint64_t sum = 0;
+
+        systime_t start = systime_now();
+        for (size_t i = 0; i < accesses; i++) {
+            size_t page = bench_rand(&rnd) % pages;
+            sum += buf[page * (BASE_PAGE_SIZE / sizeof(uint64_t))];
+        }
+        uint64_t ns = systime_to_ns(systime_now() - start);
+
+        debug_printf("benchmark_paging_tlb: %zu MiB through %s, %" PRIu64
+                     " ns per access (%" PRIx64 ")\n", bytes >> 20, names[m],
+                     accesses ? ns / accesses : 0, sum);
+    }
+
+    for (int m = 0; m < 2; m++) {
+        err = paging_unmap_range(st, bases[m], bytes);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_paging_tlb: paging_unmap_range");
+            return err;
+        }
+    }
+    return cap_destroy(frame);
+}
+
+/**
+ * \brief Measures first touches of a lazy region with and without fault-around
+ *
+ * Writes one word per page of a fresh lazy region, once with each window
+ * size, and prints the faults taken and the time per page. The regions are
+ * unmapped afterwards, their frames are not freed.
+ *
+ * \param bytes Size of each region
+ * \param window Fault-around window to compare against single pages
+ */
+errval_t benchmark_paging_fault_around(size_t bytes, size_t window)
+{
+    errval_t err;
+    struct paging_state *st = get_current_paging_state();
+    size_t windows[2] = { 1, window };
+    size_t pages = ROUND_UP(bytes, BASE_PAGE_SIZE) / BASE_PAGE_SIZE;
+
+    for (int m = 0; m < 2; m++) {
+        struct paging_region pr;
+        err = paging_region_init(st, &pr, bytes,
+                                 VREGION_FLAGS_READ_WRITE | VREGION_FLAGS_LAZY);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_paging_fault_around: paging_region_init");
+            return err;
+        }
+        paging_set_fault_around(st, windows[m]);
+
+        struct paging_fault_stats before, after;
+        paging_get_fault_stats(st, &before);
+        systime_t start = systime_now();
+        for (size_t i = 0; i < pages; i++) {
+            *(volatile uint64_t *)(pr.base_addr + i * BASE_PAGE_SIZE) = i;
+        }
+        uint64_t ns = systime_to_ns(systime_now() - start);
+        paging_get_fault_stats(st, &after);
+
+        debug_printf("benchmark_paging_fault_around: %zu pages, window %zu: %" PRIu64
+                     " faults, %" PRIu64 " ns per page\n", pages, windows[m],
+                     after.faults - before.faults, ns / pages);
+
+        err = paging_unmap(st, (void *)pr.base_addr);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_paging_fault_around: paging_unmap");
+            return err;
+        }
+    }
+    paging_set_fault_around(st, PAGING_FAULT_AROUND_DEFAULT);
+
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Maps and unmaps a frame over and over, and checks that the page
+ *        tables are returned
+ *
+ * Each round maps the frame at a new address, writes to every page and
+ * unmaps it again, which frees the tables that were created for it. Prints
+ * the time per round, and how much free RAM the rounds cost in total, which
+ * is zero unless tables leak.
+ *
+ * \param bytes Size of the frame
+ * \param rounds Number of map and unmap rounds
+ */
+errval_t benchmark_paging_unmap(size_t bytes, size_t rounds)
+{
+    errval_t err;
+    struct paging_state *st = get_current_paging_state();
+
+    struct capref frame;
+    err = frame_alloc(&frame, bytes, &bytes);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_paging_unmap: frame_alloc");
+        return err;
+    }
+
+    struct mm_stats before, after;
+    aos_mm_stats(&before);
+    uint64_t map_ns = 0, unmap_ns = 0;
+    for (size_t r = 0; r < rounds; r++) {
+        void *buf;
+        systime_t start = systime_now();
+        err = paging_map_frame_attr(st, &buf, bytes, frame, VREGION_FLAGS_READ_WRITE,
+                                    NULL, NULL);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_paging_unmap: paging_map_frame_attr");
+            return err;
+        }
+        map_ns += systime_to_ns(systime_now() - start);
+
+        for (size_t i = 0; i < bytes; i += BASE_PAGE_SIZE) {
+            ((volatile char *)buf)[i] = r;
+        }
+
+        start = systime_now();
+        err = paging_unmap(st, buf);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_paging_unmap: paging_unmap");
+            return err;
+        }
+        unmap_ns += systime_to_ns(systime_now() - start);
+    }
+    aos_mm_stats(&after);
+
+    debug_printf("benchmark_paging_unmap: %zu KiB, %" PRIu64 " ns per map, %" PRIu64
+                 " ns per unmap, %" PRId64 " bytes of RAM lost over %zu rounds\n",
+                 bytes >> 10, rounds ? map_ns / rounds : 0,
+                 rounds ? unmap_ns / rounds : 0,
+                 (int64_t)(before.bytes_free - after.bytes_free), rounds);
+
+    return cap_destroy(frame);
+}
+
+/**
+ * \brief Maps one frame copy-on-write for several instances, as spawning the
+ *        same binary repeatedly would, and writes to every page of one of them
+ *
+ * The original mapping is shared with paging_share_cow first, so that it
+ * turns copy-on-write as well. Prints the time per copied page, and checks
+ * that the written instance and the original got private copies while the
+ * other instances are unchanged.
+ *
+ * \param bytes Size of the frame
+ * \param instances Number of copy-on-write mappings of the frame
+ */
+errval_t benchmark_paging_cow(size_t bytes, size_t instances)
+{
+    errval_t err;
+    struct paging_state *st = get_current_paging_state();
+
+    struct capref frame;
+    err = frame_alloc(&frame, bytes, &bytes);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_paging_cow: frame_alloc");
+        return err;
+    }
+    uint64_t *orig;
+    err = paging_map_frame(st, (void **)&orig, bytes, frame, NULL, NULL);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_paging_cow: paging_map_frame");
+        return err;
+    }
+    size_t words = bytes / sizeof(uint64_t);
+    for (size_t i = 0; i < words; i++) {
+        orig[i] = i;
+    }
+
+    struct paging_cow_range ranges[BENCH_COW_RANGES];
+    size_t nranges;
+    err = paging_share_cow(st, (lvaddr_t)orig, bytes, ranges, BENCH_COW_RANGES, &nranges);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_paging_cow: paging_share_cow");
+        return err;
+    }
+
+    uint64_t *bufs[instances];
+    systime_t start = systime_now();
+    for (size_t n = 0; n < instances; n++) {
+        err = paging_map_frame_attr(st, (void **)&bufs[n], bytes, frame,
+                                    VREGION_FLAGS_READ_WRITE | VREGION_FLAGS_COW,
+                                    NULL, NULL);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_paging_cow: mapping copy-on-write");
+            return err;
+        }
+    }
+    uint64_t map_ns = systime_to_ns(systime_now() - start);
+
+    struct paging_fault_stats before, after;
+    paging_get_fault_stats(st, &before);
+    start = systime_now();
+    for (size_t i = 0; i < words; i += BASE_PAGE_SIZE / sizeof(uint64_t)) {
+        bufs[0][i] = ~i;
+    }
+    uint64_t write_ns = systime_to_ns(systime_now() - start);
+    paging_get_fault_stats(st, &after);
+
+    // The original is copy-on-write, too, its writes stay private
+    for (size_t i = 1; i < words; i += BASE_PAGE_SIZE / sizeof(uint64_t)) {
+        orig[i] = ~i;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < words; i += BASE_PAGE_SIZE / sizeof(uint64_t)) {
+        ok &= orig[i] == i && orig[i + 1] == ~(i + 1);
+        ok &= bufs[0][i] == ~i && bufs[0][i + 1] == i + 1;
+        for (size_t n = 1; n < instances; n++) {
+            ok &= bufs[n][i] == i && bufs[n][i + 1] == i + 1;
+        }
+    }
+
+    size_t pages = bytes / BASE_PAGE_SIZE;
+    debug_printf("benchmark_paging_cow: %zu instances of %zu KiB mapped in %" PRIu64
+                 " ns, %" PRIu64 " pages copied, %" PRIu64 " ns per copied page, %s\n",
+                 instances, bytes >> 10, map_ns, after.cow_pages - before.cow_pages,
+                 write_ns / pages, ok ? "contents ok" : "CONTENTS WRONG");
+
+    for (size_t n = 0; n < instances; n++) {
+        err = paging_unmap(st, bufs[n]);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_paging_cow: paging_unmap");
+            return err;
+        }
+    }
+    err = paging_unmap(st, orig);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    paging_unshare_cow(st, ranges, nranges);
+    return ok ? cap_destroy(frame) : LIB_ERR_VREGION_PAGEFAULT_HANDLER;
+}
+
+/// Touches `arg` bytes of its stack, a page at a time
+static int benchmark_stack_thread(void *arg)
+{
+    size_t bytes = (size_t)arg;
+    volatile char buf[bytes];
+    for (size_t i = 0; i < bytes; i += BASE_PAGE_SIZE) {
+        buf[i] = 1;
+    }
+    return buf[0] - 1;
+}
+
+/**
+ * \brief Runs many threads with large stacks of which they touch a little
+ *
+ * Prints the time to create and join a thread, and how much RAM the threads
+ * took while they were alive, which only covers the touched part of the
+ * stacks and the PAGING_STACK_EAGER_BYTES backed at their top.
+ *
+ * \param threads Number of threads alive at once
+ * \param stack_bytes Size of each thread's stack
+ * \param touch_bytes Part of the stack each thread touches
+ */
+errval_t benchmark_thread_stacks(size_t threads, size_t stack_bytes, size_t touch_bytes)
+{
+    errval_t err;
+    struct thread *t[threads];
+
+    struct mm_stats before, during;
+    aos_mm_stats(&before);
+    systime_t start = systime_now();
+    for (size_t i = 0; i < threads; i++) {
+        t[i] = thread_create_varstack(benchmark_stack_thread, (void *)touch_bytes,
+                                      stack_bytes);
+        if (t[i] == NULL) {
+            debug_printf("benchmark_thread_stacks: thread_create_varstack failed\n");
+            return LIB_ERR_THREAD_CREATE;
+        }
+    }
+    uint64_t create_ns = systime_to_ns(systime_now() - start);
+    for (size_t i = 0; i < threads; i++) {
+        thread_yield();
+    }
+    aos_mm_stats(&during);
+
+    start = systime_now();
+    for (size_t i = 0; i < threads; i++) {
+        err = thread_join(t[i], NULL);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_thread_stacks: thread_join");
+            return err;
+        }
+    }
+    uint64_t join_ns = systime_to_ns(systime_now() - start);
+
+    debug_printf("benchmark_thread_stacks: %zu threads with %zu KiB stacks touching %zu KiB, %"
+                 PRIu64 " ns per create, %" PRIu64 " ns per join, %" PRId64
+                 " bytes of RAM per live thread\n",
+                 threads, stack_bytes >> 10, touch_bytes >> 10, create_ns / threads,
+                 join_ns / threads,
+                 (int64_t)(before.bytes_free - during.bytes_free) / (int64_t)threads);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Grows the heap by `bytes` in blocks of `block` bytes, and frees them
+ *        again in reverse order
+ *
+ * Prints the time per malloc and free, and how much RAM the heap took at its
+ * largest and kept after the blocks were freed.
+ */
+errval_t benchmark_morecore(size_t bytes, size_t block)
+{
+    size_t count = bytes / block;
+    char **blocks = malloc(count * sizeof(char *));
+    if (blocks == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    struct mm_stats before, peak, after;
+    aos_mm_stats(&before);
+    systime_t start = systime_now();
+    for (size_t i = 0; i < count; i++) {
+        blocks[i] = malloc(block);
+        if (blocks[i] == NULL) {
+            debug_printf("benchmark_morecore: malloc failed after %zu KiB\n",
+                         (i * block) >> 10);
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        blocks[i][0] = blocks[i][block - 1] = 1;
+    }
+    uint64_t malloc_ns = systime_to_ns(systime_now() - start);
+    aos_mm_stats(&peak);
+
+    start = systime_now();
+    for (size_t i = count; i > 0; i--) {
+        free(blocks[i - 1]);
+    }
+    uint64_t free_ns = systime_to_ns(systime_now() - start);
+    aos_mm_stats(&after);
+    free(blocks);
+
+    debug_printf("benchmark_morecore: %zu MiB in %zu KiB blocks, %" PRIu64
+                 " ns per malloc, %" PRIu64 " ns per free, %" PRId64
+                 " KiB of RAM at the peak, %" PRId64 " KiB after freeing\n",
+                 bytes >> 20, block >> 10, malloc_ns / count, free_ns / count,
+                 (int64_t)(before.bytes_free - peak.bytes_free) >> 10,
+                 (int64_t)(before.bytes_free - after.bytes_free) >> 10);
+    return SYS_ERR_OK;
+}
+
+/// Copy function compared by benchmark_memcpy
+typedef void *(*bench_copy_fn)(void *dst, const void *src, size_t len);
+
+/**
+ * \brief Helper function: copies `len` bytes repeatedly until `bytes` were
+ *        copied, returns the ns per copy
+ */
+static uint64_t bench_copy_run(bench_copy_fn copy, char *dst, const char *src,
+                               size_t len, size_t bytes)
+{
+    size_t rounds = bytes / len;
+    systime_t start = systime_now();
+    for (size_t i = 0; i < rounds; i++) {
+        copy(dst, src, len);
+    }
+    return systime_to_ns(systime_now() - start) / rounds;
+}
+
+/**
+ * \brief Compares the memcpy and memmove of libc with the portable C versions
+ *
+ * For every power of two from 8 bytes to `max_size`, copies that many bytes
+ * until `bytes` were copied in total. memmove copies to an overlapping
+ * destination 64 bytes above the source, so that it has to copy backwards.
+ */
+errval_t benchmark_memcpy(size_t max_size, size_t bytes)
+{
+    assert(max_size <= bytes);
+    char *src = malloc(max_size + 64);
+    char *dst = malloc(max_size);
+    if (src == NULL || dst == NULL) {
+        free(src);
+        free(dst);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    memset(src, 0x5a, max_size + 64);
+    memset(dst, 0xa5, max_size);
+
+    for (size_t len = 8; len <= max_size; len *= 2) {
+        uint64_t cpy = bench_copy_run(memcpy, dst, src, len, bytes);
+        uint64_t cpy_c = bench_copy_run(memcpy_generic, dst, src, len, bytes);
+        uint64_t mov = bench_copy_run(memmove, src + 64, src, len, bytes);
+        uint64_t mov_c = bench_copy_run(memmove_generic, src + 64, src, len, bytes);
+        debug_printf("benchmark_memcpy: %zu bytes, memcpy %" PRIu64 " ns (C %" PRIu64
+                     " ns), memmove %" PRIu64 " ns (C %" PRIu64 " ns)\n",
+                     len, cpy, cpy_c, mov, mov_c);
+    }
+
+    free(src);
+    free(dst);
+    return SYS_ERR_OK;
+}
+
+
+/// Consumer side of benchmark_shm, receives `transfers` buffers
+struct bench_shm_consumer {
+    struct shm_region *shm;
+    size_t transfers;
+    uint64_t sum;
+};
+
+static int bench_shm_consumer_func(void *arg)
+{
+    struct bench_shm_consumer *c = arg;
+    errval_t err;
+
+    for (size_t i = 0; i < __atomic_load_n(&c->transfers, __ATOMIC_RELAXED); ) {
+        size_t idx, len;
+        void *buf;
+        err = shm_buf_recv(c->shm, &idx, &buf, &len);
+        if (err_no(err) == BULK_TRANSFER_NO_BUFFER) {
+            thread_yield();
+            continue;
+        } else if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_shm: shm_buf_recv");
+            return 1;
+        }
+        c->sum += ((uint64_t *)buf)[0] + ((uint64_t *)buf)[len / sizeof(uint64_t) - 1];
+        err = shm_buf_release(c->shm, idx);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_shm: shm_buf_release");
+            return 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+/**
+ * \brief Hands `transfers` filled buffers of `buf_size` bytes from a producer
+ *        to a consumer thread through a region of `buf_count` buffers
+ *
+ * The consumer attaches to a copy of the frame, as a peer domain would, so
+ * both sides go through their own mapping. Prints the time per hand-off next
+ * to the time to copy a buffer of the same size, which is what a transfer
+ * through a message channel costs at least.
+ */
+errval_t benchmark_shm(size_t buf_size, size_t buf_count, size_t transfers)
+{
+    errval_t err;
+    struct shm_region producer, consumer;
+
+    err = shm_create(&producer, buf_size, buf_count);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_shm: shm_create");
+        return err;
+    }
+    buf_size = producer.buf_size;
+
+    struct capref frame;
+    err = slot_alloc(&frame);
+    if (err_is_ok(err)) {
+        err = cap_copy(frame, producer.frame);
+    }
+    if (err_is_ok(err)) {
+        err = shm_attach(&consumer, frame);
+    }
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_shm: shm_attach");
+        shm_destroy(&producer);
+        return err;
+    }
+
+    struct bench_shm_consumer c = { .shm = &consumer, .transfers = transfers };
+    systime_t start = systime_now();
+    struct thread *t = thread_create(bench_shm_consumer_func, &c);
+    if (t == NULL) {
+        shm_destroy(&consumer);
+        shm_destroy(&producer);
+        return LIB_ERR_THREAD_CREATE;
+    }
+    for (size_t i = 0; i < transfers; ) {
+        size_t idx;
+        void *buf;
+        err = shm_buf_alloc(&producer, &idx, &buf);
+        if (err_no(err) == BULK_TRANSFER_NO_BUFFER) {
+            thread_yield();
+            continue;
+        } else if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_shm: shm_buf_alloc");
+            break;
+        }
+        ((uint64_t *)buf)[0] = i;
+        ((uint64_t *)buf)[buf_size / sizeof(uint64_t) - 1] = i;
+        err = shm_buf_send(&producer, idx, buf_size);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_shm: shm_buf_send");
+            break;
+        }
+        i++;
+    }
+    if (err_is_fail(err)) {
+        // stop the consumer before the region goes away
+        __atomic_store_n(&c.transfers, 0, __ATOMIC_RELAXED);
+    }
+    int ret;
+    thread_join(t, &ret);
+    uint64_t shm_ns = systime_to_ns(systime_now() - start);
+
+    // the same amount of data, copied once
+    char *src = shm_buf(&producer, 0);
+    char *dst = shm_buf(&producer, buf_count > 1 ? 1 : 0);
+    start = systime_now();
+    for (size_t i = 0; i < transfers; i++) {
+        memcpy(dst, src, buf_size);
+        src[0]++;
+    }
+    uint64_t copy_ns = systime_to_ns(systime_now() - start);
+
+    shm_destroy(&consumer);
+    shm_destroy(&producer);
+    if (err_is_fail(err) || ret != 0) {
+        return err_is_fail(err) ? err : BULK_TRANSFER_BUFFER_INVALID;
+    }
+
+    debug_printf("benchmark_shm: %zu transfers of %zu bytes through %zu buffers, %" PRIu64
+                 " ns per hand-off, %" PRIu64 " ns per copy\n",
+                 transfers, buf_size, buf_count, shm_ns / transfers, copy_ns / transfers);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Sends `rounds` one-word LMP messages to an endpoint of init's own,
+ *        and receives each before sending the next
+ *
+ * Every round enters the kernel, delivers the message, and resumes init,
+ * which is the part of an RPC round trip that does not depend on the peer.
+ * Prints the time per round.
+ *
+ * Init never leaves its own dispatcher here, so TTBR0 and the ASID stay the
+ * same and the number says nothing about the cost of switching between
+ * VSpaces. That takes a ping-pong with a second domain, which needs spawning.
+ */
+errval_t benchmark_lmp_self_roundtrip(size_t rounds)
+{
+    errval_t err;
+    struct lmp_chan lc;
+
+    err = lmp_chan_accept(&lc, DEFAULT_LMP_BUF_WORDS, NULL_CAP);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_lmp_self_roundtrip: lmp_chan_accept");
+        return err;
+    }
+    lc.remote_cap = lc.local_cap;
+
+    systime_t start = systime_now();
+    for (size_t i = 0; i < rounds; i++) {
+        err = lmp_chan_send1(&lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, i);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_lmp_self_roundtrip: lmp_chan_send1");
+            break;
+        }
+        struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+        err = lmp_chan_recv(&lc, &msg, NULL);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_lmp_self_roundtrip: lmp_chan_recv");
+            break;
+        }
+        assert(msg.words[0] == i);
+    }
+    uint64_t ns = systime_to_ns(systime_now() - start);
+
+    lmp_chan_destroy(&lc);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    debug_printf("benchmark_lmp_self_roundtrip: %zu rounds, %" PRIu64 " ns per round\n",
+                 rounds, ns / rounds);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Measures a round trip over a UMP channel, for comparison with
+ *        benchmark_lmp_self_roundtrip
+ *
+ * Both ends of the channel live in init, so this is the cost of the ring
+ * protocol without the cache line transfers between cores.
+ */
+errval_t benchmark_ump_roundtrip(size_t rounds)
+{
+    errval_t err;
+
+    struct capref frame;
+    size_t bytes;
+    err = frame_alloc(&frame, BASE_PAGE_SIZE, &bytes);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_ump_roundtrip: frame_alloc");
+        return err;
+    }
+    void *buf;
+    err = paging_map_frame_attr(get_current_paging_state(), &buf, bytes, frame,
+                                VREGION_FLAGS_READ_WRITE, NULL, NULL);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_ump_roundtrip: paging_map_frame_attr");
+        return err;
+    }
+    memset(buf, 0, bytes);
+
+    struct ump_chan a, b;
+    err = ump_chan_init(&a, buf, bytes, true);
+    if (err_is_ok(err)) {
+        err = ump_chan_init(&b, buf, bytes, false);
+    }
+
+    uint64_t words[UMP_MSG_WORDS] = { 0 };
+    systime_t start = systime_now();
+    for (size_t i = 0; i < rounds && err_is_ok(err); i++) {
+        words[0] = i;
+        err = ump_chan_send(&a, words);
+        if (err_is_ok(err)) {
+            err = ump_chan_recv(&b, words);
+        }
+        if (err_is_ok(err)) {
+            err = ump_chan_send(&b, words);
+        }
+        if (err_is_ok(err)) {
+            err = ump_chan_recv(&a, words);
+        }
+        assert(err_is_fail(err) || words[0] == i);
+    }
+    uint64_t ns = systime_to_ns(systime_now() - start);
+
+    paging_unmap(get_current_paging_state(), buf);
+    cap_destroy(frame);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_ump_roundtrip");
+        return err;
+    }
+
+    debug_printf("benchmark_ump_roundtrip: %zu rounds, %" PRIu64 " ns per round\n",
+                 rounds, ns / rounds);
+    return SYS_ERR_OK;
+}
+
+/// State of one side of benchmark_ump_adaptive
+struct bench_ump_side {
+    struct ump_chan chan;
+    struct waitset ws;
+    size_t received;
+    size_t rounds;
+};
+
+static void bench_ump_recv_handler(void *arg)
+{
+    struct bench_ump_side *side = arg;
+    uint64_t words[UMP_MSG_WORDS];
+    errval_t err = ump_chan_recv(&side->chan, words);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "benchmark_ump_adaptive: ump_chan_recv");
+    }
+    side->received++;
+}
+
+/// Waits for the next message of `side`
+static errval_t bench_ump_wait(struct bench_ump_side *side)
+{
+    size_t received = side->received;
+    errval_t err = ump_chan_register_recv(&side->chan, &side->ws,
+                                          MKCLOSURE(bench_ump_recv_handler, side));
+    while (err_is_ok(err) && side->received == received) {
+        err = event_dispatch(&side->ws);
+    }
+    return err;
+}
+
+static int bench_ump_echo_thread(void *arg)
+{
+    struct bench_ump_side *side = arg;
+    uint64_t words[UMP_MSG_WORDS] = { 0 };
+    for (size_t i = 0; i < side->rounds; i++) {
+        errval_t err = bench_ump_wait(side);
+        if (err_is_ok(err)) {
+            err = ump_chan_send(&side->chan, words);
+        }
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_ump_adaptive: echo");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static errval_t bench_ump_adaptive_run(void *buf, size_t bytes, bool adaptive,
+                                       uint64_t spin_ns, size_t rounds)
+{
+    errval_t err;
+
+    memset(buf, 0, bytes);
+    struct bench_ump_side client = { .rounds = rounds };
+    struct bench_ump_side echo = { .rounds = rounds };
+    err = ump_chan_init(&client.chan, buf, bytes, true);
+    if (err_is_ok(err)) {
+        err = ump_chan_init(&echo.chan, buf, bytes, false);
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
+    waitset_init(&client.ws);
+    waitset_init(&echo.ws);
+    if (adaptive) {
+        ump_chan_set_adaptive(&client.chan, disp_get_core_id(), spin_ns);
+        ump_chan_set_adaptive(&echo.chan, disp_get_core_id(), spin_ns);
+    }
+
+    struct thread *thread = thread_create(bench_ump_echo_thread, &echo);
+    if (thread == NULL) {
+        return LIB_ERR_THREAD_CREATE;
+    }
+
+    uint64_t words[UMP_MSG_WORDS] = { 0 };
+    systime_t start = systime_now();
+    for (size_t i = 0; i < rounds && err_is_ok(err); i++) {
+        err = ump_chan_send(&client.chan, words);
+        if (err_is_ok(err)) {
+            err = bench_ump_wait(&client);
+        }
+    }
+    uint64_t ns = systime_to_ns(systime_now() - start);
+
+    int retval;
+    errval_t join_err = thread_join(thread, &retval);
+    ump_chan_destroy(&client.chan);
+    ump_chan_destroy(&echo.chan);
+    waitset_destroy(&client.ws);
+    waitset_destroy(&echo.ws);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    if (err_is_fail(join_err)) {
+        return join_err;
+    }
+
+    struct ump_chan_stats *cs = &client.chan.stats;
+    struct ump_chan_stats *es = &echo.chan.stats;
+    debug_printf("benchmark_ump_adaptive: %s, spin %" PRIu64 " ns: %" PRIu64
+                 " ns per round; polled %" PRIu64 "/%" PRIu64 ", blocked %"
+                 PRIu64 "/%" PRIu64 ", woken %" PRIu64 "/%" PRIu64 ", doorbells %"
+                 PRIu64 "/%" PRIu64 " (client/echo)\n",
+                 adaptive ? "adaptive" : "polling", spin_ns, ns / rounds,
+                 cs->polled, es->polled, cs->blocks, es->blocks, cs->wakeups,
+                 es->wakeups, cs->doorbells, es->doorbells);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Measures round trips of an echo thread over a UMP channel that is
+ *        polled, or that blocks on the doorbell after polling for a while
+ *
+ * Both sides run in init, on one core, so the doorbell is an interrupt the
+ * core sends to itself. The statistics show which path the waits took.
+ */
+errval_t benchmark_ump_adaptive(size_t rounds)
+{
+    errval_t err;
+
+    err = ump_chan_doorbell_init();
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_ump_adaptive: ump_chan_doorbell_init");
+        return err;
+    }
+
+    struct capref frame;
+    size_t bytes;
+    err = frame_alloc(&frame, BASE_PAGE_SIZE, &bytes);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_ump_adaptive: frame_alloc");
+        return err;
+    }
+    void *buf;
+    err = paging_map_frame_attr(get_current_paging_state(), &buf, bytes, frame,
+                                VREGION_FLAGS_READ_WRITE, NULL, NULL);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_ump_adaptive: paging_map_frame_attr");
+        return err;
+    }
+
+    err = bench_ump_adaptive_run(buf, bytes, false, 0, rounds);
+    if (err_is_ok(err)) {
+        err = bench_ump_adaptive_run(buf, bytes, true, UMP_SPIN_DEFAULT_NS, rounds);
+    }
+    if (err_is_ok(err)) {
+        err = bench_ump_adaptive_run(buf, bytes, true, 0, rounds);
+    }
+
+    paging_unmap(get_current_paging_state(), buf);
+    cap_destroy(frame);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_ump_adaptive");
+    }
+    return err;
+}
+
+/// State of the server thread of benchmark_rpc_string
+struct bench_rpc_server {
+    struct waitset ws;
+    struct aos_rpc listener;
+    volatile bool stop;
+};
+
+static void bench_rpc_handler(struct aos_rpc *rpc, struct aos_rpc_request *req)
+{
+    errval_t err = req->err;
+    struct capref cap = NULL_CAP;
+
+    if (req->type == AOS_RPC_BIND) {
+        struct aos_rpc *client = malloc(sizeof(*client));
+        if (client == NULL) {
+            USER_PANIC("benchmark_rpc_string: malloc");
+        }
+        err = aos_rpc_accept(client, req->cap, bench_rpc_handler, rpc->ws);
+        if (err_is_fail(err)) {
+            USER_PANIC_ERR(err, "benchmark_rpc_string: aos_rpc_accept");
+        }
+        rpc = client;
+        cap = client->chan.local_cap;
+    }
+
+    err = aos_rpc_reply(rpc, req, err, 0, 0, cap, false, NULL, 0);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_rpc_string: aos_rpc_reply");
+    }
+}
+
+static int bench_rpc_server_thread(void *arg)
+{
+    struct bench_rpc_server *server = arg;
+    while (!server->stop) {
+        errval_t err = event_dispatch(&server->ws);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "benchmark_rpc_string: event_dispatch");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static errval_t bench_rpc_string_run(struct aos_rpc *rpc, const char *string, size_t rounds,
+                                     uint64_t *ret_ns)
+{
+    systime_t start = systime_now();
+    for (size_t i = 0; i < rounds; i++) {
+        errval_t err = aos_rpc_send_string(rpc, string);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+    *ret_ns = systime_to_ns(systime_now() - start);
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Measures aos_rpc_send_string for strings from 16 bytes to `max_size`,
+ *        copied into fragments and passed through the shared buffers
+ *
+ * Both sides run in init, the server on a thread of its own.
+ */
+errval_t benchmark_rpc_string(size_t max_size, size_t rounds)
+{
+    errval_t err;
+
+    struct bench_rpc_server server = { .stop = false };
+    waitset_init(&server.ws);
+
+    struct capref server_ep;
+    err = slot_alloc(&server_ep);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_SLOT_ALLOC);
+    }
+    err = aos_rpc_listen(&server.listener, server_ep, bench_rpc_handler, &server.ws);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_rpc_string: aos_rpc_listen");
+        return err;
+    }
+    struct thread *thread = thread_create(bench_rpc_server_thread, &server);
+    if (thread == NULL) {
+        return LIB_ERR_THREAD_CREATE;
+    }
+
+    struct aos_rpc copied, shared;
+    err = aos_rpc_bind(&shared, server_ep);
+    if (err_is_fail(err)) {
+        USER_PANIC_ERR(err, "benchmark_rpc_string: aos_rpc_bind");
+    }
+    err = aos_rpc_bind(&copied, server_ep);
+    if (err_is_ok(err)) {
+        copied.bulk_threshold = SIZE_MAX;
+        err = aos_rpc_bulk_setup(&shared);
+    }
+
+    char *string = malloc(max_size);
+    if (err_is_ok(err) && string == NULL) {
+        err = LIB_ERR_MALLOC_FAIL;
+    }
+    for (size_t size = 16; size <= max_size && err_is_ok(err); size *= 2) {
+        memset(string, 'x', size - 1);
+        string[size - 1] = '\0';
+
+        uint64_t copied_ns, shared_ns;
+        err = bench_rpc_string_run(&copied, string, rounds, &copied_ns);
+        if (err_is_ok(err)) {
+            err = bench_rpc_string_run(&shared, string, rounds, &shared_ns);
+        }
+        if (err_is_ok(err)) {
+            debug_printf("benchmark_rpc_string: %zu bytes, copied %" PRIu64 " ns "
+                         "(%" PRIu64 " MB/s), shared %" PRIu64 " ns (%" PRIu64 " MB/s)\n",
+                         size, copied_ns / rounds, size * rounds * 1000 / (copied_ns + 1),
+                         shared_ns / rounds, size * rounds * 1000 / (shared_ns + 1));
+        }
+    }
+    free(string);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "benchmark_rpc_string");
+    }
+
+    // the server thread checks the flag after each message, wake it with one
+    server.stop = true;
+    errval_t stop_err = aos_rpc_send_number(&shared, 0);
+    if (err_is_ok(stop_err)) {
+        thread_join(thread, NULL);
+    }
+    return err;
+}
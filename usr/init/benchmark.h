@@ -0,0 +1,41 @@
+/**
+ * \file
+ * \brief Benchmarks run by init
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef _INIT_BENCHMARK_H_
+#define _INIT_BENCHMARK_H_
+
+#include <aos/aos.h>
+
+struct mm;
+
+/// The portable C copies of libc, see memcpy_generic.c and memmove_generic.c
+void *memcpy_generic(void *dst, const void *src, size_t len);
+void *memmove_generic(void *dst, const void *src, size_t len);
+
+errval_t benchmark_mm_alloc_free(struct mm *mm, size_t iterations);
+errval_t benchmark_mm_threads(struct mm *mm, size_t max_threads, size_t iterations);
+errval_t benchmark_paging_tlb(size_t bytes, size_t accesses);
+errval_t benchmark_paging_fault_around(size_t bytes, size_t window);
+errval_t benchmark_paging_unmap(size_t bytes, size_t rounds);
+errval_t benchmark_paging_cow(size_t bytes, size_t instances);
+errval_t benchmark_thread_stacks(size_t threads, size_t stack_bytes, size_t touch_bytes);
+errval_t benchmark_morecore(size_t bytes, size_t block);
+errval_t benchmark_memcpy(size_t max_size, size_t bytes);
+errval_t benchmark_shm(size_t buf_size, size_t buf_count, size_t transfers);
+errval_t benchmark_lmp_self_roundtrip(size_t rounds);
+errval_t benchmark_ump_roundtrip(size_t rounds);
+errval_t benchmark_ump_adaptive(size_t rounds);
+errval_t benchmark_rpc_string(size_t max_size, size_t rounds);
+
+#endif /* _INIT_BENCHMARK_H_ */
@@ -24,6 +24,8 @@
 #include <grading.h>
 
 #include "mem_alloc.h"
+#include "benchmark.h"
+#include "rpc_server.h"
 
 
 
@@ -133,6 +135,30 @@ static void test(void) {
 }
 
 
+#ifdef CONFIG_MICROBENCHMARKS
+/**
+ * \brief Runs the benchmarks of benchmark.c, in builds with microbenchmarks
+ *        set in hake/Config.hs
+ */
+static void run_benchmarks(void)
+{
+    benchmark_mm_alloc_free(&aos_mm, 100000);
+    benchmark_mm_threads(&aos_mm, 8, 10000);
+    benchmark_paging_tlb(64 * 1024 * 1024, 1000000);
+    benchmark_paging_fault_around(16 * 1024 * 1024, PAGING_FAULT_AROUND_DEFAULT);
+    benchmark_paging_unmap(4 * 1024 * 1024, 1000);
+    benchmark_paging_cow(1024 * 1024, 16);
+    benchmark_thread_stacks(1000, 1024 * 1024, 16 * 1024);
+    benchmark_morecore(64 * 1024 * 1024, 64 * 1024);
+    benchmark_memcpy(16 * 1024 * 1024, 64 * 1024 * 1024);
+    benchmark_shm(4096, 64, 100000);
+    benchmark_lmp_self_roundtrip(100000);
+    benchmark_ump_roundtrip(100000);
+    benchmark_ump_adaptive(10000);
+    benchmark_rpc_string(1024 * 1024, 100);
+}
+#endif
+
 static int
 bsp_main(int argc, char *argv[])
 {
@@ -154,9 +180,17 @@ bsp_main(int argc, char *argv[])
 
     test();
     if (false) test2();
+#ifdef CONFIG_MICROBENCHMARKS
+    run_benchmarks();
+#endif
     // Grading 
     grading_test_early();
 
+    err = rpc_server_init(get_default_waitset());
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "rpc_server_init");
+    }
+
     // TODO: Spawn system processes, boot second core etc. here
     
     // Grading 
@@ -166,7 +200,19 @@ bsp_main(int argc, char *argv[])
     // Hang around
     struct waitset *default_ws = get_default_waitset();
     while (true) {
-        err = event_dispatch(default_ws);
+        // Zero frames for the pool while there is nothing else to do
+        if (mm_zpool_needs_refill(&aos_mm)) {
+            err = event_dispatch_non_block(default_ws);
+            if (err_no(err) == LIB_ERR_NO_EVENT) {
+                err = mm_zpool_refill(&aos_mm, 1);
+                if (err_is_fail(err)) {
+                    DEBUG_ERR(err, "in mm_zpool_refill");
+                }
+                continue;
+            }
+        } else {
+            err = event_dispatch(default_ws);
+        }
         if (err_is_fail(err)) {
             DEBUG_ERR(err, "in event_dispatch");
             abort();
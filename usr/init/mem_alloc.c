@@ -11,11 +11,27 @@
 /// MM allocator instance data
 struct mm aos_mm;
 
+/// Size of the frames kept in the pre-zeroed pool
+#define INIT_ZPOOL_OBJSIZE BASE_PAGE_SIZE
+/// Number of pre-zeroed frames to keep ready
+#define INIT_ZPOOL_TARGET 32
+
 errval_t aos_ram_alloc_aligned(struct capref *ret, size_t size, size_t alignment)
 {
     return mm_alloc_aligned(&aos_mm, size, alignment, ret);
 }
 
+errval_t aos_ram_alloc_batch(struct capref *ret, size_t size, size_t alignment,
+                             size_t count)
+{
+    return mm_alloc_batch(&aos_mm, size, alignment, count, ret);
+}
+
+errval_t aos_frame_alloc_zeroed(struct capref *ret, size_t size)
+{
+    return mm_alloc_flags(&aos_mm, size, BASE_PAGE_SIZE, MM_ALLOC_ZEROED, ret);
+}
+
 errval_t aos_ram_free(struct capref cap)
 {
     errval_t err;
@@ -29,6 +45,11 @@ errval_t aos_ram_free(struct capref cap)
     return mm_free(&aos_mm, cap, get_address(&c), get_size(&c));
 }
 
+void aos_mm_stats(struct mm_stats *ret)
+{
+    mm_stats(&aos_mm, ret);
+}
+
 static inline errval_t initialize_ram_allocator(void)
 {
     errval_t err;
@@ -102,6 +123,24 @@ errval_t initialize_ram_alloc(void)
     if (err_is_fail(err)) {
         return err_push(err, LIB_ERR_RAM_ALLOC_SET);
     }
+    err = ram_alloc_set_batch(aos_ram_alloc_batch);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_RAM_ALLOC_SET);
+    }
+    err = ram_alloc_set_frame(aos_frame_alloc_zeroed);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_RAM_ALLOC_SET);
+    }
+    err = ram_alloc_set_free(aos_ram_free);
+    if (err_is_fail(err)) {
+        return err_push(err, LIB_ERR_RAM_ALLOC_SET);
+    }
+
+    // The pool is filled from the idle loop in main
+    err = mm_zpool_init(&aos_mm, INIT_ZPOOL_OBJSIZE, INIT_ZPOOL_TARGET);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "mm_zpool_init");
+    }
 
     // Grading
     grading_test_mm(&aos_mm);
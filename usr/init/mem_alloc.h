@@ -20,9 +20,14 @@
 
 extern struct bootinfo *bi;
 extern struct mm aos_mm;
+struct mm_stats;
 
 errval_t initialize_ram_alloc(void);
 errval_t aos_ram_alloc_aligned(struct capref *ret, size_t size, size_t alignment);
+errval_t aos_ram_alloc_batch(struct capref *ret, size_t size, size_t alignment,
+                             size_t count);
+errval_t aos_frame_alloc_zeroed(struct capref *ret, size_t size);
 errval_t aos_ram_free(struct capref cap);
+void aos_mm_stats(struct mm_stats *ret);
 
 #endif /* _INIT_MEM_ALLOC_H_ */
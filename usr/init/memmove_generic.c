@@ -0,0 +1,20 @@
+/**
+ * \file
+ * \brief The portable C memmove of libc, as memmove_generic
+ *
+ * libc replaces memmove with an assembly version on armv8. benchmark_memcpy
+ * compares the two, so this builds the C version under a name of its own.
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetsstrasse 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#define memmove memmove_generic
+#define MEMMOVE
+#include "../../lib/libc/string/bcopy.c"
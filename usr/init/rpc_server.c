@@ -0,0 +1,155 @@
+/**
+ * \file
+ * \brief RPC server of init
+ *
+ * Init listens on its endpoint in TASKCN_SLOT_INITEP, which every domain it
+ * spawns gets a copy of. A domain binds by sending an endpoint of its own,
+ * and gets a channel of its own in return. Every request is answered before
+ * the next one is handled, but a client may have many of them queued up.
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <aos/aos.h>
+#include <aos/aos_rpc.h>
+#include <mm/mm.h>
+#include <grading.h>
+
+#include "mem_alloc.h"
+#include "rpc_server.h"
+
+static struct aos_rpc listener;
+
+static void rpc_server_handler(struct aos_rpc *rpc, struct aos_rpc_request *req);
+
+static errval_t rpc_server_bind(struct aos_rpc *rpc, struct aos_rpc_request *req)
+{
+    errval_t err;
+
+    if (rpc != &listener || capref_is_null(req->cap)) {
+        return LIB_ERR_RPC_INVALID_MSG;
+    }
+
+    struct aos_rpc *client = malloc(sizeof(*client));
+    if (client == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    err = aos_rpc_accept(client, req->cap, rpc_server_handler, rpc->ws);
+    if (err_is_fail(err)) {
+        free(client);
+        return err;
+    }
+
+    // the reply goes out on the new channel, and carries its endpoint
+    return aos_rpc_reply(client, req, SYS_ERR_OK, 0, 0, client->chan.local_cap,
+                         false, NULL, 0);
+}
+
+static void rpc_server_handler(struct aos_rpc *rpc, struct aos_rpc_request *req)
+{
+    errval_t err = req->err;
+    uintptr_t res = 0;
+    struct capref cap = NULL_CAP;
+    struct mm_stats stats;
+    const void *bulk = NULL;
+    size_t bulk_size = 0;
+
+    if (err_is_fail(err)) {
+        goto reply;
+    }
+
+    switch (req->type) {
+    case AOS_RPC_BIND:
+        err = rpc_server_bind(rpc, req);
+        if (err_is_fail(err)) {
+            DEBUG_ERR(err, "rpc_server: bind");
+            if (rpc == &listener) {
+                // the listener has no peer, answer on the endpoint of the request
+                struct capref client_ep = req->cap;
+                err = aos_rpc_reply_error(client_ep, req, err);
+                if (err_is_fail(err)) {
+                    DEBUG_ERR(err, "rpc_server: reply to bind");
+                }
+                if (!capref_is_null(client_ep)) {
+                    cap_destroy(client_ep);
+                }
+                return;
+            }
+            break;
+        }
+        return;
+
+    case AOS_RPC_NUMBER:
+        grading_rpc_handle_number(req->words[0]);
+        debug_printf("rpc_server: number %" PRIuPTR "\n", req->words[0]);
+        break;
+
+    case AOS_RPC_STRING:
+        if (req->bulk_size == 0 || ((char *)req->bulk)[req->bulk_size - 1] != '\0') {
+            err = LIB_ERR_RPC_INVALID_MSG;
+            break;
+        }
+        grading_rpc_handler_string(req->bulk);
+        debug_printf("rpc_server: string \"%s\"\n", (char *)req->bulk);
+        break;
+
+    case AOS_RPC_RAM_CAP:
+        grading_rpc_handler_ram_cap(req->words[0], req->words[1]);
+        err = aos_ram_alloc_aligned(&cap, req->words[0], req->words[1]);
+        if (err_is_ok(err)) {
+            res = req->words[0];
+        }
+        break;
+
+    case AOS_RPC_MM_STATS:
+        aos_mm_stats(&stats);
+        bulk = &stats;
+        bulk_size = sizeof(stats);
+        break;
+
+    case AOS_RPC_SERIAL_GETCHAR: {
+        grading_rpc_handler_serial_getchar();
+        char c;
+        err = sys_getchar(&c);
+        res = c;
+        break;
+    }
+
+    case AOS_RPC_SERIAL_PUTCHAR: {
+        grading_rpc_handler_serial_putchar(req->words[0]);
+        char c = req->words[0];
+        err = sys_print(&c, 1);
+        break;
+    }
+
+    default:
+        err = LIB_ERR_RPC_UNKNOWN_CALL;
+        break;
+    }
+
+reply:;
+    struct capref req_cap = req->cap;
+    // the RAM cap moves to the client
+    err = aos_rpc_reply(rpc, req, err, res, 0, cap, !capref_is_null(cap), bulk, bulk_size);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "rpc_server: reply");
+    }
+    if (!capref_is_null(req_cap)) {
+        cap_destroy(req_cap);
+    }
+}
+
+/**
+ * \brief Starts to serve RPCs on init's endpoint, on waitset `ws`
+ */
+errval_t rpc_server_init(struct waitset *ws)
+{
+    return aos_rpc_listen(&listener, cap_initep, rpc_server_handler, ws);
+}
@@ -0,0 +1,22 @@
+/**
+ * \file
+ * \brief RPC server of init
+ */
+
+/*
+ * Copyright (c) 2019, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef _INIT_RPC_SERVER_H_
+#define _INIT_RPC_SERVER_H_
+
+#include <aos/aos.h>
+
+errval_t rpc_server_init(struct waitset *ws);
+
+#endif /* _INIT_RPC_SERVER_H_ */